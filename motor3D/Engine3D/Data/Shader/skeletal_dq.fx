@@ -0,0 +1,116 @@
+//--------------------------------------------------------------------
+// Variables del efecto
+//--------------------------------------------------------------------
+
+// Huesos como cuaternios duales (parte real y dual): 8 floats por hueso,
+// con el mismo espacio de constantes que 80 matrices 3x4
+#define MAX_BONES 120
+uniform float4 BonesDQ[ MAX_BONES * 2 ];
+
+// Matriz WVP
+float4x4 worldViewProj;
+float4x4 world;
+float4x4 worldInverseTranspose;
+
+// Direccion de la luz
+float3 LightDirection : Direction = float3(0,50,10);
+
+// Color de la luz de ambiente
+float4 AmbientColor : Ambient = float4(.5,.5,.5,1);
+
+// Intensidad de la luz
+float AmbientIntensity = 1;
+
+// Datos del vertice
+struct VS_INPUT
+{
+	float3 position : POSITION;
+	float4 indexes: TEXCOORD0;
+	float4 weights: COLOR0;
+	float3 Normal : NORMAL;
+};
+
+// Datos de salida del vertex shader
+struct VS_OUTPUT
+{
+	float4 position : POSITION;
+	float3 Light : TEXCOORD0;
+	float3 Normal : TEXCOORD1;
+};
+
+// Salida del pixel shader
+struct PS_OUTPUT
+{
+	float4 Color : COLOR;
+};
+
+//--------------------------------------------------------------------
+// Vertex Shader
+//--------------------------------------------------------------------
+// Rota un vector con un cuaternio unitario
+float3 rotate( float4 q, float3 v )
+{
+	return v + 2.0 * cross(q.xyz, cross(q.xyz, v) + q.w * v);
+}
+
+VS_OUTPUT myvs( const VS_INPUT IN )
+{
+	VS_OUTPUT OUT = (VS_OUTPUT)0;
+
+	// Mezcla lineal de cuaternios duales, en el hemisferio del primer hueso
+	float4 real0 = BonesDQ[ IN.indexes.x * 2 ];
+	float4 blendReal = real0 * IN.weights.x;
+	float4 blendDual = BonesDQ[ IN.indexes.x * 2 + 1 ] * IN.weights.x;
+	float4 boneReal = BonesDQ[ IN.indexes.y * 2 ];
+	float w = (dot(real0, boneReal) < 0.0) ? -IN.weights.y : IN.weights.y;
+	blendReal += boneReal * w;
+	blendDual += BonesDQ[ IN.indexes.y * 2 + 1 ] * w;
+	boneReal = BonesDQ[ IN.indexes.z * 2 ];
+	w = (dot(real0, boneReal) < 0.0) ? -IN.weights.z : IN.weights.z;
+	blendReal += boneReal * w;
+	blendDual += BonesDQ[ IN.indexes.z * 2 + 1 ] * w;
+	boneReal = BonesDQ[ IN.indexes.w * 2 ];
+	w = (dot(real0, boneReal) < 0.0) ? -IN.weights.w : IN.weights.w;
+	blendReal += boneReal * w;
+	blendDual += BonesDQ[ IN.indexes.w * 2 + 1 ] * w;
+	float len = length(blendReal);
+	blendReal /= len;
+	blendDual /= len;
+
+	// Rotacion y traslacion
+	float3 pos = rotate(blendReal, IN.position.xyz);
+	pos += 2.0 * (blendReal.w * blendDual.xyz - blendDual.w * blendReal.xyz + cross(blendReal.xyz, blendDual.xyz));
+	OUT.position = mul( worldViewProj, float4( pos, 1.0 ) );	
+
+	// Diffuse lightning
+	OUT.Light = normalize(LightDirection);
+	OUT.Normal = normalize(mul((float3x3)worldInverseTranspose, rotate(blendReal, IN.Normal)));
+
+	return OUT;
+}
+
+//--------------------------------------------------------------------
+// Pixel Shader
+//--------------------------------------------------------------------
+PS_OUTPUT myps( VS_OUTPUT IN )
+{
+	PS_OUTPUT output;
+	//output.Color = AmbientIntensity * AmbientColor;
+	
+	output.Color = (AmbientIntensity * AmbientColor) + saturate(dot(IN.Light, IN.Normal));
+	return output;
+}
+
+//--------------------------------------------------------------------
+// Simple Effect (1 technique with 1 pass)
+//--------------------------------------------------------------------
+technique Technique0
+{
+	pass Pass0
+	{
+		Zenable = true;
+		CullFaceEnable = false;
+		VertexShader = compile glslv myvs();
+		PixelShader = compile glslf myps();
+	}
+}
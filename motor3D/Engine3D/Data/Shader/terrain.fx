@@ -1,4 +1,6 @@
-// Shader code from http://www.catalinzima.com/tutorials/4-uses-of-vtf/terrain-rendering-using-heightmaps/
+// Splat map material of the terrain. The near tiles blend the 4 layers of the atlas with
+// the weights of the splat map and fade to the macro texture with the distance, the far
+// tiles only read the macro texture (the layers already blended by the bake).
 
 //-----------------------------------------------------------------------------
 // Variables del efecto
@@ -6,81 +8,138 @@
 
 // Matriz WVP
 float4x4 worldViewProj;
-// Matrix World
-float4x4 world;
 
-// maximum height of the terrain
-float maxHeight = 128;           
+// Posicion del ojo en el mundo
+float3 eyePosition;
 
-// this texture will point to the heightmap
-texture displacementMap;    
+// Origen (x, z) del terreno, 1 / tamanyo del terreno y repeticiones de las capas por unidad
+float4 terrainMapping = float4(0, 0, 1, 0.125);
 
-//this sampler will be used to read (sample) the heightmap   
-sampler displacementSampler = sampler_state {    
-	Texture = <displacementMap>;
-	MipFilter = Point;
-	MinFilter = Point;
-	MagFilter = Point;
+// Distancias donde la textura macro empieza a sustituir a las capas y donde lo hace del todo
+float macroFadeStart = 64;
+float macroFadeEnd = 128;
+
+// Direccion de la luz
+float3 LightDirection : Direction = float3(0.4, 1, 0.3);
+
+// Color de la luz de ambiente
+float4 AmbientColor : Ambient = float4(.35,.35,.35,1);
+
+// Celdas de 2 x 2 capas, con un margen para que los mipmaps no mezclen las capas
+static const float atlasPad = 4.0 / 1024.0;
+static const float atlasScale = 0.5 - 2.0 * atlasPad;
+
+sampler2D LayerAtlas = sampler_state {
+	minFilter = LinearMipMapLinear;
+	magFilter = Linear;
+	AddressU = Clamp;
+	AddressV = Clamp;
+};
+
+sampler2D SplatMap = sampler_state {
+	minFilter = Linear;
+	magFilter = Linear;
 	AddressU = Clamp;
 	AddressV = Clamp;
 };
 
-struct VS_INPUT {
-    float4 position : POSITION;
-    float4 uv : TEXCOORD0;
+sampler2D MacroMap = sampler_state {
+	minFilter = LinearMipMapLinear;
+	magFilter = Linear;
+	AddressU = Clamp;
+	AddressV = Clamp;
 };
 
-struct VS_OUTPUT {
-    float4 position  : POSITION;
-    float4 uv : TEXCOORD0;
-    float4 worldPos : TEXCOORD1;
+// Datos del vertice
+struct VS_INPUT
+{
+	float3 position : POSITION;
+	float3 normal : NORMAL;
+};
+
+// Datos de salida del vertex shader
+struct VS_OUTPUT
+{
+	float4 position : POSITION;
+	float2 mapUV : TEXCOORD0;
+	float2 layerUV : TEXCOORD1;
+	float2 shade : TEXCOORD2;	// x: macro fade, y: diffuse light
 };
 
 //-----------------------------------------------------------------------------
 // Vertex Shader
 //-----------------------------------------------------------------------------
-VS_OUTPUT Transform(VS_INPUT In) {
-
-    //initialize the output structure
-    VS_OUTPUT Out = (VS_OUTPUT)0;                                  
-
-    // this instruction reads from the heightmap, the value at the corresponding texture coordinate
-    // Note: we selected level 0 for the mipmap parameter of tex2Dlod, since we want to read data exactly as it appears in the heightmap
-    float height = tex2Dlod ( displacementSampler, float4(In.uv.xy , 0 , 0 ) );
-
-    // with the newly read height, we compute the new value of the Y coordinate
-    // we multiply the height, which is in the (0,1) range by a value representing the Maximum Height of the Terrain
-    In.position.y = height * maxHeight;
-
-    //Pass the world position the the Pixel Shader
-    Out.worldPos = mul(In.position, world);
-
-    //Compute the final projected position by multiplying with the world, view and projection matrices                                                      
-    Out.position = mul(In.position , worldViewProj);
-
-    Out.uv = In.uv;
-
-    return Out;
-
+VS_OUTPUT myvs( const VS_INPUT IN )
+{
+	VS_OUTPUT OUT;
+	// The tiles are already in world space
+	OUT.position = mul( worldViewProj, float4(IN.position, 1.0) );
+	OUT.mapUV = (IN.position.xz - terrainMapping.xy) * terrainMapping.z;
+	OUT.layerUV = IN.position.xz * terrainMapping.w;
+	float distance = length(IN.position - eyePosition);
+	OUT.shade.x = saturate((distance - macroFadeStart) / (macroFadeEnd - macroFadeStart));
+	OUT.shade.y = saturate(dot(normalize(IN.normal), normalize(LightDirection)));
+	return OUT;
 }
 
 //-----------------------------------------------------------------------------
 // Pixel Shader
 //-----------------------------------------------------------------------------
-float4 PixelShader(in float4 worldPos : TEXCOORD1) : COLOR {
 
-        return worldPos.y / maxHeight;
+// Colour of a layer. The derivatives come from the coordinates before frac, so the
+// wrap of the tiling doesn't pick the smallest mipmap on the edges of the cells
+float3 LayerColour( float2 layerUV, float2 cell, float2 dx, float2 dy )
+{
+	float2 uv = cell + atlasPad + frac(layerUV) * atlasScale;
+	return tex2D(LayerAtlas, uv, dx, dy).rgb;
+}
+
+float4 nearps( VS_OUTPUT IN ): COLOR
+{
+	float4 weights = tex2D(SplatMap, IN.mapUV);
+	weights /= dot(weights, float4(1, 1, 1, 1)) + 0.001;
+	float2 dx = ddx(IN.layerUV) * atlasScale;
+	float2 dy = ddy(IN.layerUV) * atlasScale;
+	float3 colour = LayerColour(IN.layerUV, float2(0.0, 0.0), dx, dy) * weights.r;
+	colour += LayerColour(IN.layerUV, float2(0.5, 0.0), dx, dy) * weights.g;
+	colour += LayerColour(IN.layerUV, float2(0.0, 0.5), dx, dy) * weights.b;
+	colour += LayerColour(IN.layerUV, float2(0.5, 0.5), dx, dy) * weights.a;
+	colour = lerp(colour, tex2D(MacroMap, IN.mapUV).rgb, IN.shade.x);
+	return float4(colour * (AmbientColor.rgb + IN.shade.y), 1.0);
+}
 
+float4 farps( VS_OUTPUT IN ): COLOR
+{
+	float3 colour = tex2D(MacroMap, IN.mapUV).rgb;
+	return float4(colour * (AmbientColor.rgb + IN.shade.y), 1.0);
 }
 
 //-----------------------------------------------------------------------------
-// Simple Effect (1 technique with 1 pass)
+// Near tiles: splat map of the 4 layers
 //-----------------------------------------------------------------------------
-technique Technique0 {
-
-    pass Pass0 {
-        VertexShader = compile vs_3_0 Transform();
-        PixelShader  = compile ps_3_0 PixelShader();
-    }
+technique Technique0
+{
+	pass Pass0
+	{
+		Zenable  = true;
+		CullFaceEnable = false;
+
+		VertexShader = compile glslv myvs();
+		PixelShader  = compile glslf nearps();
+	}
+}
 
-}
\ No newline at end of file
+//-----------------------------------------------------------------------------
+// Far tiles: one fetch of the macro texture
+//-----------------------------------------------------------------------------
+technique TechniqueFar
+{
+	pass Pass0
+	{
+		Zenable  = true;
+		CullFaceEnable = false;
+
+		VertexShader = compile glslv myvs();
+		PixelShader  = compile glslf farps();
+	}
+}
@@ -12,10 +12,13 @@
 #include "..\Graphics\Effects\EffectManager.h"
 #include "..\Graphics\Skeletal\cSkeletalManager.h"
 #include "..\Graphics\Skeletal\cSkeletalMesh.h"
+#include "..\Graphics\Skeletal\cSkeletalCoreModel.h"
 #include "..\Character\CharacterManager.h"
 #include "..\Character\Behaviour\BehaviourManager.h"
 #include "..\Lua\LuaFunctions.h"
 #include "..\LuaManager\cLuaManager.h"
+#include "..\Physics\cPhysicsContacts.h"
+#include "..\Utility\ThreadPool.h"
 
 //Para configurar el InputManager hay que llamar a su Init (en cGame::Init)
 //pasndole la tabla kaActionMapping (de InputConfiguration.cpp).
@@ -26,6 +29,8 @@ bool cGame::Init()
 {	
 	mbFinish = false;
 	//	LoadResources();
+	// Los hilos del pool se crean aqui, antes de que nadie lo use desde otro hilo
+	cThreadPool::Get().Init();
 	//Se rellena la estructura de tipo cApplicationProperties: 
 	mProperties.macApplicationName = "Proyecto fin master";
 	mProperties.mbFullscreen = false;
@@ -80,20 +85,37 @@ bool cGame::Init()
 			cInputManager::Get().Init( kaActionMapping, eIA_Count );
 
 			// Initialization of physics object 
-			cPhysics::Get().Init();
+			sPhysicsConfig lPhysicsConfig;
+			cPhysics::GetDefaultConfig(lPhysicsConfig);
+			lPhysicsConfig.mbDeterministic = mbDeterministicPhysics;
+			cPhysics::Get().Init(lPhysicsConfig);
+			// 60 steps per second, at most 5 per frame (12 fps)
+			cPhysics::Get().SetFixedTimestep(60.0f, 5);
+			// Bodies of the level, the terrain tiles and room for the debris of the crashes
+			cPhysics::Get().ReserveBodies(256);
+			// Far bodies are stepped less often or frozen
+			cPhysicsLod::Get().Init();
+			// Contact events of the frame for the game and the scripts
+			cPhysicsContacts::Get().Init();
 
 			//Se inicializa la clase que gestiona la texturas indicando que habr 1, por ejemplo.
 			cTextureManager::Get().Init(20);
 
-			// Terrain object
-			if (!mHeightmap.Load()) OutputDebugString("Heightmap terrain load error!");
-
 			//Se inicializa la clase que gestiona los materiales.
 			cMaterialManager::Get().Init(10);
 
 			// Init of effects management
 			cEffectManager::Get().Init(10);
 
+			// Terrain object, its material needs the managers of materials and effects
+			if (!mHeightmap.Load()) OutputDebugString("Heightmap terrain load error!");
+			else {
+				// The sweep and prune broadphases keep to the terrain, with room above it
+				cVec3 lvMin, lvMax;
+				mHeightmap.GetData().GetBounds(lvMin, lvMax);
+				cPhysics::Get().SetWorldBounds(lvMin - cVec3(10.f, 20.f, 10.f), lvMax + cVec3(10.f, 200.f, 10.f));
+			}
+
 			//Init Camera 2D, para las cadenas de texto.
 			//Se inicializa la cmara 2D con una perspectiva ortogonal.
 			//El (0,0) est situado en el centro de la pantalla y las dimensiones estn 
@@ -153,8 +175,15 @@ bool cGame::Init()
 			// Get skeleton mesh
 			cSkeletalMesh* lpSkeletonMesh=(cSkeletalMesh*)mSkeletalMesh.GetResource();
 
-			// Play idle animation 
-			lpSkeletonMesh->PlayAnim("Idle", 1.0f, 1.0f);
+			// Start the animation state machine (idle) and resolve its events
+			if (!lpSkeletonMesh->StartStateMachine(1.0f)){
+				lpSkeletonMesh->PlayAnim("Idle", 1.0f, 1.0f);
+			}
+			cSkeletalCoreModel * lpSkeletonCore = lpSkeletonMesh->GetCoreModel();
+			miRunEvent = lpSkeletonCore->GetEventIndex("Run");
+			miStopEvent = lpSkeletonCore->GetEventIndex("Stop");
+			miWaveEvent = lpSkeletonCore->GetEventIndex("Wave");
+			miStopWaveEvent = lpSkeletonCore->GetEventIndex("StopWave");
 			
 			// Load Skeleton meshes
 			cResourceHandle lMaterial = cMaterialManager::Get().LoadResource("Skeleton", "./Data/Material/SkeletonMaterial.xml");
@@ -181,7 +210,10 @@ bool cGame::Init()
 			// Se inicializa en modo rasterizacion solida
 			mbRasterizationMode = true;
 			// Inicializacion del vehiculo
-			mVehicle.initPhysics();
+			cVehicleSystem::Get().Init();
+			sVehicleTuning lTuning;
+			cVehicleSystem::GetDefaultTuning(lTuning);
+			muiVehicle = cVehicleSystem::Get().AddVehicle(lTuning, cVec3(0.f, 0.f, 0.f), C_720PI);
 		} else {
 			//Si algo falla se libera la ventana.
 			cWindow::Get().Deinit();
@@ -237,19 +269,19 @@ void cGame::Update( float lfTimestep )
 		mGodCamera.ResetYawPitch();
 		if ( lbmoveFront ) {
 			//CharacterPos::Get().MoveFront();
-			mVehicle.MoveForward(lfTimestep);
+			cVehicleSystem::Get().MoveForward(muiVehicle, lfTimestep);
 		}
 		else if ( lbmoveBack ){
 			//CharacterPos::Get().MoveBack();
-			mVehicle.Break(lfTimestep);
+			cVehicleSystem::Get().Break(muiVehicle, lfTimestep);
 		}
 		if ( lbmoveLeft ){
 			//CharacterPos::Get().TurnLeft();
-			mVehicle.SteeringLeft(lfTimestep);
+			cVehicleSystem::Get().SteeringLeft(muiVehicle, lfTimestep);
 		}
 		else if ( lbmoveRight ){
 			//CharacterPos::Get().TurnRight();
-			mVehicle.SteeringRight(lfTimestep);
+			cVehicleSystem::Get().SteeringRight(muiVehicle, lfTimestep);
 		}
 
 		// Actualizacion de cmara de juego
@@ -261,12 +293,13 @@ void cGame::Update( float lfTimestep )
 								   vVector.z),
 								   CharacterPos::Get().GetCharacterPosition(), 
 								   cVec3(0.0f, 1.f, 0.f) );*/
-		cVec3 vVector = mVehicle.GetChasisPos() - mVehicle.GetChasisRot() * lfDistance;
+		cVec3 lChassisPos = cVehicleSystem::Get().GetChassisPosition(muiVehicle);
+		cVec3 vVector = lChassisPos - cVehicleSystem::Get().GetChassisRotation(muiVehicle) * lfDistance;
 
 		m3DCamera.SetLookAt( cVec3(vVector.x,
 								   vVector.y + 3.f,
 								   vVector.z),
-								   mVehicle.GetChasisPos(), 
+								   lChassisPos, 
 								   cVec3(0.0f, 1.f, 0.f) );
 	// Modo Godmode	
 	} else {
@@ -291,13 +324,17 @@ void cGame::Update( float lfTimestep )
 		}
 	}
 
-	mVehicle.Update();
+	// Pages the terrain tiles around the vehicle
+	mHeightmap.Update(cVehicleSystem::Get().GetChassisPosition(muiVehicle));
 
 	mObject.SetPosition(CharacterPos::Get().GetCharacterPosition(), CharacterPos::Get().GetYaw());
 
 	// Actualiza personaje
 	mObject.Update(lfTimestep);
 
+	// The lod of the physics follows the vehicle or the god camera
+	if (mbInGame) cPhysicsLod::Get().SetViewer(cVehicleSystem::Get().GetChassisPosition(muiVehicle));
+	else cPhysicsLod::Get().SetViewer(mGodCamera.GetPosition());
 	// Update bullet physics object
 	cPhysics::Get().Update(lfTimestep);
 
@@ -312,29 +349,21 @@ void cGame::Update( float lfTimestep )
 	// Check if the animation keys (stop/start) are pressed
 	cSkeletalMesh* lpSkeletonMesh =(cSkeletalMesh*)mSkeletalMesh.GetResource();
 
-	static bool mbJogging = false;
-
 	bool lbPlayJogPressed = BecomePressed(eIA_PlayJog);
 	bool lbStopJogPressed = BecomePressed(eIA_StopJog);
 	bool lbPlayWavePressed = BecomePressed(eIA_PlayWave);
 	bool lbStopWavePressed = BecomePressed(eIA_StopWave);
 
-	// Jog animation
-	if (lbPlayJogPressed && !mbJogging){
-		mbJogging = true;
-		lpSkeletonMesh->PlayAnim("Jog", 1.0f, 0.1f);
-		lpSkeletonMesh->StopAnim("Idle", 0.1f);
-	}else if (lbStopJogPressed && mbJogging){
-		mbJogging = false;
-		lpSkeletonMesh->PlayAnim("Idle", 1.0f, 0.1f);
-		lpSkeletonMesh->StopAnim("Jog", 0.1f);
+	// The state machine of the model decides the transitions and the blend times
+	if (lbPlayJogPressed){
+		lpSkeletonMesh->FireEvent(miRunEvent);
+	}else if (lbStopJogPressed){
+		lpSkeletonMesh->FireEvent(miStopEvent);
 	}
-
-	// Wave animation
 	if (lbPlayWavePressed){
-		lpSkeletonMesh->PlayAnim("Wave", 1.0f, 0.1f, 0.1f);
+		lpSkeletonMesh->FireEvent(miWaveEvent);
 	}else if (lbStopWavePressed){
-		lpSkeletonMesh->StopAnim("Wave", 0.1f);
+		lpSkeletonMesh->FireEvent(miStopWaveEvent);
 	}
 	
 	//Se comprueba si hay que cerrar la aplicacin, por ejemplo a causa de 
@@ -425,7 +454,7 @@ void cGame::Render()
 		maSphereObjects[luiIndex].Render();	
 	}		
 
-	mVehicle.renderme();
+	cVehicleSystem::Get().Render();
 
 	// 3.3) Render of the skeleton mesh
 	// -------------------------------------------------------------
@@ -482,7 +511,7 @@ bool cGame::LoadResources( void )
 bool cGame::Deinit()
 {
 	//Se deinicializa en el orden inverso a la inicializacin:
-	mVehicle.~Vehicle();
+	cVehicleSystem::Get().Deinit();
 	cMaterialManager::Get().Deinit();
 
 	//Se libera el manejador de escenas.
@@ -505,7 +534,12 @@ bool cGame::Deinit()
 	cTextureManager::Get().Deinit();  
 	// Deinitialization of terrain
 	mHeightmap.Deinit();
-	// Deinitialization of physics object 
+	// The models release their shapes, the rest of the shapes go with the physics
+	mSphereModel.Deinit();
+	mBoxModel.Deinit();
+	// Deinitialization of physics object, the frozen bodies go back to the world first
+	cPhysicsContacts::Get().Deinit();
+	cPhysicsLod::Get().Deinit();
 	cPhysics::Get().Deinit();
 	//Se libera el InputManager:
 	cInputManager::Get().Deinit();
@@ -513,5 +547,7 @@ bool cGame::Deinit()
 	lbResult = cGraphicManager::Get().Deinit();
 	//Se libera la ventana:
 	lbResult = lbResult && cWindow::Get().Deinit();
+	//Se paran los hilos del pool
+	cThreadPool::Get().Deinit();
 	return lbResult;	
 }
\ No newline at end of file
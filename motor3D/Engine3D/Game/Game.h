@@ -11,7 +11,7 @@
 #include "..\Gameplay\Terrain\Heightmap.h"
 #include "..\Gameplay\CharacterPos\CharacterPos.h"
 #include "..\Graphics\GodCamera.h"
-#include "..\Gameplay\Vehicle\Vehicle.h"
+#include "..\Gameplay\Vehicle\VehicleSystem.h"
 
 //Clase que hace uso del Patrn Singleton definido en Singleton.h, para iniciar, actualizar, dibujar
 // y finalizar el juego
@@ -19,7 +19,7 @@ class cGame : public cSingleton<cGame>
 {
 	friend class cSingleton<cGame>;
 protected:
-		cGame() { ; } // Protected constructor	
+		cGame() { mbDeterministicPhysics = false; } // Protected constructor	
 		//Variable privada para gestionar si tenemos que salir de la aplicacin.
 		bool mbFinish;
 		//Clase para los atributos de la ventana (cWindow) que se crear en el mtodo Init.
@@ -34,6 +34,11 @@ protected:
 		cResourceHandle mScene;
 		// Instance that manages skeletal animation part of the engine
 		cResourceHandle mSkeletalMesh;
+		// Events of the animation state machine
+		int miRunEvent;
+		int miStopEvent;
+		int miWaveEvent;
+		int miStopWaveEvent;
 		// Bullet physics object
 		//cPhysics mPhysics;
 	
@@ -45,8 +50,10 @@ protected:
 		bool mbRasterizationMode;
 		// Camara godmode
 		GodCamera mGodCamera;
-		// Vehiculo 
-		Vehicle mVehicle;
+		// Vehiculo del jugador, en cVehicleSystem
+		unsigned muiVehicle;
+		// Physics world made for the replays (see SetDeterministicPhysics)
+		bool mbDeterministicPhysics;
 
 public:
 	
@@ -68,6 +75,10 @@ public:
 	//Funcin para cargar los recursos necesarios para el juego.
 	bool LoadResources( void );
 
+	// Sequential physics that replays the same steps from a snapshot, for the benchmarks and
+	// tests. Before Init
+	inline void SetDeterministicPhysics( bool lbDeterministic ) { mbDeterministicPhysics = lbDeterministic; }
+
 	// Time since application start
 	inline float GetAcumulatedTime() { return mfAcTime; }	
 	float mfAcTime;
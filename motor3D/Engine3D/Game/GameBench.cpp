@@ -0,0 +1,102 @@
+#include "GameBench.h"
+#include "..\Utility\Benchmark.h"
+#include "..\Graphics\Meshes\MeshManager.h"
+#include "..\Graphics\Skeletal\cSkeletalMesh.h"
+#include "..\Graphics\Skeletal\cSkeletalSkinning.h"
+#include "..\Gameplay\Terrain\TerrainGenerator.h"
+#include "..\Physics\cPhysics.h"
+#include "..\Gameplay\Vehicle\VehicleSystem.h"
+
+// Skinning of the skeleton of the game against CalPhysique
+static bool BenchSkinning()
+{
+	cResourceHandle lMesh = cMeshManager::Get().FindResource("Skeleton");
+	if (!lMesh.IsValidHandle())
+	{
+		BenchReport("Skinning: the skeleton is not loaded");
+		return false;
+	}
+	return ((cSkeletalMesh *)lMesh.GetResource())->BenchmarkSkinning(200);
+}
+
+// Generation of a 4097x4097 map with the three models
+static bool BenchTerrain()
+{
+	return cTerrainGenerator::Benchmark();
+}
+
+// Pile of 4000 bodies with every configuration of the dispatcher and the solver
+static bool BenchPhysics()
+{
+	cPhysics::Benchmark();
+	return true;
+}
+
+// 64 AI cars in the level, with the wheel rays one by one and in batches
+static bool BenchVehicles()
+{
+	cVehicleSystem::Benchmark();
+	return true;
+}
+
+// 2000 boxes scattered in three ways over 400x400 m with every broadphase
+static bool BenchBroadphase()
+{
+	cPhysics::BenchmarkBroadphase();
+	return true;
+}
+
+// Fast debris against a thin wall and a heightfield, none may go through with CCD
+static bool TestTunnelling()
+{
+	return cPhysics::TestTunnelling();
+}
+
+// Two runs of the level from the same snapshot must hash the same fixed steps, through the
+// frame update of the game and stepping the world directly
+static bool TestReplay()
+{
+	static const unsigned kuiFrames = 120;
+	cPhysics& lPhysics = cPhysics::Get();
+	std::vector<unsigned char> lacStart;
+	lPhysics.SaveSnapshot(lacStart);
+	lPhysics.SetDeterminismCheck(true);
+	std::vector<unsigned> lauiRuns[2];
+	bool lbRestored = true;
+	for (unsigned luiRun = 0; luiRun < 2; ++luiRun)
+	{
+		lbRestored = lbRestored && lPhysics.RestoreSnapshot(lacStart);
+		lPhysics.ClearStepHashes();
+		for (unsigned luiFrame = 0; luiFrame < kuiFrames; ++luiFrame)
+		{
+			lPhysics.Update(1.0f / 60.0f);
+		}
+		lauiRuns[luiRun] = lPhysics.GetStepHashes();
+	}
+	lPhysics.SetDeterminismCheck(false);
+	lbRestored = lbRestored && lPhysics.RestoreSnapshot(lacStart);
+
+	unsigned luiStep = 0;
+	while (luiStep < lauiRuns[0].size() && luiStep < lauiRuns[1].size() && lauiRuns[0][luiStep] == lauiRuns[1][luiStep]) ++luiStep;
+	bool lbSame = !lauiRuns[0].empty() && (lauiRuns[0].size() == lauiRuns[1].size()) && (luiStep == lauiRuns[0].size());
+	BenchReport("Replay of %u frames: %u and %u steps, %s%s", kuiFrames, (unsigned)lauiRuns[0].size(), (unsigned)lauiRuns[1].size(),
+				lbSame ? "same hashes" : "the runs split", lbRestored ? "" : ", a snapshot was not restored");
+	return lbSame && lbRestored && lPhysics.CheckReplay();
+}
+
+// Tabla de benchmarks y tests, por nombre
+static const sBenchTest kaGameBenches[] = {
+	{ "skinning", BenchSkinning },
+	{ "dualquat", cSkeletalSkinning::SelfTest },
+	{ "terrain", BenchTerrain },
+	{ "physics", BenchPhysics },
+	{ "broadphase", BenchBroadphase },
+	{ "tunnelling", TestTunnelling },
+	{ "vehicles", BenchVehicles },
+	{ "replay", TestReplay },
+};
+
+bool RunGameBench( const char * lacName )
+{
+	return RunBenchTests(kaGameBenches, sizeof(kaGameBenches) / sizeof(kaGameBenches[0]), lacName);
+}
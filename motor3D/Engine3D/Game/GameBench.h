@@ -0,0 +1,8 @@
+#ifndef GameBench_H
+#define GameBench_H
+
+// Runs the benchmarks and tests of the engine by name ("all" runs every one). They need the
+// game loaded (cGame::Init) and report to the output window and to bench.log
+bool RunGameBench( const char * lacName );
+
+#endif
@@ -10,6 +10,9 @@
 #include "../../Graphics/Materials/MaterialManager.h"
 #include "../../Graphics/Materials/Material.h"
 #include "../../Utility/FileUtils.h"
+#include "../../Physics/cPhysics.h"
+#include "../../Physics/cPhysicsShapes.h"
+#include "../../Physics/cPhysicsCook.h"
  
 /*NOTA:
 ------------------
@@ -57,6 +60,7 @@ bool cScene::Init( const std::string &lacNameID, const std::string &lacFile )
    //Se extrae la informacin de la escena (en nuestro caso, se encargar de 
    // extraer la informacin de las mallas).
    ProcessScene(lpScene);
+   CookCollision(lpScene);
 
    //La llamada a FreeScene se encarga de liberar la escena recin cargada. 
    //De todas formas, las escenas se liberan al eliminarse el importador.
@@ -140,6 +144,84 @@ void cScene::Deinit()
 		mObjectList[luiIndex]->Deinit();
 		delete mObjectList[luiIndex];
 	}
+	// The bodies release their references to the shapes, then the scene releases its own
+	for (unsigned luiIndex=0;luiIndex < mapBodies.size();++luiIndex )
+	{
+		cPhysics::Get().RemoveBody(mapBodies[luiIndex]);
+	}
+	mapBodies.clear();
+	for (unsigned luiIndex=0;luiIndex < mapMeshShapes.size();++luiIndex )
+	{
+		if (mapMeshShapes[luiIndex]) cPhysicsShapes::Get().Release(mapMeshShapes[luiIndex]);
+	}
+	mapMeshShapes.clear();
+	maBodyDefs.clear();
+}
+
+// Reads the hulls of the meshes from the cooked file, or cooks them again when the scene
+// file or the config of the cook have changed
+void cScene::CookCollision( const aiScene* lpScene )
+{
+	sPhysicsCookConfig lConfig;
+	cPhysicsCook::GetDefaultConfig(lConfig);
+	unsigned luiSourceHash = cPhysicsCook::HashConfig(lConfig, cFileUtils::HashFileStamp(macFile));
+	std::string lacCookedFile = macFile + ".hulls";
+
+	std::vector<sPhysicsCookedMesh> laMeshes;
+	if (!cPhysicsCook::ReadFile(lacCookedFile, luiSourceHash, laMeshes) || laMeshes.size() != lpScene->mNumMeshes)
+	{
+		OutputDebugString("Scene collision: cooking\n");
+		laMeshes.resize(lpScene->mNumMeshes);
+		std::vector<unsigned> lauiIndices;
+		for (unsigned luiMesh = 0;luiMesh < lpScene->mNumMeshes;++luiMesh)
+		{
+			// Only the triangles, the points and lines of the mesh have no volume
+			const aiMesh* lpMesh = lpScene->mMeshes[luiMesh];
+			lauiIndices.clear();
+			for (unsigned luiFace = 0;luiFace < lpMesh->mNumFaces;++luiFace)
+			{
+				const aiFace& lFace = lpMesh->mFaces[luiFace];
+				if (lFace.mNumIndices == 3) lauiIndices.insert(lauiIndices.end(), lFace.mIndices, lFace.mIndices + 3);
+			}
+			if (lauiIndices.empty()) continue;
+			cPhysicsCook::CookMesh(&lpMesh->mVertices[0].x, lpMesh->mNumVertices, &lauiIndices[0], lauiIndices.size(), lConfig, laMeshes[luiMesh]);
+		}
+		if (!cPhysicsCook::WriteFile(lacCookedFile, luiSourceHash, laMeshes))
+		{
+			OutputDebugString("Scene collision: the cooked file can't be written\n");
+		}
+	}
+
+	// The same hulls in other scenes (or loaded again) give the same shape
+	for (unsigned luiMesh = 0;luiMesh < laMeshes.size();++luiMesh)
+	{
+		mapMeshShapes.push_back(cPhysicsShapes::Get().GetHulls(laMeshes[luiMesh]));
+	}
+}
+
+// Creates a static body for every mesh of every node with collision
+void cScene::CreatePhysics()
+{
+	for (unsigned luiIndex = 0;luiIndex < maBodyDefs.size();++luiIndex)
+	{
+		btCollisionShape* lpShape = mapMeshShapes[maBodyDefs[luiIndex].muiMesh];
+		if (!lpShape) continue;
+		// The hulls are shared by the nodes of the mesh, the scale of a node can't go in them
+		const cMatrix& lTransform = maBodyDefs[luiIndex].mTransform;
+		bool lbScaled = false;
+		for (unsigned luiAxis = 0;luiAxis < 3;++luiAxis)
+		{
+			cVec3 lAxis(lTransform.rows[luiAxis].x, lTransform.rows[luiAxis].y, lTransform.rows[luiAxis].z);
+			if (fabsf(lAxis.Length() - 1.0f) > 0.001f) lbScaled = true;
+		}
+		assert(!lbScaled);
+		if (lbScaled)
+		{
+			OutputDebugString("Scene collision: a node with scale has no body\n");
+			continue;
+		}
+		mapBodies.push_back(cPhysics::Get().GetNewBody(lpShape, 0.0f, maBodyDefs[luiIndex].mTransform));
+	}
 }
 
 // This method converts three structure of the scene to a more plannar structure for optimize the render process. Scene will be static. 
@@ -180,6 +262,11 @@ void cScene::ConvertNodesToObjects( aiNode *lpNode, cMatrix lTransform )
 			luiMaterialIndex = mMeshMaterialIndexList[luiMeshIndex];
 			lpObject->AddMesh( mMeshList[luiMeshIndex],
 			mMaterialList[luiMaterialIndex] );
+			// Its body is created later, by CreatePhysics
+			sSceneBody lBody;
+			lBody.mTransform = lTransform;
+			lBody.muiMesh = luiMeshIndex;
+			maBodyDefs.push_back(lBody);
 		}
 		mObjectList.push_back(lpObject);
 	}
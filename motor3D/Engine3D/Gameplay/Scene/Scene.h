@@ -17,6 +17,8 @@ implementa las funciones virtuales correspondientes.
 // aadir una declaracin forward de aiScene para poder referenciarla en dicha funcin: 
 struct aiScene;
 struct aiNode;
+class btCollisionShape;
+class btRigidBody;
 
 class cScene : public cResource
 {
@@ -29,6 +31,10 @@ class cScene : public cResource
 	  // This method converts three structure of the scene to a more plannar structure for optimize the render process. Scene will be static. 
 	  void cScene::ConvertNodesToObjects( aiNode *lpNode, cMatrix lTransform );
 
+	  // Collision of the meshes: the hulls are read from the cooked file next to the scene,
+	  // or cooked from the vertices of the meshes and written there
+	  void CookCollision( const aiScene* lpScene );
+
 	  //Cadena que almacena el nombre del fichero de escena.
       std::string macFile;
 
@@ -48,6 +54,16 @@ class cScene : public cResource
 	  typedef std::vector<cObject *> cObjectList;
 	  cObjectList mObjectList;
 
+	  // Shared shape of every mesh (NULL for a mesh without triangles)
+	  std::vector<btCollisionShape*> mapMeshShapes;
+	  // Mesh of a node and its world matrix, a static body of CreatePhysics
+	  struct sSceneBody{
+		  cMatrix mTransform;
+		  unsigned muiMesh;
+	  };
+	  std::vector<sSceneBody> maBodyDefs;
+	  std::vector<btRigidBody*> mapBodies;
+
    public:
       cScene()                               { mbLoaded = false; }
  
@@ -67,6 +83,10 @@ class cScene : public cResource
 
 	  cObject* getSubObject(int param){ return mObjectList[param]; };
 
+	  // Static bodies for the meshes of the nodes, they leave the world with the scene. The
+	  // bullet transforms are rigid, a node with scale gets no body
+	  void CreatePhysics();
+
 };
 
 #endif
\ No newline at end of file
@@ -1,12 +1,21 @@
 #include "Heightmap.h"
 #include <stdio.h>
-#include "../../Graphics/Textures/TextureManager.h"
-#include "../../Graphics/Textures/Texture.h"
+#include "../../Graphics/GraphicManager.h"
+#include "../../Graphics/Frustum.h"
+#include "../../Graphics/Materials/MaterialManager.h"
+#include "../../Graphics/Materials/Material.h"
+#include "../../Graphics/Effects/cEffect.h"
+#include "../../Utility/FileUtils.h"
 #include <assert.h>
+#include <math.h>
+#include <float.h>
+#include <xmmintrin.h>
+#include <emmintrin.h>
 
 /* Utilities */
 
-bool Heightmap::LoadRawFile(char *filename,int size){
+// The size of the map comes from the size of the file: (size x size) samples of 1 or 2 bytes
+bool Heightmap::LoadRawFile(const char *filename, unsigned bytes){
 	FILE *file = NULL;
 
 	// Let's open the file in Read/Binary mode.
@@ -20,13 +29,28 @@ bool Heightmap::LoadRawFile(char *filename,int size){
 		return false;
 	}
 
-	// Here we load the .raw file into our pHeightMap data array.
-	// We are only reading in '1', and the size is the (width * height)
-	fread(&HeightMap,1,size,file);
+	// The file must hold a square map
+	fseek(file, 0, SEEK_END);
+	long length = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	unsigned size = (unsigned)(sqrt((double)(length / bytes)) + 0.5);
+	if (size < 2 || (long)(size * size * bytes) != length){
+		fclose(file);
+		return false;
+	}
+	mapSize = size;
+	bytesPerSample = bytes;
+	HeightMap.resize(length);
+
+	// Here we load the .raw file into our HeightMap data array.
+	fread(&HeightMap[0],1,length,file);
 
 	// After we read the data, it's a good idea to check if everything read fine.
 	int result = ferror(file);
 
+	// Close the file.
+	fclose(file);
+
 	// Check if we received an error.
 	if (result)
 	{
@@ -34,273 +58,344 @@ bool Heightmap::LoadRawFile(char *filename,int size){
 		return false;
 	}
 
-	// Close the file.
-	fclose(file);
-
 	return true;
 }
 
-// This returns the height (0 to 255) from a heightmap given an X and Y
+// This returns the raw height from a heightmap given an X and Y
 int Heightmap::Height(int X, int Y){
 	// This is used to index into our height map array.
 	// When ever we are dealing with arrays, we want to make sure
 	// that we don't go outside of them, so we make sure that doesn't
-	// happen with a %.  This way x and y will cap out at (MAX_SIZE - 1)
+	// happen with a %.  This way x and y will cap out at (mapSize - 1)
 
-	int x = X % MAP_SIZE;					// Error check our x value
-	int y = Y % MAP_SIZE;					// Error check our y value
+	if(HeightMap.empty()) return 0;			// Make sure our data is valid
 
-	if(!HeightMap) return 0;				// Make sure our data is valid
+	// The % by the unsigned size would turn a negative value into a huge one, the
+	// coordinates under 0 are clamped to the first row or column.
+	unsigned x = (X > 0)? (unsigned)X % mapSize : 0;	// Error check our x value
+	unsigned y = (Y > 0)? (unsigned)Y % mapSize : 0;	// Error check our y value
 
 	// Below, we need to treat the single array like a 2D array.
 	// We can use the equation: index = (x + (y * arrayWidth) ).
-	// This is assuming we are using this assumption array[x][y]
-	// otherwise it's the opposite.  Now that we have the correct index,
-	// we will return the height in that index.
+	// 16 bits maps are read as signed shorts like bullet does.
 
-	return HeightMap[x + (y * MAP_SIZE)];	// Index into our height array and return the height
+	if (bytesPerSample == 2) return ((short*)&HeightMap[0])[x + (y * mapSize)];
+	return HeightMap[x + (y * mapSize)];	// Index into our height array and return the height
 }
 
-// UV mapping
-void Heightmap::SetTextureCoord(float x, float z){
-	// Find the (u, v) coordinate for the current vertex
-	float u =  (float)x / (float)MAP_SIZE;
-	float v = -(float)z / (float)MAP_SIZE;
+/* Heightmap */
 
-	// Give OpenGL the current texture coordinate for our height map
-	glMultiTexCoord2fARB(GL_TEXTURE0_ARB, u, v);
-	glMultiTexCoord2fARB(GL_TEXTURE1_ARB, u, v);
+Heightmap::Heightmap(){
+	mapSize = 0;
+	bytesPerSample = 1;
+	nearLods = 2;
 }
 
-static btVector3 getUpVector(int upAxis, btScalar regularValue, btScalar upValue){
-	btAssert(upAxis >= 0 && upAxis <= 2 && "bad up axis");
+bool Heightmap::Load(){
+	const char *rawFile = "./Data/Scene/images/terrain1.raw";
+	const char *tiledFile = "./Data/Scene/images/terrain1.hft";
+
+	//Tiled file, cooked again when the raw file changes
+	unsigned sourceHash = cFileUtils::HashFileStamp(rawFile);
+	if (!file.Open(tiledFile) || file.GetHeader().muiSourceHash != sourceHash){
+		file.Close();
+		if (!Cook(rawFile, tiledFile, sourceHash) || !file.Open(tiledFile)) return false;
+	}
 
-	btVector3 v(regularValue, regularValue, regularValue);
-	v[upAxis] = upValue;
+	// Same placement the display list had: centred on the map and 100 units down.
+	// The layout and the ranges of the tiles come from the table of the file
+	const sTerrainFileHeader& header = file.GetHeader();
+	float halfSize = (header.muiSize - 1) * header.mfSpacing * 0.5f;
+	if (!data.Init(file, cVec3(-halfSize, -100.0f, -halfSize))) return false;
+
+	// Splat map material, the textures are baked before it loads them
+	if (!BakeTextures()) return false;
+	material = cMaterialManager::Get().LoadResource("TerrainMaterial", "./Data/Material/TerrainMaterial.xml");
+	if (!material.IsValidHandle()) return false;
+	if (!quadtree.Init(data)) return false;
+
+	// The tiles create their render mesh and their physics when they become resident
+	if (!streamer.Init(&data, &file, &quadtree, 2)) return false;
+	streamer.Prefetch(cVec3(0.0f, 0.0f, 0.0f));
+	cPhysics::Get().SetHeightfield(this);
+
+#ifdef _DEBUG
+	// The batched path must give the same heights as the scalar one
+	float xs[7], zs[7], heights[7], height;
+	for (unsigned i = 0; i < 7; ++i){
+		xs[i] = -3.3f + 1.7f * i;
+		zs[i] = 2.9f - 1.1f * i;
+	}
+	GetHeights(xs, zs, heights, 7);
+	for (unsigned i = 0; i < 7; ++i){
+		if (GetHeightAt(xs[i], zs[i], height)) assert(fabsf(height - heights[i]) < 0.001f);
+	}
+#endif
 
-	return v;
+	return true;
 }
 
-
-/* Heightmap */
-
-bool Heightmap::Load(){
-	//Raw file
-	if(!LoadRawFile			("./Data/Scene/images/terrain1.raw", MAP_SIZE*MAP_SIZE))	return false;
-	
-	//Texture 1
-	tex_floor = cTextureManager::Get().LoadResource("terrain", "./Data/Scene/images/sand.tga"); 
-	assert(tex_floor.IsValidHandle());
-	
-	//Texture 2
-	tex_detail = cTextureManager::Get().LoadResource("detail", "./Data/Scene/images/mid1.tga");	
-	assert(tex_detail.IsValidHandle());
-	
-	//Texture 3
-//	tex_water = cTextureManager::Get().LoadResource("water", "./Data/Scene/images/water.jpg");
-//	assert(tex_water.IsValidHandle());
-	//move = 0.0f;
-	
-	btScalar minHeight, maxHeight;
-
-	//Create display list
-	Create(minHeight, maxHeight);
-
-/*	for (int i = 0; i <= BULLET_MAP_SIZE; i++ ){
-		for (int j = 0; j <= BULLET_MAP_SIZE; j++ ){
-			smallHeightMap[ i + (j * BULLET_MAP_SIZE) ] = Height( i, j );
+// The render grid is the next (2^n + 1) size, wrapping the raw map like Height() does.
+// The physics used to read the raw map with a 0.2 scale, now it uses the render heights
+bool Heightmap::Cook(const char *rawFile, const char *tiledFile, unsigned sourceHash){
+	if(!LoadRawFile(rawFile, 1)) return false;
+
+	unsigned gridSize = 2;
+	while (gridSize < mapSize) gridSize = (gridSize - 1) * 2 + 1;
+	unsigned tileQuads = (gridSize - 1 < 32) ? gridSize - 1 : 32;
+
+	// 16 bits samples, the 8 bits of the raw file fit without loss
+	cTerrainData cooked;
+	if (!cooked.Init(gridSize, tileQuads, eTerrainFormat_Short, cVec3(0.0f, 0.0f, 0.0f), 1.0f, 1.0f)) return false;
+	for (unsigned Y = 0; Y < gridSize; ++Y){
+		for (unsigned X = 0; X < gridSize; ++X){
+			cooked.SetSample(X, Y, (float)Height(X, Y));
 		}
-	}*/
-
-	// Creates physics over the terrain data
-	bool flipQuadEdges = false;													// width, height, *heightmapData, scale, minHeight, maxHeight, upAxis, heightMapDatatype, flipQuadEdges 
-	int upAxis = 1;
-	//btHeightfieldTerrainShape * heightfieldShape = new btHeightfieldTerrainShape(MAP_SIZE, MAP_SIZE, HeightMap, s_gridHeightScale1, minHeight, maxHeight, upAxis, PHY_UCHAR, flipQuadEdges);
-	btHeightfieldTerrainShape * heightfieldShape = new btHeightfieldTerrainShape(BULLET_MAP_SIZE, BULLET_MAP_SIZE, HeightMap /*smallHeightMap*/, s_gridHeightScale1, minHeight, maxHeight, upAxis, PHY_UCHAR, flipQuadEdges);
-	assert(heightfieldShape);
+	}
+	std::vector<unsigned char>().swap(HeightMap);
+	cooked.UpdateBounds();
 
-	// scale the shape
-//	btVector3 localScaling = getUpVector(upAxis, s_gridSpacing1, 1.0);
-//	heightfieldShape->setLocalScaling(localScaling);
+	return cTerrainFile::Write(tiledFile, cooked, sourceHash);
+}
 
-	// stash this shape away
-	cPhysics::Get().getCollisionShapes().push_back(heightfieldShape);
-	//m_collisionShapes.push_back(heightfieldShape);
+// The layer images, the splat map and the macro texture are baked offline like the
+// tiled file, the material only reads them
+bool Heightmap::BakeTextures(){
+	sTerrainBakeParams params;
+	cTerrainBaker::GetDefaultParams(params);
+	unsigned sourceHash = cTerrainBaker::GetSourceHash(params, file.GetHeader().muiSourceHash);
+	if (!cTerrainBaker::IsStale(params, sourceHash)) return true;
 
-	// create ground object
-	float mass = 0.0;
-   
-	btRigidBody* body = cPhysics::Get().GetNewBody(heightfieldShape, mass, cVec3(0, -100, 0));	
+	cTerrainBaker baker;
+	return baker.Bake(params, data, &file, sourceHash);
+}
 
-	return true;
+void Heightmap::Update(const cVec3& position){
+	streamer.Update(position);
 }
 
-void Heightmap::Create(btScalar& minHeight, btScalar& maxHeight){
-	int X = 0, Y = 0;						// Create some variables to walk the array with.
-	int x, y, z;							// Create some variables for readability
-	bool bSwitchSides = false;
-	minHeight = maxHeight = 0;				// Max and min height in the heightmap
-
-	if(!HeightMap) return;					// Make sure our height data is valid
-
-	detail = true;							// Detailed heightmap
-	detail_level = 32;
-	disp_list_id = glGenLists(1);
-	glNewList(disp_list_id, GL_COMPILE);
-
-	glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-
-	// Bind the terrain texture to our terrain
-	glActiveTextureARB(GL_TEXTURE0_ARB);
-	glEnable(GL_TEXTURE_2D);
-	cTexture* lpTexture = (cTexture*) tex_floor.GetResource();
-	glBindTexture(GL_TEXTURE_2D, lpTexture->GetTextureHandle());
-
-	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_S,GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_T,GL_REPEAT);
-	glTexParameterf(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_LINEAR);
-	glTexParameterf(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_LINEAR);
-
-	if (detail){
-		// Activate the second texture ID and bind the fog texture to it
-		glActiveTextureARB(GL_TEXTURE1_ARB);
-		glEnable(GL_TEXTURE_2D);
-			
-		// Here we turn on the COMBINE properties and increase our RGB
-		// gamma for the detail texture.  2 seems to work just right.
-		glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_COMBINE_ARB);
-		glTexEnvi(GL_TEXTURE_ENV, GL_RGB_SCALE_ARB, 2);
-		
-		// Bind the detail texture
-		lpTexture = (cTexture*) tex_detail.GetResource();
-		glBindTexture(GL_TEXTURE_2D, lpTexture->GetTextureHandle());	
-		
-		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_S,GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_T,GL_REPEAT);
-		glTexParameterf(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_LINEAR);
-		glTexParameterf(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_LINEAR);
-
-		// Now we want to enter the texture matrix.  This will allow us
-		// to change the tiling of the detail texture.
-		glMatrixMode(GL_TEXTURE);
-
-			// Reset the current matrix and apply our chosen scale value
-			glLoadIdentity();
-			glScalef((float)detail_level, (float)detail_level, 1.0f);
-
-		// Leave the texture matrix and set us back in the model view matrix
-		glMatrixMode(GL_MODELVIEW);
+void Heightmap::Render(){
+	if (!quadtree.IsLoaded() || !material.IsValidHandle()) return;
+
+	// Tiles are in world space, the world matrix is already the identity
+	Frustum frustum;
+	frustum.calculateFrustum();
+	cMatrix eye = cGraphicManager::Get().GetActiveCamera()->GetView();
+	eye.Invert();
+	quadtree.SelectLod(eye.GetPosition());
+
+	// The parameters are the same for both techniques. The lod of a tile grows with the
+	// distance to its box, so every pixel of a far tile is beyond the end of the fade
+	cMaterial* mat = (cMaterial*) material.GetResource();
+	cEffect* effect = (cEffect*) mat->GetEffect().GetResource();
+	float size = (data.GetSize() - 1) * data.GetSpacing();
+	float farDistance = quadtree.GetLodDistance() * (float)(1 << (nearLods - 1));
+	effect->SetParam("terrainMapping", cVec4(data.GetOrigin().x, data.GetOrigin().z, 1.0f / size, 0.125f));
+	effect->SetParam("eyePosition", eye.GetPosition());
+	effect->SetParam("macroFadeStart", farDistance * 0.5f);
+	effect->SetParam("macroFadeEnd", farDistance);
+
+	// One technique change per frame instead of texture changes per tile
+	RenderTiles(frustum, "Technique0", 0, nearLods - 1);
+	if (quadtree.GetLodCount() > nearLods){
+		RenderTiles(frustum, "TechniqueFar", nearLods, quadtree.GetLodCount() - 1);
 	}
+}
 
-	// We want to render triangle strips
-	glBegin( GL_TRIANGLE_STRIP );			
-
-	// Go through all of the rows of the height map
-	for ( X = 0; X <= MAP_SIZE; X += STEP_SIZE ){
-		// Check if we need to render the opposite way for this column
-		if (bSwitchSides){	
-			// Render a column of the terrain, for this current X.
-			// We start at MAP_SIZE and render down to 0.
-			for ( Y = MAP_SIZE; Y >= 0; Y -= STEP_SIZE ){
-				// Get the (X, Y, Z) value for the bottom left vertex		
-				x = X;							
-				y = Height(X, Y );	
-				z = Y;	
-
-				// Calculates min and max heightmap
-				if (y < minHeight) {
-					minHeight = y;
-				}
-				if (y > maxHeight) {
-					maxHeight = y;
-				}					
-
-				// Set the current texture coordinate and render the vertex
-				SetTextureCoord( (float)x, (float)z );
-				glVertex3i(x, y, z);		
-
-				// Get the (X, Y, Z) value for the bottom right vertex		
-				x = X + STEP_SIZE; 
-				y = Height(X + STEP_SIZE, Y ); 
-				z = Y;
-
-				// Set the current texture coordinate and render the vertex
-				SetTextureCoord( (float)x, (float)z );
-				glVertex3i(x, y, z);			
-			}
-		}
-		else{	
-			// Render a column of the terrain, for this current X.
-			// We start at 0 and render down up to MAP_SIZE.
-			for ( Y = 0; Y <= MAP_SIZE; Y += STEP_SIZE ){
-				// Get the (X, Y, Z) value for the bottom right vertex		
-				x = X + STEP_SIZE; 
-				y = Height(X + STEP_SIZE, Y ); 
-				z = Y;
-
-				// Calculates min and max heightmap
-				if (!X && !Y){
-					maxHeight = minHeight = y;
-				}else{
-					if (y < minHeight) {
-						minHeight = y;
-					}
-					if (y > maxHeight) {
-						maxHeight = y;
-					}					
-				}
+void Heightmap::RenderTiles(Frustum& frustum, const char* technique, unsigned minLod, unsigned maxLod){
+	cMaterial* mat = (cMaterial*) material.GetResource();
+	mat->SetTechnique(technique);
+	mat->PrepareRender();
+	bool continuePass = mat->SetFirstPass();
+	while (continuePass){
+		quadtree.Render(frustum, minLod, maxLod);
+		continuePass = mat->SetNextPass();
+	}
+}
 
-				// Set the current texture coordinate and render the vertex
-				SetTextureCoord( (float)x, (float)z );
-				glVertex3i(x, y, z);
+/* Height queries */
 
-				// Get the (X, Y, Z) value for the bottom left vertex		
-				x = X;							
-				y = Height(X, Y );	
-				z = Y;							
+// Height inside a cell. The diagonal goes from corner 10 to corner 01, like the
+// triangles of the tiles and of btHeightfieldTerrainShape
+static inline float InterpolateCell(const float* cell, float fx, float fz){
+	if (fx + fz <= 1.0f) return cell[0] + (cell[1] - cell[0]) * fx + (cell[2] - cell[0]) * fz;
+	return cell[3] + (cell[2] - cell[3]) * (1.0f - fx) + (cell[1] - cell[3]) * (1.0f - fz);
+}
 
-				// Set the current texture coordinate and render the vertex
-				SetTextureCoord( (float)x, (float)z );
-				glVertex3i(x, y, z);		
-			}
-		}
+void Heightmap::ToGrid(float x, float z, int& cellX, int& cellZ, float& fx, float& fz) const{
+	float invSpacing = 1.0f / data.GetSpacing();
+	float limit = (float)(data.GetSize() - 1);
+	limit -= limit * FLT_EPSILON;
+	float gx = (x - data.GetOrigin().x) * invSpacing;
+	float gz = (z - data.GetOrigin().z) * invSpacing;
+	gx = (gx < 0.0f) ? 0.0f : ((gx > limit) ? limit : gx);
+	gz = (gz < 0.0f) ? 0.0f : ((gz > limit) ? limit : gz);
+	cellX = (int)gx;
+	cellZ = (int)gz;
+	fx = gx - cellX;
+	fz = gz - cellZ;
+}
 
-		// Switch the direction the column renders to allow the fluid tri strips
-		bSwitchSides = !bSwitchSides;
+bool Heightmap::GetCellHeights(int cellX, int cellZ, float* cell) const{
+	unsigned quads = data.GetTileQuads();
+	unsigned tile = (cellZ / quads) * data.GetTilesPerSide() + cellX / quads;
+	const void* samples = streamer.GetTileSamples(tile);
+	if (!samples){
+		cell[0] = cell[1] = cell[2] = cell[3] = data.GetTileMin(tile);
+		return false;
 	}
+	// A cell never crosses a tile, the last row and column of the tile are stored in it
+	unsigned side = quads + 1;
+	unsigned first = (cellZ % quads) * side + cellX % quads;
+	if (data.GetFormat() == eTerrainFormat_Float){
+		const float* corner = (const float*)samples + first;
+		cell[0] = corner[0];
+		cell[1] = corner[1];
+		cell[2] = corner[side];
+		cell[3] = corner[side + 1];
+	} else {
+		const short* corner = (const short*)samples + first;
+		cell[0] = corner[0];
+		cell[1] = corner[1];
+		cell[2] = corner[side];
+		cell[3] = corner[side + 1];
+	}
+	return true;
+}
 
-	// Stop rendering triangle strips
-	glEnd();
-
-	// Now let's clean up our multitexturing so it doesn't effect anything else
-	// Turn the second multitexture pass off
-	glActiveTextureARB(GL_TEXTURE1_ARB);
-	glDisable(GL_TEXTURE_2D);
-	// Turn the first multitexture pass off
-	glActiveTextureARB(GL_TEXTURE0_ARB);		
-	glDisable(GL_TEXTURE_2D);
-
-	glEndList();
+bool Heightmap::GetHeightAt(float x, float z, float& height) const{
+	if (!quadtree.IsLoaded()) return false;
+	int cellX, cellZ;
+	float fx, fz, cell[4];
+	ToGrid(x, z, cellX, cellZ, fx, fz);
+	if (!GetCellHeights(cellX, cellZ, cell)) return false;
+	height = data.GetOrigin().y + InterpolateCell(cell, fx, fz) * data.GetHeightScale();
+	return true;
+}
 
-	// Recalculates min and max heights
-	if (maxHeight < -minHeight) {
-		maxHeight = -minHeight;
-	}
-	if (minHeight > -maxHeight) {
-		minHeight = -maxHeight;
+// Normal of the triangle under the position
+bool Heightmap::GetNormalAt(float x, float z, cVec3& normal) const{
+	if (!quadtree.IsLoaded()) return false;
+	int cellX, cellZ;
+	float fx, fz, cell[4];
+	ToGrid(x, z, cellX, cellZ, fx, fz);
+	if (!GetCellHeights(cellX, cellZ, cell)) return false;
+
+	float slopeX, slopeZ;
+	if (fx + fz <= 1.0f){
+		slopeX = cell[1] - cell[0];
+		slopeZ = cell[2] - cell[0];
+	} else {
+		slopeX = cell[3] - cell[2];
+		slopeZ = cell[3] - cell[1];
 	}
+	float scale = data.GetHeightScale() / data.GetSpacing();
+	normal = cVec3(-slopeX * scale, 1.0f, -slopeZ * scale);
+	normal.Normalize();
+	return true;
+}
 
+// Height of the ray over the surface is positive above it. The first step that goes under
+// it is bisected, the steps over tiles that are not resident are skipped
+bool Heightmap::RayCast(const cVec3& from, const cVec3& to, float& fraction, cVec3& normal) const{
+	if (!quadtree.IsLoaded()) return false;
+	cVec3 delta = to - from;
+	float length = sqrtf(delta.x * delta.x + delta.z * delta.z);
+	unsigned steps = (unsigned)(length / (data.GetSpacing() * 0.5f)) + 1;
+	float height;
+	bool lastValid = false;
+	for (unsigned i = 0; i <= steps; ++i){
+		float t = (float)i / steps;
+		cVec3 point = from + delta * t;
+		if (!GetHeightAt(point.x, point.z, height)){
+			lastValid = false;
+			continue;
+		}
+		float above = point.y - height;
+		if (above <= 0.0f){
+			if (i == 0){
+				// The ray starts under the surface
+				fraction = 0.0f;
+				return GetNormalAt(point.x, point.z, normal);
+			}
+			float low = (float)(i - 1) / steps;
+			float high = t;
+			if (lastValid){
+				for (unsigned j = 0; j < 8; ++j){
+					float mid = (low + high) * 0.5f;
+					cVec3 midPoint = from + delta * mid;
+					if (GetHeightAt(midPoint.x, midPoint.z, height) && midPoint.y - height > 0.0f) low = mid;
+					else high = mid;
+				}
+			}
+			fraction = high;
+			point = from + delta * fraction;
+			return GetNormalAt(point.x, point.z, normal);
+		}
+		lastValid = true;
+	}
+	return false;
 }
 
-void Heightmap::Render(){
-	glPushMatrix();
-//	glScalef(100.0f,100.0f,100.0f);
-	glColor4f(1.0f, 1.0f, 1.0f, 1.0f);	
-	glTranslatef(-BULLET_MAP_SIZE * 0.5f, -100.0f, -BULLET_MAP_SIZE * 0.5f); 
-	glEnable(GL_TEXTURE_2D);
-	glCallList(disp_list_id);
-	glDisable(GL_TEXTURE_2D);
-	glPopMatrix();
+// The grid transform and the interpolation run on 4 points at once, only the
+// samples are read one by one (there are no gathers in SSE)
+void Heightmap::GetHeights(const float* xs, const float* zs, float* out, unsigned n) const{
+	assert(xs && zs && out);
+	if (!quadtree.IsLoaded()) return;
+
+	float invSpacing = 1.0f / data.GetSpacing();
+	float limit = (float)(data.GetSize() - 1);
+	limit -= limit * FLT_EPSILON;
+	const __m128 originX = _mm_set1_ps(data.GetOrigin().x);
+	const __m128 originZ = _mm_set1_ps(data.GetOrigin().z);
+	const __m128 originY = _mm_set1_ps(data.GetOrigin().y);
+	const __m128 heightScale = _mm_set1_ps(data.GetHeightScale());
+	const __m128 gridScale = _mm_set1_ps(invSpacing);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 maxGrid = _mm_set1_ps(limit);
+
+	unsigned i = 0;
+	for (; i + 4 <= n; i += 4){
+		__m128 gx = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(xs + i), originX), gridScale);
+		__m128 gz = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(zs + i), originZ), gridScale);
+		gx = _mm_min_ps(_mm_max_ps(gx, zero), maxGrid);
+		gz = _mm_min_ps(_mm_max_ps(gz, zero), maxGrid);
+		__m128i cellX = _mm_cvttps_epi32(gx);
+		__m128i cellZ = _mm_cvttps_epi32(gz);
+		__m128 fx = _mm_sub_ps(gx, _mm_cvtepi32_ps(cellX));
+		__m128 fz = _mm_sub_ps(gz, _mm_cvtepi32_ps(cellZ));
+
+		// Corners of the 4 cells, transposed so every register holds one corner
+		int cellsX[4], cellsZ[4];
+		_mm_storeu_si128((__m128i*)cellsX, cellX);
+		_mm_storeu_si128((__m128i*)cellsZ, cellZ);
+		float cells[4][4];
+		for (unsigned point = 0; point < 4; ++point){
+			GetCellHeights(cellsX[point], cellsZ[point], cells[point]);
+		}
+		__m128 h00 = _mm_loadu_ps(cells[0]);
+		__m128 h10 = _mm_loadu_ps(cells[1]);
+		__m128 h01 = _mm_loadu_ps(cells[2]);
+		__m128 h11 = _mm_loadu_ps(cells[3]);
+		_MM_TRANSPOSE4_PS(h00, h10, h01, h11);
+
+		// Both triangles and a select with the diagonal test
+		__m128 lower = _mm_add_ps(h00, _mm_add_ps(_mm_mul_ps(_mm_sub_ps(h10, h00), fx), _mm_mul_ps(_mm_sub_ps(h01, h00), fz)));
+		__m128 upper = _mm_add_ps(h11, _mm_add_ps(_mm_mul_ps(_mm_sub_ps(h01, h11), _mm_sub_ps(one, fx)), _mm_mul_ps(_mm_sub_ps(h10, h11), _mm_sub_ps(one, fz))));
+		__m128 isUpper = _mm_cmpgt_ps(_mm_add_ps(fx, fz), one);
+		__m128 height = _mm_or_ps(_mm_and_ps(isUpper, upper), _mm_andnot_ps(isUpper, lower));
+		_mm_storeu_ps(out + i, _mm_add_ps(originY, _mm_mul_ps(height, heightScale)));
+	}
+
+	// Remaining points
+	for (; i < n; ++i){
+		int cellX, cellZ;
+		float fx, fz, cell[4];
+		ToGrid(xs[i], zs[i], cellX, cellZ, fx, fz);
+		GetCellHeights(cellX, cellZ, cell);
+		out[i] = data.GetOrigin().y + InterpolateCell(cell, fx, fz) * data.GetHeightScale();
+	}
 }
 
 /// removes all objects from the world
@@ -309,5 +404,10 @@ void Heightmap::clearWorld(void){
 }
 
 void Heightmap::Deinit(void){
+	if (cPhysics::Get().GetHeightfield() == this) cPhysics::Get().SetHeightfield(NULL);
 	clearWorld();
+	streamer.Deinit();
+	quadtree.Deinit();
+	data.Deinit();
+	file.Close();
 }
\ No newline at end of file
@@ -1,42 +1,78 @@
 #ifndef HEIGHTMAP_H
 #define HEIGHTMAP_H
 
+#include <vector>
 #include "../../Utility/ResourceHandle.h"
 #include "../../Graphics/GLHeaders.h"
 #include "..\..\Libraries\Bullet\include\btBulletCollisionCommon.h"
 #include "..\..\Libraries\Bullet\include\btBulletDynamicsCommon.h"
 #include "..\..\Libraries\Bullet\include\BulletCollision\CollisionShapes\btHeightfieldTerrainShape.h"
 #include "..\..\Physics\cPhysics.h"
+#include "TerrainQuadtree.h"
+#include "TerrainFile.h"
+#include "TerrainData.h"
+#include "TerrainStreamer.h"
+#include "TerrainBaker.h"
 
-#define MAP_SIZE	64	// This is the size of our .raw height map
-#define BULLET_MAP_SIZE	64	// This is the size of our .raw height map
-#define STEP_SIZE	8		// This is width and height of each QUAD
-static const float s_gridHeightScale1		= 0.2;
-static const float s_gridSpacing1		= 5.0;
+class Frustum;
 
-class Heightmap{
+class Heightmap : public cPhysicsHeightfield{
 
 public:
 
+	Heightmap();
+
 	bool Load();
 	void Render();
-	void Create(btScalar& minHeight, btScalar& maxHeight);
+	// Streams the tiles around the position (the vehicle)
+	void Update(const cVec3& position);
 	int  Height(int X,int Y);
 	void Deinit(void);
 	void clearWorld(void);
 
+	// Height of the surface at a world position, on the same triangles the mesh and
+	// bullet use. False if the position is over a tile that is not resident
+	bool GetHeightAt(float x, float z, float& height) const;
+	bool GetNormalAt(float x, float z, cVec3& normal) const;
+	// GetHeightAt for many points (ground snapping), 4 points per SSE iteration.
+	// Points over tiles that are not resident get the lowest height of their tile
+	void GetHeights(const float* xs, const float* zs, float* out, unsigned n) const;
+	// Ray against the surface for the scene queries, marching half a cell per step and
+	// refining the crossing. The tiles that are not resident are not hit
+	virtual bool RayCast(const cVec3& from, const cVec3& to, float& fraction, cVec3& normal) const;
+
+	inline unsigned GetMapSize() const { return mapSize; }
+	inline const cTerrainData& GetData() const { return data; }
+	inline cTerrainQuadtree& GetQuadtree() { return quadtree; }
+	inline cTerrainStreamer& GetStreamer() { return streamer; }
+
 private:
 
-	bool LoadRawFile(char *file,int size);
-	void SetTextureCoord(float x, float z);
+	bool LoadRawFile(const char *file, unsigned bytesPerSample);
+	// Converts the raw map into a tiled heightfield file
+	bool Cook(const char *rawFile, const char *tiledFile, unsigned sourceHash);
+	// Bakes the textures of the splat material again when the heights or the layers changed
+	bool BakeTextures();
+	// Draws the tiles with a lod in [minLod, maxLod] with a technique of the material
+	void RenderTiles(Frustum& frustum, const char* technique, unsigned minLod, unsigned maxLod);
+	// World position to grid cell and position inside the cell, clamped to the map
+	void ToGrid(float x, float z, int& cellX, int& cellZ, float& fx, float& fz) const;
+	// Samples of the corners of a cell (00, 10, 01, 11). False if its tile is not resident
+	bool GetCellHeights(int cellX, int cellZ, float* cell) const;
 
-	unsigned char HeightMap[MAP_SIZE*MAP_SIZE]; // 0..255 values
-	unsigned char smallHeightMap[BULLET_MAP_SIZE*BULLET_MAP_SIZE];
-	int disp_list_id;
-	//cTexture tex_floor,tex_detail,tex_water,tex_waterfall;
-	cResourceHandle tex_floor, tex_detail, tex_water;
-	bool detail;
-	int  detail_level;
+	// Raw samples as they are in the file (mapSize x mapSize), only while cooking
+	std::vector<unsigned char> HeightMap;
+	unsigned mapSize;
+	unsigned bytesPerSample;
+	// Tiled heightfield, the layout and transform shared by the render tiles and
+	// bullet, the render tiles and the streamer that pages them
+	cTerrainFile file;
+	cTerrainData data;
+	cTerrainQuadtree quadtree;
+	cTerrainStreamer streamer;
+	// Splat map material, the near tiles blend the layers and the far ones read the macro texture
+	cResourceHandle material;
+	unsigned nearLods;
 };
 
 #endif
\ No newline at end of file
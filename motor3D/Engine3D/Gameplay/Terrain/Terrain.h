@@ -23,20 +23,17 @@ subject to the following restrictions:
 #include "..\..\Libraries\Bullet\include\BulletCollision\CollisionShapes\btHeightfieldTerrainShape.h"
 
 #include "..\..\Physics\cPhysics.h"
+#include "TerrainData.h"
 
 // what type of terrain is generated?
 enum eTerrainModel {
-	eRadial			= 1,	// deterministic
-	eFractal		= 2	// random
+	eRadial			= 1,	// waves around the centre
+	eFractal		= 2	// diamond square, the seed makes it repeatable
 };
 
-typedef unsigned char byte_t;
-
 static const int s_gridSize			= 64 + 1;  // must be (2^N) + 1
 static const float s_gridSpacing		= 5.0;
 
-static const float s_gridHeightScale		= 0.2;
-
 
 class Terrain {
 public:
@@ -57,12 +54,8 @@ private:
 	void clearWorld(void);
 
 	// private data members ------------------------------------------------
-	int										m_upAxis;
-	PHY_ScalarType							m_type;
 	eTerrainModel							m_model;					
-	byte_t *								m_rawHeightfieldData;		
-	btScalar								m_minHeight;
-	btScalar								m_maxHeight;
+	cTerrainData							m_data;
 
 	btDynamicsWorld * 						m_dynamicsWorld;
 };
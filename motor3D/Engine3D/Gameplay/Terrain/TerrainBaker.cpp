@@ -0,0 +1,321 @@
+#include "TerrainBaker.h"
+#include "TerrainData.h"
+#include "TerrainFile.h"
+#include "../../Graphics/Textures/SOIL/SOIL.h"
+#include "../../Utility/FileUtils.h"
+#include <windows.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+static inline float Saturate( float lfValue )
+{
+	return (lfValue < 0.0f) ? 0.0f : ((lfValue > 1.0f) ? 1.0f : lfValue);
+}
+
+// 1 inside [lfMin, lfMax] and a ramp of width lfFade on both sides.
+// The limits at 0 and 1 have no ramp, nothing is out of the range there
+static inline float Band( float lfValue, float lfMin, float lfMax, float lfFade )
+{
+	float lfLow = (lfMin <= 0.0f) ? 1.0f : Saturate((lfValue - lfMin) / lfFade + 0.5f);
+	float lfHigh = (lfMax >= 1.0f) ? 1.0f : Saturate((lfMax - lfValue) / lfFade + 0.5f);
+	return lfLow * lfHigh;
+}
+
+static inline unsigned char ToByte( float lfValue )
+{
+	return (unsigned char)(Saturate(lfValue) * 255.0f + 0.5f);
+}
+
+static bool FileExists( const std::string &lacFile )
+{
+	FILE* lpFile = fopen(lacFile.c_str(), "rb");
+	if ( !lpFile ) return false;
+	fclose(lpFile);
+	return true;
+}
+
+cTerrainBaker::cTerrainBaker()
+{
+	muiSize = 0;
+	mfMinHeight = 0.0f;
+	mfMaxHeight = 0.0f;
+}
+
+void cTerrainBaker::GetDefaultParams( sTerrainBakeParams& lParams )
+{
+	// Sand on the low flat ground, grass above it, snow on the peaks and rock on the slopes
+	static const char* lacFiles[kuiTerrainLayers] = {
+		"./Data/Scene/images/sand.tga",
+		"./Data/Scene/images/mid1.tga",
+		"./Data/Scene/images/mid1.tga",
+		"./Data/Scene/images/sand.tga"
+	};
+	static const float lafRules[kuiTerrainLayers][7] = {
+		// Tint                 Height         Slope
+		{ 1.0f, 1.0f, 1.0f,     0.0f, 0.25f,   0.0f, 0.35f },
+		{ 0.55f, 0.8f, 0.4f,    0.25f, 0.7f,   0.0f, 0.35f },
+		{ 0.6f, 0.58f, 0.55f,   0.0f, 1.0f,    0.35f, 1.0f },
+		{ 1.3f, 1.3f, 1.4f,     0.7f, 1.0f,    0.0f, 0.35f }
+	};
+	for ( unsigned luiLayer = 0; luiLayer < kuiTerrainLayers; ++luiLayer ) {
+		sTerrainLayer& lLayer = lParams.maLayers[luiLayer];
+		lLayer.macFile = lacFiles[luiLayer];
+		lLayer.mafTint[0] = lafRules[luiLayer][0];
+		lLayer.mafTint[1] = lafRules[luiLayer][1];
+		lLayer.mafTint[2] = lafRules[luiLayer][2];
+		lLayer.mfMinHeight = lafRules[luiLayer][3];
+		lLayer.mfMaxHeight = lafRules[luiLayer][4];
+		lLayer.mfMinSlope = lafRules[luiLayer][5];
+		lLayer.mfMaxSlope = lafRules[luiLayer][6];
+	}
+	// The names must match the textures of ./Data/Material/TerrainMaterial.xml
+	lParams.macAtlasFile = "./Data/Scene/images/terrain1_atlas.tga";
+	lParams.macSplatFile = "./Data/Scene/images/terrain1_splat.tga";
+	lParams.macMacroFile = "./Data/Scene/images/terrain1_macro.tga";
+	lParams.macStampFile = "./Data/Scene/images/terrain1.bake";
+	lParams.muiLayerSize = 512;
+	lParams.muiMapSize = 512;
+	lParams.mfFade = 0.05f;
+}
+
+unsigned cTerrainBaker::GetSourceHash( const sTerrainBakeParams& lParams, unsigned luiHeightsHash )
+{
+	unsigned luiHash = cFileUtils::Hash(&luiHeightsHash, sizeof(luiHeightsHash));
+	for ( unsigned luiLayer = 0; luiLayer < kuiTerrainLayers; ++luiLayer ) {
+		const sTerrainLayer& lLayer = lParams.maLayers[luiLayer];
+		float lafRule[7] = { lLayer.mafTint[0], lLayer.mafTint[1], lLayer.mafTint[2],
+							 lLayer.mfMinHeight, lLayer.mfMaxHeight, lLayer.mfMinSlope, lLayer.mfMaxSlope };
+		luiHash = cFileUtils::HashFileStamp(lLayer.macFile, luiHash);
+		luiHash = cFileUtils::Hash(lafRule, sizeof(lafRule), luiHash);
+	}
+	unsigned lauiSizes[2] = { lParams.muiLayerSize, lParams.muiMapSize };
+	luiHash = cFileUtils::Hash(lauiSizes, sizeof(lauiSizes), luiHash);
+	return cFileUtils::Hash(&lParams.mfFade, sizeof(lParams.mfFade), luiHash);
+}
+
+bool cTerrainBaker::IsStale( const sTerrainBakeParams& lParams, unsigned luiSourceHash )
+{
+	if ( !FileExists(lParams.macAtlasFile) || !FileExists(lParams.macSplatFile) || !FileExists(lParams.macMacroFile) ) return true;
+
+	FILE* lpFile = fopen(lParams.macStampFile.c_str(), "rb");
+	if ( !lpFile ) return true;
+	unsigned luiStamp = 0;
+	bool lbRead = (fread(&luiStamp, sizeof(luiStamp), 1, lpFile) == 1);
+	fclose(lpFile);
+	return !lbRead || luiStamp != luiSourceHash;
+}
+
+bool cTerrainBaker::Bake( const sTerrainBakeParams& lParams, const cTerrainData& lData, const cTerrainFile* lpFile, unsigned luiSourceHash )
+{
+	mParams = lParams;
+	LARGE_INTEGER lFrequency, lStart, lEnd;
+	QueryPerformanceFrequency(&lFrequency);
+	QueryPerformanceCounter(&lStart);
+
+	bool lbOk = LoadLayers() && BakeAtlas() && ReadHeights(lData, lpFile) && BakeMaps(lData);
+
+	// Only the textures stay
+	for ( unsigned luiLayer = 0; luiLayer < kuiTerrainLayers; ++luiLayer ) {
+		std::vector<unsigned char>().swap(macLayers[luiLayer]);
+	}
+	std::vector<float>().swap(mafHeights);
+	if ( !lbOk ) {
+		OutputDebugString("Terrain textures bake: FAILED\n");
+		return false;
+	}
+
+	FILE* lpStamp = fopen(mParams.macStampFile.c_str(), "wb");
+	if ( !lpStamp ) return false;
+	fwrite(&luiSourceHash, sizeof(luiSourceHash), 1, lpStamp);
+	fclose(lpStamp);
+
+	QueryPerformanceCounter(&lEnd);
+	char lacBuffer[128];
+	sprintf(lacBuffer, "Terrain textures baked in %.1f ms\n", 1000.0 * (double)(lEnd.QuadPart - lStart.QuadPart) / (double)lFrequency.QuadPart);
+	OutputDebugString(lacBuffer);
+	return true;
+}
+
+// The images are resized to the cell of the atlas with a bilinear filter that wraps,
+// the layers tile over the terrain
+bool cTerrainBaker::LoadLayers()
+{
+	unsigned luiCell = mParams.muiLayerSize;
+	for ( unsigned luiLayer = 0; luiLayer < kuiTerrainLayers; ++luiLayer ) {
+		const sTerrainLayer& lLayer = mParams.maLayers[luiLayer];
+		int liWidth, liHeight, liChannels;
+		unsigned char* lpacImage = SOIL_load_image(lLayer.macFile.c_str(), &liWidth, &liHeight, &liChannels, SOIL_LOAD_RGB);
+		if ( !lpacImage ) {
+			OutputDebugString("Terrain layer load: FAILED ");
+			OutputDebugString(lLayer.macFile.c_str());
+			OutputDebugString("\n");
+			return false;
+		}
+
+		std::vector<unsigned char>& lacLayer = macLayers[luiLayer];
+		lacLayer.resize(luiCell * luiCell * 3);
+		double ladSum[3] = { 0.0, 0.0, 0.0 };
+		for ( unsigned luiY = 0; luiY < luiCell; ++luiY ) {
+			float lfY = (luiY + 0.5f) * liHeight / luiCell - 0.5f;
+			int liY0 = (int)floorf(lfY);
+			float lfFy = lfY - liY0;
+			unsigned luiRow0 = (unsigned)((liY0 + liHeight) % liHeight);
+			unsigned luiRow1 = (unsigned)((liY0 + 1 + liHeight) % liHeight);
+			for ( unsigned luiX = 0; luiX < luiCell; ++luiX ) {
+				float lfX = (luiX + 0.5f) * liWidth / luiCell - 0.5f;
+				int liX0 = (int)floorf(lfX);
+				float lfFx = lfX - liX0;
+				unsigned luiCol0 = (unsigned)((liX0 + liWidth) % liWidth);
+				unsigned luiCol1 = (unsigned)((liX0 + 1 + liWidth) % liWidth);
+				for ( unsigned luiChannel = 0; luiChannel < 3; ++luiChannel ) {
+					float lf00 = lpacImage[(luiRow0 * liWidth + luiCol0) * 3 + luiChannel];
+					float lf10 = lpacImage[(luiRow0 * liWidth + luiCol1) * 3 + luiChannel];
+					float lf01 = lpacImage[(luiRow1 * liWidth + luiCol0) * 3 + luiChannel];
+					float lf11 = lpacImage[(luiRow1 * liWidth + luiCol1) * 3 + luiChannel];
+					float lfTop = lf00 + (lf10 - lf00) * lfFx;
+					float lfBottom = lf01 + (lf11 - lf01) * lfFx;
+					float lfValue = (lfTop + (lfBottom - lfTop) * lfFy) * lLayer.mafTint[luiChannel] / 255.0f;
+					unsigned char lucValue = ToByte(lfValue);
+					lacLayer[(luiY * luiCell + luiX) * 3 + luiChannel] = lucValue;
+					ladSum[luiChannel] += lucValue;
+				}
+			}
+		}
+		SOIL_free_image_data(lpacImage);
+
+		for ( unsigned luiChannel = 0; luiChannel < 3; ++luiChannel ) {
+			mafMeanColour[luiLayer][luiChannel] = (float)(ladSum[luiChannel] / (255.0 * luiCell * luiCell));
+		}
+	}
+	return true;
+}
+
+// Layer i goes to the cell (i % 2, i / 2)
+bool cTerrainBaker::BakeAtlas()
+{
+	unsigned luiCell = mParams.muiLayerSize;
+	unsigned luiSize = luiCell * 2;
+	std::vector<unsigned char> lacAtlas(luiSize * luiSize * 3);
+	for ( unsigned luiLayer = 0; luiLayer < kuiTerrainLayers; ++luiLayer ) {
+		unsigned luiFirstX = (luiLayer % 2) * luiCell;
+		unsigned luiFirstY = (luiLayer / 2) * luiCell;
+		for ( unsigned luiY = 0; luiY < luiCell; ++luiY ) {
+			memcpy(&lacAtlas[((luiFirstY + luiY) * luiSize + luiFirstX) * 3], &macLayers[luiLayer][luiY * luiCell * 3], luiCell * 3);
+		}
+	}
+	return SOIL_save_image(mParams.macAtlasFile.c_str(), SOIL_SAVE_TYPE_TGA, luiSize, luiSize, 3, &lacAtlas[0]) != 0;
+}
+
+bool cTerrainBaker::ReadHeights( const cTerrainData& lData, const cTerrainFile* lpFile )
+{
+	if ( !lData.HasSamples() && (!lpFile || !lpFile->IsOpen()) ) return false;
+
+	muiSize = lData.GetSize();
+	mafHeights.resize(muiSize * muiSize);
+	unsigned luiQuads = lData.GetTileQuads();
+	unsigned luiSide = luiQuads + 1;
+	for ( unsigned luiTile = 0; luiTile < lData.GetTileCount(); ++luiTile ) {
+		void* lpView = NULL;
+		const void* lpSamples = lData.HasSamples() ? lData.GetTileSamples(luiTile) : lpFile->MapTile(luiTile, &lpView);
+		if ( !lpSamples ) return false;
+
+		unsigned luiFirstX = (luiTile % lData.GetTilesPerSide()) * luiQuads;
+		unsigned luiFirstZ = (luiTile / lData.GetTilesPerSide()) * luiQuads;
+		for ( unsigned luiZ = 0; luiZ < luiSide; ++luiZ ) {
+			float* lpafRow = &mafHeights[(luiFirstZ + luiZ) * muiSize + luiFirstX];
+			if ( lData.GetFormat() == eTerrainFormat_Float ) {
+				const float* lpafSamples = (const float*)lpSamples + luiZ * luiSide;
+				for ( unsigned luiX = 0; luiX < luiSide; ++luiX ) lpafRow[luiX] = lpafSamples[luiX];
+			} else {
+				const short* lpaiSamples = (const short*)lpSamples + luiZ * luiSide;
+				for ( unsigned luiX = 0; luiX < luiSide; ++luiX ) lpafRow[luiX] = lpaiSamples[luiX];
+			}
+		}
+		if ( lpView ) cTerrainFile::UnmapTile(lpView);
+	}
+
+	mfMinHeight = mfMaxHeight = mafHeights[0];
+	for ( unsigned luiSample = 1; luiSample < mafHeights.size(); ++luiSample ) {
+		if ( mafHeights[luiSample] < mfMinHeight ) mfMinHeight = mafHeights[luiSample];
+		if ( mafHeights[luiSample] > mfMaxHeight ) mfMaxHeight = mafHeights[luiSample];
+	}
+	return true;
+}
+
+float cTerrainBaker::SampleHeight( float lfX, float lfZ ) const
+{
+	float lfLimit = (float)(muiSize - 1);
+	lfX = (lfX < 0.0f) ? 0.0f : ((lfX > lfLimit) ? lfLimit : lfX);
+	lfZ = (lfZ < 0.0f) ? 0.0f : ((lfZ > lfLimit) ? lfLimit : lfZ);
+	unsigned luiX = (unsigned)lfX;
+	unsigned luiZ = (unsigned)lfZ;
+	if ( luiX > muiSize - 2 ) luiX = muiSize - 2;
+	if ( luiZ > muiSize - 2 ) luiZ = muiSize - 2;
+	float lfFx = lfX - luiX;
+	float lfFz = lfZ - luiZ;
+	const float* lpafCell = &mafHeights[luiZ * muiSize + luiX];
+	float lfTop = lpafCell[0] + (lpafCell[1] - lpafCell[0]) * lfFx;
+	float lfBottom = lpafCell[muiSize] + (lpafCell[muiSize + 1] - lpafCell[muiSize]) * lfFx;
+	return lfTop + (lfBottom - lfTop) * lfFz;
+}
+
+void cTerrainBaker::GetWeights( float lfHeight, float lfSlope, float* lpafWeights ) const
+{
+	float lfTotal = 0.0f;
+	for ( unsigned luiLayer = 0; luiLayer < kuiTerrainLayers; ++luiLayer ) {
+		const sTerrainLayer& lLayer = mParams.maLayers[luiLayer];
+		lpafWeights[luiLayer] = Band(lfHeight, lLayer.mfMinHeight, lLayer.mfMaxHeight, mParams.mfFade) *
+								Band(lfSlope, lLayer.mfMinSlope, lLayer.mfMaxSlope, mParams.mfFade);
+		lfTotal += lpafWeights[luiLayer];
+	}
+	if ( lfTotal <= 0.0f ) {
+		lpafWeights[0] = lfTotal = 1.0f;
+	}
+	for ( unsigned luiLayer = 0; luiLayer < kuiTerrainLayers; ++luiLayer ) {
+		lpafWeights[luiLayer] /= lfTotal;
+	}
+}
+
+// Texel (i, j) covers the point ((i + 0.5) / size, (j + 0.5) / size) of the map, the
+// shader maps the world position to the same coordinates
+bool cTerrainBaker::BakeMaps( const cTerrainData& lData )
+{
+	unsigned luiMap = mParams.muiMapSize;
+	std::vector<unsigned char> lacSplat(luiMap * luiMap * 4);
+	std::vector<unsigned char> lacMacro(luiMap * luiMap * 3);
+
+	float lfGridScale = (float)(muiSize - 1) / luiMap;
+	float lfRange = mfMaxHeight - mfMinHeight;
+	float lfInvRange = (lfRange > 0.0f) ? 1.0f / lfRange : 0.0f;
+	// Slope of the raw heights in world units, over 2 samples
+	float lfSlopeScale = lData.GetHeightScale() / (2.0f * lData.GetSpacing());
+	for ( unsigned luiJ = 0; luiJ < luiMap; ++luiJ ) {
+		float lfZ = (luiJ + 0.5f) * lfGridScale;
+		for ( unsigned luiI = 0; luiI < luiMap; ++luiI ) {
+			float lfX = (luiI + 0.5f) * lfGridScale;
+			float lfHeight = (SampleHeight(lfX, lfZ) - mfMinHeight) * lfInvRange;
+			float lfDx = (SampleHeight(lfX + 1.0f, lfZ) - SampleHeight(lfX - 1.0f, lfZ)) * lfSlopeScale;
+			float lfDz = (SampleHeight(lfX, lfZ + 1.0f) - SampleHeight(lfX, lfZ - 1.0f)) * lfSlopeScale;
+			float lfSlope = 1.0f - 1.0f / sqrtf(lfDx * lfDx + lfDz * lfDz + 1.0f);
+
+			float lafWeights[kuiTerrainLayers];
+			GetWeights(lfHeight, lfSlope, lafWeights);
+			unsigned luiTexel = luiJ * luiMap + luiI;
+			float lafColour[3] = { 0.0f, 0.0f, 0.0f };
+			for ( unsigned luiLayer = 0; luiLayer < kuiTerrainLayers; ++luiLayer ) {
+				lacSplat[luiTexel * 4 + luiLayer] = ToByte(lafWeights[luiLayer]);
+				for ( unsigned luiChannel = 0; luiChannel < 3; ++luiChannel ) {
+					lafColour[luiChannel] += lafWeights[luiLayer] * mafMeanColour[luiLayer][luiChannel];
+				}
+			}
+			for ( unsigned luiChannel = 0; luiChannel < 3; ++luiChannel ) {
+				lacMacro[luiTexel * 3 + luiChannel] = ToByte(lafColour[luiChannel]);
+			}
+		}
+	}
+
+	if ( !SOIL_save_image(mParams.macSplatFile.c_str(), SOIL_SAVE_TYPE_TGA, luiMap, luiMap, 4, &lacSplat[0]) ) return false;
+	return SOIL_save_image(mParams.macMacroFile.c_str(), SOIL_SAVE_TYPE_TGA, luiMap, luiMap, 3, &lacMacro[0]) != 0;
+}
@@ -0,0 +1,79 @@
+// Offline bake of the textures of the terrain material. The 4 layer images are packed
+// in one atlas (2 x 2), a splat map keeps the weight of every layer in its channels (r, g,
+// b, a) from height and slope rules, and a low resolution macro texture keeps the colour
+// the layers give when they are blended, so the far tiles only need one texture fetch.
+// The textures are baked again when the heights or the layer images change.
+
+#ifndef TERRAIN_BAKER_H
+#define TERRAIN_BAKER_H
+
+#include <string>
+#include <vector>
+
+class cTerrainData;
+class cTerrainFile;
+
+static const unsigned kuiTerrainLayers = 4;
+
+// Where a layer is used. The height is normalised to the range of the terrain (0, 1),
+// the slope is 1 - normal.y (0 flat, 1 vertical)
+struct sTerrainLayer
+{
+	std::string macFile;
+	float mafTint[3];		// Multiplies the colour of the image
+	float mfMinHeight;
+	float mfMaxHeight;
+	float mfMinSlope;
+	float mfMaxSlope;
+};
+
+struct sTerrainBakeParams
+{
+	sTerrainLayer maLayers[kuiTerrainLayers];
+	std::string macAtlasFile;
+	std::string macSplatFile;
+	std::string macMacroFile;
+	std::string macStampFile;	// Hash of the sources of the last bake
+	unsigned muiLayerSize;		// Size of every layer inside the atlas (power of two)
+	unsigned muiMapSize;		// Size of the splat and macro maps (power of two)
+	float mfFade;				// Width of the transitions between the layers
+};
+
+class cTerrainBaker
+{
+public:
+	cTerrainBaker();
+
+	static void GetDefaultParams( sTerrainBakeParams& lParams );
+
+	// Hash of the layer images and of the heights (the source hash of the terrain file)
+	static unsigned GetSourceHash( const sTerrainBakeParams& lParams, unsigned luiHeightsHash );
+	// True if the textures are missing or were baked from other sources
+	static bool IsStale( const sTerrainBakeParams& lParams, unsigned luiSourceHash );
+
+	// Bakes the atlas, the splat map and the macro texture. The heights come from the
+	// terrain itself or, when it has no samples, from the tiles of lpFile
+	bool Bake( const sTerrainBakeParams& lParams, const cTerrainData& lData, const cTerrainFile* lpFile, unsigned luiSourceHash );
+
+private:
+	bool LoadLayers();
+	bool BakeAtlas();
+	bool ReadHeights( const cTerrainData& lData, const cTerrainFile* lpFile );
+	bool BakeMaps( const cTerrainData& lData );
+	// Weights of the layers at a point of the map, they add up to 1
+	void GetWeights( float lfHeight, float lfSlope, float* lpafWeights ) const;
+	// Raw height of the grid at a fractional position, bilinear
+	float SampleHeight( float lfX, float lfZ ) const;
+
+	sTerrainBakeParams mParams;
+	// RGB images of the layers resized to the size of the atlas cells, and their mean colours
+	std::vector<unsigned char> macLayers[kuiTerrainLayers];
+	float mafMeanColour[kuiTerrainLayers][3];
+	// Raw heights of the whole grid and their range
+	std::vector<float> mafHeights;
+	unsigned muiSize;
+	float mfMinHeight;
+	float mfMaxHeight;
+};
+
+#endif
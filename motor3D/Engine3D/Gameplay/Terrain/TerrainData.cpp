@@ -0,0 +1,204 @@
+#include "TerrainData.h"
+#include "..\..\Libraries\Bullet\include\btBulletCollisionCommon.h"
+#include "..\..\Libraries\Bullet\include\BulletCollision\CollisionShapes\btHeightfieldTerrainShape.h"
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+
+// Nearest 16 bits sample
+static inline short ToShort( float lfValue )
+{
+	float lfRounded = floorf(lfValue + 0.5f);
+	return (short)((lfRounded < -32768.0f) ? -32768.0f : ((lfRounded > 32767.0f) ? 32767.0f : lfRounded));
+}
+
+cTerrainData::cTerrainData()
+{
+	muiSize = 0;
+	muiTileQuads = 0;
+	muiTilesPerSide = 0;
+	meFormat = eTerrainFormat_Short;
+	mvOrigin = cVec3(0.0f, 0.0f, 0.0f);
+	mfSpacing = 1.0f;
+	mfHeightScale = 1.0f;
+}
+
+bool cTerrainData::SetLayout( unsigned luiSize, unsigned luiTileQuads, eTerrainFormat leFormat, const cVec3& lvOrigin, float lfSpacing, float lfHeightScale )
+{
+	Deinit();
+	if ( luiTileQuads == 0 || luiSize < 2 || (luiSize - 1) % luiTileQuads != 0 ) return false;
+
+	muiSize = luiSize;
+	muiTileQuads = luiTileQuads;
+	muiTilesPerSide = (luiSize - 1) / luiTileQuads;
+	meFormat = leFormat;
+	mvOrigin = lvOrigin;
+	mfSpacing = lfSpacing;
+	mfHeightScale = lfHeightScale;
+	mafTileMinMax.assign(GetTileCount() * 2, 0.0f);
+	return true;
+}
+
+bool cTerrainData::Init( unsigned luiSize, unsigned luiTileQuads, eTerrainFormat leFormat, const cVec3& lvOrigin, float lfSpacing, float lfHeightScale )
+{
+	if ( !SetLayout(luiSize, luiTileQuads, leFormat, lvOrigin, lfSpacing, lfHeightScale) ) return false;
+	macSamples.assign(GetTileCount() * GetTileBytes(), 0);
+	return true;
+}
+
+bool cTerrainData::Init( const cTerrainFile& lFile, const cVec3& lvOrigin )
+{
+	if ( !lFile.IsOpen() ) return false;
+	const sTerrainFileHeader& lHeader = lFile.GetHeader();
+	if ( !SetLayout(lHeader.muiSize, lHeader.muiTileQuads, lFile.GetFormat(), lvOrigin, lHeader.mfSpacing, lHeader.mfHeightScale) ) return false;
+
+	for ( unsigned luiTile = 0; luiTile < GetTileCount(); ++luiTile ) {
+		mafTileMinMax[luiTile * 2] = lFile.GetTile(luiTile).mfMin;
+		mafTileMinMax[luiTile * 2 + 1] = lFile.GetTile(luiTile).mfMax;
+	}
+	return true;
+}
+
+void cTerrainData::Deinit()
+{
+	// swap releases the memory, clear only empties the vectors
+	std::vector<char>().swap(macSamples);
+	std::vector<float>().swap(mafTileMinMax);
+	muiSize = 0;
+	muiTileQuads = 0;
+	muiTilesPerSide = 0;
+}
+
+const void* cTerrainData::GetTileSamples( unsigned luiTile ) const
+{
+	if ( !HasSamples() ) return NULL;
+	assert(luiTile < GetTileCount());
+	return &macSamples[luiTile * GetTileBytes()];
+}
+
+void* cTerrainData::GetTileSamples( unsigned luiTile )
+{
+	if ( !HasSamples() ) return NULL;
+	assert(luiTile < GetTileCount());
+	return &macSamples[luiTile * GetTileBytes()];
+}
+
+void cTerrainData::SetTileSamples( unsigned luiTile, const float* lpafValues )
+{
+	assert(HasSamples() && luiTile < GetTileCount() && lpafValues);
+	unsigned luiCount = (muiTileQuads + 1) * (muiTileQuads + 1);
+	if ( meFormat == eTerrainFormat_Float ) {
+		memcpy(GetTileSamples(luiTile), lpafValues, luiCount * sizeof(float));
+		return;
+	}
+	short* lpaiSamples = (short*)GetTileSamples(luiTile);
+	for ( unsigned luiSample = 0; luiSample < luiCount; ++luiSample ) {
+		lpaiSamples[luiSample] = ToShort(lpafValues[luiSample]);
+	}
+}
+
+unsigned cTerrainData::GetTileOffset( unsigned luiTile, unsigned luiX, unsigned luiZ ) const
+{
+	unsigned luiLocalX = luiX - (luiTile % muiTilesPerSide) * muiTileQuads;
+	unsigned luiLocalZ = luiZ - (luiTile / muiTilesPerSide) * muiTileQuads;
+	return luiTile * GetTileBytes() + (luiLocalZ * (muiTileQuads + 1) + luiLocalX) * GetSampleSize();
+}
+
+float cTerrainData::GetSample( unsigned luiX, unsigned luiZ ) const
+{
+	assert(HasSamples() && luiX < muiSize && luiZ < muiSize);
+	// The last row and column belong to the previous tile
+	unsigned luiTileX = (luiX == muiSize - 1) ? muiTilesPerSide - 1 : luiX / muiTileQuads;
+	unsigned luiTileZ = (luiZ == muiSize - 1) ? muiTilesPerSide - 1 : luiZ / muiTileQuads;
+	const char* lpSample = &macSamples[GetTileOffset(luiTileZ * muiTilesPerSide + luiTileX, luiX, luiZ)];
+	if ( meFormat == eTerrainFormat_Float ) return *(const float*)lpSample;
+	return *(const short*)lpSample;
+}
+
+void cTerrainData::SetSample( unsigned luiX, unsigned luiZ, float lfValue )
+{
+	assert(HasSamples() && luiX < muiSize && luiZ < muiSize);
+	// A sample on a tile edge is repeated in up to 4 tiles
+	unsigned lauiTilesX[2], lauiTilesZ[2];
+	unsigned luiCountX = 0, luiCountZ = 0;
+	if ( luiX < muiSize - 1 ) lauiTilesX[luiCountX++] = luiX / muiTileQuads;
+	if ( luiX > 0 && luiX % muiTileQuads == 0 ) lauiTilesX[luiCountX++] = luiX / muiTileQuads - 1;
+	if ( luiZ < muiSize - 1 ) lauiTilesZ[luiCountZ++] = luiZ / muiTileQuads;
+	if ( luiZ > 0 && luiZ % muiTileQuads == 0 ) lauiTilesZ[luiCountZ++] = luiZ / muiTileQuads - 1;
+
+	for ( unsigned luiIndexZ = 0; luiIndexZ < luiCountZ; ++luiIndexZ ) {
+		for ( unsigned luiIndexX = 0; luiIndexX < luiCountX; ++luiIndexX ) {
+			char* lpSample = &macSamples[GetTileOffset(lauiTilesZ[luiIndexZ] * muiTilesPerSide + lauiTilesX[luiIndexX], luiX, luiZ)];
+			if ( meFormat == eTerrainFormat_Float ) {
+				*(float*)lpSample = lfValue;
+			} else {
+				*(short*)lpSample = ToShort(lfValue);
+			}
+		}
+	}
+}
+
+void cTerrainData::UpdateBounds()
+{
+	assert(HasSamples());
+	unsigned luiCount = (muiTileQuads + 1) * (muiTileQuads + 1);
+	for ( unsigned luiTile = 0; luiTile < GetTileCount(); ++luiTile ) {
+		const void* lpSamples = GetTileSamples(luiTile);
+		float lfMin, lfMax;
+		if ( meFormat == eTerrainFormat_Float ) {
+			const float* lpafSamples = (const float*)lpSamples;
+			lfMin = lfMax = lpafSamples[0];
+			for ( unsigned luiSample = 1; luiSample < luiCount; ++luiSample ) {
+				if ( lpafSamples[luiSample] < lfMin ) lfMin = lpafSamples[luiSample];
+				if ( lpafSamples[luiSample] > lfMax ) lfMax = lpafSamples[luiSample];
+			}
+		} else {
+			const short* lpaiSamples = (const short*)lpSamples;
+			short liMin = lpaiSamples[0], liMax = lpaiSamples[0];
+			for ( unsigned luiSample = 1; luiSample < luiCount; ++luiSample ) {
+				if ( lpaiSamples[luiSample] < liMin ) liMin = lpaiSamples[luiSample];
+				if ( lpaiSamples[luiSample] > liMax ) liMax = lpaiSamples[luiSample];
+			}
+			lfMin = liMin;
+			lfMax = liMax;
+		}
+		mafTileMinMax[luiTile * 2] = lfMin;
+		mafTileMinMax[luiTile * 2 + 1] = lfMax;
+	}
+}
+
+void cTerrainData::GetBounds( cVec3& lvMin, cVec3& lvMax ) const
+{
+	assert(!mafTileMinMax.empty());
+	float lfMin = mafTileMinMax[0], lfMax = mafTileMinMax[1];
+	for ( unsigned luiTile = 1; luiTile < GetTileCount(); ++luiTile ) {
+		if ( GetTileMin(luiTile) < lfMin ) lfMin = GetTileMin(luiTile);
+		if ( GetTileMax(luiTile) > lfMax ) lfMax = GetTileMax(luiTile);
+	}
+	lvMin = GetPosition(0, 0, lfMin);
+	lvMax = GetPosition(muiSize - 1, muiSize - 1, lfMax);
+}
+
+cVec3 cTerrainData::GetPosition( unsigned luiX, unsigned luiZ, float lfValue ) const
+{
+	return cVec3(mvOrigin.x + luiX * mfSpacing, mvOrigin.y + lfValue * mfHeightScale, mvOrigin.z + luiZ * mfSpacing);
+}
+
+cVec3 cTerrainData::GetTileCenter( unsigned luiTile ) const
+{
+	float lfHalf = muiTileQuads * 0.5f;
+	return GetPosition((luiTile % muiTilesPerSide) * muiTileQuads, (luiTile / muiTilesPerSide) * muiTileQuads, (GetTileMin(luiTile) + GetTileMax(luiTile)) * 0.5f)
+		   + cVec3(lfHalf * mfSpacing, 0.0f, lfHalf * mfSpacing);
+}
+
+// Bullet only applies its height scale to integer samples, so the scale goes in the
+// local scaling and the shape works with raw values for both formats
+btHeightfieldTerrainShape* cTerrainData::CreateTileShape( unsigned luiTile, const void* lpSamples ) const
+{
+	assert(lpSamples && luiTile < GetTileCount());
+	PHY_ScalarType leType = (meFormat == eTerrainFormat_Float) ? PHY_FLOAT : PHY_SHORT;
+	btHeightfieldTerrainShape* lpShape = new btHeightfieldTerrainShape(muiTileQuads + 1, muiTileQuads + 1, (void*)lpSamples, 1.0f,
+																	   GetTileMin(luiTile), GetTileMax(luiTile), 1, leType, false);
+	lpShape->setLocalScaling(btVector3(mfSpacing, mfHeightScale, mfSpacing));
+	return lpShape;
+}
@@ -0,0 +1,80 @@
+// Heights of a terrain and its place in the world. The samples are kept in one buffer
+// of 16 bits or float values cut in tiles like the tiled file: every tile holds its own
+// (quads + 1)^2 samples, so the render tiles and the bullet shapes read a tile where it
+// is. A terrain streamed from a file only has the layout, its tiles are views of the file.
+// Both the render mesh and bullet place the samples with the transform of this class.
+
+#ifndef TERRAIN_DATA_H
+#define TERRAIN_DATA_H
+
+#include <vector>
+#include "../../MathLib/MathLib.h"
+#include "TerrainFile.h"
+
+class btHeightfieldTerrainShape;
+
+class cTerrainData
+{
+public:
+	cTerrainData();
+
+	// Terrain with its own samples, all of them 0. luiSize = 2^n + 1
+	bool Init( unsigned luiSize, unsigned luiTileQuads, eTerrainFormat leFormat, const cVec3& lvOrigin, float lfSpacing, float lfHeightScale );
+	// Terrain of a tiled file, the layout and the ranges of the tiles without samples
+	bool Init( const cTerrainFile& lFile, const cVec3& lvOrigin );
+	void Deinit();
+
+	// Own samples of a tile, NULL for a streamed terrain
+	inline bool HasSamples() const { return !macSamples.empty(); }
+	const void* GetTileSamples( unsigned luiTile ) const;
+	void* GetTileSamples( unsigned luiTile );
+	// Writes the (quads + 1)^2 samples of a tile, converted to the format of the terrain.
+	// Different tiles can be written from different threads
+	void SetTileSamples( unsigned luiTile, const float* lpafValues );
+	// Raw value of a sample of the grid. Setting it writes every tile that shares it,
+	// UpdateBounds must be called after the changes
+	float GetSample( unsigned luiX, unsigned luiZ ) const;
+	void SetSample( unsigned luiX, unsigned luiZ, float lfValue );
+	void UpdateBounds();
+
+	inline unsigned GetSize() const { return muiSize; }
+	inline unsigned GetTileQuads() const { return muiTileQuads; }
+	inline unsigned GetTilesPerSide() const { return muiTilesPerSide; }
+	inline unsigned GetTileCount() const { return muiTilesPerSide * muiTilesPerSide; }
+	inline eTerrainFormat GetFormat() const { return meFormat; }
+	inline unsigned GetSampleSize() const { return (meFormat == eTerrainFormat_Float) ? sizeof(float) : sizeof(short); }
+	inline unsigned GetTileBytes() const { return (muiTileQuads + 1) * (muiTileQuads + 1) * GetSampleSize(); }
+	inline const cVec3& GetOrigin() const { return mvOrigin; }
+	inline float GetSpacing() const { return mfSpacing; }
+	inline float GetHeightScale() const { return mfHeightScale; }
+	// Raw range of the samples of a tile, pairs (min, max) for every tile
+	inline float GetTileMin( unsigned luiTile ) const { return mafTileMinMax[luiTile * 2]; }
+	inline float GetTileMax( unsigned luiTile ) const { return mafTileMinMax[luiTile * 2 + 1]; }
+	inline const float* GetTileMinMax() const { return &mafTileMinMax[0]; }
+
+	// World box of the whole terrain, from the ranges of the tiles
+	void GetBounds( cVec3& lvMin, cVec3& lvMax ) const;
+	// World position of a sample of the grid with a raw value
+	cVec3 GetPosition( unsigned luiX, unsigned luiZ, float lfValue ) const;
+	// Where the body of a tile goes. Bullet centres the shape on its bounding box
+	cVec3 GetTileCenter( unsigned luiTile ) const;
+	// Heightfield shape that reads the samples of a tile in place, they must outlive it
+	btHeightfieldTerrainShape* CreateTileShape( unsigned luiTile, const void* lpSamples ) const;
+
+private:
+	// Position of a sample of the grid inside a tile
+	unsigned GetTileOffset( unsigned luiTile, unsigned luiX, unsigned luiZ ) const;
+	bool SetLayout( unsigned luiSize, unsigned luiTileQuads, eTerrainFormat leFormat, const cVec3& lvOrigin, float lfSpacing, float lfHeightScale );
+
+	std::vector<char> macSamples;
+	std::vector<float> mafTileMinMax;
+	unsigned muiSize;
+	unsigned muiTileQuads;
+	unsigned muiTilesPerSide;
+	eTerrainFormat meFormat;
+	cVec3 mvOrigin;
+	float mfSpacing;
+	float mfHeightScale;
+};
+
+#endif
@@ -0,0 +1,138 @@
+#include "TerrainFile.h"
+#include "TerrainData.h"
+#include "../../Utility/FileUtils.h"
+#include <assert.h>
+
+static const unsigned kuiTerrainFileMagic = 0x4C544648; // "HFTL"
+static const unsigned kuiTerrainFileVersion = 2;
+
+cTerrainFile::cTerrainFile()
+{
+	mhFile = INVALID_HANDLE_VALUE;
+	mhMapping = NULL;
+	muiTilesPerSide = 0;
+	memset(&mHeader, 0, sizeof(mHeader));
+
+	// Views must start on a multiple of the allocation granularity
+	SYSTEM_INFO lInfo;
+	GetSystemInfo(&lInfo);
+	muiGranularity = lInfo.dwAllocationGranularity;
+}
+
+bool cTerrainFile::Open( const std::string &lacFile )
+{
+	Close();
+	mhFile = CreateFileA(lacFile.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if ( mhFile == INVALID_HANDLE_VALUE ) return false;
+
+	DWORD luiFileSize = GetFileSize(mhFile, NULL);
+	mhMapping = CreateFileMappingA(mhFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	if ( !mhMapping || luiFileSize < sizeof(sTerrainFileHeader) ) {
+		Close();
+		return false;
+	}
+
+	// Header and tile table are copied, the samples stay in the file.
+	// Only that part is mapped, whole worlds may not fit the address space
+	if ( !ReadView(0, sizeof(sTerrainFileHeader), &mHeader) ) {
+		Close();
+		return false;
+	}
+	bool lbValid = mHeader.muiMagic == kuiTerrainFileMagic && mHeader.muiVersion == kuiTerrainFileVersion &&
+				   mHeader.muiTileQuads > 0 && mHeader.muiSize > 1 && (mHeader.muiSize - 1) % mHeader.muiTileQuads == 0 &&
+				   mHeader.muiFormat <= eTerrainFormat_Float;
+	if ( lbValid ) {
+		muiTilesPerSide = (mHeader.muiSize - 1) / mHeader.muiTileQuads;
+		unsigned luiTileCount = muiTilesPerSide * muiTilesPerSide;
+		unsigned luiTileBytes = GetTileBytes();
+		maTiles.resize(luiTileCount);
+		lbValid = sizeof(sTerrainFileHeader) + luiTileCount * sizeof(sTerrainFileTile) <= luiFileSize &&
+				  ReadView(sizeof(sTerrainFileHeader), luiTileCount * sizeof(sTerrainFileTile), &maTiles[0]);
+		for ( unsigned luiTile = 0; luiTile < luiTileCount && lbValid; ++luiTile ) {
+			lbValid = maTiles[luiTile].muiOffset + luiTileBytes <= luiFileSize;
+		}
+	}
+
+	if ( !lbValid ) {
+		OutputDebugString("Invalid tiled heightfield file!\n");
+		Close();
+		return false;
+	}
+	return true;
+}
+
+// Copies a range of the file through a temporary view
+bool cTerrainFile::ReadView( unsigned luiOffset, unsigned luiSize, void* lpDestination ) const
+{
+	unsigned luiStart = luiOffset - luiOffset % muiGranularity;
+	const char* lpView = (const char*)MapViewOfFile(mhMapping, FILE_MAP_READ, 0, luiStart, luiSize + (luiOffset - luiStart));
+	if ( !lpView ) return false;
+	memcpy(lpDestination, lpView + (luiOffset - luiStart), luiSize);
+	UnmapViewOfFile(lpView);
+	return true;
+}
+
+void cTerrainFile::Close()
+{
+	if ( mhMapping ) CloseHandle(mhMapping);
+	if ( mhFile != INVALID_HANDLE_VALUE ) CloseHandle(mhFile);
+	mhMapping = NULL;
+	mhFile = INVALID_HANDLE_VALUE;
+	maTiles.clear();
+	muiTilesPerSide = 0;
+}
+
+unsigned cTerrainFile::GetTileBytes() const
+{
+	unsigned luiSampleSize = (mHeader.muiFormat == eTerrainFormat_Float) ? sizeof(float) : sizeof(short);
+	return (mHeader.muiTileQuads + 1) * (mHeader.muiTileQuads + 1) * luiSampleSize;
+}
+
+const void* cTerrainFile::MapTile( unsigned luiTile, void** lppView ) const
+{
+	assert(IsOpen() && luiTile < maTiles.size() && lppView);
+	unsigned luiOffset = maTiles[luiTile].muiOffset;
+	unsigned luiStart = luiOffset - luiOffset % muiGranularity;
+	unsigned luiBytes = GetTileBytes() + (luiOffset - luiStart);
+
+	*lppView = MapViewOfFile(mhMapping, FILE_MAP_READ, 0, luiStart, luiBytes);
+	if ( !*lppView ) return NULL;
+	return (const char*)*lppView + (luiOffset - luiStart);
+}
+
+void cTerrainFile::UnmapTile( void* lpView )
+{
+	if ( lpView ) UnmapViewOfFile(lpView);
+}
+
+bool cTerrainFile::Write( const std::string &lacFile, const cTerrainData& lData, unsigned luiSourceHash )
+{
+	if ( !lData.HasSamples() ) return false;
+
+	unsigned luiTileCount = lData.GetTileCount();
+	unsigned luiTileBytes = lData.GetTileBytes();
+	unsigned luiDataOffset = sizeof(sTerrainFileHeader) + luiTileCount * sizeof(sTerrainFileTile);
+	std::vector<char> lacBuffer(luiDataOffset + luiTileCount * luiTileBytes);
+
+	sTerrainFileHeader* lpHeader = (sTerrainFileHeader*)&lacBuffer[0];
+	lpHeader->muiMagic = kuiTerrainFileMagic;
+	lpHeader->muiVersion = kuiTerrainFileVersion;
+	lpHeader->muiSourceHash = luiSourceHash;
+	lpHeader->muiSize = lData.GetSize();
+	lpHeader->muiTileQuads = lData.GetTileQuads();
+	lpHeader->mfSpacing = lData.GetSpacing();
+	lpHeader->mfHeightScale = lData.GetHeightScale();
+	lpHeader->muiFormat = lData.GetFormat();
+
+	// The samples are stored in the file the same way the terrain keeps them
+	sTerrainFileTile* lpTiles = (sTerrainFileTile*)&lacBuffer[sizeof(sTerrainFileHeader)];
+	for ( unsigned luiTile = 0; luiTile < luiTileCount; ++luiTile ) {
+		unsigned luiOffset = luiDataOffset + luiTile * luiTileBytes;
+		memcpy(&lacBuffer[luiOffset], lData.GetTileSamples(luiTile), luiTileBytes);
+		lpTiles[luiTile].mfMin = lData.GetTileMin(luiTile);
+		lpTiles[luiTile].mfMax = lData.GetTileMax(luiTile);
+		lpTiles[luiTile].muiOffset = luiOffset;
+	}
+
+	return cFileUtils::WriteFile(lacFile, &lacBuffer[0], lacBuffer.size());
+}
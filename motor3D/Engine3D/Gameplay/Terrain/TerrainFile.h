@@ -0,0 +1,79 @@
+// Tiled heightfield file (.hft). The map is stored tile by tile as 16 bits or float
+// samples, so a tile can be paged in with a small view of the memory mapped file.
+//
+//   sTerrainFileHeader
+//   sTerrainFileTile [tiles per side ^ 2]
+//   short or float [(quads + 1) ^ 2] for every tile, the samples of the shared edges are repeated
+
+#ifndef TERRAIN_FILE_H
+#define TERRAIN_FILE_H
+
+#include <windows.h>
+#include <string>
+#include <vector>
+
+class cTerrainData;
+
+// Format of the samples, bullet reads both of them (PHY_SHORT and PHY_FLOAT)
+enum eTerrainFormat
+{
+	eTerrainFormat_Short = 0,
+	eTerrainFormat_Float
+};
+
+struct sTerrainFileHeader
+{
+	unsigned muiMagic;
+	unsigned muiVersion;
+	unsigned muiSourceHash;		// Stamp of the file it was cooked from
+	unsigned muiSize;			// Samples per side of the whole map (2^n + 1)
+	unsigned muiTileQuads;		// Quads per side of a tile
+	float mfSpacing;			// Distance between samples
+	float mfHeightScale;		// Height of a sample = value * scale
+	unsigned muiFormat;			// eTerrainFormat
+};
+
+struct sTerrainFileTile
+{
+	float mfMin;				// Range of the samples of the tile
+	float mfMax;
+	unsigned muiOffset;			// Offset of the samples in the file
+};
+
+class cTerrainFile
+{
+public:
+	cTerrainFile();
+	~cTerrainFile() { Close(); }
+
+	bool Open( const std::string &lacFile );
+	void Close();
+	inline bool IsOpen() const { return mhMapping != NULL; }
+
+	// Maps a view of the file with the samples of a tile. The pointer is valid until
+	// the view is unmapped. It can be called from any thread
+	const void* MapTile( unsigned luiTile, void** lppView ) const;
+	static void UnmapTile( void* lpView );
+
+	inline const sTerrainFileHeader& GetHeader() const { return mHeader; }
+	inline unsigned GetTilesPerSide() const { return muiTilesPerSide; }
+	inline unsigned GetTileCount() const { return (unsigned)maTiles.size(); }
+	inline const sTerrainFileTile& GetTile( unsigned luiTile ) const { return maTiles[luiTile]; }
+	inline eTerrainFormat GetFormat() const { return (eTerrainFormat)mHeader.muiFormat; }
+	unsigned GetTileBytes() const;
+
+	// Writes the samples of a terrain, it is already cut in tiles
+	static bool Write( const std::string &lacFile, const cTerrainData& lData, unsigned luiSourceHash = 0 );
+
+private:
+	bool ReadView( unsigned luiOffset, unsigned luiSize, void* lpDestination ) const;
+
+	HANDLE mhFile;
+	HANDLE mhMapping;
+	sTerrainFileHeader mHeader;
+	std::vector<sTerrainFileTile> maTiles;
+	unsigned muiTilesPerSide;
+	unsigned muiGranularity;
+};
+
+#endif
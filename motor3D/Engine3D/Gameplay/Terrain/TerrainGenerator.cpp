@@ -0,0 +1,450 @@
+#include "TerrainGenerator.h"
+#include "TerrainData.h"
+#include "../../Utility/ThreadPool.h"
+#include "../../Utility/Benchmark.h"
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include <xmmintrin.h>
+#include <emmintrin.h>
+
+// Constants of the kernels
+static const float kfTwoPi = 6.28318530718f;
+static const float kfHalfPi = 1.57079632679f;
+static const unsigned kuiOctaveSeedStep = 0x9E3779B9;
+
+// Integer hash made of adds, xors and shifts (Robert Jenkins), so SSE2 can run it on 4 values
+static inline unsigned HashValue( unsigned luiValue )
+{
+	luiValue = (luiValue + 0x7ed55d16) + (luiValue << 12);
+	luiValue = (luiValue ^ 0xc761c23c) ^ (luiValue >> 19);
+	luiValue = (luiValue + 0x165667b1) + (luiValue << 5);
+	luiValue = (luiValue + 0xd3a2646c) ^ (luiValue << 9);
+	luiValue = (luiValue + 0xfd7046c5) + (luiValue << 3);
+	luiValue = (luiValue ^ 0xb55a4f09) ^ (luiValue >> 16);
+	return luiValue;
+}
+
+static inline __m128i HashValue4( __m128i lValue )
+{
+	lValue = _mm_add_epi32(_mm_add_epi32(lValue, _mm_set1_epi32(0x7ed55d16)), _mm_slli_epi32(lValue, 12));
+	lValue = _mm_xor_si128(_mm_xor_si128(lValue, _mm_set1_epi32((int)0xc761c23c)), _mm_srli_epi32(lValue, 19));
+	lValue = _mm_add_epi32(_mm_add_epi32(lValue, _mm_set1_epi32(0x165667b1)), _mm_slli_epi32(lValue, 5));
+	lValue = _mm_xor_si128(_mm_add_epi32(lValue, _mm_set1_epi32((int)0xd3a2646c)), _mm_slli_epi32(lValue, 9));
+	lValue = _mm_add_epi32(_mm_add_epi32(lValue, _mm_set1_epi32((int)0xfd7046c5)), _mm_slli_epi32(lValue, 3));
+	lValue = _mm_xor_si128(_mm_xor_si128(lValue, _mm_set1_epi32((int)0xb55a4f09)), _mm_srli_epi32(lValue, 16));
+	return lValue;
+}
+
+// Low 16 bits of a hash as a value in [-1, 1]
+static inline float HashToSigned( unsigned luiHash )
+{
+	return (float)(luiHash & 0xFFFF) * (2.0f / 65535.0f) - 1.0f;
+}
+
+static inline __m128 HashToSigned4( __m128i lHash )
+{
+	__m128 lValue = _mm_cvtepi32_ps(_mm_and_si128(lHash, _mm_set1_epi32(0xFFFF)));
+	return _mm_sub_ps(_mm_mul_ps(lValue, _mm_set1_ps(2.0f / 65535.0f)), _mm_set1_ps(1.0f));
+}
+
+// Random value of a sample of the map
+static inline float PointNoise( unsigned luiX, unsigned luiZ, unsigned luiSeed )
+{
+	return HashToSigned(HashValue(luiX + HashValue(luiZ ^ luiSeed)));
+}
+
+// Sine of 4 values: reduced to [-pi/2, pi/2] and a polynomial of 9th degree (error < 4e-6)
+static inline __m128 Sin4( __m128 lAngle )
+{
+	__m128 lTurns = _mm_cvtepi32_ps(_mm_cvtps_epi32(_mm_mul_ps(lAngle, _mm_set1_ps(1.0f / kfTwoPi))));
+	__m128 lX = _mm_sub_ps(lAngle, _mm_mul_ps(lTurns, _mm_set1_ps(kfTwoPi)));
+	// sin(x) = sin(pi - x) = sin(-pi - x)
+	__m128 lHigh = _mm_cmpgt_ps(lX, _mm_set1_ps(kfHalfPi));
+	__m128 lLow = _mm_cmplt_ps(lX, _mm_set1_ps(-kfHalfPi));
+	__m128 lMirror = _mm_or_ps(_mm_and_ps(lHigh, _mm_set1_ps(kfTwoPi * 0.5f)), _mm_and_ps(lLow, _mm_set1_ps(-kfTwoPi * 0.5f)));
+	__m128 lFolded = _mm_sub_ps(lMirror, lX);
+	__m128 lFold = _mm_or_ps(lHigh, lLow);
+	lX = _mm_or_ps(_mm_and_ps(lFold, lFolded), _mm_andnot_ps(lFold, lX));
+
+	__m128 lX2 = _mm_mul_ps(lX, lX);
+	__m128 lPoly = _mm_set1_ps(1.0f / 362880.0f);
+	lPoly = _mm_add_ps(_mm_mul_ps(lPoly, lX2), _mm_set1_ps(-1.0f / 5040.0f));
+	lPoly = _mm_add_ps(_mm_mul_ps(lPoly, lX2), _mm_set1_ps(1.0f / 120.0f));
+	lPoly = _mm_add_ps(_mm_mul_ps(lPoly, lX2), _mm_set1_ps(-1.0f / 6.0f));
+	lPoly = _mm_add_ps(_mm_mul_ps(lPoly, lX2), _mm_set1_ps(1.0f));
+	return _mm_mul_ps(lPoly, lX);
+}
+
+// Stores the first luiCount lanes (all of them when there are 4 or more)
+static inline void StoreLanes( float* lpafOut, __m128 lValue, unsigned luiCount )
+{
+	if ( luiCount >= 4 ) {
+		_mm_storeu_ps(lpafOut, lValue);
+		return;
+	}
+	float lafLanes[4];
+	_mm_storeu_ps(lafLanes, lValue);
+	for ( unsigned luiLane = 0; luiLane < luiCount; ++luiLane ) lpafOut[luiLane] = lafLanes[luiLane];
+}
+
+// PointNoise of luiCount samples of a row. The last group goes through SSE too, so a
+// sample gets the same value whatever its position in the row
+static void NoiseRow( unsigned luiFirstX, unsigned luiZ, unsigned luiSeed, unsigned luiCount, float* lpafOut )
+{
+	const __m128i lLanes = _mm_set_epi32(3, 2, 1, 0);
+	const __m128i lRowHash = _mm_set1_epi32((int)HashValue(luiZ ^ luiSeed));
+	for ( unsigned luiIndex = 0; luiIndex < luiCount; luiIndex += 4 ) {
+		__m128i lX = _mm_add_epi32(_mm_set1_epi32((int)(luiFirstX + luiIndex)), lLanes);
+		StoreLanes(lpafOut + luiIndex, HashToSigned4(HashValue4(_mm_add_epi32(lX, lRowHash))), luiCount - luiIndex);
+	}
+}
+
+// Parameters of a parallel generation
+struct sGenerateJob
+{
+	const cTerrainGenerator* mpGenerator;
+	cTerrainData* mpData;
+};
+
+cTerrainGenerator::cTerrainGenerator()
+{
+	GetDefaultParams(eTerrainGenerator_Noise, mParams);
+	muiSize = 0;
+	muiTileQuads = 0;
+	muiTilesPerSide = 0;
+	mfSpacing = 1.0f;
+	mfHeightScale = 1.0f;
+	mbInit = false;
+}
+
+void cTerrainGenerator::GetDefaultParams( eTerrainGeneratorModel leModel, sTerrainGeneratorParams& lParams )
+{
+	lParams.meModel = leModel;
+	lParams.muiSeed = 1;
+	lParams.mfAmplitude = 64.0f;
+	lParams.mfRoughness = 0.5f;
+	lParams.mfFrequency = 1.0f / 256.0f;
+	lParams.muiOctaves = 6;
+	lParams.mfPhase = 0.0f;
+	// Same waves as the bullet demo with a spacing of 5
+	if ( leModel == eTerrainGenerator_Radial ) lParams.mfAmplitude = 11.18f;
+}
+
+bool cTerrainGenerator::Init( const sTerrainGeneratorParams& lParams, const cTerrainData& lLayout )
+{
+	mbInit = false;
+	unsigned luiQuads = lLayout.GetTileQuads();
+	// Diamond square needs power of two tiles, which is always the case in a 2^n + 1 map
+	if ( lLayout.GetSize() < 2 || (luiQuads & (luiQuads - 1)) != 0 ) return false;
+
+	mParams = lParams;
+	muiSize = lLayout.GetSize();
+	muiTileQuads = luiQuads;
+	muiTilesPerSide = lLayout.GetTilesPerSide();
+	mfSpacing = lLayout.GetSpacing();
+	mfHeightScale = lLayout.GetHeightScale();
+
+	if ( mParams.meModel == eTerrainGenerator_DiamondSquare ) {
+		// Raw displacement of the points created by a step of 2^n samples
+		unsigned luiLevels = 0;
+		while ( (1u << luiLevels) < muiSize - 1 ) ++luiLevels;
+		mafStepScale.resize(luiLevels + 1);
+		float lfScale = mParams.mfAmplitude / mfHeightScale;
+		for ( int liLevel = (int)luiLevels; liLevel >= 0; --liLevel ) {
+			mafStepScale[liLevel] = lfScale;
+			lfScale *= mParams.mfRoughness;
+		}
+		BuildCoarseGrid();
+	}
+	mbInit = true;
+	return true;
+}
+
+void cTerrainGenerator::BuildCoarseGrid()
+{
+	unsigned luiSide = muiTilesPerSide + 1;
+	unsigned luiSeed = mParams.muiSeed;
+	mafCoarse.assign(luiSide * luiSide, 0.0f);
+	float* lpafGrid = &mafCoarse[0];
+
+	float lfCornerScale = mafStepScale.back();
+	for ( unsigned luiCorner = 0; luiCorner < 4; ++luiCorner ) {
+		unsigned luiX = (luiCorner & 1) * muiTilesPerSide;
+		unsigned luiZ = (luiCorner >> 1) * muiTilesPerSide;
+		lpafGrid[luiZ * luiSide + luiX] = PointNoise(luiX * muiTileQuads, luiZ * muiTileQuads, luiSeed) * lfCornerScale;
+	}
+
+	unsigned luiLevel = (unsigned)mafStepScale.size() - 1;
+	for ( unsigned luiStep = muiTilesPerSide; luiStep > 1; luiStep /= 2, --luiLevel ) {
+		unsigned luiHalf = luiStep / 2;
+		float lfScale = mafStepScale[luiLevel];
+
+		// Square: centres of the squares
+		for ( unsigned luiZ = luiHalf; luiZ < luiSide; luiZ += luiStep ) {
+			for ( unsigned luiX = luiHalf; luiX < luiSide; luiX += luiStep ) {
+				float lfAverage = (lpafGrid[(luiZ - luiHalf) * luiSide + luiX - luiHalf] + lpafGrid[(luiZ - luiHalf) * luiSide + luiX + luiHalf] +
+								   lpafGrid[(luiZ + luiHalf) * luiSide + luiX - luiHalf] + lpafGrid[(luiZ + luiHalf) * luiSide + luiX + luiHalf]) * 0.25f;
+				lpafGrid[luiZ * luiSide + luiX] = lfAverage + PointNoise(luiX * muiTileQuads, luiZ * muiTileQuads, luiSeed) * lfScale;
+			}
+		}
+
+		// Diamond: middle of the edges, with 3 neighbours on the border of the map
+		for ( unsigned luiZ = 0; luiZ < luiSide; luiZ += luiHalf ) {
+			for ( unsigned luiX = ((luiZ / luiHalf) % 2 == 0) ? luiHalf : 0; luiX < luiSide; luiX += luiStep ) {
+				float lfSum = 0.0f;
+				unsigned luiCount = 0;
+				if ( luiX >= luiHalf ) { lfSum += lpafGrid[luiZ * luiSide + luiX - luiHalf]; ++luiCount; }
+				if ( luiX + luiHalf < luiSide ) { lfSum += lpafGrid[luiZ * luiSide + luiX + luiHalf]; ++luiCount; }
+				if ( luiZ >= luiHalf ) { lfSum += lpafGrid[(luiZ - luiHalf) * luiSide + luiX]; ++luiCount; }
+				if ( luiZ + luiHalf < luiSide ) { lfSum += lpafGrid[(luiZ + luiHalf) * luiSide + luiX]; ++luiCount; }
+				lpafGrid[luiZ * luiSide + luiX] = lfSum / luiCount + PointNoise(luiX * muiTileQuads, luiZ * muiTileQuads, luiSeed) * lfScale;
+			}
+		}
+	}
+}
+
+void cTerrainGenerator::GenerateTile( unsigned luiTile, float* lpafSamples ) const
+{
+	assert(mbInit && lpafSamples && luiTile < muiTilesPerSide * muiTilesPerSide);
+	unsigned luiFirstX = (luiTile % muiTilesPerSide) * muiTileQuads;
+	unsigned luiFirstZ = (luiTile / muiTilesPerSide) * muiTileQuads;
+	switch ( mParams.meModel ) {
+	case eTerrainGenerator_Radial:
+		GenerateRadial(luiFirstX, luiFirstZ, lpafSamples);
+		break;
+	case eTerrainGenerator_DiamondSquare:
+		GenerateDiamondSquare(luiTile, luiFirstX, luiFirstZ, lpafSamples);
+		break;
+	default:
+		GenerateNoise(luiFirstX, luiFirstZ, lpafSamples);
+		break;
+	}
+}
+
+// Waves of the old bullet demo: sin(period * r + phase) / r clamped, around the centre
+void cTerrainGenerator::GenerateRadial( unsigned luiFirstX, unsigned luiFirstZ, float* lpafSamples ) const
+{
+	unsigned luiSide = muiTileQuads + 1;
+	float lfPeriod = 0.5f / mfSpacing;
+	float lfMinRadius = 3.0f * sqrtf(mfSpacing);
+	// With phase 0 the waves start at their highest point
+	float lfPhase = mParams.mfPhase + kfHalfPi - lfPeriod * lfMinRadius;
+	float lfCentre = 0.5f * (muiSize - 1) * mfSpacing;
+
+	const __m128 lLanes = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+	const __m128 lSpacing = _mm_set1_ps(mfSpacing);
+	const __m128 lCentre = _mm_set1_ps(lfCentre);
+	const __m128 lMinRadius = _mm_set1_ps(lfMinRadius);
+	const __m128 lPeriod = _mm_set1_ps(lfPeriod);
+	const __m128 lPhase = _mm_set1_ps(lfPhase);
+	const __m128 lOne = _mm_set1_ps(1.0f);
+	const __m128 lMinusOne = _mm_set1_ps(-1.0f);
+	const __m128 lScale = _mm_set1_ps(mParams.mfAmplitude / mfHeightScale);
+
+	for ( unsigned luiZ = 0; luiZ < luiSide; ++luiZ ) {
+		__m128 lDz = _mm_sub_ps(_mm_set1_ps((float)(luiFirstZ + luiZ) * mfSpacing), lCentre);
+		__m128 lDz2 = _mm_mul_ps(lDz, lDz);
+		for ( unsigned luiX = 0; luiX < luiSide; luiX += 4 ) {
+			__m128 lDx = _mm_sub_ps(_mm_mul_ps(_mm_add_ps(_mm_set1_ps((float)(luiFirstX + luiX)), lLanes), lSpacing), lCentre);
+			__m128 lRadius = _mm_max_ps(_mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(lDx, lDx), lDz2)), lMinRadius);
+			__m128 lWave = _mm_div_ps(Sin4(_mm_add_ps(_mm_mul_ps(lRadius, lPeriod), lPhase)), _mm_mul_ps(lRadius, lPeriod));
+			lWave = _mm_min_ps(_mm_max_ps(lWave, lMinusOne), lOne);
+			StoreLanes(lpafSamples + luiZ * luiSide + luiX, _mm_mul_ps(lWave, lScale), luiSide - luiX);
+		}
+	}
+}
+
+// fBm of value noise. The lattice values are hashes of their coordinates, so there is no
+// table to gather from and the 4 lanes run the whole octave in SSE registers
+void cTerrainGenerator::GenerateNoise( unsigned luiFirstX, unsigned luiFirstZ, float* lpafSamples ) const
+{
+	unsigned luiSide = muiTileQuads + 1;
+	float lfAmplitudeSum = 0.0f;
+	float lfAmplitude = 1.0f;
+	for ( unsigned luiOctave = 0; luiOctave < mParams.muiOctaves; ++luiOctave ) {
+		lfAmplitudeSum += lfAmplitude;
+		lfAmplitude *= mParams.mfRoughness;
+	}
+	float lfScale = (lfAmplitudeSum > 0.0f) ? mParams.mfAmplitude / (lfAmplitudeSum * mfHeightScale) : 0.0f;
+
+	const __m128 lLanes = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+	const __m128 lThree = _mm_set1_ps(3.0f);
+	const __m128 lTwo = _mm_set1_ps(2.0f);
+	const __m128i lOneInt = _mm_set1_epi32(1);
+
+	for ( unsigned luiZ = 0; luiZ < luiSide; ++luiZ ) {
+		float lfZ = (float)(luiFirstZ + luiZ);
+		for ( unsigned luiX = 0; luiX < luiSide; luiX += 4 ) {
+			__m128 lX = _mm_add_ps(_mm_set1_ps((float)(luiFirstX + luiX)), lLanes);
+			__m128 lSum = _mm_setzero_ps();
+			float lfOctaveAmplitude = 1.0f;
+			float lfFrequency = mParams.mfFrequency;
+			unsigned luiSeed = mParams.muiSeed;
+			for ( unsigned luiOctave = 0; luiOctave < mParams.muiOctaves; ++luiOctave ) {
+				// Row of the lattice, the same for the 4 lanes
+				float lfGridZ = lfZ * lfFrequency;
+				unsigned luiCellZ = (unsigned)lfGridZ;
+				float lfFz = lfGridZ - (float)luiCellZ;
+				__m128 lUz = _mm_set1_ps(lfFz * lfFz * (3.0f - 2.0f * lfFz));
+				__m128i lRow0 = _mm_set1_epi32((int)HashValue(luiCellZ ^ luiSeed));
+				__m128i lRow1 = _mm_set1_epi32((int)HashValue((luiCellZ + 1) ^ luiSeed));
+
+				// Columns of the lattice, the positions are never negative so truncating is floor
+				__m128 lGridX = _mm_mul_ps(lX, _mm_set1_ps(lfFrequency));
+				__m128i lCellX = _mm_cvttps_epi32(lGridX);
+				__m128 lFx = _mm_sub_ps(lGridX, _mm_cvtepi32_ps(lCellX));
+				__m128 lUx = _mm_mul_ps(_mm_mul_ps(lFx, lFx), _mm_sub_ps(lThree, _mm_mul_ps(lTwo, lFx)));
+				__m128i lCellX1 = _mm_add_epi32(lCellX, lOneInt);
+
+				__m128 lV00 = HashToSigned4(HashValue4(_mm_add_epi32(lCellX, lRow0)));
+				__m128 lV10 = HashToSigned4(HashValue4(_mm_add_epi32(lCellX1, lRow0)));
+				__m128 lV01 = HashToSigned4(HashValue4(_mm_add_epi32(lCellX, lRow1)));
+				__m128 lV11 = HashToSigned4(HashValue4(_mm_add_epi32(lCellX1, lRow1)));
+				__m128 lTop = _mm_add_ps(lV00, _mm_mul_ps(_mm_sub_ps(lV10, lV00), lUx));
+				__m128 lBottom = _mm_add_ps(lV01, _mm_mul_ps(_mm_sub_ps(lV11, lV01), lUx));
+				__m128 lValue = _mm_add_ps(lTop, _mm_mul_ps(_mm_sub_ps(lBottom, lTop), lUz));
+
+				lSum = _mm_add_ps(lSum, _mm_mul_ps(lValue, _mm_set1_ps(lfOctaveAmplitude)));
+				lfOctaveAmplitude *= mParams.mfRoughness;
+				lfFrequency *= 2.0f;
+				luiSeed += kuiOctaveSeedStep;
+			}
+			StoreLanes(lpafSamples + luiZ * luiSide + luiX, _mm_mul_ps(lSum, _mm_set1_ps(lfScale)), luiSide - luiX);
+		}
+	}
+}
+
+// The corners come from the coarse grid and the tile refines them. Points on the edges of
+// the tile only average the two points of their edge, so both tiles of an edge compute the
+// same values without reading each other
+void cTerrainGenerator::GenerateDiamondSquare( unsigned luiTile, unsigned luiFirstX, unsigned luiFirstZ, float* lpafSamples ) const
+{
+	unsigned luiQuads = muiTileQuads;
+	unsigned luiSide = luiQuads + 1;
+	float* lpafGrid = lpafSamples;
+
+	// Random value of every sample first, a contiguous SSE pass. The steps scale them
+	for ( unsigned luiZ = 0; luiZ < luiSide; ++luiZ ) {
+		NoiseRow(luiFirstX, luiFirstZ + luiZ, mParams.muiSeed, luiSide, lpafGrid + luiZ * luiSide);
+	}
+
+	unsigned luiCoarseSide = muiTilesPerSide + 1;
+	unsigned luiCoarse = (luiTile / muiTilesPerSide) * luiCoarseSide + luiTile % muiTilesPerSide;
+	lpafGrid[0] = mafCoarse[luiCoarse];
+	lpafGrid[luiQuads] = mafCoarse[luiCoarse + 1];
+	lpafGrid[luiQuads * luiSide] = mafCoarse[luiCoarse + luiCoarseSide];
+	lpafGrid[luiQuads * luiSide + luiQuads] = mafCoarse[luiCoarse + luiCoarseSide + 1];
+
+	unsigned luiLevel = 0;
+	while ( (1u << luiLevel) < luiQuads ) ++luiLevel;
+	for ( unsigned luiStep = luiQuads; luiStep > 1; luiStep /= 2, --luiLevel ) {
+		unsigned luiHalf = luiStep / 2;
+		float lfScale = mafStepScale[luiLevel];
+
+		for ( unsigned luiZ = luiHalf; luiZ < luiQuads; luiZ += luiStep ) {
+			float* lpafTop = lpafGrid + (luiZ - luiHalf) * luiSide;
+			float* lpafRow = lpafGrid + luiZ * luiSide;
+			float* lpafBottom = lpafGrid + (luiZ + luiHalf) * luiSide;
+			for ( unsigned luiX = luiHalf; luiX < luiQuads; luiX += luiStep ) {
+				float lfAverage = (lpafTop[luiX - luiHalf] + lpafTop[luiX + luiHalf] + lpafBottom[luiX - luiHalf] + lpafBottom[luiX + luiHalf]) * 0.25f;
+				lpafRow[luiX] = lfAverage + lpafRow[luiX] * lfScale;
+			}
+		}
+
+		for ( unsigned luiZ = 0; luiZ <= luiQuads; luiZ += luiHalf ) {
+			float* lpafRow = lpafGrid + luiZ * luiSide;
+			bool lbEdgeRow = (luiZ == 0 || luiZ == luiQuads);
+			for ( unsigned luiX = ((luiZ / luiHalf) % 2 == 0) ? luiHalf : 0; luiX <= luiQuads; luiX += luiStep ) {
+				float lfAverage;
+				if ( lbEdgeRow ) {
+					lfAverage = (lpafRow[luiX - luiHalf] + lpafRow[luiX + luiHalf]) * 0.5f;
+				} else {
+					float lfUp = lpafGrid[(luiZ - luiHalf) * luiSide + luiX];
+					float lfDown = lpafGrid[(luiZ + luiHalf) * luiSide + luiX];
+					if ( luiX == 0 || luiX == luiQuads ) {
+						lfAverage = (lfUp + lfDown) * 0.5f;
+					} else {
+						lfAverage = (lpafRow[luiX - luiHalf] + lpafRow[luiX + luiHalf] + lfUp + lfDown) * 0.25f;
+					}
+				}
+				lpafRow[luiX] = lfAverage + lpafRow[luiX] * lfScale;
+			}
+		}
+	}
+}
+
+void cTerrainGenerator::GenerateJob( unsigned luiTile, void* lpData )
+{
+	sGenerateJob* lpJob = (sGenerateJob*)lpData;
+	if ( lpJob->mpData->GetFormat() == eTerrainFormat_Float ) {
+		// Straight into the samples of the terrain
+		lpJob->mpGenerator->GenerateTile(luiTile, (float*)lpJob->mpData->GetTileSamples(luiTile));
+	} else {
+		unsigned luiSide = lpJob->mpData->GetTileQuads() + 1;
+		std::vector<float> lafSamples(luiSide * luiSide);
+		lpJob->mpGenerator->GenerateTile(luiTile, &lafSamples[0]);
+		lpJob->mpData->SetTileSamples(luiTile, &lafSamples[0]);
+	}
+}
+
+bool cTerrainGenerator::Generate( cTerrainData& lData ) const
+{
+	if ( !mbInit || !lData.HasSamples() || lData.GetSize() != muiSize || lData.GetTileQuads() != muiTileQuads ) return false;
+
+	// Every job writes its own tile
+	sGenerateJob lJob;
+	lJob.mpGenerator = this;
+	lJob.mpData = &lData;
+	cThreadPool::Get().ParallelFor(lData.GetTileCount(), GenerateJob, &lJob);
+	lData.UpdateBounds();
+	return true;
+}
+
+bool cTerrainGenerator::Benchmark( unsigned luiSize, unsigned luiTileQuads )
+{
+	cTerrainData lData;
+	if ( !lData.Init(luiSize, luiTileQuads, eTerrainFormat_Float, cVec3(0.0f, 0.0f, 0.0f), 1.0f, 1.0f) ) {
+		BenchReport("Terrain generator: no room for a %ux%u map", luiSize, luiSize);
+		return false;
+	}
+
+	static const char* lacModels[] = { "radial", "diamond square", "fbm" };
+	unsigned luiSide = luiTileQuads + 1;
+	std::vector<float> lafTile(luiSide * luiSide);
+	cBenchTimer lTimer;
+	bool lbPassed = true;
+
+	for ( unsigned luiModel = 0; luiModel < 3; ++luiModel ) {
+		sTerrainGeneratorParams lParams;
+		GetDefaultParams((eTerrainGeneratorModel)luiModel, lParams);
+		cTerrainGenerator lGenerator;
+		lTimer.Start();
+		lGenerator.Init(lParams, lData);
+		double ldInit = lTimer.GetMs();
+
+		// One thread
+		lTimer.Start();
+		for ( unsigned luiTile = 0; luiTile < lData.GetTileCount(); ++luiTile ) {
+			lGenerator.GenerateTile(luiTile, (float*)lData.GetTileSamples(luiTile));
+		}
+		double ldSingle = lTimer.GetMs();
+
+		// Thread pool
+		lTimer.Start();
+		lGenerator.Generate(lData);
+		double ldParallel = lTimer.GetMs();
+
+		// A tile generated again must be the same, bit by bit
+		unsigned luiTile = lData.GetTileCount() / 2;
+		lGenerator.GenerateTile(luiTile, &lafTile[0]);
+		bool lbSame = memcmp(&lafTile[0], lData.GetTileSamples(luiTile), lafTile.size() * sizeof(float)) == 0;
+		lbPassed = lbPassed && lbSame;
+
+		double ldSamples = (double)luiSize * luiSize;
+		BenchReport("Terrain generator %s %ux%u: init %.2f ms, 1 thread %.1f ms, %u threads %.1f ms (%.1f Msamples/s), regenerated tile %s",
+					lacModels[luiModel], luiSize, luiSize, ldInit, ldSingle, cThreadPool::Get().GetThreadCount(),
+					ldParallel, ldSamples / (ldParallel * 1000.0), lbSame ? "matches" : "DIFFERS");
+	}
+	return lbPassed;
+}
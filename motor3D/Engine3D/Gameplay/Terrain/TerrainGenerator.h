@@ -0,0 +1,71 @@
+// Procedural heights for the tiles of a terrain. Every sample only depends on the seed
+// and on its position in the map, so any tile can be generated again on demand and the
+// shared edges of neighbour tiles always match. The tiles are generated in parallel and
+// the sample loops run 4 samples at a time with SSE2.
+
+#ifndef TERRAIN_GENERATOR_H
+#define TERRAIN_GENERATOR_H
+
+#include <vector>
+
+class cTerrainData;
+
+enum eTerrainGeneratorModel
+{
+	eTerrainGenerator_Radial = 0,		// Waves around the centre (old bullet demo terrain)
+	eTerrainGenerator_DiamondSquare,	// Midpoint displacement
+	eTerrainGenerator_Noise				// fBm of value noise
+};
+
+struct sTerrainGeneratorParams
+{
+	eTerrainGeneratorModel meModel;
+	unsigned muiSeed;
+	float mfAmplitude;		// Height of the relief in world units
+	float mfRoughness;		// Amplitude kept at every level or octave (0, 1)
+	float mfFrequency;		// Noise: cycles per sample of the first octave
+	unsigned muiOctaves;	// Noise: octaves, each one doubles the frequency
+	float mfPhase;			// Radial: phase of the waves
+};
+
+class cTerrainGenerator
+{
+public:
+	cTerrainGenerator();
+
+	static void GetDefaultParams( eTerrainGeneratorModel leModel, sTerrainGeneratorParams& lParams );
+
+	// Prepares the generation of the tiles of lLayout (size, tiles, spacing and height scale)
+	bool Init( const sTerrainGeneratorParams& lParams, const cTerrainData& lLayout );
+
+	// Raw samples of a tile, (quads + 1)^2 values. It can be called from any thread
+	void GenerateTile( unsigned luiTile, float* lpafSamples ) const;
+	// Fills every tile of a terrain with its own samples, spread between the threads of the pool
+	bool Generate( cTerrainData& lData ) const;
+
+	// Times the three models on a luiSize x luiSize map, with one thread and with the pool
+	// (BenchReport). False if a tile generated again is not the same
+	static bool Benchmark( unsigned luiSize = 4097, unsigned luiTileQuads = 32 );
+
+private:
+	static void GenerateJob( unsigned luiTile, void* lpData );
+
+	void GenerateRadial( unsigned luiFirstX, unsigned luiFirstZ, float* lpafSamples ) const;
+	void GenerateNoise( unsigned luiFirstX, unsigned luiFirstZ, float* lpafSamples ) const;
+	void GenerateDiamondSquare( unsigned luiTile, unsigned luiFirstX, unsigned luiFirstZ, float* lpafSamples ) const;
+	// Diamond square over the corners of the tiles, the tiles refine it on their own
+	void BuildCoarseGrid();
+
+	sTerrainGeneratorParams mParams;
+	unsigned muiSize;
+	unsigned muiTileQuads;
+	unsigned muiTilesPerSide;
+	float mfSpacing;
+	float mfHeightScale;
+	// Diamond square: corners of the tiles and displacement of every step size
+	std::vector<float> mafCoarse;
+	std::vector<float> mafStepScale;
+	bool mbInit;
+};
+
+#endif
@@ -0,0 +1,433 @@
+#include "TerrainQuadtree.h"
+#include "TerrainData.h"
+#include "../../Graphics/Frustum.h"
+#include <assert.h>
+#include <math.h>
+
+// Sides of a tile used in the stitch masks. A bit is set when the neighbour of that side has a coarser lod
+enum eTerrainSide
+{
+	eTerrainSide_Left	= 1,
+	eTerrainSide_Right	= 2,
+	eTerrainSide_Top	= 4,
+	eTerrainSide_Bottom	= 8,
+	eTerrainSide_Masks	= 16
+};
+
+// The tile must be a power of two that divides the map and fits 16 bits indices, and the
+// tiles per side a power of two so every level of the tree splits in four
+static bool IsValidLayout( unsigned luiSize, unsigned luiTileQuads )
+{
+	unsigned luiTilesPerSide = (luiTileQuads > 0 && luiSize > 0)? (luiSize - 1) / luiTileQuads : 0;
+	if ( luiSize < 2 || luiTileQuads == 0 || (luiTileQuads & (luiTileQuads - 1)) != 0 || (luiSize - 1) % luiTileQuads != 0 || luiTileQuads > 128 ||
+		 luiTilesPerSide == 0 || (luiTilesPerSide & (luiTilesPerSide - 1)) != 0 ) {
+		OutputDebugString("Terrain size must be (2^n + 1) and the tile a power of two!\n");
+		return false;
+	}
+	return true;
+}
+
+cTerrainQuadtree::cTerrainQuadtree()
+{
+	muiIbo = 0;
+	muiSize = 0;
+	muiTileQuads = 0;
+	muiTilesPerSide = 0;
+	muiLodCount = 0;
+	muiDrawnTiles = 0;
+	mvOrigin = cVec3(0.0f, 0.0f, 0.0f);
+	mfSpacing = 1.0f;
+	mfHeightScale = 1.0f;
+	mfLodDistance = 64.0f;
+	mbLoaded = false;
+}
+
+bool cTerrainQuadtree::Init( const float* lpafHeights, unsigned luiSize, const cVec3& lvOrigin, float lfSpacing, float lfHeightScale, unsigned luiTileQuads )
+{
+	assert(lpafHeights);
+	// Small maps are a single tile
+	if ( luiSize < 2 ) return false;
+	if ( luiTileQuads > luiSize - 1 ) luiTileQuads = luiSize - 1;
+	if ( !IsValidLayout(luiSize, luiTileQuads) ) return false;
+
+	// Height range of every tile for the bounding boxes
+	unsigned luiTilesPerSide = (luiSize - 1) / luiTileQuads;
+	std::vector<float> lafTileMinMax(luiTilesPerSide * luiTilesPerSide * 2);
+	for ( unsigned luiTile = 0; luiTile < luiTilesPerSide * luiTilesPerSide; ++luiTile ) {
+		unsigned luiFirstX = (luiTile % luiTilesPerSide) * luiTileQuads;
+		unsigned luiFirstZ = (luiTile / luiTilesPerSide) * luiTileQuads;
+		float lfMin = lpafHeights[luiFirstZ * luiSize + luiFirstX];
+		float lfMax = lfMin;
+		for ( unsigned luiZ = luiFirstZ; luiZ <= luiFirstZ + luiTileQuads; ++luiZ ) {
+			for ( unsigned luiX = luiFirstX; luiX <= luiFirstX + luiTileQuads; ++luiX ) {
+				float lfHeight = lpafHeights[luiZ * luiSize + luiX];
+				if ( lfHeight < lfMin ) lfMin = lfHeight;
+				if ( lfHeight > lfMax ) lfMax = lfHeight;
+			}
+		}
+		lafTileMinMax[luiTile * 2] = lfMin;
+		lafTileMinMax[luiTile * 2 + 1] = lfMax;
+	}
+	if ( !Init(luiSize, lvOrigin, lfSpacing, lfHeightScale, luiTileQuads, &lafTileMinMax[0]) ) return false;
+
+	// Vertex buffers of all the tiles
+	for ( unsigned luiTile = 0; luiTile < maTiles.size(); ++luiTile ) {
+		BuildTile(luiTile, lpafHeights, luiSize, (luiTile % muiTilesPerSide) * muiTileQuads, (luiTile / muiTilesPerSide) * muiTileQuads);
+	}
+	maVertices.clear();
+	return true;
+}
+
+bool cTerrainQuadtree::Init( unsigned luiSize, const cVec3& lvOrigin, float lfSpacing, float lfHeightScale, unsigned luiTileQuads, const float* lpafTileMinMax )
+{
+	if ( !IsValidLayout(luiSize, luiTileQuads) ) return false;
+	assert(lpafTileMinMax);
+
+	Deinit();
+	muiSize = luiSize;
+	muiTileQuads = luiTileQuads;
+	muiTilesPerSide = (luiSize - 1) / luiTileQuads;
+	mvOrigin = lvOrigin;
+	mfSpacing = lfSpacing;
+	mfHeightScale = lfHeightScale;
+
+	// One lod per halving of the tile resolution
+	muiLodCount = 1;
+	while ( (1u << muiLodCount) <= muiTileQuads ) ++muiLodCount;
+
+	// Bounding boxes of the tiles, without vertex buffers
+	maTiles.resize(muiTilesPerSide * muiTilesPerSide);
+	for ( unsigned luiTile = 0; luiTile < maTiles.size(); ++luiTile ) {
+		sTerrainTile& lTile = maTiles[luiTile];
+		lTile.mafMin[0] = mvOrigin.x + (luiTile % muiTilesPerSide) * muiTileQuads * mfSpacing;
+		lTile.mafMin[1] = mvOrigin.y + lpafTileMinMax[luiTile * 2] * mfHeightScale;
+		lTile.mafMin[2] = mvOrigin.z + (luiTile / muiTilesPerSide) * muiTileQuads * mfSpacing;
+		lTile.mafMax[0] = lTile.mafMin[0] + muiTileQuads * mfSpacing;
+		lTile.mafMax[1] = mvOrigin.y + lpafTileMinMax[luiTile * 2 + 1] * mfHeightScale;
+		lTile.mafMax[2] = lTile.mafMin[2] + muiTileQuads * mfSpacing;
+		lTile.muiLod = 0;
+		lTile.muiVbo = 0;
+	}
+
+	// Index buffer shared by all the tiles
+	BuildIndices();
+
+	// Quadtree over the tiles
+	maNodes.reserve(maTiles.size() * 2);
+	BuildNode(0, 0, muiTilesPerSide);
+
+	mbLoaded = true;
+	return true;
+}
+
+bool cTerrainQuadtree::Init( const cTerrainData& lData )
+{
+	return Init(lData.GetSize(), lData.GetOrigin(), lData.GetSpacing(), lData.GetHeightScale(), lData.GetTileQuads(), lData.GetTileMinMax());
+}
+
+void cTerrainQuadtree::Deinit()
+{
+	for ( unsigned luiTile = 0; luiTile < maTiles.size(); ++luiTile ) {
+		ReleaseTile(luiTile);
+	}
+	if ( muiIbo ) glDeleteBuffers(1, &muiIbo);
+	muiIbo = 0;
+	maTiles.clear();
+	maNodes.clear();
+	maVertices.clear();
+	maIndexOffset.clear();
+	maIndexCount.clear();
+	mbLoaded = false;
+}
+
+void cTerrainQuadtree::LoadTile( unsigned luiTile, const short* lpaiSamples )
+{
+	assert(luiTile < maTiles.size() && lpaiSamples);
+	ReleaseTile(luiTile);
+	BuildTile(luiTile, lpaiSamples, muiTileQuads + 1, 0, 0);
+}
+
+void cTerrainQuadtree::LoadTile( unsigned luiTile, const float* lpafSamples )
+{
+	assert(luiTile < maTiles.size() && lpafSamples);
+	ReleaseTile(luiTile);
+	BuildTile(luiTile, lpafSamples, muiTileQuads + 1, 0, 0);
+}
+
+void cTerrainQuadtree::ReleaseTile( unsigned luiTile )
+{
+	sTerrainTile& lTile = maTiles[luiTile];
+	if ( lTile.muiVbo ) {
+		glDeleteBuffers(1, &lTile.muiVbo);
+		lTile.muiVbo = 0;
+	}
+}
+
+// Fills the vertex buffer of a tile. The bounding box was set by Init
+template <typename T>
+void cTerrainQuadtree::BuildTile( unsigned luiTile, const T* lpSamples, unsigned luiWindow, unsigned luiFirstX, unsigned luiFirstZ )
+{
+	unsigned luiSide = muiTileQuads + 1;
+	maVertices.resize(luiSide * luiSide);
+
+	unsigned luiTileX = (luiTile % muiTilesPerSide) * muiTileQuads;
+	unsigned luiTileZ = (luiTile / muiTilesPerSide) * muiTileQuads;
+	for ( unsigned luiZ = 0; luiZ < luiSide; ++luiZ ) {
+		unsigned luiSampleZ = luiFirstZ + luiZ;
+		for ( unsigned luiX = 0; luiX < luiSide; ++luiX ) {
+			unsigned luiSampleX = luiFirstX + luiX;
+
+			sTerrainVertex& lVertex = maVertices[luiZ * luiSide + luiX];
+			lVertex.mfX = mvOrigin.x + (luiTileX + luiX) * mfSpacing;
+			lVertex.mfY = mvOrigin.y + lpSamples[luiSampleZ * luiWindow + luiSampleX] * mfHeightScale;
+			lVertex.mfZ = mvOrigin.z + (luiTileZ + luiZ) * mfSpacing;
+
+			// Normal from the central differences, clamped on the border of the samples
+			unsigned luiLeft = (luiSampleX > 0) ? luiSampleX - 1 : luiSampleX;
+			unsigned luiRight = (luiSampleX < luiWindow - 1) ? luiSampleX + 1 : luiSampleX;
+			unsigned luiUp = (luiSampleZ > 0) ? luiSampleZ - 1 : luiSampleZ;
+			unsigned luiDown = (luiSampleZ < luiWindow - 1) ? luiSampleZ + 1 : luiSampleZ;
+			float lfDx = ((float)lpSamples[luiSampleZ * luiWindow + luiLeft] - (float)lpSamples[luiSampleZ * luiWindow + luiRight]) * mfHeightScale;
+			float lfDz = ((float)lpSamples[luiUp * luiWindow + luiSampleX] - (float)lpSamples[luiDown * luiWindow + luiSampleX]) * mfHeightScale;
+			float lfDy = (float)((luiRight - luiLeft) + (luiDown - luiUp)) * 0.5f * mfSpacing;
+			float lfInvLength = 127.0f / sqrtf(lfDx * lfDx + lfDy * lfDy + lfDz * lfDz);
+			lVertex.macNormal[0] = (signed char)(lfDx * lfInvLength);
+			lVertex.macNormal[1] = (signed char)(lfDy * lfInvLength);
+			lVertex.macNormal[2] = (signed char)(lfDz * lfInvLength);
+			lVertex.macNormal[3] = 0;
+		}
+	}
+
+	sTerrainTile& lTile = maTiles[luiTile];
+	glGenBuffers(1, &lTile.muiVbo);
+	assert(glGetError() == GL_NO_ERROR);
+	glBindBuffer(GL_ARRAY_BUFFER, lTile.muiVbo);
+	glBufferData(GL_ARRAY_BUFFER, maVertices.size() * sizeof(sTerrainVertex), &maVertices[0], GL_STATIC_DRAW);
+	assert(glGetError() == GL_NO_ERROR);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// Builds the triangles of every lod and stitch mask. On a stitched side the odd
+// vertices of the edge are collapsed onto the previous even one, so the edge matches
+// the one of the coarser neighbour. Triangles that become degenerate are dropped.
+void cTerrainQuadtree::BuildIndices()
+{
+	unsigned luiSide = muiTileQuads + 1;
+	unsigned luiLast = muiTileQuads;
+	std::vector<unsigned short> lauiIndices;
+
+	maIndexOffset.resize(muiLodCount * eTerrainSide_Masks);
+	maIndexCount.resize(muiLodCount * eTerrainSide_Masks);
+	for ( unsigned luiLod = 0; luiLod < muiLodCount; ++luiLod ) {
+		unsigned luiStep = 1 << luiLod;
+		for ( unsigned luiMask = 0; luiMask < eTerrainSide_Masks; ++luiMask ) {
+			unsigned luiBlock = luiLod * eTerrainSide_Masks + luiMask;
+			maIndexOffset[luiBlock] = (unsigned)lauiIndices.size();
+
+			for ( unsigned luiZ = 0; luiZ < luiLast; luiZ += luiStep ) {
+				for ( unsigned luiX = 0; luiX < luiLast; luiX += luiStep ) {
+					unsigned lauiCornerX[4] = { luiX, luiX + luiStep, luiX, luiX + luiStep };
+					unsigned lauiCornerZ[4] = { luiZ, luiZ, luiZ + luiStep, luiZ + luiStep };
+					unsigned short lauiCorner[4];
+					for ( unsigned luiCorner = 0; luiCorner < 4; ++luiCorner ) {
+						unsigned luiCX = lauiCornerX[luiCorner];
+						unsigned luiCZ = lauiCornerZ[luiCorner];
+						bool lbOddZ = ((luiCZ / luiStep) & 1) != 0;
+						bool lbOddX = ((luiCX / luiStep) & 1) != 0;
+						if ( luiCX == 0 && (luiMask & eTerrainSide_Left) && lbOddZ ) luiCZ -= luiStep;
+						else if ( luiCX == luiLast && (luiMask & eTerrainSide_Right) && lbOddZ ) luiCZ -= luiStep;
+						else if ( luiCZ == 0 && (luiMask & eTerrainSide_Top) && lbOddX ) luiCX -= luiStep;
+						else if ( luiCZ == luiLast && (luiMask & eTerrainSide_Bottom) && lbOddX ) luiCX -= luiStep;
+						lauiCorner[luiCorner] = (unsigned short)(luiCZ * luiSide + luiCX);
+					}
+
+					// Counter clockwise seen from above. The last cell uses the other diagonal,
+					// otherwise stitching the right and bottom sides would fold it
+					unsigned short lauiTriangles[6] = { lauiCorner[0], lauiCorner[2], lauiCorner[1],
+														lauiCorner[1], lauiCorner[2], lauiCorner[3] };
+					if ( luiX + luiStep == luiLast && luiZ + luiStep == luiLast ) {
+						lauiTriangles[1] = lauiCorner[2]; lauiTriangles[2] = lauiCorner[3];
+						lauiTriangles[3] = lauiCorner[0]; lauiTriangles[4] = lauiCorner[3]; lauiTriangles[5] = lauiCorner[1];
+					}
+					for ( unsigned luiTriangle = 0; luiTriangle < 6; luiTriangle += 3 ) {
+						unsigned short luiA = lauiTriangles[luiTriangle];
+						unsigned short luiB = lauiTriangles[luiTriangle + 1];
+						unsigned short luiC = lauiTriangles[luiTriangle + 2];
+						if ( luiA == luiB || luiB == luiC || luiA == luiC ) continue;
+						lauiIndices.push_back(luiA);
+						lauiIndices.push_back(luiB);
+						lauiIndices.push_back(luiC);
+					}
+				}
+			}
+			maIndexCount[luiBlock] = (unsigned)lauiIndices.size() - maIndexOffset[luiBlock];
+		}
+	}
+
+	glGenBuffers(1, &muiIbo);
+	assert(glGetError() == GL_NO_ERROR);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, muiIbo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, lauiIndices.size() * sizeof(unsigned short), &lauiIndices[0], GL_STATIC_DRAW);
+	assert(glGetError() == GL_NO_ERROR);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+// Creates the node of a square range of tiles and returns its index
+int cTerrainQuadtree::BuildNode( unsigned luiX, unsigned luiZ, unsigned luiSize )
+{
+	int liNode = (int)maNodes.size();
+	maNodes.push_back(sTerrainNode());
+	for ( unsigned luiChild = 0; luiChild < 4; ++luiChild ) maNodes[liNode].maiChildren[luiChild] = -1;
+
+	if ( luiSize == 1 ) {
+		const sTerrainTile& lTile = maTiles[luiZ * muiTilesPerSide + luiX];
+		sTerrainNode& lNode = maNodes[liNode];
+		lNode.muiTile = luiZ * muiTilesPerSide + luiX;
+		for ( unsigned luiAxis = 0; luiAxis < 3; ++luiAxis ) {
+			lNode.mafMin[luiAxis] = lTile.mafMin[luiAxis];
+			lNode.mafMax[luiAxis] = lTile.mafMax[luiAxis];
+		}
+		return liNode;
+	}
+
+	// Children are built first because they may grow the node array
+	unsigned luiHalf = luiSize / 2;
+	int laiChildren[4];
+	laiChildren[0] = BuildNode(luiX, luiZ, luiHalf);
+	laiChildren[1] = BuildNode(luiX + luiHalf, luiZ, luiHalf);
+	laiChildren[2] = BuildNode(luiX, luiZ + luiHalf, luiHalf);
+	laiChildren[3] = BuildNode(luiX + luiHalf, luiZ + luiHalf, luiHalf);
+
+	sTerrainNode& lNode = maNodes[liNode];
+	lNode.muiTile = 0;
+	for ( unsigned luiAxis = 0; luiAxis < 3; ++luiAxis ) {
+		lNode.mafMin[luiAxis] = maNodes[laiChildren[0]].mafMin[luiAxis];
+		lNode.mafMax[luiAxis] = maNodes[laiChildren[0]].mafMax[luiAxis];
+	}
+	for ( unsigned luiChild = 0; luiChild < 4; ++luiChild ) {
+		const sTerrainNode& lChild = maNodes[laiChildren[luiChild]];
+		lNode.maiChildren[luiChild] = laiChildren[luiChild];
+		for ( unsigned luiAxis = 0; luiAxis < 3; ++luiAxis ) {
+			if ( lChild.mafMin[luiAxis] < lNode.mafMin[luiAxis] ) lNode.mafMin[luiAxis] = lChild.mafMin[luiAxis];
+			if ( lChild.mafMax[luiAxis] > lNode.mafMax[luiAxis] ) lNode.mafMax[luiAxis] = lChild.mafMax[luiAxis];
+		}
+	}
+	return liNode;
+}
+
+// The lod grows with the distance from the eye to the box of the tile. Afterwards the
+// lods are relaxed until neighbours differ at most in one, which the stitching needs.
+void cTerrainQuadtree::SelectLod( const cVec3& lvEye )
+{
+	// The tiles drawn by the Render calls of the frame
+	muiDrawnTiles = 0;
+	if ( !mbLoaded ) return;
+
+	float lafEye[3] = { lvEye.x, lvEye.y, lvEye.z };
+	for ( unsigned luiTile = 0; luiTile < maTiles.size(); ++luiTile ) {
+		sTerrainTile& lTile = maTiles[luiTile];
+		float lfDistance2 = 0.0f;
+		for ( unsigned luiAxis = 0; luiAxis < 3; ++luiAxis ) {
+			float lfDelta = 0.0f;
+			if ( lafEye[luiAxis] < lTile.mafMin[luiAxis] ) lfDelta = lTile.mafMin[luiAxis] - lafEye[luiAxis];
+			else if ( lafEye[luiAxis] > lTile.mafMax[luiAxis] ) lfDelta = lafEye[luiAxis] - lTile.mafMax[luiAxis];
+			lfDistance2 += lfDelta * lfDelta;
+		}
+
+		unsigned luiLod = 0;
+		float lfLodDistance = mfLodDistance;
+		while ( luiLod + 1 < muiLodCount && lfDistance2 > lfLodDistance * lfLodDistance ) {
+			++luiLod;
+			lfLodDistance *= 2.0f;
+		}
+		lTile.muiLod = luiLod;
+	}
+
+	bool lbChanged = true;
+	while ( lbChanged ) {
+		lbChanged = false;
+		for ( unsigned luiZ = 0; luiZ < muiTilesPerSide; ++luiZ ) {
+			for ( unsigned luiX = 0; luiX < muiTilesPerSide; ++luiX ) {
+				unsigned luiMaxLod = maTiles[luiZ * muiTilesPerSide + luiX].muiLod + 1;
+				unsigned lauiNeighbour[4];
+				unsigned luiNeighbours = 0;
+				if ( luiX > 0 ) lauiNeighbour[luiNeighbours++] = luiZ * muiTilesPerSide + luiX - 1;
+				if ( luiX + 1 < muiTilesPerSide ) lauiNeighbour[luiNeighbours++] = luiZ * muiTilesPerSide + luiX + 1;
+				if ( luiZ > 0 ) lauiNeighbour[luiNeighbours++] = (luiZ - 1) * muiTilesPerSide + luiX;
+				if ( luiZ + 1 < muiTilesPerSide ) lauiNeighbour[luiNeighbours++] = (luiZ + 1) * muiTilesPerSide + luiX;
+				for ( unsigned luiNeighbour = 0; luiNeighbour < luiNeighbours; ++luiNeighbour ) {
+					sTerrainTile& lNeighbour = maTiles[lauiNeighbour[luiNeighbour]];
+					if ( lNeighbour.muiLod > luiMaxLod ) {
+						lNeighbour.muiLod = luiMaxLod;
+						lbChanged = true;
+					}
+				}
+			}
+		}
+	}
+}
+
+// Sides of the tile whose neighbour is coarser
+unsigned cTerrainQuadtree::GetStitchMask( unsigned luiTile ) const
+{
+	unsigned luiX = luiTile % muiTilesPerSide;
+	unsigned luiZ = luiTile / muiTilesPerSide;
+	unsigned luiLod = maTiles[luiTile].muiLod;
+	unsigned luiMask = 0;
+	if ( luiX > 0 && maTiles[luiTile - 1].muiLod > luiLod ) luiMask |= eTerrainSide_Left;
+	if ( luiX + 1 < muiTilesPerSide && maTiles[luiTile + 1].muiLod > luiLod ) luiMask |= eTerrainSide_Right;
+	if ( luiZ > 0 && maTiles[luiTile - muiTilesPerSide].muiLod > luiLod ) luiMask |= eTerrainSide_Top;
+	if ( luiZ + 1 < muiTilesPerSide && maTiles[luiTile + muiTilesPerSide].muiLod > luiLod ) luiMask |= eTerrainSide_Bottom;
+	return luiMask;
+}
+
+void cTerrainQuadtree::Render( Frustum& lFrustum, unsigned luiMinLod, unsigned luiMaxLod )
+{
+	if ( !mbLoaded ) return;
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, muiIbo);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_NORMAL_ARRAY);
+
+	RenderNode(0, lFrustum, luiMinLod, luiMaxLod);
+
+	glDisableClientState(GL_NORMAL_ARRAY);
+	glDisableClientState(GL_VERTEX_ARRAY);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+void cTerrainQuadtree::RenderNode( int liNode, Frustum& lFrustum, unsigned luiMinLod, unsigned luiMaxLod )
+{
+	const sTerrainNode& lNode = maNodes[liNode];
+	if ( !lFrustum.boxInFrustum(lNode.mafMin[0], lNode.mafMin[1], lNode.mafMin[2], lNode.mafMax[0], lNode.mafMax[1], lNode.mafMax[2]) ) return;
+
+	if ( lNode.maiChildren[0] < 0 ) {
+		unsigned luiLod = maTiles[lNode.muiTile].muiLod;
+		if ( luiLod >= luiMinLod && luiLod <= luiMaxLod ) DrawTile(lNode.muiTile);
+		return;
+	}
+	for ( unsigned luiChild = 0; luiChild < 4; ++luiChild ) {
+		RenderNode(lNode.maiChildren[luiChild], lFrustum, luiMinLod, luiMaxLod);
+	}
+}
+
+void cTerrainQuadtree::DrawTile( unsigned luiTile )
+{
+	const sTerrainTile& lTile = maTiles[luiTile];
+	if ( !lTile.muiVbo ) return;
+	unsigned luiBlock = lTile.muiLod * eTerrainSide_Masks + GetStitchMask(luiTile);
+	unsigned luiVertexCount = (muiTileQuads + 1) * (muiTileQuads + 1);
+
+	glBindBuffer(GL_ARRAY_BUFFER, lTile.muiVbo);
+	glVertexPointer(3, GL_FLOAT, sizeof(sTerrainVertex), 0);
+	glNormalPointer(GL_BYTE, sizeof(sTerrainVertex), (char *)NULL + 3 * sizeof(float));
+	glDrawRangeElements(GL_TRIANGLES,
+						0,
+						luiVertexCount - 1,
+						maIndexCount[luiBlock],
+						GL_UNSIGNED_SHORT,
+						(char *)NULL + maIndexOffset[luiBlock] * sizeof(unsigned short));
+	assert(glGetError() == GL_NO_ERROR);
+	++muiDrawnTiles;
+}
@@ -0,0 +1,112 @@
+#ifndef TERRAIN_QUADTREE_H
+#define TERRAIN_QUADTREE_H
+
+#include <vector>
+#include "../../Graphics/GLHeaders.h"
+#include "../../MathLib/MathLib.h"
+
+class Frustum;
+class cTerrainData;
+
+// Tile of the terrain: a square patch of (quads + 1)^2 vertices with its own vertex buffer.
+// The buffer is 0 while the tile is not resident
+struct sTerrainTile
+{
+	unsigned muiVbo;
+	float mafMin[3];
+	float mafMax[3];
+	unsigned muiLod;
+};
+
+// Node of the quadtree: bounding box of a square range of tiles
+struct sTerrainNode
+{
+	float mafMin[3];
+	float mafMax[3];
+	int maiChildren[4];		// -1 on leaves
+	unsigned muiTile;		// Tile of the leaves
+};
+
+// Chunked terrain. The heightfield is split in tiles that are culled with a quadtree
+// and drawn with geomipmapping. All the tiles share one index buffer that holds every
+// lod, and for each lod one version per combination of coarser neighbours, so the
+// edges are stitched without cracks.
+class cTerrainQuadtree
+{
+public:
+	// Vertex of the tiles: position and a packed normal
+	struct sTerrainVertex
+	{
+		float mfX, mfY, mfZ;
+		signed char macNormal[4];
+	};
+
+	cTerrainQuadtree();
+
+	// Heights are a luiSize x luiSize grid (luiSize = 2^n + 1) and are not kept
+	bool Init( const float* lpafHeights, unsigned luiSize, const cVec3& lvOrigin, float lfSpacing, float lfHeightScale, unsigned luiTileQuads = 32 );
+	// Only the layout, the tiles are loaded later. lpafTileMinMax holds the height range of every tile
+	bool Init( unsigned luiSize, const cVec3& lvOrigin, float lfSpacing, float lfHeightScale, unsigned luiTileQuads, const float* lpafTileMinMax );
+	// Layout of a terrain, the tiles are placed with its transform
+	bool Init( const cTerrainData& lData );
+	void Deinit();
+
+	// Creates the vertex buffer of a tile from its (quads + 1)^2 samples
+	void LoadTile( unsigned luiTile, const short* lpaiSamples );
+	void LoadTile( unsigned luiTile, const float* lpafSamples );
+	void ReleaseTile( unsigned luiTile );
+	inline bool IsTileLoaded( unsigned luiTile ) const { return maTiles[luiTile].muiVbo != 0; }
+
+	// Chooses the lod of every tile from the eye position
+	void SelectLod( const cVec3& lvEye );
+	// Culls the tiles against the frustum and draws the visible ones with a lod in
+	// [luiMinLod, luiMaxLod], so the near and the far tiles can use different shaders
+	void Render( Frustum& lFrustum, unsigned luiMinLod = 0, unsigned luiMaxLod = ~0u );
+
+	// Distance where the first lod change happens, the next ones double it
+	inline void SetLodDistance( float lfDistance ) { mfLodDistance = lfDistance; }
+	inline float GetLodDistance() const { return mfLodDistance; }
+	inline unsigned GetLodCount() const { return muiLodCount; }
+	inline unsigned GetTileCount() const { return (unsigned)maTiles.size(); }
+	inline unsigned GetTilesPerSide() const { return muiTilesPerSide; }
+	inline unsigned GetTileQuads() const { return muiTileQuads; }
+	inline unsigned GetSize() const { return muiSize; }
+	inline const cVec3& GetOrigin() const { return mvOrigin; }
+	inline float GetSpacing() const { return mfSpacing; }
+	inline float GetHeightScale() const { return mfHeightScale; }
+	inline unsigned GetDrawnTiles() const { return muiDrawnTiles; }
+	inline bool IsLoaded() const { return mbLoaded; }
+
+private:
+
+	// Samples of the tile start at (luiFirstX, luiFirstZ) inside a window of luiWindow x luiWindow samples
+	template <typename T>
+	void BuildTile( unsigned luiTile, const T* lpSamples, unsigned luiWindow, unsigned luiFirstX, unsigned luiFirstZ );
+	void BuildIndices();
+	int BuildNode( unsigned luiX, unsigned luiZ, unsigned luiSize );
+	void RenderNode( int liNode, Frustum& lFrustum, unsigned luiMinLod, unsigned luiMaxLod );
+	void DrawTile( unsigned luiTile );
+	unsigned GetStitchMask( unsigned luiTile ) const;
+
+	std::vector<sTerrainTile> maTiles;
+	std::vector<sTerrainNode> maNodes;
+	std::vector<sTerrainVertex> maVertices;	// Scratch buffer of BuildTile
+
+	// Offset and count of the indices of each lod/mask pair
+	std::vector<unsigned> maIndexOffset;
+	std::vector<unsigned> maIndexCount;
+	unsigned muiIbo;
+
+	unsigned muiSize;
+	unsigned muiTileQuads;
+	unsigned muiTilesPerSide;
+	unsigned muiLodCount;
+	unsigned muiDrawnTiles;
+	cVec3 mvOrigin;
+	float mfSpacing;
+	float mfHeightScale;
+	float mfLodDistance;
+	bool mbLoaded;
+};
+
+#endif
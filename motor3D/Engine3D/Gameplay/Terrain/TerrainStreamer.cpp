@@ -0,0 +1,335 @@
+#include "TerrainStreamer.h"
+#include "TerrainFile.h"
+#include "TerrainData.h"
+#include "TerrainQuadtree.h"
+#include "../../Physics/cPhysics.h"
+#include "../../Physics/cPhysicsShapes.h"
+#include "..\..\Libraries\Bullet\include\BulletCollision\CollisionShapes\btHeightfieldTerrainShape.h"
+#include <algorithm>
+#include <math.h>
+#include <stdlib.h>
+#include <assert.h>
+
+// Distance of a request to the center, used to serve the nearest tiles first
+struct sTileRequest
+{
+	unsigned muiDistance;
+	unsigned muiTile;
+	bool operator < ( const sTileRequest& lOther ) const { return muiDistance > lOther.muiDistance; }
+};
+
+cTerrainStreamer::cTerrainStreamer()
+{
+	mpData = NULL;
+	mpFile = NULL;
+	mpQuadtree = NULL;
+	muiRadius = 0;
+	muiResidentCount = 0;
+	mhThread = NULL;
+	mhWakeEvent = NULL;
+	mbQuit = false;
+	mbInit = false;
+}
+
+bool cTerrainStreamer::Init( const cTerrainData* lpData, const cTerrainFile* lpFile, cTerrainQuadtree* lpQuadtree, unsigned luiRadius )
+{
+	assert(lpData && lpQuadtree);
+	Deinit();
+	if ( lpData->GetTileCount() != lpQuadtree->GetTileCount() ) return false;
+	if ( lpFile ? (!lpFile->IsOpen() || lpFile->GetTileCount() != lpData->GetTileCount()) : !lpData->HasSamples() ) return false;
+
+	mpData = lpData;
+	mpFile = lpFile;
+	mpQuadtree = lpQuadtree;
+	muiRadius = luiRadius;
+	muiResidentCount = 0;
+
+	sStreamTile lEmpty;
+	lEmpty.meState = eTile_Unloaded;
+	lEmpty.mpView = NULL;
+	lEmpty.mpSamples = NULL;
+	lEmpty.mpShape = NULL;
+	lEmpty.mpBody = NULL;
+	maTiles.assign(lpData->GetTileCount(), lEmpty);
+	maActive.reserve(GetMaxResident());
+
+	InitializeCriticalSection(&mLock);
+	mhWakeEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+	mbQuit = false;
+	if ( mpFile ) mhThread = CreateThread(NULL, 0, LoaderMain, this, 0, NULL);
+	mbInit = true;
+	return true;
+}
+
+void cTerrainStreamer::Deinit()
+{
+	if ( !mbInit ) return;
+
+	// Stop the loader before touching the tiles
+	mbQuit = true;
+	if ( mhThread ) {
+		SetEvent(mhWakeEvent);
+		WaitForSingleObject(mhThread, INFINITE);
+		CloseHandle(mhThread);
+	}
+	CloseHandle(mhWakeEvent);
+	DeleteCriticalSection(&mLock);
+
+	while ( !maActive.empty() ) {
+		Release(maActive.back());
+		maActive.pop_back();
+	}
+	maTiles.clear();
+	maRequests.clear();
+	maMapped.clear();
+	mhThread = NULL;
+	mhWakeEvent = NULL;
+	mbInit = false;
+}
+
+DWORD WINAPI cTerrainStreamer::LoaderMain( LPVOID lpParam )
+{
+	((cTerrainStreamer*)lpParam)->LoaderLoop();
+	return 0;
+}
+
+void cTerrainStreamer::LoaderLoop()
+{
+	while ( !mbQuit ) {
+		WaitForSingleObject(mhWakeEvent, INFINITE);
+		while ( !mbQuit ) {
+			// Nearest request that is still wanted
+			EnterCriticalSection(&mLock);
+			if ( maRequests.empty() ) {
+				LeaveCriticalSection(&mLock);
+				break;
+			}
+			unsigned luiTile = maRequests.back();
+			maRequests.pop_back();
+			bool lbWanted = (maTiles[luiTile].meState == eTile_Requested);
+			LeaveCriticalSection(&mLock);
+			if ( !lbWanted ) continue;
+
+			// Page in the samples, so the main thread doesn't fault on them
+			void* lpView = NULL;
+			const void* lpSamples = mpFile->MapTile(luiTile, &lpView);
+			if ( lpSamples ) {
+				unsigned luiBytes = mpFile->GetTileBytes();
+				volatile char lcTouch = 0;
+				for ( unsigned luiByte = 0; luiByte < luiBytes; luiByte += 4096 ) {
+					lcTouch += ((const char*)lpSamples)[luiByte];
+				}
+			}
+
+			// The main thread may have cancelled it meanwhile
+			EnterCriticalSection(&mLock);
+			sStreamTile& lTile = maTiles[luiTile];
+			bool lbKeep = (lTile.meState == eTile_Requested && lpSamples != NULL);
+			if ( lbKeep ) {
+				lTile.mpView = lpView;
+				lTile.mpSamples = lpSamples;
+				lTile.meState = eTile_Mapped;
+				maMapped.push_back(luiTile);
+			}
+			else if ( lTile.meState == eTile_Requested ) {
+				// It failed, it will be requested again
+				lTile.meState = eTile_Unloaded;
+			}
+			LeaveCriticalSection(&mLock);
+			if ( !lbKeep ) cTerrainFile::UnmapTile(lpView);
+		}
+	}
+}
+
+// Samples of a tile, from a view of the file or from the terrain itself
+const void* cTerrainStreamer::MapTile( unsigned luiTile, void** lppView ) const
+{
+	if ( mpFile ) return mpFile->MapTile(luiTile, lppView);
+	*lppView = NULL;
+	return mpData->GetTileSamples(luiTile);
+}
+
+void cTerrainStreamer::GetCenterTile( const cVec3& lvPosition, int& liTileX, int& liTileZ ) const
+{
+	float lfTileSize = mpData->GetTileQuads() * mpData->GetSpacing();
+	liTileX = (int)floorf((lvPosition.x - mpData->GetOrigin().x) / lfTileSize);
+	liTileZ = (int)floorf((lvPosition.z - mpData->GetOrigin().z) / lfTileSize);
+}
+
+void cTerrainStreamer::Update( const cVec3& lvPosition, unsigned luiMaxBuilds )
+{
+	if ( !mbInit ) return;
+
+	int liCenterX, liCenterZ;
+	GetCenterTile(lvPosition, liCenterX, liCenterZ);
+	int liTilesPerSide = (int)mpData->GetTilesPerSide();
+	// Resident tiles are kept one ring further than they are requested, so moving
+	// along a tile border doesn't load and release the same tiles every frame
+	int liRequest = (int)muiRadius;
+	int liKeep = liRequest + 1;
+
+	std::vector<unsigned> lauiRelease;
+	std::vector<unsigned> lauiBuild;
+	EnterCriticalSection(&mLock);
+
+	// Cancel and release the far tiles
+	for ( unsigned luiActive = 0; luiActive < maActive.size(); ) {
+		unsigned luiTile = maActive[luiActive];
+		sStreamTile& lTile = maTiles[luiTile];
+		int liDistX = abs((int)(luiTile % liTilesPerSide) - liCenterX);
+		int liDistZ = abs((int)(luiTile / liTilesPerSide) - liCenterZ);
+		bool lbOutRequest = liDistX > liRequest || liDistZ > liRequest;
+		bool lbOutKeep = liDistX > liKeep || liDistZ > liKeep;
+		bool lbRemove = false;
+		if ( lTile.meState == eTile_Requested && lbOutRequest ) {
+			lTile.meState = eTile_Unloaded;
+			lbRemove = true;
+		}
+		else if ( lTile.meState == eTile_Mapped && lbOutKeep ) {
+			cTerrainFile::UnmapTile(lTile.mpView);
+			lTile.mpView = NULL;
+			lTile.mpSamples = NULL;
+			lTile.meState = eTile_Unloaded;
+			lbRemove = true;
+		}
+		else if ( lTile.meState == eTile_Resident && lbOutKeep ) {
+			lauiRelease.push_back(luiTile);
+			lbRemove = true;
+		}
+		else if ( lTile.meState == eTile_Unloaded ) {
+			lbRemove = true;
+		}
+		if ( lbRemove ) {
+			maActive[luiActive] = maActive.back();
+			maActive.pop_back();
+		} else {
+			++luiActive;
+		}
+	}
+
+	// New requests, nearest last so the loader pops them first
+	std::vector<sTileRequest> laRequests;
+	for ( int liZ = liCenterZ - liRequest; liZ <= liCenterZ + liRequest; ++liZ ) {
+		for ( int liX = liCenterX - liRequest; liX <= liCenterX + liRequest; ++liX ) {
+			if ( liX < 0 || liZ < 0 || liX >= liTilesPerSide || liZ >= liTilesPerSide ) continue;
+			unsigned luiTile = (unsigned)(liZ * liTilesPerSide + liX);
+			sStreamTile& lTile = maTiles[luiTile];
+			if ( lTile.meState == eTile_Unloaded ) {
+				lTile.meState = eTile_Requested;
+				maActive.push_back(luiTile);
+			}
+			if ( lTile.meState == eTile_Requested && !mpFile ) {
+				// Own samples, there is nothing to wait for
+				lTile.mpSamples = MapTile(luiTile, &lTile.mpView);
+				lTile.meState = eTile_Mapped;
+				maMapped.push_back(luiTile);
+			}
+			if ( lTile.meState == eTile_Requested ) {
+				sTileRequest lRequest;
+				lRequest.muiDistance = (unsigned)((liX - liCenterX) * (liX - liCenterX) + (liZ - liCenterZ) * (liZ - liCenterZ));
+				lRequest.muiTile = luiTile;
+				laRequests.push_back(lRequest);
+			}
+		}
+	}
+	std::sort(laRequests.begin(), laRequests.end());
+	maRequests.clear();
+	for ( unsigned luiRequest = 0; luiRequest < laRequests.size(); ++luiRequest ) {
+		maRequests.push_back(laRequests[luiRequest].muiTile);
+	}
+
+	// Tiles that arrived, a few per frame to spread the cost of the buffers and shapes
+	while ( !maMapped.empty() && lauiBuild.size() < luiMaxBuilds ) {
+		unsigned luiTile = maMapped.back();
+		maMapped.pop_back();
+		if ( maTiles[luiTile].meState == eTile_Mapped ) lauiBuild.push_back(luiTile);
+	}
+	bool lbWake = !maRequests.empty();
+	LeaveCriticalSection(&mLock);
+
+	if ( lbWake ) SetEvent(mhWakeEvent);
+
+	for ( unsigned luiIndex = 0; luiIndex < lauiRelease.size(); ++luiIndex ) {
+		Release(lauiRelease[luiIndex]);
+	}
+	for ( unsigned luiIndex = 0; luiIndex < lauiBuild.size(); ++luiIndex ) {
+		MakeResident(lauiBuild[luiIndex]);
+	}
+}
+
+void cTerrainStreamer::Prefetch( const cVec3& lvPosition )
+{
+	if ( !mbInit ) return;
+
+	int liCenterX, liCenterZ;
+	GetCenterTile(lvPosition, liCenterX, liCenterZ);
+	int liTilesPerSide = (int)mpData->GetTilesPerSide();
+	int liRadius = (int)muiRadius;
+
+	// If the loader is mapping one of these tiles it will drop its view when it sees the state
+	std::vector<unsigned> lauiBuild;
+	EnterCriticalSection(&mLock);
+	for ( int liZ = liCenterZ - liRadius; liZ <= liCenterZ + liRadius; ++liZ ) {
+		for ( int liX = liCenterX - liRadius; liX <= liCenterX + liRadius; ++liX ) {
+			if ( liX < 0 || liZ < 0 || liX >= liTilesPerSide || liZ >= liTilesPerSide ) continue;
+			unsigned luiTile = (unsigned)(liZ * liTilesPerSide + liX);
+			sStreamTile& lTile = maTiles[luiTile];
+			if ( lTile.meState == eTile_Unloaded || lTile.meState == eTile_Requested ) {
+				lTile.mpSamples = MapTile(luiTile, &lTile.mpView);
+				if ( !lTile.mpSamples ) continue;
+				if ( lTile.meState == eTile_Unloaded ) maActive.push_back(luiTile);
+				lTile.meState = eTile_Mapped;
+			}
+			if ( lTile.meState == eTile_Mapped ) lauiBuild.push_back(luiTile);
+		}
+	}
+	LeaveCriticalSection(&mLock);
+
+	for ( unsigned luiIndex = 0; luiIndex < lauiBuild.size(); ++luiIndex ) {
+		MakeResident(lauiBuild[luiIndex]);
+	}
+}
+
+// Creates the vertex buffer and the bullet shape of a mapped tile. Both read the
+// samples where they are, the shape keeps pointing to them while the tile is resident
+void cTerrainStreamer::MakeResident( unsigned luiTile )
+{
+	sStreamTile& lTile = maTiles[luiTile];
+	assert(lTile.meState == eTile_Mapped && lTile.mpSamples);
+	if ( mpData->GetFormat() == eTerrainFormat_Float ) {
+		mpQuadtree->LoadTile(luiTile, (const float*)lTile.mpSamples);
+	} else {
+		mpQuadtree->LoadTile(luiTile, (const short*)lTile.mpSamples);
+	}
+
+	lTile.mpShape = mpData->CreateTileShape(luiTile, lTile.mpSamples);
+	cPhysicsShapes::Get().Register(lTile.mpShape);
+	lTile.mpBody = cPhysics::Get().GetNewBody(lTile.mpShape, 0.0f, mpData->GetTileCenter(luiTile));
+
+	lTile.meState = eTile_Resident;
+	++muiResidentCount;
+}
+
+void cTerrainStreamer::Release( unsigned luiTile )
+{
+	sStreamTile& lTile = maTiles[luiTile];
+	if ( lTile.meState == eTile_Resident ) {
+		cPhysics::Get().RemoveBody(lTile.mpBody);
+		// Last reference, the shape is deleted before its samples are unmapped
+		cPhysicsShapes::Get().Release(lTile.mpShape);
+		mpQuadtree->ReleaseTile(luiTile);
+		--muiResidentCount;
+	}
+	cTerrainFile::UnmapTile(lTile.mpView);
+	lTile.mpView = NULL;
+	lTile.mpSamples = NULL;
+	lTile.mpShape = NULL;
+	lTile.mpBody = NULL;
+	lTile.meState = eTile_Unloaded;
+}
+
+const void* cTerrainStreamer::GetTileSamples( unsigned luiTile ) const
+{
+	if ( luiTile >= maTiles.size() || maTiles[luiTile].meState != eTile_Resident ) return NULL;
+	return maTiles[luiTile].mpSamples;
+}
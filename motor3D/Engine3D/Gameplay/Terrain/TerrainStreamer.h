@@ -0,0 +1,88 @@
+// Pages the tiles of a terrain in and out around a position.
+// A background thread maps the views of the requested tiles and touches their pages,
+// the main thread creates the render mesh and the bullet shape of the tiles that arrived.
+// Terrains with their own samples (no file) skip the thread, their tiles are already there.
+// The number of resident tiles only depends on the radius, never on the size of the world.
+
+#ifndef TERRAIN_STREAMER_H
+#define TERRAIN_STREAMER_H
+
+#include <windows.h>
+#include <vector>
+#include "../../MathLib/MathLib.h"
+
+class cTerrainFile;
+class cTerrainData;
+class cTerrainQuadtree;
+class btHeightfieldTerrainShape;
+class btRigidBody;
+
+class cTerrainStreamer
+{
+public:
+	cTerrainStreamer();
+	~cTerrainStreamer() { Deinit(); }
+
+	// Tiles closer than luiRadius tiles to the position are kept resident. The samples come
+	// from the file, or from the terrain itself when lpFile is NULL
+	bool Init( const cTerrainData* lpData, const cTerrainFile* lpFile, cTerrainQuadtree* lpQuadtree, unsigned luiRadius = 2 );
+	void Deinit();
+
+	// Main thread: requests the tiles around the position, makes resident the ones that
+	// arrived (at most luiMaxBuilds per call) and releases the far ones
+	void Update( const cVec3& lvPosition, unsigned luiMaxBuilds = 4 );
+	// Loads the tiles around the position without the thread (first frame, teleports)
+	void Prefetch( const cVec3& lvPosition );
+
+	// Samples of a resident tile in the format of the terrain, NULL if it is not resident
+	const void* GetTileSamples( unsigned luiTile ) const;
+	inline unsigned GetResidentCount() const { return muiResidentCount; }
+	inline unsigned GetMaxResident() const { return (2 * muiRadius + 3) * (2 * muiRadius + 3); }
+
+private:
+	enum eTileState
+	{
+		eTile_Unloaded = 0,
+		eTile_Requested,		// Waiting for the thread
+		eTile_Mapped,			// The thread mapped it, waiting for the main thread
+		eTile_Resident
+	};
+
+	struct sStreamTile
+	{
+		eTileState meState;
+		void* mpView;
+		const void* mpSamples;
+		btHeightfieldTerrainShape* mpShape;
+		btRigidBody* mpBody;
+	};
+
+	static DWORD WINAPI LoaderMain( LPVOID lpParam );
+	void LoaderLoop();
+
+	const void* MapTile( unsigned luiTile, void** lppView ) const;
+
+	// Main thread only
+	void MakeResident( unsigned luiTile );
+	void Release( unsigned luiTile );
+	void GetCenterTile( const cVec3& lvPosition, int& liTileX, int& liTileZ ) const;
+
+	const cTerrainData* mpData;
+	const cTerrainFile* mpFile;
+	cTerrainQuadtree* mpQuadtree;
+	unsigned muiRadius;
+	unsigned muiResidentCount;
+	std::vector<unsigned> maActive;		// Tiles that are not unloaded, main thread only
+
+	// Shared with the loader thread
+	std::vector<sStreamTile> maTiles;
+	std::vector<unsigned> maRequests;		// Nearest last
+	std::vector<unsigned> maMapped;
+	CRITICAL_SECTION mLock;
+	HANDLE mhThread;
+	HANDLE mhWakeEvent;
+	volatile bool mbQuit;
+	bool mbInit;
+};
+
+#endif
@@ -0,0 +1,689 @@
+#include "VehicleSystem.h"
+#include "..\..\Physics\cPhysics.h"
+#include "..\..\Physics\cPhysicsShapes.h"
+#include "..\..\Physics\cPhysicsLod.h"
+#include "..\..\Utility\ThreadPool.h"
+#include "..\..\Utility\Benchmark.h"
+#include "..\..\Graphics\GLHeaders.h"
+#include "..\..\Graphics\GraphicManager.h"
+#include <assert.h>
+#include <math.h>
+
+static const int kiRightIndex = 0;
+static const int kiUpIndex = 1;
+static const int kiForwardIndex = 2;
+
+///btRaycastVehicle is the interface for the constraint that implements the raycast vehicle
+///notice that for higher-quality slow-moving vehicles, another approach might be better
+///implementing explicit hinged-wheel constraints with cylinder collision, rather then raycasts
+void cVehicleSystem::GetDefaultTuning( sVehicleTuning& lTuning ){
+	lTuning.mfMass = 800.f;
+	lTuning.mfMaxEngineForce = 1500.f;		// 100000.f;
+	lTuning.mfMaxBrakingForce = 100.f;		// 10000.f;
+	lTuning.mfSteeringIncrement = 0.04f;
+	lTuning.mfSteeringClamp = 0.3f;
+	lTuning.mfWheelRadius = 0.35f * PHYSCAR_SCALE;	//** 0.5f;
+	lTuning.mfWheelWidth = 0.2f * PHYSCAR_SCALE;		//* 0.4f;
+	lTuning.mfWheelFriction = 10;					// 1000;//BT_LARGE_FLOAT;
+	lTuning.mfSuspensionStiffness = 50.f;			// 20.f;
+	lTuning.mfSuspensionDamping = 0.3f * 2.0f * btSqrt(lTuning.mfSuspensionStiffness);		// 2.3f;
+	lTuning.mfSuspensionCompression = 0.2f * 2.0f * btSqrt(lTuning.mfSuspensionStiffness);	// 4.4f;
+	lTuning.mfRollInfluence = 0.5f;					// 0.1f;  //1.0f;
+	lTuning.mfSuspensionRestLength = 0.15f * PHYSCAR_SCALE;  //** (0.6);
+}
+
+cVehicleSystem::cVehicleSystem( ){
+	muiNextRay = 0;
+	mbBatchedRays = true;
+	mpWorld = NULL;
+	mRaycaster.mpSystem = this;
+	mbInit = false;
+}
+
+void cVehicleSystem::Init( ){
+	if ( mbInit ) return;
+	// The physics thread uses the pool, it must be started already
+	assert( cThreadPool::Get().IsInit() );
+	// One ray per wheel, the chassis itself is skipped
+	mRays.Init( ePhysicsQuery_Ray, ePhysicsQuery_Objects );
+	cPhysics::Get().GetBulletWorld()->addAction( this );
+	cPhysics::Get().AddSyncCallback( SyncVehicles, this );
+	cPhysics::Get().AddSnapshotCallbacks( WriteSnapshot, ReadSnapshot, this );
+	mbInit = true;
+}
+
+void cVehicleSystem::Deinit( ){
+	if ( !mbInit ) return;
+	while ( !mauiIndexHandle.empty() ){
+		RemoveVehicle( mauiIndexHandle.back() );
+	}
+	cPhysics::Get().RemoveSyncCallback( SyncVehicles, this );
+	cPhysics::Get().RemoveSnapshotCallbacks( this );
+	cPhysics::Get().GetBulletWorld()->removeAction( this );
+
+	// The hulls of the wheel debug draw are ours, the shapes can be gone already
+	for (int i=0;i<m_shapecaches.size();i++)
+	{
+		m_shapecaches[i]->~ShapeCache();
+		btAlignedFree(m_shapecaches[i]);
+	}
+	m_shapecaches.clear();
+	mauiHandleIndex.clear();
+	mauiFreeHandles.clear();
+	mRays.Clear();
+	mbInit = false;
+}
+
+unsigned cVehicleSystem::AddVehicle( const sVehicleTuning& lTuning, const cVec3& lPosition, float lfYaw ){
+	assert( mbInit );
+	// The vehicle keeps a reference to its shapes until it is removed
+	btCollisionShape* lpChassisShape = cPhysicsShapes::Get().GetBox(cVec3(1.f,0.5f,2.f));
+	btCompoundShape* lpCompound = new btCompoundShape();
+	cPhysicsShapes::Get().Register(lpCompound);
+	btTransform localTrans;
+	localTrans.setIdentity();
+	//localTrans effectively shifts the center of mass with respect to the chassis
+	localTrans.setOrigin(btVector3(0,1.4,0));		//** localTrans.setOrigin(btVector3(0,1,0));
+	lpCompound->addChildShape(localTrans,lpChassisShape);
+
+	btRigidBody* lpChassis = cPhysics::Get().GetNewBody(lpCompound, lTuning.mfMass, lPosition, lfYaw);
+	///never deactivate the vehicle near the viewer, the lod lets it sleep when it is far
+	lpChassis->setActivationState(DISABLE_DEACTIVATION);
+	cPhysicsLod::Get().AddBody(lpChassis, ePhysicsLodClass_Vehicle);
+
+	float lfRadius = lTuning.mfWheelRadius;
+	float lfWidth = lTuning.mfWheelWidth;
+	btCollisionShape* lpWheelShape = cPhysicsShapes::Get().GetCylinderX(cVec3(lfWidth,lfRadius,lfRadius));
+
+	/// create vehicle, the system is its action in the world
+	btRaycastVehicle* lpVehicle = new btRaycastVehicle(mWheelTuning, lpChassis, &mRaycaster);
+	//choose coordinate system
+	lpVehicle->setCoordinateSystem(kiRightIndex, kiUpIndex, kiForwardIndex);
+
+	btVector3 wheelDirectionCS0(0,-1,0);
+	btVector3 wheelAxleCS(-1,0,0);
+	float connectionHeight = 1.2f;
+	// front left, front right, rear left and rear right
+	btVector3 laConnections[kuiVehicleWheels] = {
+		btVector3(CUBE_HALF_EXTENTS-(0.3*lfWidth),connectionHeight,2*CUBE_HALF_EXTENTS-lfRadius),
+		btVector3(-CUBE_HALF_EXTENTS+(0.3*lfWidth),connectionHeight,2*CUBE_HALF_EXTENTS-lfRadius),
+		btVector3(-CUBE_HALF_EXTENTS+(0.3*lfWidth),connectionHeight,-2*CUBE_HALF_EXTENTS+lfRadius),
+		btVector3(CUBE_HALF_EXTENTS-(0.3*lfWidth),connectionHeight,-2*CUBE_HALF_EXTENTS+lfRadius)
+	};
+	for (unsigned i=0;i<kuiVehicleWheels;i++){
+		bool isFrontWheel = (i < 2);
+		btWheelInfo& wheel = lpVehicle->addWheel(laConnections[i],wheelDirectionCS0,wheelAxleCS,lTuning.mfSuspensionRestLength,lfRadius,mWheelTuning,isFrontWheel);
+		wheel.m_suspensionStiffness = lTuning.mfSuspensionStiffness;
+		wheel.m_wheelsDampingRelaxation = lTuning.mfSuspensionDamping;
+		wheel.m_wheelsDampingCompression = lTuning.mfSuspensionCompression;
+		wheel.m_frictionSlip = lTuning.mfWheelFriction;
+		wheel.m_rollInfluence = lTuning.mfRollInfluence;
+	}
+	lpVehicle->resetSuspension();
+
+	// Handle of the new place
+	unsigned luiIndex = mapVehicles.size();
+	unsigned luiHandle;
+	if ( mauiFreeHandles.empty() ){
+		luiHandle = mauiHandleIndex.size();
+		mauiHandleIndex.push_back( luiIndex );
+	} else {
+		luiHandle = mauiFreeHandles.back();
+		mauiFreeHandles.pop_back();
+		mauiHandleIndex[luiHandle] = luiIndex;
+	}
+	mauiIndexHandle.push_back( luiHandle );
+
+	mapChassis.push_back( lpChassis );
+	mapVehicles.push_back( lpVehicle );
+	mapCompounds.push_back( lpCompound );
+	mapChassisShapes.push_back( lpChassisShape );
+	mapWheelShapes.push_back( lpWheelShape );
+	maSpawnTransforms.push_back( lpChassis->getWorldTransform() );
+	mafSteering.push_back( 0.0f );
+	mafEngineForce.push_back( 0.0f );
+	mafBrakingForce.push_back( 0.0f );
+	maucReset.push_back( 0 );
+	mafMaxEngineForce.push_back( lTuning.mfMaxEngineForce );
+	mafMaxBrakingForce.push_back( lTuning.mfMaxBrakingForce );
+	mafSteeringIncrement.push_back( lTuning.mfSteeringIncrement );
+	mafSteeringClamp.push_back( lTuning.mfSteeringClamp );
+	// The ccd of bullet sweeps a sphere from the origin of the body, and the origin of the
+	// chassis (its centre of mass) is under the road. The box is swept by the system instead
+	sPhysicsCcd lCcd;
+	cPhysics::GetDefaultCcd( lpChassisShape, lCcd );
+	mafCcdThreshold.push_back( lCcd.mfMotionThreshold );
+	maWheelTransforms.resize( maWheelTransforms.size() + kuiVehicleWheels );
+
+	// GetNewBody waited for the step, the wheels can be read now
+	SyncWheels( luiIndex );
+	return luiHandle;
+}
+
+void cVehicleSystem::RemoveVehicle( unsigned luiVehicle ){
+	assert( luiVehicle < mauiHandleIndex.size() && mauiHandleIndex[luiVehicle] != kuiInvalidVehicle );
+	unsigned luiIndex = mauiHandleIndex[luiVehicle];
+	// No step in flight from here, the vehicle is not used by the physics thread
+	cPhysics::Get().WaitForStep();
+	delete mapVehicles[luiIndex];
+	cPhysicsLod::Get().RemoveBody( mapChassis[luiIndex] );
+	cPhysics::Get().RemoveBody( mapChassis[luiIndex] );
+	cPhysicsShapes::Get().Release( mapCompounds[luiIndex] );
+	cPhysicsShapes::Get().Release( mapChassisShapes[luiIndex] );
+	bool lbSharedWheels = false;
+	for ( unsigned luiOther = 0; luiOther < mapWheelShapes.size(); ++luiOther ){
+		if ( luiOther != luiIndex && mapWheelShapes[luiOther] == mapWheelShapes[luiIndex] ) lbSharedWheels = true;
+	}
+	// A new shape could take the address of the released one
+	if ( !lbSharedWheels ) uncache( mapWheelShapes[luiIndex] );
+	cPhysicsShapes::Get().Release( mapWheelShapes[luiIndex] );
+
+	// The last vehicle takes the place
+	unsigned luiLast = mapVehicles.size() - 1;
+	if ( luiIndex != luiLast ){
+		mapChassis[luiIndex] = mapChassis[luiLast];
+		mapVehicles[luiIndex] = mapVehicles[luiLast];
+		mapCompounds[luiIndex] = mapCompounds[luiLast];
+		mapChassisShapes[luiIndex] = mapChassisShapes[luiLast];
+		mapWheelShapes[luiIndex] = mapWheelShapes[luiLast];
+		maSpawnTransforms[luiIndex] = maSpawnTransforms[luiLast];
+		mafSteering[luiIndex] = mafSteering[luiLast];
+		mafEngineForce[luiIndex] = mafEngineForce[luiLast];
+		mafBrakingForce[luiIndex] = mafBrakingForce[luiLast];
+		maucReset[luiIndex] = maucReset[luiLast];
+		mafMaxEngineForce[luiIndex] = mafMaxEngineForce[luiLast];
+		mafMaxBrakingForce[luiIndex] = mafMaxBrakingForce[luiLast];
+		mafSteeringIncrement[luiIndex] = mafSteeringIncrement[luiLast];
+		mafSteeringClamp[luiIndex] = mafSteeringClamp[luiLast];
+		mafCcdThreshold[luiIndex] = mafCcdThreshold[luiLast];
+		for ( unsigned luiWheel = 0; luiWheel < kuiVehicleWheels; ++luiWheel ){
+			maWheelTransforms[luiIndex * kuiVehicleWheels + luiWheel] = maWheelTransforms[luiLast * kuiVehicleWheels + luiWheel];
+		}
+		mauiIndexHandle[luiIndex] = mauiIndexHandle[luiLast];
+		mauiHandleIndex[mauiIndexHandle[luiIndex]] = luiIndex;
+	}
+	mapChassis.pop_back();
+	mapVehicles.pop_back();
+	mapCompounds.pop_back();
+	mapChassisShapes.pop_back();
+	mapWheelShapes.pop_back();
+	maSpawnTransforms.pop_back();
+	mafSteering.pop_back();
+	mafEngineForce.pop_back();
+	mafBrakingForce.pop_back();
+	maucReset.pop_back();
+	mafMaxEngineForce.pop_back();
+	mafMaxBrakingForce.pop_back();
+	mafSteeringIncrement.pop_back();
+	mafSteeringClamp.pop_back();
+	mafCcdThreshold.pop_back();
+	maWheelTransforms.resize( mapVehicles.size() * kuiVehicleWheels );
+	mauiIndexHandle.pop_back();
+	mauiHandleIndex[luiVehicle] = kuiInvalidVehicle;
+	mauiFreeHandles.push_back( luiVehicle );
+}
+
+void cVehicleSystem::ResetVehicle( unsigned luiVehicle ){
+	unsigned luiIndex = mauiHandleIndex[luiVehicle];
+	mafSteering[luiIndex] = 0.0f;
+	// The chassis belongs to the physics thread, the reset is done before its next step
+	maucReset[luiIndex] = 1;
+}
+
+void cVehicleSystem::ResetIndex( unsigned luiIndex ){
+	// Teleport at rest, the chassis leaves the broadphase and enters it again
+	btRigidBody* lpChassis = mapChassis[luiIndex];
+	cPhysics::Get().ReuseBody( lpChassis, cPhysics::Bullet2Local( maSpawnTransforms[luiIndex] ) );
+	btRaycastVehicle* lpVehicle = mapVehicles[luiIndex];
+	lpVehicle->resetSuspension();
+	for (int i=0;i<lpVehicle->getNumWheels();i++)
+	{
+		//synchronize the wheels with the (interpolated) chassis worldtransform
+		lpVehicle->updateWheelTransform(i,true);
+	}
+	maucReset[luiIndex] = 0;
+}
+
+void cVehicleSystem::SyncVehicles( void* lpData ){
+	cVehicleSystem* lpSystem = (cVehicleSystem*)lpData;
+	for ( unsigned luiIndex = 0; luiIndex < lpSystem->mapVehicles.size(); ++luiIndex ){
+		if ( lpSystem->maucReset[luiIndex] ) lpSystem->ResetIndex( luiIndex );
+		lpSystem->ApplyControls( luiIndex );
+		lpSystem->SyncWheels( luiIndex );
+	}
+}
+
+void cVehicleSystem::ApplyControls( unsigned luiIndex ){
+	btRaycastVehicle* lpVehicle = mapVehicles[luiIndex];
+	// A far vehicle can be asleep, the engine wakes it
+	if ( mafEngineForce[luiIndex] != 0.0f ) mapChassis[luiIndex]->activate();
+	// for rear wheel drive cars
+	for (int i = 0; i < lpVehicle->getNumWheels(); i++){
+		if (lpVehicle->getWheelInfo(i).m_bIsFrontWheel == true){
+			lpVehicle->setSteeringValue(mafSteering[luiIndex], i);
+		}
+		else{
+			lpVehicle->applyEngineForce(mafEngineForce[luiIndex], i);
+			lpVehicle->setBrake(mafBrakingForce[luiIndex], i);
+		}
+	}
+}
+
+void cVehicleSystem::SyncWheels( unsigned luiIndex ){
+	// Wheels relative to the chassis of the last step, the render puts them on the interpolated one
+	btRaycastVehicle* lpVehicle = mapVehicles[luiIndex];
+	btTransform chassisTrans;
+	mapChassis[luiIndex]->getMotionState()->getWorldTransform(chassisTrans);
+	btTransform toChassis = chassisTrans.inverse();
+	for (int i=0;i<lpVehicle->getNumWheels();i++)
+	{
+		lpVehicle->updateWheelTransform(i,true);
+		maWheelTransforms[luiIndex * kuiVehicleWheels + i] = toChassis * lpVehicle->getWheelInfo(i).m_worldTransform;
+	}
+}
+
+// State of a wheel in the snapshots, the chassis is one of the bodies of cPhysics
+struct sSnapshotWheel{
+	float mfRotation;
+	float mfDeltaRotation;
+	float mfSteering;
+	float mfEngineForce;
+	float mfBrake;
+	float mfSuspensionLength;
+	float mfSuspensionRelativeVelocity;
+	float mfSuspensionForce;
+	float mfSkidInfo;
+	float mfClippedInvContactDotSuspension;
+};
+
+void cVehicleSystem::WriteSnapshot( std::vector<unsigned char>& lacBuffer, void* lpData ){
+	// Only the bullet vehicles are read, the controls of the game can be changing
+	cVehicleSystem* lpSystem = (cVehicleSystem*)lpData;
+	unsigned luiCount = lpSystem->mapVehicles.size();
+	cPhysics::SnapshotWrite( lacBuffer, &luiCount, sizeof( luiCount ) );
+	for ( unsigned luiIndex = 0; luiIndex < luiCount; ++luiIndex ){
+		cPhysics::SnapshotWrite( lacBuffer, &lpSystem->mauiIndexHandle[luiIndex], sizeof( unsigned ) );
+		btRaycastVehicle* lpVehicle = lpSystem->mapVehicles[luiIndex];
+		for ( int liWheel = 0; liWheel < lpVehicle->getNumWheels(); ++liWheel ){
+			const btWheelInfo& lInfo = lpVehicle->getWheelInfo( liWheel );
+			sSnapshotWheel lWheel;
+			lWheel.mfRotation = lInfo.m_rotation;
+			lWheel.mfDeltaRotation = lInfo.m_deltaRotation;
+			lWheel.mfSteering = lInfo.m_steering;
+			lWheel.mfEngineForce = lInfo.m_engineForce;
+			lWheel.mfBrake = lInfo.m_brake;
+			lWheel.mfSuspensionLength = lInfo.m_raycastInfo.m_suspensionLength;
+			lWheel.mfSuspensionRelativeVelocity = lInfo.m_suspensionRelativeVelocity;
+			lWheel.mfSuspensionForce = lInfo.m_wheelsSuspensionForce;
+			lWheel.mfSkidInfo = lInfo.m_skidInfo;
+			lWheel.mfClippedInvContactDotSuspension = lInfo.m_clippedInvContactDotSuspension;
+			cPhysics::SnapshotWrite( lacBuffer, &lWheel, sizeof( lWheel ) );
+		}
+	}
+}
+
+bool cVehicleSystem::ReadSnapshot( const unsigned char*& lpucData, const unsigned char* lpucEnd, bool lbApply, void* lpData ){
+	cVehicleSystem* lpSystem = (cVehicleSystem*)lpData;
+	unsigned luiCount;
+	if ( !cPhysics::SnapshotRead( lpucData, lpucEnd, &luiCount, sizeof( luiCount ) ) || luiCount != lpSystem->mapVehicles.size() ) return false;
+	for ( unsigned luiVehicle = 0; luiVehicle < luiCount; ++luiVehicle ){
+		unsigned luiHandle;
+		if ( !cPhysics::SnapshotRead( lpucData, lpucEnd, &luiHandle, sizeof( luiHandle ) ) ) return false;
+		if ( luiHandle >= lpSystem->mauiHandleIndex.size() || lpSystem->mauiHandleIndex[luiHandle] == kuiInvalidVehicle ) return false;
+		unsigned luiIndex = lpSystem->mauiHandleIndex[luiHandle];
+		btRaycastVehicle* lpVehicle = lpSystem->mapVehicles[luiIndex];
+		for ( int liWheel = 0; liWheel < lpVehicle->getNumWheels(); ++liWheel ){
+			sSnapshotWheel lWheel;
+			if ( !cPhysics::SnapshotRead( lpucData, lpucEnd, &lWheel, sizeof( lWheel ) ) ) return false;
+			// The check only walks the buffer
+			if ( !lbApply ) continue;
+			btWheelInfo& lInfo = lpVehicle->getWheelInfo( liWheel );
+			lInfo.m_rotation = lWheel.mfRotation;
+			lInfo.m_deltaRotation = lWheel.mfDeltaRotation;
+			lInfo.m_steering = lWheel.mfSteering;
+			lInfo.m_engineForce = lWheel.mfEngineForce;
+			lInfo.m_brake = lWheel.mfBrake;
+			lInfo.m_raycastInfo.m_suspensionLength = lWheel.mfSuspensionLength;
+			lInfo.m_suspensionRelativeVelocity = lWheel.mfSuspensionRelativeVelocity;
+			lInfo.m_wheelsSuspensionForce = lWheel.mfSuspensionForce;
+			lInfo.m_skidInfo = lWheel.mfSkidInfo;
+			lInfo.m_clippedInvContactDotSuspension = lWheel.mfClippedInvContactDotSuspension;
+			// The controls of the game go back with the wheels, the next sync applies them again
+			if ( lInfo.m_bIsFrontWheel ){
+				lpSystem->mafSteering[luiIndex] = lWheel.mfSteering;
+			} else {
+				lpSystem->mafEngineForce[luiIndex] = lWheel.mfEngineForce;
+				lpSystem->mafBrakingForce[luiIndex] = lWheel.mfBrake;
+			}
+		}
+		if ( !lbApply ) continue;
+		lpSystem->maucReset[luiIndex] = 0;
+		lpSystem->SyncWheels( luiIndex );
+	}
+	return true;
+}
+
+void cVehicleSystem::updateAction( btCollisionWorld* lpWorld, btScalar lfStep ){
+	mpWorld = (btDynamicsWorld*)lpWorld;
+	if ( mbBatchedRays ){
+		// The rays of all the wheels, as btRaycastVehicle::rayCast builds them, in the
+		// order updateVehicle asks for them
+		mRays.Clear();
+		for ( unsigned luiIndex = 0; luiIndex < mapVehicles.size(); ++luiIndex ){
+			btRaycastVehicle* lpVehicle = mapVehicles[luiIndex];
+			for ( int liWheel = 0; liWheel < lpVehicle->getNumWheels(); ++liWheel ){
+				lpVehicle->updateWheelTransform( liWheel, false );
+				const btWheelInfo& lWheel = lpVehicle->getWheelInfo( liWheel );
+				btScalar lfLength = lWheel.getSuspensionRestLength() + lWheel.m_wheelsRadius;
+				const btVector3& lFrom = lWheel.m_raycastInfo.m_hardPointWS;
+				btVector3 lTo = lFrom + lWheel.m_raycastInfo.m_wheelDirectionWS * lfLength;
+				mRays.AddRay( cPhysics::Bullet2Local( lFrom ), cPhysics::Bullet2Local( lTo ), mapChassis[luiIndex] );
+			}
+		}
+		mRays.Run();
+		muiNextRay = 0;
+	}
+	// The vehicles push their chassis, one after the other
+	for ( unsigned luiIndex = 0; luiIndex < mapVehicles.size(); ++luiIndex ){
+		mapVehicles[luiIndex]->updateVehicle( lfStep );
+		SweepChassis( luiIndex, lfStep );
+	}
+	assert( !mbBatchedRays || muiNextRay == mRays.GetCount() );
+}
+
+void cVehicleSystem::SweepChassis( unsigned luiIndex, btScalar lfStep ){
+	btRigidBody* lpChassis = mapChassis[luiIndex];
+	btVector3 lVelocity = lpChassis->getLinearVelocity();
+	btVector3 lMotion = lVelocity * lfStep;
+	float lfThreshold = mafCcdThreshold[luiIndex];
+	if ( lfThreshold <= 0.0f || lMotion.length2() < lfThreshold * lfThreshold ) return;
+
+	// The box from its place to the place of the next step, against the static world
+	btTransform lFrom = lpChassis->getWorldTransform() * mapCompounds[luiIndex]->getChildTransform( 0 );
+	btTransform lTo = lFrom;
+	lTo.setOrigin( lFrom.getOrigin() + lMotion );
+	btCollisionWorld::ClosestConvexResultCallback lResult( lFrom.getOrigin(), lTo.getOrigin() );
+	lResult.m_collisionFilterGroup = btBroadphaseProxy::DefaultFilter;
+	lResult.m_collisionFilterMask = btBroadphaseProxy::StaticFilter;
+	mpWorld->convexSweepTest( (const btConvexShape*)mapChassisShapes[luiIndex], lFrom, lTo, lResult );
+	if ( !lResult.hasHit() ) return;
+
+	// The velocity into the surface is cut to what reaches it in the next step, the solver
+	// takes the contact from there. The rest of the velocity (sliding along it) is kept
+	float lfInto = lVelocity.dot( lResult.m_hitNormalWorld );
+	if ( lfInto >= 0.0f ) return;
+	lpChassis->setLinearVelocity( lVelocity - lResult.m_hitNormalWorld * ( lfInto * ( 1.0f - lResult.m_closestHitFraction ) ) );
+}
+
+void* cVehicleSystem::cBatchRaycaster::castRay( const btVector3& lFrom, const btVector3& lTo, btVehicleRaycasterResult& lResult ){
+	return mpSystem->CastRay( lFrom, lTo, lResult );
+}
+
+void* cVehicleSystem::CastRay( const btVector3& lFrom, const btVector3& lTo, btVehicleRaycaster::btVehicleRaycasterResult& lResult ){
+	if ( !mbBatchedRays ){
+		// One by one, like btDefaultVehicleRaycaster
+		btDefaultVehicleRaycaster lRaycaster( mpWorld );
+		return lRaycaster.castRay( lFrom, lTo, lResult );
+	}
+	unsigned luiRay = muiNextRay++;
+	assert( luiRay < mRays.GetCount() );
+	if ( !mRays.IsHit( luiRay ) ) return NULL;
+	btRigidBody* lpBody = btRigidBody::upcast( (btCollisionObject*)mRays.GetObject( luiRay ) );
+	if ( !lpBody || !lpBody->hasContactResponse() ) return NULL;
+	lResult.m_hitPointInWorld = cPhysics::Local2Bullet( mRays.GetPoint( luiRay ) );
+	lResult.m_hitNormalInWorld = cPhysics::Local2Bullet( mRays.GetNormal( luiRay ) );
+	lResult.m_hitNormalInWorld.normalize();
+	lResult.m_distFraction = mRays.GetFraction( luiRay );
+	return lpBody;
+}
+
+void cVehicleSystem::Render( ){
+
+	btScalar m[16];
+	int i;
+
+	btVector3 wheelColor(1,0,0);
+
+	// Not used to draw the wheels, the broadphase belongs to the physics thread
+	btVector3	worldBoundsMin(0,0,0),worldBoundsMax(0,0,0);
+
+	for ( unsigned luiIndex = 0; luiIndex < mapVehicles.size(); ++luiIndex )
+	{
+		btTransform renderTrans;
+		cPhysics::Get().GetInterpolatedTransform(mapChassis[luiIndex], renderTrans);
+
+		for (i=0;i<mapVehicles[luiIndex]->getNumWheels();i++)
+		{
+			btTransform wheelTrans = renderTrans * maWheelTransforms[luiIndex * kuiVehicleWheels + i];
+
+			//draw wheels (cylinders)
+			wheelTrans.getOpenGLMatrix(m);
+			glPushMatrix();
+			cVec3 lTranslation = cPhysics::Get().Bullet2Local(wheelTrans.getOrigin());
+
+			cMatrix lTransMatrix, lRotMatrix;
+			lTransMatrix.LoadTranslation(lTranslation);
+			btQuaternion btq = wheelTrans.getRotation();
+			cVec3 lqAxis = cPhysics::Get().Bullet2Local(btq.getAxis());
+			lRotMatrix.LoadRotation(lqAxis, btq.getAngle());
+
+			cGraphicManager::Get().SetWorldMatrix(lRotMatrix * lTransMatrix);
+			debugWheels(m,mapWheelShapes[luiIndex],wheelColor,1,worldBoundsMin,worldBoundsMax);
+
+			lTransMatrix.LoadIdentity();
+			cGraphicManager::Get().SetWorldMatrix(lTransMatrix);
+
+			glPopMatrix();
+		}
+	}
+}
+
+void cVehicleSystem::SetControls( unsigned luiVehicle, float lfSteering, float lfEngineForce, float lfBrakingForce ){
+	unsigned luiIndex = mauiHandleIndex[luiVehicle];
+	mafSteering[luiIndex] = btClamped( lfSteering, -mafSteeringClamp[luiIndex], mafSteeringClamp[luiIndex] );
+	mafEngineForce[luiIndex] = lfEngineForce;
+	mafBrakingForce[luiIndex] = lfBrakingForce;
+}
+
+void cVehicleSystem::MoveForward( unsigned luiVehicle, float lfTimestep ){
+	unsigned luiIndex = mauiHandleIndex[luiVehicle];
+	mafEngineForce[luiIndex] = mafMaxEngineForce[luiIndex]; // * lfTimestep;
+	mafBrakingForce[luiIndex] = 0.f;
+}
+
+void cVehicleSystem::Break( unsigned luiVehicle, float lfTimestep ){
+	unsigned luiIndex = mauiHandleIndex[luiVehicle];
+	mafBrakingForce[luiIndex] = mafMaxBrakingForce[luiIndex]; // * lfTimestep;
+	mafEngineForce[luiIndex] = 0.f;
+}
+
+void cVehicleSystem::SteeringLeft( unsigned luiVehicle, float lfTimestep ){
+	unsigned luiIndex = mauiHandleIndex[luiVehicle];
+	mafSteering[luiIndex] += mafSteeringIncrement[luiIndex] * lfTimestep * 60.f;
+	if (mafSteering[luiIndex] > mafSteeringClamp[luiIndex])
+		mafSteering[luiIndex] = mafSteeringClamp[luiIndex];
+}
+
+void cVehicleSystem::SteeringRight( unsigned luiVehicle, float lfTimestep ){
+	unsigned luiIndex = mauiHandleIndex[luiVehicle];
+	mafSteering[luiIndex] -= mafSteeringIncrement[luiIndex] * lfTimestep * 60.f;
+	if (mafSteering[luiIndex] < -mafSteeringClamp[luiIndex])
+		mafSteering[luiIndex] = -mafSteeringClamp[luiIndex];
+}
+
+cVec3 cVehicleSystem::GetChassisPosition( unsigned luiVehicle ) const{
+	// Render position, interpolated between the fixed steps
+	btTransform chassisWorldTrans;
+	cPhysics::Get().GetInterpolatedTransform(GetChassis(luiVehicle), chassisWorldTrans);
+	cMatrix lmChasisTrans = cPhysics::Get().Bullet2Local(chassisWorldTrans);
+
+	return lmChasisTrans.GetPosition();
+}
+
+cVec3 cVehicleSystem::GetChassisRotation( unsigned luiVehicle ) const{
+	btTransform chassisWorldTrans;
+	cPhysics::Get().GetInterpolatedTransform(GetChassis(luiVehicle), chassisWorldTrans);
+
+	btQuaternion lbtq = chassisWorldTrans.getRotation();
+	return cPhysics::Get().Bullet2Local(lbtq.getAxis() * lbtq.getAngle());
+}
+
+void cVehicleSystem::Benchmark( unsigned luiCars, unsigned luiSteps ){
+	static const char* lacModes[] = { "one by one", "batched" };
+	static const unsigned kuiGridSide = 8;
+	static const float kfPitch = 8.0f;
+	const float lfStep = 1.0f / 60.0f;
+	cVehicleSystem& lSystem = cVehicleSystem::Get();
+	assert( lSystem.mbInit );
+
+	// Grid of cars over the start, they fall on the ground and drive in circles
+	sVehicleTuning lTuning;
+	GetDefaultTuning( lTuning );
+	std::vector<unsigned> lauiCars;
+	for ( unsigned luiCar = 0; luiCar < luiCars; ++luiCar ){
+		cVec3 lPosition( ( luiCar % kuiGridSide ) * kfPitch - kuiGridSide * kfPitch * 0.5f, 4.0f + ( luiCar / ( kuiGridSide * kuiGridSide ) ) * 4.0f,
+						 ( ( luiCar / kuiGridSide ) % kuiGridSide ) * kfPitch - kuiGridSide * kfPitch * 0.5f );
+		lauiCars.push_back( lSystem.AddVehicle( lTuning, lPosition, 0.0f ) );
+	}
+
+	cBenchTimer lTimer;
+	// Nothing runs in the physics thread while the main thread is here
+	btDiscreteDynamicsWorld* lpWorld = cPhysics::Get().GetBulletWorld();
+	bool lbBatched = lSystem.mbBatchedRays;
+
+	for ( unsigned luiMode = 0; luiMode < 2; ++luiMode ){
+		lSystem.mbBatchedRays = ( luiMode == 1 );
+		for ( unsigned luiCar = 0; luiCar < luiCars; ++luiCar ){
+			lSystem.ResetVehicle( lauiCars[luiCar] );
+		}
+
+		double ldTotal = 0.0, ldWorst = 0.0;
+		for ( unsigned luiStep = 0; luiStep < luiSteps; ++luiStep ){
+			// AI: full throttle, every car with its own slow slalom
+			for ( unsigned luiCar = 0; luiCar < luiCars; ++luiCar ){
+				float lfSteering = lTuning.mfSteeringClamp * sinf( luiStep * 0.02f + luiCar );
+				lSystem.SetControls( lauiCars[luiCar], lfSteering, lTuning.mfMaxEngineForce, 0.0f );
+			}
+			SyncVehicles( &lSystem );
+
+			lTimer.Start( );
+			lpWorld->stepSimulation( lfStep, 1, lfStep );
+			double ldTime = lTimer.GetMs( );
+			ldTotal += ldTime;
+			if ( ldTime > ldWorst ) ldWorst = ldTime;
+		}
+
+		BenchReport( "Vehicle benchmark, wheel rays %s, %u cars, %u threads: mean step %.2f ms, worst step %.2f ms",
+					 lacModes[luiMode], lSystem.GetCount(), ( luiMode == 0 ) ? 1 : cThreadPool::Get().GetThreadCount(),
+					 ldTotal / luiSteps, ldWorst );
+	}
+
+	lSystem.mbBatchedRays = lbBatched;
+	for ( unsigned luiCar = 0; luiCar < luiCars; ++luiCar ){
+		lSystem.RemoveVehicle( lauiCars[luiCar] );
+	}
+}
+
+cVehicleSystem::ShapeCache*		cVehicleSystem::cache(btConvexShape* shape)
+{
+	ShapeCache*		sc=NULL;
+	for (int i=0;i<m_shapecaches.size() && !sc;i++)
+	{
+		if (m_shapecaches[i]->m_shape==shape) sc=m_shapecaches[i];
+	}
+	if(!sc)
+	{
+		sc=new(btAlignedAlloc(sizeof(ShapeCache),16)) ShapeCache(shape);
+		sc->m_shapehull.buildHull(shape->getMargin());
+		m_shapecaches.push_back(sc);
+		/* Build edges	*/ 
+		const int			ni=sc->m_shapehull.numIndices();
+		const int			nv=sc->m_shapehull.numVertices();
+		const unsigned int*	pi=sc->m_shapehull.getIndexPointer();
+		const btVector3*	pv=sc->m_shapehull.getVertexPointer();
+		btAlignedObjectArray<ShapeCache::Edge*>	edges;
+		sc->m_edges.reserve(ni);
+		edges.resize(nv*nv,0);
+		for(int i=0;i<ni;i+=3)
+		{
+			const unsigned int* ti=pi+i;
+			const btVector3		nrm=btCross(pv[ti[1]]-pv[ti[0]],pv[ti[2]]-pv[ti[0]]).normalized();
+			for(int j=2,k=0;k<3;j=k++)
+			{
+				const unsigned int	a=ti[j];
+				const unsigned int	b=ti[k];
+				ShapeCache::Edge*&	e=edges[btMin(a,b)*nv+btMax(a,b)];
+				if(!e)
+				{
+					sc->m_edges.push_back(ShapeCache::Edge());
+					e=&sc->m_edges[sc->m_edges.size()-1];
+					e->n[0]=nrm;e->n[1]=-nrm;
+					e->v[0]=a;e->v[1]=b;
+				}
+				else
+				{
+					e->n[1]=nrm;
+				}
+			}
+		}
+	}
+	return(sc);
+}
+
+void cVehicleSystem::uncache(const btCollisionShape* shape)
+{
+	for (int i=0;i<m_shapecaches.size();i++)
+	{
+		if (m_shapecaches[i]->m_shape!=shape) continue;
+		m_shapecaches[i]->~ShapeCache();
+		btAlignedFree(m_shapecaches[i]);
+		m_shapecaches.swap(i,m_shapecaches.size()-1);
+		m_shapecaches.pop_back();
+		return;
+	}
+}
+
+void cVehicleSystem::debugWheels(btScalar* m, const btCollisionShape* shape, const btVector3& color,int	debugMode,const btVector3& worldBoundsMin,const btVector3& worldBoundsMax){
+	ShapeCache*	sc=cache((btConvexShape*)shape);
+
+	btShapeHull* hull = &sc->m_shapehull; //(btShapeHull*)shape->getUserPointer();
+
+	if (hull->numTriangles () > 0)
+	{
+		int index = 0;
+		const unsigned int* idx = hull->getIndexPointer();
+		const btVector3* vtx = hull->getVertexPointer();
+
+		glBegin (GL_TRIANGLES);
+
+		for (int i = 0; i < hull->numTriangles (); i++)
+		{
+			int i1 = index++;
+			int i2 = index++;
+			int i3 = index++;
+			btAssert(i1 < hull->numIndices () &&
+				i2 < hull->numIndices () &&
+				i3 < hull->numIndices ());
+
+			int index1 = idx[i1];
+			int index2 = idx[i2];
+			int index3 = idx[i3];
+			btAssert(index1 < hull->numVertices () &&
+				index2 < hull->numVertices () &&
+				index3 < hull->numVertices ());
+
+			btVector3 v1 = vtx[index1];
+			btVector3 v2 = vtx[index2];
+			btVector3 v3 = vtx[index3];
+			btVector3 normal = (v3-v1).cross(v2-v1);
+			normal.normalize ();
+			glNormal3f(normal.getX(),normal.getY(),normal.getZ());
+			glVertex3f (v1.x(), v1.y(), v1.z());
+			glVertex3f (v2.x(), v2.y(), v2.z());
+			glVertex3f (v3.x(), v3.y(), v3.z());
+
+		}
+		glEnd ();
+	}
+	glNormal3f(0,1,0);
+}
@@ -0,0 +1,188 @@
+/*
+Bullet Continuous Collision Detection and Physics Library
+Copyright (c) 2003-2006 Erwin Coumans  http://continuousphysics.com/Bullet/
+
+This software is provided 'as-is', without any express or implied warranty.
+In no event will the authors be held liable for any damages arising from the use of this software.
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it freely,
+subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must not claim that you wrote the original software. If you use this software in a product, an acknowledgment in the product documentation would be appreciated but is not required.
+2. Altered source versions must be plainly marked as such, and must not be misrepresented as being the original software.
+3. This notice may not be removed or altered from any source distribution.
+*/
+#ifndef VEHICLE_SYSTEM_H
+#define VEHICLE_SYSTEM_H
+
+// Raycast vehicles of the game (player, traffic, AI). The state of the vehicles and their
+// tuning are kept in SoA arrays, one entry per vehicle. The system is the only action of
+// the world for all of them: every step it casts the rays of all the wheels in one batch,
+// split between the threads of the pool, and then updates the vehicles one by one
+
+#include <vector>
+#include "../../Libraries/Bullet/include/BulletDynamics/Vehicle/btRaycastVehicle.h"
+#include "../../Mathlib/Mathlib.h"
+#include "../../Libraries/Bullet/include/BulletCollision/CollisionShapes/btShapeHull.h"
+#include "../../Utility/Singleton.h"
+#include "../../Physics/cPhysicsQuery.h"
+
+#define PHYSCAR_SCALE 1
+#define CUBE_HALF_EXTENTS 1
+
+static const unsigned kuiVehicleWheels = 4;
+static const unsigned kuiInvalidVehicle = 0xFFFFFFFF;
+
+// Tuning of a vehicle
+struct sVehicleTuning{
+	float mfMass;
+	float mfMaxEngineForce;			// This should be engine/velocity dependent
+	float mfMaxBrakingForce;
+	float mfSteeringIncrement;		// Per frame at 60 fps, scaled by the frame time
+	float mfSteeringClamp;
+	float mfWheelRadius;
+	float mfWheelWidth;
+	// The coefficient of friction between the tyre and the ground.
+	// Should be about 0.8 for realistic cars, but can increased for better handling.
+	// Set large (10000.0) for kart racers
+	float mfWheelFriction;
+	// The stiffness constant for the suspension.
+	// 10.0 - Offroad buggy, 50.0 - Sports car, 200.0 - F1 Car
+	float mfSuspensionStiffness;
+	// The damping coefficient for when the suspension is expanding, slightly larger than
+	// the compression one, eg 0.2 to 0.5 of the critical damping
+	float mfSuspensionDamping;
+	// The damping coefficient for when the suspension is compressed.
+	// Set to k * 2.0 * btSqrt(suspensionStiffness) so k is proportional to critical damping.
+	// k = 0.0 undamped & bouncy, k = 1.0 critical damping
+	// 0.1 to 0.3 are good values
+	float mfSuspensionCompression;
+	// Reduces the rolling torque applied from the wheels that cause the vehicle to roll over.
+	// This is a bit of a hack, but it's quite effective. 0.0 = no roll, 1.0 = physical behaviour.
+	// If m_frictionSlip is too high, you'll need to reduce this to stop the vehicle rolling over.
+	// You should also try lowering the vehicle's centre of mass
+	float mfRollInfluence;
+	// The maximum length of the suspension (metres)
+	float mfSuspensionRestLength;
+};
+
+class cVehicleSystem : public cSingleton<cVehicleSystem>, public btActionInterface{
+public:
+	static void GetDefaultTuning( sVehicleTuning& lTuning );
+
+	// Becomes the action of the vehicles in the world of cPhysics
+	void Init( );
+	// Removes every vehicle and leaves the world
+	void Deinit( );
+
+	// The vehicles are known by a handle that doesn't change when others are removed.
+	// They keep a reference to their shapes until they are removed
+	unsigned AddVehicle( const sVehicleTuning& lTuning, const cVec3& lPosition, float lfYaw );
+	void RemoveVehicle( unsigned luiVehicle );
+	// Back to the place where the vehicle was added, at rest, before the next step
+	void ResetVehicle( unsigned luiVehicle );
+	inline unsigned GetCount( ) const { return mapVehicles.size(); }
+
+	// Controls, they reach the wheels before the next step
+	void MoveForward( unsigned luiVehicle, float lfTimestep );
+	void Break( unsigned luiVehicle, float lfTimestep );
+	void SteeringLeft( unsigned luiVehicle, float lfTimestep );
+	void SteeringRight( unsigned luiVehicle, float lfTimestep );
+	void SetControls( unsigned luiVehicle, float lfSteering, float lfEngineForce, float lfBrakingForce );
+	inline float GetEngineForce( unsigned luiVehicle ) const { return mafEngineForce[mauiHandleIndex[luiVehicle]]; }
+	inline float GetBrakingForce( unsigned luiVehicle ) const { return mafBrakingForce[mauiHandleIndex[luiVehicle]]; }
+
+	// Render position and rotation of the chassis, interpolated between the fixed steps
+	cVec3 GetChassisPosition( unsigned luiVehicle ) const;
+	cVec3 GetChassisRotation( unsigned luiVehicle ) const;
+	inline btRigidBody* GetChassis( unsigned luiVehicle ) const { return mapChassis[mauiHandleIndex[luiVehicle]]; }
+
+	// Draws the wheels of every vehicle
+	void Render( );
+
+	// Action of the world, in the physics thread
+	virtual void updateAction( btCollisionWorld* lpWorld, btScalar lfStep );
+	virtual void debugDraw( btIDebugDraw* lpDebugDrawer ) { ; }
+
+	// Adds luiCars AI cars to the running game and times luiSteps steps of the world with
+	// the wheel rays cast one by one and in parallel batches. The cars are removed at the end
+	static void Benchmark( unsigned luiCars = 64, unsigned luiSteps = 300 );
+
+	friend class cSingleton<cVehicleSystem>;
+
+private:
+	// Raycaster shared by the vehicles, it gives the results of the batch in order
+	class cBatchRaycaster : public btVehicleRaycaster{
+	public:
+		cBatchRaycaster( ) { mpSystem = NULL; }
+		virtual void* castRay( const btVector3& lFrom, const btVector3& lTo, btVehicleRaycasterResult& lResult );
+		cVehicleSystem* mpSystem;
+	};
+
+	/* aadido para depuracion de ruedas */
+	struct ShapeCache{
+		struct Edge { btVector3 n[2];int v[2]; };
+		ShapeCache(btConvexShape* s) : m_shape(s), m_shapehull(s) {}
+		const btConvexShape*		m_shape;
+		btShapeHull					m_shapehull;
+		btAlignedObjectArray<Edge>	m_edges;
+	};
+
+	cVehicleSystem( );
+	void* CastRay( const btVector3& lFrom, const btVector3& lTo, btVehicleRaycaster::btVehicleRaycasterResult& lResult );
+	// Main thread while the world is idle: resets, controls and wheel transforms
+	static void SyncVehicles( void* lpData );
+	// Wheels of the physics snapshots
+	static void WriteSnapshot( std::vector<unsigned char>& lacBuffer, void* lpData );
+	static bool ReadSnapshot( const unsigned char*& lpucData, const unsigned char* lpucEnd, bool lbApply, void* lpData );
+	void ResetIndex( unsigned luiIndex );
+	void ApplyControls( unsigned luiIndex );
+	void SyncWheels( unsigned luiIndex );
+	// Physics thread, after the vehicle: continuous collision of the box of a fast chassis
+	void SweepChassis( unsigned luiIndex, btScalar lfStep );
+	void debugWheels(btScalar* m, const btCollisionShape* shape, const btVector3& color,int	debugMode,const btVector3& worldBoundsMin,const btVector3& worldBoundsMax);
+	// Hulls of the debug draw by shape, the shapes are shared with other owners so their user
+	// pointer is not ours. A hull goes with the last vehicle of its shape
+	ShapeCache*	cache(btConvexShape*);
+	void uncache(const btCollisionShape*);
+
+	// Vehicles, the last one fills the place of a removed one
+	std::vector<btRigidBody*> mapChassis;
+	std::vector<btRaycastVehicle*> mapVehicles;
+	std::vector<btCompoundShape*> mapCompounds;
+	std::vector<btCollisionShape*> mapChassisShapes;
+	std::vector<btCollisionShape*> mapWheelShapes;
+	btAlignedObjectArray<btTransform> maSpawnTransforms;
+	// Controls of the game
+	std::vector<float> mafSteering;
+	std::vector<float> mafEngineForce;
+	std::vector<float> mafBrakingForce;
+	std::vector<unsigned char> maucReset;
+	// Tuning of the controls, the suspension and the tyres are kept by the wheels of bullet
+	std::vector<float> mafMaxEngineForce;
+	std::vector<float> mafMaxBrakingForce;
+	std::vector<float> mafSteeringIncrement;
+	std::vector<float> mafSteeringClamp;
+	// Motion in a step over which the chassis is swept, half of the thinnest side of its box
+	std::vector<float> mafCcdThreshold;
+	// Wheels relative to the chassis, kuiVehicleWheels per vehicle, taken when the world is idle
+	btAlignedObjectArray<btTransform> maWheelTransforms;
+
+	// Handles to places in the arrays and back
+	std::vector<unsigned> mauiHandleIndex;
+	std::vector<unsigned> mauiIndexHandle;
+	std::vector<unsigned> mauiFreeHandles;
+
+	// Rays of the wheels of the step in the physics thread
+	cPhysicsQueryBatch mRays;
+	unsigned muiNextRay;
+	bool mbBatchedRays;
+	btDynamicsWorld* mpWorld;
+	cBatchRaycaster mRaycaster;
+	btRaycastVehicle::btVehicleTuning mWheelTuning;
+	bool mbInit;
+
+	btAlignedObjectArray<ShapeCache*>	m_shapecaches;
+};
+
+#endif
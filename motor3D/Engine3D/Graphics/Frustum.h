@@ -267,6 +267,43 @@ class Frustum
 			return true;
 		}
 
+
+		//////////////////////////////////////////////////////////
+		///	Function: "boxInFrustum"
+		//
+		///	FirstModified: 10/19/2026
+		//
+		///	\param float minX, minY, minZ		The minimum corner of the box.
+		//		   float maxX, maxY, maxZ		The maximum corner of the box.
+		//
+		///	Output: None
+		//
+		///	\return True if any part of the box may be in the frustum.
+		//
+		///	Purpose: Checks an axis aligned box against the frustum.
+		//			 Only the corner furthest along each plane normal is
+		//			 tested, so it is conservative near the frustum corners.
+		//////////////////////////////////////////////////////////
+		bool boxInFrustum(float minX, float minY, float minZ,
+						  float maxX, float maxY, float maxZ)
+		{
+			// Loop through the sides of the frustum.
+			for (int i = 0; i < 6; i++)
+			{
+				// Pick the corner of the box furthest along the normal.
+				float x = (frustum[i][0] >= 0) ? maxX : minX;
+				float y = (frustum[i][1] >= 0) ? maxY : minY;
+				float z = (frustum[i][2] >= 0) ? maxZ : minZ;
+
+				// If even that corner is behind the side, the box is outside.
+				if (frustum[i][0] * x + frustum[i][1] * y + frustum[i][2] * z + frustum[i][3] <= 0)
+					return false;
+			}
+
+			// Some part of the box is inside the frustum.
+			return true;
+		}
+
 };
 
 #endif
\ No newline at end of file
@@ -89,6 +89,13 @@ bool cMaterial::Init( const std::string &lacNameID, const std::string &lacFile )
 	std::string lacEffectPath = lhRoot.ToElement()->Attribute("effectPath");
 	mEffect = cEffectManager::Get().LoadResource( lacEffectName, lacEffectPath );
 
+	// Optional skinning mode: "matrix" (default) or "dq"
+	meSkinning = eSkinning_Matrix;
+	const char * lacSkinning = lhRoot.ToElement()->Attribute("skinning");
+	if (lacSkinning && (lacSkinning[0] == 'd' || lacSkinning[0] == 'D')){
+		meSkinning = eSkinning_DualQuaternion;
+	}
+
 	// Read all the animations
 	maTextureData.resize(0);
 	lpElem=lhRoot.FirstChild( "Texture" ).Element();
@@ -124,7 +131,7 @@ void cMaterial::PrepareRender() {
 	assert( mEffect.IsValidHandle() );
 	cEffect * lpEffect = (cEffect *)mEffect.GetResource();
 	assert( lpEffect );
-	lpEffect->SetTechnique("Technique0");
+	lpEffect->SetTechnique(macTechnique);
 	// Set Properties
 	cMatrix lWVPMatrix = cGraphicManager::Get().GetWVPMatrix();
 	lpEffect->SetParam("worldViewProj", lWVPMatrix );
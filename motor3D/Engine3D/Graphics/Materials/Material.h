@@ -17,11 +17,18 @@ struct cTextureData
 	cResourceHandle mTexture;
 };
 
+// Skinning used by the skeletal meshes drawn with the material
+enum eSkinningMode
+{
+	eSkinning_Matrix = 0,
+	eSkinning_DualQuaternion
+};
+
 /*******************/
 
 class cMaterial : public cResource {
 	public:
-		cMaterial() { mbLoaded = false; }
+		cMaterial() { mbLoaded = false; meSkinning = eSkinning_Matrix; macTechnique = "Technique0"; }
 		virtual bool Init( const std::string &lacNameID, void * lpMemoryData, int liDataType );
 		bool Init( const std::string &lacNameID, const std::string &lacFile );
 		virtual void Deinit();
@@ -31,12 +38,17 @@ class cMaterial : public cResource {
 		bool SetFirstPass();
 		bool SetNextPass();
 		inline cResourceHandle GetEffect() { return mEffect; }
+		inline eSkinningMode GetSkinning() const { return meSkinning; }
+		// Technique PrepareRender selects, "Technique0" by default
+		inline void SetTechnique( const std::string &lacTechnique ) { macTechnique = lacTechnique; }
 	private:
 		void ReadAllTextures(aiMaterial * lpAiMaterial, cMaterialData * lpMaterialData);
 		std::string macFile;
+		std::string macTechnique;
 		std::vector<cTextureData> maTextureData;
 		//cResourceHandle mDiffuseTexture;
 		cResourceHandle mEffect;
+		eSkinningMode meSkinning;
 		bool mbLoaded;
 };
 
@@ -8,6 +8,29 @@
 #include <tinystr.h>
 #include <tinyxml.h>
 #include <windows.h>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+
+// Cooked cache of a core model. The header is followed by the sizes of the
+// Cal3D file images (skeleton, animations and meshes), the images themselves,
+// the interleaved vertices and the indices. Every block is 4 bytes aligned
+struct sSkeletalCacheHeader{
+	unsigned muiMagic;
+	unsigned muiVersion;
+	unsigned muiSourceHash;
+	unsigned muiChunkCount;
+	unsigned muiTexCoordCount;
+	unsigned muiVertexCount;
+	unsigned muiIndexCount;
+};
+
+static const unsigned kuiSkeletalCacheMagic = 0x434C4B53; // "SKLC"
+static const unsigned kuiSkeletalCacheVersion = 1;
+
+static inline unsigned AlignCacheSize( unsigned luiSize ){
+	return (luiSize + 3) & ~3u;
+}
 
 bool cSkeletalCoreModel::Init( const std::string &lacNameID, const std::string &lacFile ){
 	// Get the name and the directory
@@ -41,14 +64,12 @@ bool cSkeletalCoreModel::Init( const std::string &lacNameID, const std::string &
 
 	// Obtain the Skeleton Path
 	std::string lacSkeletonFile = lacBaseDirectory + lhRoot.ToElement()->Attribute("skeletonfile");
-	
-	// Load the skeleton
-	bool lbIsOk = mpCoreModel->loadCoreSkeleton(lacSkeletonFile);
-	
-	// All is ok?
-	assert(lbIsOk);
 
-	// Read all the animations
+	// The cache is keyed by the XML and the stamps of all the source files
+	unsigned luiSourceHash = cFileUtils::HashFileStamp(lacFile);
+	luiSourceHash = cFileUtils::HashFileStamp(lacSkeletonFile, luiSourceHash);
+
+	// Read all the animations (the data is loaded later, from the cache or the files)
 	lpElem=lhRoot.FirstChild( "Animation" ).Element();
 	for( lpElem; lpElem; lpElem = lpElem->NextSiblingElement("Animation")){
 		sAnimationDef lDefinition;
@@ -63,36 +84,241 @@ bool cSkeletalCoreModel::Init( const std::string &lacNameID, const std::string &
 			// Its a cycle
 			lDefinition.meAnimType = eAnimType_Cycle;
 		}
-
-		// Load the animation in the coremodel
-		lDefinition.miAnimID=mpCoreModel->loadCoreAnimation(lDefinition.macAnimationFile, lDefinition.macName);
-		assert( lDefinition.miAnimID >= 0 );
+		lDefinition.miAnimID = -1;
+		luiSourceHash = cFileUtils::HashFileStamp(lDefinition.macAnimationFile, luiSourceHash);
 
 		// Store the animation info for later
 		mAnimationDefs.push_back(lDefinition);
 	}
 	
 	// Read all the meshes
+	std::vector<std::string> lacMeshFiles;
 	lpElem=lhRoot.FirstChild( "Mesh" ).Element();
 	for( lpElem; lpElem; lpElem = lpElem->NextSiblingElement("Mesh")){
-		std::string lacFile = lacBaseDirectory + lpElem->Attribute("file");
-		
-		// Load the mesh into Cal3D
-		int liMeshIndex = mpCoreModel->loadCoreMesh(lacFile);
-		assert(liMeshIndex >= 0);
-		
+		std::string lacMeshFile = lacBaseDirectory + lpElem->Attribute("file");
+		luiSourceHash = cFileUtils::HashFileStamp(lacMeshFile, luiSourceHash);
+		lacMeshFiles.push_back(lacMeshFile);
+	}
+
+	// Load the cooked data, or cook it again if the sources have changed
+	std::string lacCacheFile = lacFile + ".cache";
+	if (!LoadCache(lacCacheFile, luiSourceHash)){
+		OutputDebugString("Skeletal cache: rebuilding\n");
+		// Start again from a clean core model
+		delete mpCoreModel;
+		mpCoreModel = new CalCoreModel(lacNameID);
+		mMeshIndexes.clear();
+		if (!LoadSources(lacSkeletonFile, lacMeshFiles, lacCacheFile, luiSourceHash)){
+			OutputDebugString("Skeletal load: FAILED\n");
+			return false;
+		}
+	}
+
+	// Optional animation state machine
+	lpElem = lhRoot.FirstChild( "StateMachine" ).Element();
+	if (lpElem && !LoadStateMachine(lpElem)){
+		OutputDebugString("Skeletal state machine: FAILED\n");
+		return false;
+	}
+
+	// Bake the cycles for the far instances (bakerate is optional, in frames per second)
+	double ldBakeRate;
+	if (lhRoot.ToElement()->Attribute("bakerate", &ldBakeRate) && ldBakeRate > 0.0){
+		mfBakeRate = (float)ldBakeRate;
+	}
+	BakeCycles();
+
+	return true;
+}
+
+// Creates the Cal3D objects from the file images: skeleton, animations (in the order of
+// mAnimationDefs) and meshes
+bool cSkeletalCoreModel::LoadCoreData( const std::vector<char *> &lapChunks ){
+	assert(lapChunks.size() >= 1 + mAnimationDefs.size());
+
+	// Load the skeleton
+	CalCoreSkeletonPtr lpSkeleton = CalLoader::loadCoreSkeleton( (void *)lapChunks[0] );
+	if (!lpSkeleton){
+		return false;
+	}
+	mpCoreModel->setCoreSkeleton(lpSkeleton.get());
+
+	// Load the animations in the coremodel
+	unsigned luiChunk = 1;
+	std::vector<sAnimationDef>::iterator it = mAnimationDefs.begin();
+	while (it != mAnimationDefs.end()){
+		CalCoreAnimationPtr lpAnimation = CalLoader::loadCoreAnimation( (void *)lapChunks[luiChunk++], mpCoreModel->getCoreSkeleton() );
+		if (!lpAnimation){
+			return false;
+		}
+		it->miAnimID = mpCoreModel->addCoreAnimation(lpAnimation.get());
+		mpCoreModel->addAnimationName(it->macName, it->miAnimID);
+		++it;
+	}
+
+	// Load the meshes into Cal3D
+	for ( ; luiChunk < lapChunks.size(); ++luiChunk){
+		CalCoreMeshPtr lpMesh = CalLoader::loadCoreMesh( (void *)lapChunks[luiChunk] );
+		if (!lpMesh){
+			return false;
+		}
 		// Store the mesh index
-		mMeshIndexes.push_back(liMeshIndex);
+		mMeshIndexes.push_back(mpCoreModel->addCoreMesh(lpMesh.get()));
 	}
+	BuildSkinRanges();
+	return true;
+}
 
-	// Create buffers to render skeletal mesh
-	CreateBuffers();
+// Every submesh is a range of the vertex buffer (same order as BuildVertexData)
+void cSkeletalCoreModel::BuildSkinRanges(){
+	maSkinRanges.clear();
+	unsigned luiFirstVertex = 0;
+	for (int liIndexMesh = 0; liIndexMesh < mpCoreModel->getCoreMeshCount(); ++liIndexMesh){
+		CalCoreMesh * lpCoreMesh = mpCoreModel->getCoreMesh(liIndexMesh);
+		for (int liIndexSubMesh = 0; liIndexSubMesh < lpCoreMesh->getCoreSubmeshCount(); ++liIndexSubMesh){
+			sSkinRange lRange;
+			lRange.muiFirstVertex = luiFirstVertex;
+			lRange.muiVertexCount = lpCoreMesh->getCoreSubmesh(liIndexSubMesh)->getVertexCount();
+			luiFirstVertex += lRange.muiVertexCount;
+			maSkinRanges.push_back(lRange);
+		}
+	}
+}
 
+// Loads the whole cache in a single read. Returns false if it's missing or outdated
+bool cSkeletalCoreModel::LoadCache( const std::string &lacCacheFile, unsigned luiSourceHash ){
+	std::vector<char> lacCache;
+	if (!cFileUtils::ReadFile(lacCacheFile, lacCache) || lacCache.size() < sizeof(sSkeletalCacheHeader)){
+		return false;
+	}
+	const sSkeletalCacheHeader * lpHeader = (const sSkeletalCacheHeader *)&lacCache[0];
+	if (lpHeader->muiMagic != kuiSkeletalCacheMagic || lpHeader->muiVersion != kuiSkeletalCacheVersion ||
+		lpHeader->muiSourceHash != luiSourceHash || lpHeader->muiChunkCount < 1 + mAnimationDefs.size() ||
+		lpHeader->muiTexCoordCount > 3){
+		return false;
+	}
+
+	// Locate the Cal3D images
+	unsigned luiOffset = sizeof(sSkeletalCacheHeader) + lpHeader->muiChunkCount * sizeof(unsigned);
+	if (luiOffset > lacCache.size()){
+		return false;
+	}
+	const unsigned * lauiChunkSizes = (const unsigned *)&lacCache[sizeof(sSkeletalCacheHeader)];
+	std::vector<char *> lapChunks(lpHeader->muiChunkCount);
+	for (unsigned luiChunk = 0; luiChunk < lpHeader->muiChunkCount; ++luiChunk){
+		lapChunks[luiChunk] = &lacCache[0] + luiOffset;
+		luiOffset += AlignCacheSize(lauiChunkSizes[luiChunk]);
+		if (luiOffset > lacCache.size()){
+			return false;
+		}
+	}
+
+	// And the GPU data
+	muiTexCoordCount = lpHeader->muiTexCoordCount;
+	muiVertexStride = kuiTexCoordOffset + muiTexCoordCount * sizeof(float) * 2;
+	muiVertexCount = lpHeader->muiVertexCount;
+	muiIndexCount = lpHeader->muiIndexCount;
+	unsigned luiVertexOffset = luiOffset;
+	unsigned luiIndexOffset = luiVertexOffset + AlignCacheSize(muiVertexCount * muiVertexStride);
+	if (luiIndexOffset + muiIndexCount * sizeof(unsigned) > lacCache.size()){
+		return false;
+	}
+
+	if (!LoadCoreData(lapChunks)){
+		return false;
+	}
+	macVertices.assign( (const unsigned char *)&lacCache[luiVertexOffset], (const unsigned char *)&lacCache[luiVertexOffset] + muiVertexCount * muiVertexStride );
+	CreateBuffers( &macVertices[0], (const unsigned *)&lacCache[luiIndexOffset] );
+	return true;
+}
+
+// Loads the Cal3D files, builds the vertex data and writes the cache
+bool cSkeletalCoreModel::LoadSources( const std::string &lacSkeletonFile, const std::vector<std::string> &lacMeshFiles,
+									  const std::string &lacCacheFile, unsigned luiSourceHash ){
+	// Read the images of all the files
+	std::vector<std::string> lacFiles;
+	lacFiles.push_back(lacSkeletonFile);
+	std::vector<sAnimationDef>::iterator it = mAnimationDefs.begin();
+	while (it != mAnimationDefs.end()){
+		lacFiles.push_back(it->macAnimationFile);
+		++it;
+	}
+	lacFiles.insert(lacFiles.end(), lacMeshFiles.begin(), lacMeshFiles.end());
+
+	std::vector< std::vector<char> > lacImages(lacFiles.size());
+	std::vector<char *> lapChunks(lacFiles.size());
+	for (unsigned luiIndex = 0; luiIndex < lacFiles.size(); ++luiIndex){
+		bool lbIsOk = cFileUtils::ReadFile(lacFiles[luiIndex], lacImages[luiIndex]) && !lacImages[luiIndex].empty();
+		assert(lbIsOk);
+		if (!lbIsOk){
+			return false;
+		}
+		lapChunks[luiIndex] = &lacImages[luiIndex][0];
+	}
+	if (!LoadCoreData(lapChunks)){
+		return false;
+	}
+
+	// Build and upload the vertex data
+	std::vector<unsigned char> lacVertices;
+	std::vector<unsigned> lauiIndices;
+	BuildVertexData(lacVertices, lauiIndices);
+	CreateBuffers(&lacVertices[0], &lauiIndices[0]);
+
+	// Write the cache
+	sSkeletalCacheHeader lHeader;
+	lHeader.muiMagic = kuiSkeletalCacheMagic;
+	lHeader.muiVersion = kuiSkeletalCacheVersion;
+	lHeader.muiSourceHash = luiSourceHash;
+	lHeader.muiChunkCount = lacImages.size();
+	lHeader.muiTexCoordCount = muiTexCoordCount;
+	lHeader.muiVertexCount = muiVertexCount;
+	lHeader.muiIndexCount = muiIndexCount;
+
+	unsigned luiSize = sizeof(sSkeletalCacheHeader) + lHeader.muiChunkCount * sizeof(unsigned);
+	for (unsigned luiIndex = 0; luiIndex < lacImages.size(); ++luiIndex){
+		luiSize += AlignCacheSize(lacImages[luiIndex].size());
+	}
+	unsigned luiVertexOffset = luiSize;
+	luiSize += AlignCacheSize(lacVertices.size()) + lauiIndices.size() * sizeof(unsigned);
+
+	std::vector<char> lacCache(luiSize, 0);
+	memcpy(&lacCache[0], &lHeader, sizeof(sSkeletalCacheHeader));
+	unsigned luiOffset = sizeof(sSkeletalCacheHeader);
+	for (unsigned luiIndex = 0; luiIndex < lacImages.size(); ++luiIndex){
+		unsigned luiChunkSize = lacImages[luiIndex].size();
+		memcpy(&lacCache[luiOffset], &luiChunkSize, sizeof(unsigned));
+		luiOffset += sizeof(unsigned);
+	}
+	for (unsigned luiIndex = 0; luiIndex < lacImages.size(); ++luiIndex){
+		memcpy(&lacCache[luiOffset], &lacImages[luiIndex][0], lacImages[luiIndex].size());
+		luiOffset += AlignCacheSize(lacImages[luiIndex].size());
+	}
+	assert(luiOffset == luiVertexOffset);
+	memcpy(&lacCache[luiOffset], &lacVertices[0], lacVertices.size());
+	luiOffset += AlignCacheSize(lacVertices.size());
+	memcpy(&lacCache[luiOffset], &lauiIndices[0], lauiIndices.size() * sizeof(unsigned));
+
+	if (!cFileUtils::WriteFile(lacCacheFile, &lacCache[0], luiSize)){
+		OutputDebugString("Skeletal cache: write FAILED\n");
+	}
+
+	// Keep the vertices for the CPU skinning
+	macVertices.swap(lacVertices);
 	return true;
 }
 
 void cSkeletalCoreModel::Deinit(){
 	ReleaseBuffers();
+	maStates.clear();
+	macEventNames.clear();
+	maTransitions.clear();
+	maEventActions.clear();
+	maBakedClipOfAnim.clear();
+	macVertices.clear();
+	maSkinRanges.clear();
+	maBakedClips.clear();
+	mafBakedPalettes.clear();
 	// Clean core model
 	if (mpCoreModel){
 		delete mpCoreModel;
@@ -114,22 +340,244 @@ void cSkeletalCoreModel::CreateInstance( cSkeletalMesh * lpMesh ){
 	}
 }
 
+void cSkeletalCoreModel::CreateBakedInstance( cSkeletalMesh * lpMesh ){
+	// Baked instances only need the core part, the pose comes from the table
+	assert(lpMesh);
+	lpMesh->mpCal3DModel = NULL;
+	lpMesh->mpCoreModel = this;
+	lpMesh->miBakedClip = (maBakedClips.empty())? -1 : 0;
+	lpMesh->mfBakedPhase = 0.0f;
+}
+
 sAnimationDef* cSkeletalCoreModel::GetAnimationDef(const std::string lacAnim){
 	// Look for the animation
-	std::list<sAnimationDef>::iterator it = mAnimationDefs.begin();
+	return GetAnimationDef(GetAnimationIndex(lacAnim));
+}
+
+int cSkeletalCoreModel::GetAnimationIndex(const std::string &lacAnim) const{
+	for (unsigned luiIndex = 0; luiIndex < mAnimationDefs.size(); ++luiIndex){
+		if (mAnimationDefs[luiIndex].macName == lacAnim){
+			return (int)luiIndex;
+		}
+	}
+	return -1;
+}
+
+int cSkeletalCoreModel::GetBakedClip(const std::string &lacAnim){
+	return GetBakedClip(GetAnimationIndex(lacAnim));
+}
+
+int cSkeletalCoreModel::GetStateIndex(const std::string &lacState) const{
+	for (unsigned luiIndex = 0; luiIndex < maStates.size(); ++luiIndex){
+		if (maStates[luiIndex].macName == lacState){
+			return (int)luiIndex;
+		}
+	}
+	return -1;
+}
+
+int cSkeletalCoreModel::GetEventIndex(const std::string &lacEvent) const{
+	for (unsigned luiIndex = 0; luiIndex < macEventNames.size(); ++luiIndex){
+		if (macEventNames[luiIndex] == lacEvent){
+			return (int)luiIndex;
+		}
+	}
+	return -1;
+}
+
+// <StateMachine initial="state">
+//   <State name="..." anim="cycle" />
+//   <Transition from="state or *" event="..." to="state" blend="seconds" />
+//   <Action event="..." anim="action" blendin="seconds" blendout="seconds" stop="1" />
+// </StateMachine>
+bool cSkeletalCoreModel::LoadStateMachine( TiXmlElement * lpRoot ){
+	TiXmlElement * lpElem;
+
+	// States
+	for (lpElem = lpRoot->FirstChildElement("State"); lpElem; lpElem = lpElem->NextSiblingElement("State")){
+		const char * lacName = lpElem->Attribute("name");
+		const char * lacAnim = lpElem->Attribute("anim");
+		if (!lacName || !lacAnim){
+			return false;
+		}
+		sAnimState lState;
+		lState.macName = lacName;
+		lState.miAnim = GetAnimationIndex(lacAnim);
+		assert(lState.miAnim >= 0);
+		if (lState.miAnim < 0){
+			return false;
+		}
+		maStates.push_back(lState);
+	}
+
+	// Events, in order of appearance
+	for (lpElem = lpRoot->FirstChildElement(); lpElem; lpElem = lpElem->NextSiblingElement()){
+		const char * lacEvent = lpElem->Attribute("event");
+		if (lacEvent && GetEventIndex(lacEvent) < 0){
+			macEventNames.push_back(lacEvent);
+		}
+	}
+
+	// Flat transition table, empty by default
+	unsigned luiEventCount = macEventNames.size();
+	sAnimTransition lNoTransition;
+	lNoTransition.miTargetState = -1;
+	lNoTransition.mfBlendTime = 0.0f;
+	maTransitions.assign(maStates.size() * luiEventCount, lNoTransition);
+	for (lpElem = lpRoot->FirstChildElement("Transition"); lpElem; lpElem = lpElem->NextSiblingElement("Transition")){
+		const char * lacFrom = lpElem->Attribute("from");
+		const char * lacTo = lpElem->Attribute("to");
+		const char * lacEvent = lpElem->Attribute("event");
+		if (!lacFrom || !lacTo || !lacEvent){
+			return false;
+		}
+		sAnimTransition lTransition;
+		lTransition.miTargetState = GetStateIndex(lacTo);
+		double ldBlend = 0.0;
+		lpElem->Attribute("blend", &ldBlend);
+		lTransition.mfBlendTime = (float)ldBlend;
+		int liEvent = GetEventIndex(lacEvent);
+		if (lTransition.miTargetState < 0){
+			return false;
+		}
+
+		// "*" adds the transition to all the states
+		bool lbAnyState = (std::string(lacFrom) == "*");
+		int liFrom = GetStateIndex(lacFrom);
+		if (!lbAnyState && liFrom < 0){
+			return false;
+		}
+		for (unsigned luiState = 0; luiState < maStates.size(); ++luiState){
+			if (lbAnyState || (int)luiState == liFrom){
+				maTransitions[luiState * luiEventCount + liEvent] = lTransition;
+			}
+		}
+	}
+
+	// Actions triggered by the events, they don't change the state
+	sAnimEventAction lNoAction;
+	lNoAction.miAnim = -1;
+	lNoAction.mfBlendIn = 0.0f;
+	lNoAction.mfBlendOut = 0.0f;
+	lNoAction.mbStop = false;
+	maEventActions.assign(luiEventCount, lNoAction);
+	for (lpElem = lpRoot->FirstChildElement("Action"); lpElem; lpElem = lpElem->NextSiblingElement("Action")){
+		const char * lacEvent = lpElem->Attribute("event");
+		const char * lacAnim = lpElem->Attribute("anim");
+		if (!lacEvent || !lacAnim){
+			return false;
+		}
+		sAnimEventAction &lAction = maEventActions[GetEventIndex(lacEvent)];
+		lAction.miAnim = GetAnimationIndex(lacAnim);
+		if (lAction.miAnim < 0){
+			return false;
+		}
+		double ldBlend = 0.0;
+		lpElem->Attribute("blendin", &ldBlend);
+		lAction.mfBlendIn = (float)ldBlend;
+		ldBlend = 0.0;
+		lpElem->Attribute("blendout", &ldBlend);
+		lAction.mfBlendOut = (float)ldBlend;
+		int liStop = 0;
+		lpElem->Attribute("stop", &liStop);
+		lAction.mbStop = (liStop != 0);
+	}
+
+	// Initial state (the first one by default)
+	const char * lacInitial = lpRoot->Attribute("initial");
+	miInitialState = (lacInitial)? GetStateIndex(lacInitial) : 0;
+	return (maStates.empty() || miInitialState >= 0);
+}
+
+const float* cSkeletalCoreModel::GetBakedPalette(int liClip, float lfPhase){
+	assert(liClip >= 0 && liClip < (int)maBakedClips.size());
+	const sBakedClip &lClip = maBakedClips[liClip];
+
+	// Wrap the phase and pick the nearest baked frame
+	float lfTime = fmod(lfPhase, lClip.mfDuration);
+	if (lfTime < 0.0f){
+		lfTime += lClip.mfDuration;
+	}
+	unsigned luiFrame = (unsigned)(lfTime * mfBakeRate + 0.5f);
+	if (luiFrame >= lClip.muiFrameCount){
+		luiFrame = 0;
+	}
+	return &mafBakedPalettes[(lClip.muiFirstFrame + luiFrame) * muiBoneCount * 12];
+}
+
+unsigned cSkeletalCoreModel::BuildBonePalette( CalSkeleton * lpSkeleton, float * lafPalette ){
+	const std::vector< CalBone * > &lBones = lpSkeleton->getVectorBone( );
+	unsigned luiBoneCount = lBones.size();
+	assert(luiBoneCount <= kuiMaxBonesDQ);
+	for( unsigned luiIndex = 0; luiIndex < luiBoneCount; ++luiIndex ){
+		const CalMatrix &lCalMatrix = lBones[ luiIndex ]->getTransformMatrix( );
+		const CalVector &lCalTrans = lBones[ luiIndex ]->getTranslationBoneSpace( );
+		// Convert the CalMatrix in a 3x4 transposed matrix
+		float * lafRow = lafPalette + luiIndex * 12;
+		lafRow[0] = lCalMatrix.dxdx;
+		lafRow[1] = lCalMatrix.dxdy;
+		lafRow[2] = lCalMatrix.dxdz;
+		lafRow[3] = lCalTrans.x;
+		lafRow[4] = lCalMatrix.dydx;
+		lafRow[5] = lCalMatrix.dydy;
+		lafRow[6] = lCalMatrix.dydz;
+		lafRow[7] = lCalTrans.y;
+		lafRow[8] = lCalMatrix.dzdx;
+		lafRow[9] = lCalMatrix.dzdy;
+		lafRow[10] = lCalMatrix.dzdz;
+		lafRow[11] = lCalTrans.z;
+	}
+	return luiBoneCount;
+}
+
+// Samples every cycle at a fixed rate. All the instances share this table
+void cSkeletalCoreModel::BakeCycles(){
+	maBakedClips.clear();
+	mafBakedPalettes.clear();
+	maBakedClipOfAnim.assign(mAnimationDefs.size(), -1);
+	muiBoneCount = mpCoreModel->getCoreSkeleton()->getVectorCoreBone().size();
+	assert(muiBoneCount <= kuiMaxBonesDQ);
+
+	unsigned luiFrameTotal = 0;
+	std::vector<sAnimationDef>::iterator it = mAnimationDefs.begin();
 	while (it != mAnimationDefs.end()){
-		std::string lacName = it->macName;
-		if ( lacName == lacAnim ){
-			return &(*it);
+		if (it->meAnimType == eAnimType_Cycle){
+			CalCoreAnimation * lpCoreAnim = mpCoreModel->getCoreAnimation(it->miAnimID);
+			assert(lpCoreAnim);
+
+			sBakedClip lClip;
+			lClip.miAnimID = it->miAnimID;
+			lClip.mfDuration = lpCoreAnim->getDuration();
+			lClip.muiFrameCount = (unsigned)(lClip.mfDuration * mfBakeRate) + 1;
+			lClip.muiFirstFrame = luiFrameTotal;
+			luiFrameTotal += lClip.muiFrameCount;
+			mafBakedPalettes.resize(luiFrameTotal * muiBoneCount * 12);
+
+			// A temporary model plays the cycle alone, so its time is the clip time
+			CalModel lModel(mpCoreModel);
+			CalMixer * lpMixer = lModel.getMixer();
+			lpMixer->blendCycle(lClip.miAnimID, 1.0f, 0.0f);
+			lpMixer->updateAnimation(0.0f);
+			for (unsigned luiFrame = 0; luiFrame < lClip.muiFrameCount; ++luiFrame){
+				float lfTime = (float)luiFrame / mfBakeRate;
+				lpMixer->setAnimationTime((lfTime < lClip.mfDuration)? lfTime : 0.0f);
+				lpMixer->updateSkeleton();
+				float * lafFrame = &mafBakedPalettes[(lClip.muiFirstFrame + luiFrame) * muiBoneCount * 12];
+				BuildBonePalette(lModel.getSkeleton(), lafFrame);
+			}
+			maBakedClipOfAnim[it - mAnimationDefs.begin()] = maBakedClips.size();
+			maBakedClips.push_back(lClip);
 		}
 		++it;
 	}
-	
-	return NULL;
+
+	char lacBuffer[128];
+	sprintf(lacBuffer, "Baked %d cycles, %d frames\n", (int)maBakedClips.size(), luiFrameTotal);
+	OutputDebugString(lacBuffer);
 }
 
-// This will be load skeletal meshes in GPU
-void cSkeletalCoreModel::CreateBuffers(){
+// Builds the interleaved vertices (position, normal, bone indexes, weights and UVs) and the indices
+void cSkeletalCoreModel::BuildVertexData( std::vector<unsigned char> &lacVertices, std::vector<unsigned> &lauiIndices ){
 	int luiNumMeshes = mpCoreModel->getCoreMeshCount();
 	unsigned luiVertexCount = 0;
 	unsigned luiFaceCount = 0;
@@ -151,18 +599,15 @@ void cSkeletalCoreModel::CreateBuffers(){
 			luiTextCoordCount = (lTextureCoords.size() > luiTextCoordCount)? lTextureCoords.size() : luiTextCoordCount;
 		}
 	}
+	assert(luiTextCoordCount <= 3);
 
 	// Create the buffers
-	cVec3* laPositionBuffer = new cVec3[luiVertexCount];
-	cVec3* laNormalBuffer = new cVec3[luiVertexCount];
-	cVec4* laBoneIndexes = new cVec4[luiVertexCount];
-	unsigned char* laWeights = new unsigned char[luiVertexCount * 4];
-	cVec2** laaTextureBuffer = new cVec2*[luiTextCoordCount];
-	for (unsigned luiIndex = 0; luiIndex < luiTextCoordCount; ++luiIndex){
-		laaTextureBuffer[luiIndex] = new cVec2[luiVertexCount];
-	}
+	muiTexCoordCount = luiTextCoordCount;
+	muiVertexStride = kuiTexCoordOffset + muiTexCoordCount * sizeof(float) * 2;
+	muiVertexCount = luiVertexCount;
 	muiIndexCount = luiFaceCount * 3;
-	unsigned* lauiIndexBuffer = new unsigned[muiIndexCount];
+	lacVertices.assign(muiVertexCount * muiVertexStride, 0);
+	lauiIndices.resize(muiIndexCount);
 
 	// Load the vertex and index information
 	unsigned luiVertexIndex = 0;
@@ -178,147 +623,82 @@ void cSkeletalCoreModel::CreateBuffers(){
 		for (int liIndexSubMesh= 0; liIndexSubMesh < luiCoreSubMeshesCount; ++liIndexSubMesh){
 			CalCoreSubmesh *lpCoreSubMesh = lpCoreMesh->getCoreSubmesh( liIndexSubMesh );
 			int luiSkinVertexCount = lpCoreSubMesh->getVertexCount( );
+			const std::vector< std::vector< CalCoreSubmesh::TextureCoordinate > > &laTexturesCoord = lpCoreSubMesh->getVectorVectorTextureCoordinate();
 			
 			// For all the vertex
 			for(int liIndex = 0; liIndex < luiSkinVertexCount; ++liIndex ){
-			const CalCoreSubmesh::Vertex &cv = lpCoreSubMesh->getVectorVertex( )[ liIndex ];
-			
-			// Read Vertex Normals and Position
-			laPositionBuffer[luiVertexIndex].x = cv.position.x;
-			laPositionBuffer[luiVertexIndex].y = cv.position.y;
-			laPositionBuffer[luiVertexIndex].z = cv.position.z;
-			laNormalBuffer[luiVertexIndex].x = cv.normal.x;
-			laNormalBuffer[luiVertexIndex].y = cv.normal.y;
-			laNormalBuffer[luiVertexIndex].z = cv.normal.z;
-
-			// Initialize Vertex Weights and BoneIndex
-			for( int j=0; j<4; ++j ){
-				laWeights[ luiVertexIndex * 4 + j ] = 0;
-				laBoneIndexes[luiVertexIndex][ j ] = 0;
-			}
-			for(size_t j=0;j< cv.vectorInfluence.size( ); ++j ){
-				const CalCoreSubmesh::Influence &influence = cv.vectorInfluence[ j ];
-				laWeights[ luiVertexIndex * 4 + j ] = (unsigned char)(influence.weight * 255.0f);
-				laBoneIndexes[luiVertexIndex][ j ] = (float)influence.boneId;
-			}
+				const CalCoreSubmesh::Vertex &cv = lpCoreSubMesh->getVectorVertex( )[ liIndex ];
+				unsigned char * lpVertex = &lacVertices[luiVertexIndex * muiVertexStride];
+				float * lafPosition = (float *)lpVertex;
+				float * lafNormal = (float *)(lpVertex + kuiNormalOffset);
+				float * lafBoneIndexes = (float *)(lpVertex + kuiBoneIxOffset);
+				unsigned char * lacWeights = lpVertex + kuiWeightOffset;
+				float * lafTexCoords = (float *)(lpVertex + kuiTexCoordOffset);
 
-			// Read Texture Coordinates
-			const std::vector< std::vector< CalCoreSubmesh::TextureCoordinate > > &laTexturesCoord = lpCoreSubMesh->getVectorVectorTextureCoordinate();
-			for (unsigned luiTexIndex = 0; luiTexIndex <laTexturesCoord.size(); ++luiTexIndex){
-				const CalCoreSubmesh::TextureCoordinate &lCoord = laTexturesCoord[luiTexIndex][luiVertexIndex];
-				laaTextureBuffer[luiTexIndex][luiVertexIndex].x = lCoord.u;
-				laaTextureBuffer[luiTexIndex][luiVertexIndex].y = lCoord.v;
+				// Read Vertex Normals and Position
+				lafPosition[0] = cv.position.x;
+				lafPosition[1] = cv.position.y;
+				lafPosition[2] = cv.position.z;
+				lafNormal[0] = cv.normal.x;
+				lafNormal[1] = cv.normal.y;
+				lafNormal[2] = cv.normal.z;
+
+				// Vertex Weights and BoneIndex (the buffer is zeroed, only 4 influences fit)
+				size_t luiInfluences = (cv.vectorInfluence.size() < 4)? cv.vectorInfluence.size() : 4;
+				for(size_t j = 0; j < luiInfluences; ++j ){
+					const CalCoreSubmesh::Influence &influence = cv.vectorInfluence[ j ];
+					lacWeights[ j ] = (unsigned char)(influence.weight * 255.0f);
+					lafBoneIndexes[ j ] = (float)influence.boneId;
+				}
+
+				// Read Texture Coordinates
+				for (unsigned luiTexIndex = 0; luiTexIndex < laTexturesCoord.size(); ++luiTexIndex){
+					const CalCoreSubmesh::TextureCoordinate &lCoord = laTexturesCoord[luiTexIndex][liIndex];
+					lafTexCoords[luiTexIndex * 2] = lCoord.u;
+					lafTexCoords[luiTexIndex * 2 + 1] = lCoord.v;
+				}
+				luiVertexIndex++;
 			}
-			luiVertexIndex++;
-		}
 		
-		// Calculate indices
-		unsigned luiFaceCount = lpCoreSubMesh->getFaceCount();
-		const std::vector<CalCoreSubmesh::Face> &lFaces = lpCoreSubMesh->getVectorFace();
-		for (unsigned luiIndex = 0; luiIndex < luiFaceCount; ++luiIndex){
-			const CalCoreSubmesh::Face &lFace = lFaces[luiIndex];
-			lauiIndexBuffer[ luiIndexesIndex++ ] = lFace.vertexId[0] + luiVertexAnt;
-			lauiIndexBuffer[ luiIndexesIndex++ ] = lFace.vertexId[1] + luiVertexAnt;
-			lauiIndexBuffer[ luiIndexesIndex++ ] = lFace.vertexId[2] + luiVertexAnt;
-			assert(lauiIndexBuffer[ luiIndexesIndex - 1 ] < luiVertexCount);
-			assert(lauiIndexBuffer[ luiIndexesIndex - 2 ] < luiVertexCount);
-			assert(lauiIndexBuffer[ luiIndexesIndex - 3 ] < luiVertexCount);
+			// Calculate indices
+			unsigned luiFaceCount = lpCoreSubMesh->getFaceCount();
+			const std::vector<CalCoreSubmesh::Face> &lFaces = lpCoreSubMesh->getVectorFace();
+			for (unsigned luiIndex = 0; luiIndex < luiFaceCount; ++luiIndex){
+				const CalCoreSubmesh::Face &lFace = lFaces[luiIndex];
+				lauiIndices[ luiIndexesIndex++ ] = lFace.vertexId[0] + luiVertexAnt;
+				lauiIndices[ luiIndexesIndex++ ] = lFace.vertexId[1] + luiVertexAnt;
+				lauiIndices[ luiIndexesIndex++ ] = lFace.vertexId[2] + luiVertexAnt;
+				assert(lauiIndices[ luiIndexesIndex - 1 ] < luiVertexCount);
+				assert(lauiIndices[ luiIndexesIndex - 2 ] < luiVertexCount);
+				assert(lauiIndices[ luiIndexesIndex - 3 ] < luiVertexCount);
+			}
+			luiVertexAnt = luiVertexIndex;
 		}
-		luiVertexAnt = luiVertexIndex;
-	}
 	}
 	assert( luiVertexIndex == luiVertexCount );
+}
 
-	// Create the GPU buffers
-	//----------------------------------------------------------------------------------------------------
-	
-	// Get the number of texture coordinates
-	unsigned luiTextureCoordinateCount = luiTextCoordCount;
-	assert(luiTextureCoordinateCount <= 3);
-	maVboTexture.resize(luiTextureCoordinateCount);
+// This will be load skeletal meshes in GPU
+void cSkeletalCoreModel::CreateBuffers( const unsigned char * lpVertices, const unsigned * lpIndices ){
 	glGenBuffers(1, &mVboVertices);
 	assert(glGetError() == GL_NO_ERROR);
-	
-	// Creating all the texture coordinate buffers	
-	for(unsigned luiIndex = 0; luiIndex < luiTextureCoordinateCount; ++luiIndex){
-		glGenBuffers(1, &maVboTexture[luiIndex]);
-		assert(glGetError() == GL_NO_ERROR);
-	}
-
-	glGenBuffers(1, &mVboNormals);
-	assert(glGetError() == GL_NO_ERROR);
-	glGenBuffers(1, &mVboWeight);
-	assert(glGetError() == GL_NO_ERROR);
-	glGenBuffers(1, &mVboBoneIx);
-	assert(glGetError() == GL_NO_ERROR);
 	glGenBuffers(1, &mVboIndex);
 	assert(glGetError() == GL_NO_ERROR);
 
-	// Send the buffers to GPU
-	//----------------------------------------------------------------------------------------------------
-
-	// Position
+	// Interleaved vertices
 	glBindBuffer(GL_ARRAY_BUFFER, mVboVertices);
 	assert(glGetError() == GL_NO_ERROR);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(float) * 3 * luiVertexCount,
-	laPositionBuffer, GL_STATIC_DRAW);
-	assert(glGetError() == GL_NO_ERROR);
-	
-	// Normals
-	glBindBuffer(GL_ARRAY_BUFFER, mVboNormals);
-	assert(glGetError() == GL_NO_ERROR);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(float) * 3 * luiVertexCount,
-	laNormalBuffer, GL_STATIC_DRAW);
-	assert(glGetError() == GL_NO_ERROR);
-	
-	// Textures
-	for(unsigned luiTexCoordChannel = 0; luiTexCoordChannel < luiTextureCoordinateCount; ++luiTexCoordChannel){
-		glBindBuffer(GL_ARRAY_BUFFER,
-		maVboTexture[luiTexCoordChannel]);
-		assert(glGetError() == GL_NO_ERROR);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(float) * 2 * luiVertexCount, laaTextureBuffer[luiTexCoordChannel], GL_STATIC_DRAW);
-		assert(glGetError() == GL_NO_ERROR);
-	}
-
-	// Weights (Color Channel)
-	glBindBuffer(GL_ARRAY_BUFFER, mVboWeight);
-	assert(glGetError() == GL_NO_ERROR);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(unsigned char) * 4 * luiVertexCount,
-	laWeights, GL_STATIC_DRAW);
-	assert(glGetError() == GL_NO_ERROR);
-
-	// Bone IDs
-	glBindBuffer(GL_ARRAY_BUFFER, mVboBoneIx);
-	assert(glGetError() == GL_NO_ERROR);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(float) * 4 * luiVertexCount, laBoneIndexes, GL_STATIC_DRAW);
+	glBufferData(GL_ARRAY_BUFFER, muiVertexCount * muiVertexStride, lpVertices, GL_STATIC_DRAW);
 	assert(glGetError() == GL_NO_ERROR);
 
 	// Index
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mVboIndex);
 	assert(glGetError() == GL_NO_ERROR);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, muiIndexCount * sizeof(unsigned), lauiIndexBuffer, GL_STATIC_DRAW);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, muiIndexCount * sizeof(unsigned), lpIndices, GL_STATIC_DRAW);
 	assert(glGetError() == GL_NO_ERROR);
-
-	// Delete Buffers (used for store temporary data from calc3D)
-	// ----------------------------------------------------------------
-	delete laPositionBuffer;
-	delete laNormalBuffer;
-	delete laBoneIndexes;
-	delete laWeights;
-	for (unsigned luiIndex=0; luiIndex < luiTextCoordCount; ++luiIndex){
-		delete laaTextureBuffer[luiIndex];
-	}
-	delete laaTextureBuffer;
-	delete lauiIndexBuffer;
 }
 
 void cSkeletalCoreModel::ReleaseBuffers(){
-	glDeleteBuffers(1, &mVboBoneIx);
-	glDeleteBuffers(1, &mVboWeight);
 	glDeleteBuffers(1, &mVboVertices);
-	for( unsigned luiTexCoordChannel = 0; luiTexCoordChannel<maVboTexture.size(); ++luiTexCoordChannel){
-		glDeleteBuffers(1, &maVboTexture[luiTexCoordChannel]);
-	}
-	glDeleteBuffers(1, &mVboNormals);
 	glDeleteBuffers(1, &mVboIndex);
 }
\ No newline at end of file
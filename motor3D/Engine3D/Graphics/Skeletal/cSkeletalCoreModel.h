@@ -8,6 +8,7 @@
 #include "../../Utility/Resource.h"
 #include "../../Utility/Singleton.h" 
 #include "cal3d/coremodel.h"
+#include "cSkeletalSkinning.h"
 
 // These structs store XML data from the Cal3D skeletal mesh files
 enum eAnimType{
@@ -22,13 +23,54 @@ struct sAnimationDef{
 	int miAnimID;
 };
 
+// Animation state machine: every state plays a cycle, the events move between states
+// or trigger actions. The transitions are compiled to a flat table of states x events
+struct sAnimState{
+	std::string macName;
+	int miAnim;
+};
+
+struct sAnimTransition{
+	int miTargetState;
+	float mfBlendTime;
+};
+
+struct sAnimEventAction{
+	int miAnim;
+	float mfBlendIn;
+	float mfBlendOut;
+	bool mbStop;
+};
+
+// Baked poses of a cycle animation. The palettes of all the clips are stored
+// in a shared table, so far instances don't need a CalModel to be rendered
+struct sBakedClip{
+	int miAnimID;
+	float mfDuration;
+	unsigned muiFrameCount;
+	unsigned muiFirstFrame;
+};
+
 class cSkeletalMesh;
+class CalSkeleton;
+class TiXmlElement;
 
 class cSkeletalCoreModel : public cResource{
 
 public:
+	// Max number of bones supported by the skinning shaders (matrices and dual quaternions)
+	static const unsigned kuiMaxBones = 80;
+	static const unsigned kuiMaxBonesDQ = 120;
+
+	// Layout of the interleaved vertex: position, normal, bone indexes (4 floats),
+	// weights (4 bytes) and up to 3 UV channels
+	static const unsigned kuiNormalOffset = 12;
+	static const unsigned kuiBoneIxOffset = 24;
+	static const unsigned kuiWeightOffset = 40;
+	static const unsigned kuiTexCoordOffset = 44;
+
 	// Class constructor
-	cSkeletalCoreModel() { mpCoreModel = NULL; }
+	cSkeletalCoreModel() { mpCoreModel = NULL; miInitialState = -1; mfBakeRate = 30.0f; muiBoneCount = 0; muiVertexCount = 0; muiIndexCount = 0; muiTexCoordCount = 0; muiVertexStride = kuiTexCoordOffset; }
 
 	// The skeletal mesh
 	friend class cSkeletalMesh;
@@ -45,35 +87,96 @@ public:
 	// Gets the current animation
 	sAnimationDef* GetAnimationDef(const std::string lacAnim);
 
+	// Index of an animation by name (-1 if not found). Resolve the names once and
+	// then use the indexes
+	int GetAnimationIndex(const std::string &lacAnim) const;
+	inline sAnimationDef* GetAnimationDef(int liAnim) { return (liAnim >= 0 && liAnim < (int)mAnimationDefs.size())? &mAnimationDefs[liAnim] : NULL; }
+
+	// Gets the baked clip index of a cycle animation (-1 if it isn't baked)
+	int GetBakedClip(const std::string &lacAnim);
+	inline int GetBakedClip(int liAnim) const { return (liAnim >= 0 && liAnim < (int)maBakedClipOfAnim.size())? maBakedClipOfAnim[liAnim] : -1; }
+
+	// State machine ids (-1 if not found), resolve them at load time
+	int GetStateIndex(const std::string &lacState) const;
+	int GetEventIndex(const std::string &lacEvent) const;
+	inline bool HasStateMachine() const { return !maStates.empty(); }
+
+	// Gets the bone palette of a baked clip at the given phase (in seconds)
+	const float* GetBakedPalette(int liClip, float lfPhase);
+	inline float GetBakedDuration(int liClip) const { return maBakedClips[liClip].mfDuration; }
+
+	// Number of bones of the skeleton
+	inline unsigned GetBoneCount() const { return muiBoneCount; }
+
+	// Number of vertices of all the meshes (CPU skinning output size)
+	inline unsigned GetVertexCount() const { return muiVertexCount; }
+
 private:
 	// Getter
 	CalCoreModel* GetCoreModel() { return mpCoreModel; }
 	
 	// Creates the instance part
 	void CreateInstance( cSkeletalMesh * lpMesh );
+
+	// Creates an instance that uses the baked poses instead of a CalModel
+	void CreateBakedInstance( cSkeletalMesh * lpMesh );
+
+	// Fills a 3x4 matrix per bone with the current state of the skeleton
+	static unsigned BuildBonePalette( CalSkeleton * lpSkeleton, float * lafPalette );
+
+	// Samples all the cycles at mfBakeRate and stores the palettes
+	void BakeCycles();
+
+	// Reads the <StateMachine> element and builds the transition table
+	bool LoadStateMachine( TiXmlElement * lpElem );
 	
 	std::string macFile;
 	
 	// List of animations
-	std::list<sAnimationDef> mAnimationDefs;
+	std::vector<sAnimationDef> mAnimationDefs;
+
+	// Compiled state machine
+	std::vector<sAnimState> maStates;
+	std::vector<std::string> macEventNames;
+	std::vector<sAnimTransition> maTransitions;
+	std::vector<sAnimEventAction> maEventActions;
+	int miInitialState;
 	
 	std::list<int> mMeshIndexes;
+
+	// Baked cycles and their bone palettes (12 floats per bone and frame)
+	std::vector<sBakedClip> maBakedClips;
+	std::vector<int> maBakedClipOfAnim;
+	std::vector<float> mafBakedPalettes;
+	float mfBakeRate;
+	unsigned muiBoneCount;
 	
 	// Pointer to the core part
 	CalCoreModel* mpCoreModel;
 
+	// Cooked cache (<model>.xml.cache) with the Cal3D files and the vertex data
+	bool LoadCache( const std::string &lacCacheFile, unsigned luiSourceHash );
+	bool LoadSources( const std::string &lacSkeletonFile, const std::vector<std::string> &lacMeshFiles,
+					  const std::string &lacCacheFile, unsigned luiSourceHash );
+	bool LoadCoreData( const std::vector<char *> &lapChunks );
+	void BuildSkinRanges();
+
 	// Buffers to load the meshes associated to the skeletal model
-	void CreateBuffers();
+	void BuildVertexData( std::vector<unsigned char> &lacVertices, std::vector<unsigned> &lauiIndices );
+	void CreateBuffers( const unsigned char * lpVertices, const unsigned * lpIndices );
 	void ReleaseBuffers();
 
 	// Pass data to shader, loads skeletal meshes in GPU
-	unsigned mVboWeight;
-	unsigned mVboBoneIx;
 	unsigned muiIndexCount;
-	std::vector<unsigned> maVboTexture;
+	unsigned muiVertexCount;
+	unsigned muiVertexStride;
+	unsigned muiTexCoordCount;
 	unsigned mVboVertices;
-	unsigned mVboNormals;
 	unsigned mVboIndex;
+
+	// CPU copy of the interleaved vertices and the submesh ranges, for CPU skinning
+	std::vector<unsigned char> macVertices;
+	std::vector<sSkinRange> maSkinRanges;
 };
 
 
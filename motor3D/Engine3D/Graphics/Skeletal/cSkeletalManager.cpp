@@ -34,5 +34,23 @@ cSkeletalMesh * cSkeletalManager::CreateSkeletalMesh( const std::string& lacCore
 		}
 	}
 	
+	return NULL;
+}
+
+cSkeletalMesh * cSkeletalManager::CreateBakedSkeletalMesh( const std::string& lacCoreModelName, const std::string& lacCycleName, float lfPhase ){
+	// Try to find core part
+	cResourceHandle lHandle = this->FindResource(lacCoreModelName);
+	if (lHandle.IsValidHandle()){
+		cSkeletalCoreModel* lpCoreModel = (cSkeletalCoreModel*)lHandle.GetResource();
+		cSkeletalMesh* lpSkeletalMesh = new cSkeletalMesh;
+		// Inits the baked instance and selects the cycle
+		if ( lpSkeletalMesh->Init("", lpCoreModel, eSkeletalInstance_Baked) && lpSkeletalMesh->PlayAnim(lacCycleName, 1.0f, 0.0f) ){
+			lpSkeletalMesh->SetBakedPhase(lfPhase);
+			return lpSkeletalMesh;
+		}else{
+			delete lpSkeletalMesh;
+		}
+	}
+	
 	return NULL;
 }
\ No newline at end of file
@@ -20,6 +20,9 @@ public:
 	// Creates a skeletal mesh (the instance)
 	cSkeletalMesh * CreateSkeletalMesh( const std::string& lacCoreModelName );
 
+	// Creates a far instance that plays a baked cycle (no CalModel)
+	cSkeletalMesh * CreateBakedSkeletalMesh( const std::string& lacCoreModelName, const std::string& lacCycleName, float lfPhase = 0.0f );
+
 protected:
 	cSkeletalManager() { ; } // Protected constructor
 
@@ -10,11 +10,20 @@
 #include "cal3d/cal3d.h"
 #include "../Materials/Material.h"
 #include "../Effects/cEffect.h"
+#include "cSkeletalSkinning.h"
+#include "../../Utility/ThreadPool.h"
+#include "../../Utility/Benchmark.h"
+#include <cstring>
+#include <cmath>
 
 bool cSkeletalMesh::Init( const std::string &lacNameID, void * lpMemoryData, int liDataType ){
 	// Gets the core model
 	cSkeletalCoreModel * lpCoreModel = (cSkeletalCoreModel *)lpMemoryData;
 	// And creates a new instance
+	if (liDataType == eSkeletalInstance_Baked){
+		lpCoreModel->CreateBakedInstance(this);
+		return (miBakedClip >= 0);
+	}
 	lpCoreModel->CreateInstance(this);
 	
 	return true;
@@ -23,14 +32,106 @@ bool cSkeletalMesh::Init( const std::string &lacNameID, void * lpMemoryData, int
 void cSkeletalMesh::Deinit(){
 	// Delete model
 	delete mpCal3DModel;
+	mpCal3DModel = NULL;
 }
 void cSkeletalMesh::Update(float lfTimestep){	
+	if (IsBaked()){
+		// Baked instances only advance the phase. It is wrapped here, a phase that keeps
+		// growing loses the precision of the frames
+		mfBakedPhase += lfTimestep;
+		float lfDuration = (miBakedClip >= 0)? mpCoreModel->GetBakedDuration(miBakedClip) : 0.0f;
+		if (lfDuration > 0.0f){
+			mfBakedPhase = fmod(mfBakedPhase, lfDuration);
+		}
+		return;
+	}
 	mpCal3DModel->update(lfTimestep);
 }
 
+int cSkeletalMesh::GetPlayingBakedClip(){
+	CalAnimationCycle * lpCycle = NULL;
+	std::list<CalAnimationCycle *> &lCycles = mpCal3DModel->getMixer()->getAnimationCycle();
+	for (std::list<CalAnimationCycle *>::iterator it = lCycles.begin(); it != lCycles.end(); ++it){
+		if (lpCycle == NULL || (*it)->getWeight() > lpCycle->getWeight()){
+			lpCycle = *it;
+		}
+	}
+	if (lpCycle == NULL){
+		return -1;
+	}
+	for (unsigned luiClip = 0; luiClip < mpCoreModel->maBakedClips.size(); ++luiClip){
+		if (mpCoreModel->mpCoreModel->getCoreAnimation(mpCoreModel->maBakedClips[luiClip].miAnimID) == lpCycle->getCoreAnimation()){
+			return (int)luiClip;
+		}
+	}
+	return -1;
+}
+
+bool cSkeletalMesh::SetBaked(bool lbBaked){
+	if (lbBaked == IsBaked()){
+		return true;
+	}
+	if (lbBaked){
+		int liClip = GetPlayingBakedClip();
+		if (liClip < 0){
+			return false;
+		}
+		// The cycles run on the time of the mixer, scaled to the duration of every cycle
+		CalMixer * lpMixer = mpCal3DModel->getMixer();
+		float lfPhase = lpMixer->getAnimationTime();
+		float lfMixerDuration = lpMixer->getAnimationDuration();
+		if (lfMixerDuration > 0.0f){
+			lfPhase *= mpCoreModel->GetBakedDuration(liClip) / lfMixerDuration;
+		}
+		delete mpCal3DModel;
+		mpCal3DModel = NULL;
+		miBakedClip = liClip;
+		mfBakedPhase = lfPhase;
+		return true;
+	}
+
+	mpCoreModel->CreateInstance(this);
+	if (miBakedClip >= 0){
+		// The first update gives the mixer the duration of the cycle, then the time can be set
+		CalMixer * lpMixer = mpCal3DModel->getMixer();
+		lpMixer->blendCycle(mpCoreModel->maBakedClips[miBakedClip].miAnimID, 1.0f, 0.0f);
+		mpCal3DModel->update(0.0f);
+		lpMixer->setAnimationTime(mfBakedPhase);
+		mpCal3DModel->update(0.0f);
+	}
+	return true;
+}
+
+void cSkeletalMesh::UpdateLod(float lfDistance, float lfBakeDistance){
+	if (IsBaked()){
+		if (lfDistance < lfBakeDistance * 0.9f){
+			SetBaked(false);
+		}
+	}else if (lfDistance > lfBakeDistance){
+		SetBaked(true);
+	}
+}
+
 bool cSkeletalMesh::PlayAnim(const std::string & lacAnimName, float lfWeight, float lfDelayIn, float lfDelayOut){
 	// Search for the animation
-	sAnimationDef* lpDef = mpCoreModel->GetAnimationDef(lacAnimName);
+	return PlayAnim(mpCoreModel->GetAnimationIndex(lacAnimName), lfWeight, lfDelayIn, lfDelayOut);
+}
+
+bool cSkeletalMesh::PlayAnim(int liAnim, float lfWeight, float lfDelayIn, float lfDelayOut){
+	if (IsBaked()){
+		// Baked instances can only switch between cycles, without blending
+		int liClip = mpCoreModel->GetBakedClip(liAnim);
+		if (liClip < 0){
+			return false;
+		}
+		if (liClip != miBakedClip){
+			miBakedClip = liClip;
+			mfBakedPhase = 0.0f;
+		}
+		return true;
+	}
+
+	sAnimationDef* lpDef = mpCoreModel->GetAnimationDef(liAnim);
 	if (lpDef){
 		// Detects if it's a cycle or an action
 		if (lpDef->meAnimType == eAnimType_Cycle){
@@ -48,7 +149,15 @@ bool cSkeletalMesh::PlayAnim(const std::string & lacAnimName, float lfWeight, fl
 }
 
 void cSkeletalMesh::StopAnim(const std::string & lacAnimName, float lfDelayOut){
-	sAnimationDef* lpDef= mpCoreModel->GetAnimationDef(lacAnimName);
+	StopAnim(mpCoreModel->GetAnimationIndex(lacAnimName), lfDelayOut);
+}
+
+void cSkeletalMesh::StopAnim(int liAnim, float lfDelayOut){
+	// The baked clip keeps playing until another one is requested
+	if (IsBaked()){
+		return;
+	}
+	sAnimationDef* lpDef= mpCoreModel->GetAnimationDef(liAnim);
 	if (lpDef){
 		if (lpDef->meAnimType == eAnimType_Cycle){
 			// Blend the cycle
@@ -60,7 +169,44 @@ void cSkeletalMesh::StopAnim(const std::string & lacAnimName, float lfDelayOut){
 	}
 }
 
+bool cSkeletalMesh::StartStateMachine(float lfBlendTime){
+	if (!mpCoreModel->HasStateMachine()){
+		return false;
+	}
+	miState = mpCoreModel->miInitialState;
+	return PlayAnim(mpCoreModel->maStates[miState].miAnim, 1.0f, lfBlendTime);
+}
+
+void cSkeletalMesh::FireEvent(int liEvent){
+	if (miState < 0 || liEvent < 0 || liEvent >= (int)mpCoreModel->macEventNames.size()){
+		return;
+	}
+
+	// Move to the next state, blending the cycles
+	const sAnimTransition &lTransition = mpCoreModel->maTransitions[miState * mpCoreModel->macEventNames.size() + liEvent];
+	if (lTransition.miTargetState >= 0 && lTransition.miTargetState != miState){
+		StopAnim(mpCoreModel->maStates[miState].miAnim, lTransition.mfBlendTime);
+		miState = lTransition.miTargetState;
+		PlayAnim(mpCoreModel->maStates[miState].miAnim, 1.0f, lTransition.mfBlendTime);
+	}
+
+	// And play or stop the action of the event
+	const sAnimEventAction &lAction = mpCoreModel->maEventActions[liEvent];
+	if (lAction.miAnim >= 0){
+		if (lAction.mbStop){
+			StopAnim(lAction.miAnim, lAction.mfBlendOut);
+		}else{
+			PlayAnim(lAction.miAnim, 1.0f, lAction.mfBlendIn, lAction.mfBlendOut);
+		}
+	}
+}
+
 void cSkeletalMesh::RenderSkeleton(void){
+	// There is no skeleton in the baked instances
+	if (IsBaked()){
+		return;
+	}
+
 	// Set world parameters to 0.01f (the model is too big!)
 	cMatrix lWorld;
 	lWorld.LoadIdentity();
@@ -87,46 +233,40 @@ void cSkeletalMesh::RenderSkeleton(void){
 
 // This function will set the buffers and sent data to render by OpenGL
 // Weight buffer will be used like a color buffer and index buffer will be used like an additional texture coordinate 
+// All the streams are interleaved in a single vertex buffer
 void cSkeletalMesh::RenderMesh(){
-	// Position
+	unsigned luiStride = mpCoreModel->muiVertexStride;
 	glBindBuffer(GL_ARRAY_BUFFER, mpCoreModel->mVboVertices);
 	assert(glGetError() == GL_NO_ERROR);
-	glVertexPointer(3, GL_FLOAT, sizeof(float) * 3, 0);
+
+	// Position
+	glVertexPointer(3, GL_FLOAT, luiStride, 0);
 	assert(glGetError() == GL_NO_ERROR);
 
 	// Normals
-	glBindBuffer(GL_ARRAY_BUFFER, mpCoreModel->mVboNormals);
-	assert(glGetError() == GL_NO_ERROR);
-	glNormalPointer(GL_FLOAT, sizeof(float) * 3, 0);
+	glNormalPointer(GL_FLOAT, luiStride, (char *)NULL + cSkeletalCoreModel::kuiNormalOffset);
 	assert(glGetError() == GL_NO_ERROR);
 
-	// This line has been added
-	//-----------------------------------------------------------------
 	// Set all the UV channels to the render
 	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
-	assert(mpCoreModel->maVboTexture.size() <= 3);
+	assert(mpCoreModel->muiTexCoordCount <= 3);
 	static GLenum meTextureChannelEnum[] = { GL_TEXTURE0, GL_TEXTURE1, GL_TEXTURE2, GL_TEXTURE3 };
-	for(unsigned luiTexCoordChannel = 0; luiTexCoordChannel < mpCoreModel->maVboTexture.size(); ++luiTexCoordChannel){
+	for(unsigned luiTexCoordChannel = 0; luiTexCoordChannel < mpCoreModel->muiTexCoordCount; ++luiTexCoordChannel){
 		// Texture coordinates
 		glClientActiveTexture(meTextureChannelEnum[luiTexCoordChannel]);
-		glBindBuffer(GL_ARRAY_BUFFER,
-		mpCoreModel->maVboTexture[luiTexCoordChannel]);
-		assert(glGetError() == GL_NO_ERROR);
-		glTexCoordPointer(2, GL_FLOAT, sizeof(float)*2, 0);
+		glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+		glTexCoordPointer(2, GL_FLOAT, luiStride, (char *)NULL + cSkeletalCoreModel::kuiTexCoordOffset + luiTexCoordChannel * sizeof(float) * 2);
 		assert(glGetError() == GL_NO_ERROR);
 	}
 
 	// Bone Index
-	glClientActiveTexture(meTextureChannelEnum[mpCoreModel->maVboTexture.size()]);
-	glBindBuffer(GL_ARRAY_BUFFER, mpCoreModel->mVboBoneIx);
-	assert(glGetError() == GL_NO_ERROR);
-	glTexCoordPointer(4, GL_FLOAT, sizeof(float)*4, 0);
+	glClientActiveTexture(meTextureChannelEnum[mpCoreModel->muiTexCoordCount]);
+	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	glTexCoordPointer(4, GL_FLOAT, luiStride, (char *)NULL + cSkeletalCoreModel::kuiBoneIxOffset);
 	assert(glGetError() == GL_NO_ERROR);
 
 	// Weights
-	glBindBuffer(GL_ARRAY_BUFFER, mpCoreModel->mVboWeight);
-	assert(glGetError() == GL_NO_ERROR);
-	glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(unsigned char) * 4, 0);
+	glColorPointer(4, GL_UNSIGNED_BYTE, luiStride, (char *)NULL + cSkeletalCoreModel::kuiWeightOffset);
 	assert(glGetError() == GL_NO_ERROR);
 
 	// Index
@@ -135,11 +275,10 @@ void cSkeletalMesh::RenderMesh(){
 	glEnableClientState(GL_VERTEX_ARRAY);
 	glEnableClientState(GL_NORMAL_ARRAY);
 	glEnableClientState(GL_COLOR_ARRAY);
-	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
 
 	glDrawRangeElements(GL_TRIANGLES,
 						0,
-						mpCoreModel->muiIndexCount,
+						mpCoreModel->muiVertexCount - 1,
 						mpCoreModel->muiIndexCount,
 						GL_UNSIGNED_INT,
 						NULL);
@@ -149,40 +288,134 @@ void cSkeletalMesh::RenderMesh(){
 	glDisableClientState(GL_COLOR_ARRAY);
 	glDisableClientState(GL_VERTEX_ARRAY);
 	glDisableClientState(GL_NORMAL_ARRAY);
-	glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+	for(unsigned luiTexCoordChannel = 0; luiTexCoordChannel <= mpCoreModel->muiTexCoordCount; ++luiTexCoordChannel){
+		glClientActiveTexture(meTextureChannelEnum[luiTexCoordChannel]);
+		glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+	}
+	glClientActiveTexture(GL_TEXTURE0);
 }
 
 void cSkeletalMesh::PrepareRender(cResourceHandle lMaterial){
-	struct sMatrix3x4 {
-		float r00, r01, r02, tx;
-		float r10, r11, r12, ty;
-		float r20, r21, r22, tz;
-	};
-
-	sMatrix3x4 lMatrices[ 80 ];
-	typedef std::vector< CalBone * > cVBones;
-	const cVBones &lBones = mpCal3DModel->getSkeleton()->getVectorBone( );
-	int liBoneCount = lBones.size();
-	assert(liBoneCount <= 80);
-	for( unsigned luiIndex = 0; luiIndex < (unsigned)liBoneCount; ++luiIndex ){
-		const CalMatrix &lCalMatrix = lBones[ luiIndex ]->getTransformMatrix( );
-		const CalVector &lCalTrans = lBones[ luiIndex ]->getTranslationBoneSpace( );
-		// Convert the CalMatrix in a 3x4 transposed matrix
-		lMatrices[ luiIndex ].r00 = lCalMatrix.dxdx;
-		lMatrices[ luiIndex ].r01 = lCalMatrix.dxdy;
-		lMatrices[ luiIndex ].r02 = lCalMatrix.dxdz;
-		lMatrices[ luiIndex ].tx = lCalTrans.x;
-		lMatrices[ luiIndex ].r10 = lCalMatrix.dydx;
-		lMatrices[ luiIndex ].r11 = lCalMatrix.dydy;
-		lMatrices[ luiIndex ].r12 = lCalMatrix.dydz;
-		lMatrices[ luiIndex ].ty = lCalTrans.y;
-		lMatrices[ luiIndex ].r20 = lCalMatrix.dzdx;
-		lMatrices[ luiIndex ].r21 = lCalMatrix.dzdy;
-		lMatrices[ luiIndex ].r22 = lCalMatrix.dzdz;
-		lMatrices[ luiIndex ].tz = lCalTrans.z;
-	}
-
 	cMaterial* lpMaterial = (cMaterial*)lMaterial.GetResource();	
 	cEffect * lpEffect = (cEffect *)lpMaterial->GetEffect().GetResource();
-	lpEffect->SetParam("BonesRow", &lMatrices[0].r00, lBones.size( ) * 12 );
+
+	// Palette of the pose (far instances read it from the table of the core model)
+	float lafPalette[ cSkeletalCoreModel::kuiMaxBonesDQ * 12 ];
+	const float * lafBones = lafPalette;
+	unsigned luiBoneCount;
+	if (IsBaked()){
+		lafBones = mpCoreModel->GetBakedPalette(miBakedClip, mfBakedPhase);
+		luiBoneCount = mpCoreModel->GetBoneCount();
+	}else{
+		luiBoneCount = cSkeletalCoreModel::BuildBonePalette(mpCal3DModel->getSkeleton(), lafPalette);
+	}
+
+	if (lpMaterial->GetSkinning() == eSkinning_DualQuaternion){
+		// 8 floats per bone instead of 12
+		float lafDualQuats[ cSkeletalCoreModel::kuiMaxBonesDQ * 8 ];
+		cSkeletalSkinning::PaletteToDualQuaternions(lafBones, luiBoneCount, lafDualQuats);
+		lpEffect->SetParam("BonesDQ", lafDualQuats, luiBoneCount * 8 );
+	}else{
+		assert(luiBoneCount <= cSkeletalCoreModel::kuiMaxBones);
+		lpEffect->SetParam("BonesRow", lafBones, luiBoneCount * 12 );
+	}
+}
+
+unsigned cSkeletalMesh::GetBonePalette(float * lafPalette){
+	if (IsBaked()){
+		unsigned luiBoneCount = mpCoreModel->GetBoneCount();
+		memcpy(lafPalette, mpCoreModel->GetBakedPalette(miBakedClip, mfBakedPhase), luiBoneCount * 12 * sizeof(float));
+		return luiBoneCount;
+	}
+	return cSkeletalCoreModel::BuildBonePalette(mpCal3DModel->getSkeleton(), lafPalette);
+}
+
+unsigned cSkeletalMesh::GetSkinVertexCount() const{
+	return mpCoreModel->GetVertexCount();
+}
+
+void cSkeletalMesh::SkinVertices(float * lafPositions, float * lafNormals){
+	assert(lafPositions);
+	if (mpCoreModel->maSkinRanges.empty()){
+		return;
+	}
+	float lafPalette[ cSkeletalCoreModel::kuiMaxBonesDQ * 12 ];
+	GetBonePalette(lafPalette);
+	cSkeletalSkinning::SkinRanges(&mpCoreModel->macVertices[0], mpCoreModel->muiVertexStride, &mpCoreModel->maSkinRanges[0],
+								  mpCoreModel->maSkinRanges.size(), lafPalette, lafPositions, lafNormals);
+}
+
+bool cSkeletalMesh::BenchmarkSkinning(unsigned luiIterations){
+	// CalPhysique needs the full instance
+	if (IsBaked() || luiIterations == 0 || mpCoreModel->maSkinRanges.empty()){
+		BenchReport("Skinning: needs a full instance with skin ranges");
+		return false;
+	}
+	unsigned luiVertexCount = GetSkinVertexCount();
+	std::vector<float> lafPositions(luiVertexCount * 3);
+	std::vector<float> lafNormals(luiVertexCount * 3);
+	std::vector<float> lafPhysique(luiVertexCount * 6);
+	float lafPalette[ cSkeletalCoreModel::kuiMaxBonesDQ * 12 ];
+	const std::vector<sSkinRange> &laRanges = mpCoreModel->maSkinRanges;
+	const unsigned char * lpVertices = &mpCoreModel->macVertices[0];
+	unsigned luiStride = mpCoreModel->muiVertexStride;
+
+	cBenchTimer lTimer;
+	double ladTimes[4];
+
+	// Scalar CalPhysique
+	lTimer.Start();
+	for (unsigned luiIteration = 0; luiIteration < luiIterations; ++luiIteration){
+		float * lafOut = &lafPhysique[0];
+		std::vector<CalMesh *> &lMeshes = mpCal3DModel->getVectorMesh();
+		for (unsigned luiMesh = 0; luiMesh < lMeshes.size(); ++luiMesh){
+			std::vector<CalSubmesh *> &lSubmeshes = lMeshes[luiMesh]->getVectorSubmesh();
+			for (unsigned luiSubmesh = 0; luiSubmesh < lSubmeshes.size(); ++luiSubmesh){
+				int liCount = mpCal3DModel->getPhysique()->calculateVerticesAndNormals(lSubmeshes[luiSubmesh], lafOut);
+				lafOut += liCount * 6;
+			}
+		}
+	}
+	ladTimes[0] = lTimer.GetMs();
+
+	// Scalar path over the packed streams
+	lTimer.Start();
+	for (unsigned luiIteration = 0; luiIteration < luiIterations; ++luiIteration){
+		GetBonePalette(lafPalette);
+		for (unsigned luiRange = 0; luiRange < laRanges.size(); ++luiRange){
+			cSkeletalSkinning::SkinRangeScalar(lpVertices, luiStride, laRanges[luiRange], lafPalette, &lafPositions[0], &lafNormals[0]);
+		}
+	}
+	ladTimes[1] = lTimer.GetMs();
+
+	// SSE in a single thread
+	lTimer.Start();
+	for (unsigned luiIteration = 0; luiIteration < luiIterations; ++luiIteration){
+		GetBonePalette(lafPalette);
+		for (unsigned luiRange = 0; luiRange < laRanges.size(); ++luiRange){
+			cSkeletalSkinning::SkinRange(lpVertices, luiStride, laRanges[luiRange], lafPalette, &lafPositions[0], &lafNormals[0]);
+		}
+	}
+	ladTimes[2] = lTimer.GetMs();
+
+	// SSE with the parallel for over the submeshes
+	lTimer.Start();
+	for (unsigned luiIteration = 0; luiIteration < luiIterations; ++luiIteration){
+		SkinVertices(&lafPositions[0], &lafNormals[0]);
+	}
+	ladTimes[3] = lTimer.GetMs();
+
+	// Both paths should give the same pose (the weights are quantized to 8 bits in the streams)
+	float lfMaxError = 0.0f;
+	for (unsigned luiVertex = 0; luiVertex < luiVertexCount; ++luiVertex){
+		for (unsigned luiAxis = 0; luiAxis < 3; ++luiAxis){
+			float lfError = fabsf(lafPhysique[luiVertex * 6 + luiAxis] - lafPositions[luiVertex * 3 + luiAxis]);
+			lfMaxError = (lfError > lfMaxError)? lfError : lfMaxError;
+		}
+	}
+
+	BenchReport("Skinning %u vertices x %u: CalPhysique %.3f ms, scalar %.3f ms, SSE %.3f ms, SSE %u threads %.3f ms (max error %f)",
+				luiVertexCount, luiIterations, ladTimes[0] / luiIterations, ladTimes[1] / luiIterations,
+				ladTimes[2] / luiIterations, cThreadPool::Get().GetThreadCount(), ladTimes[3] / luiIterations, lfMaxError);
+	return true;
 }
\ No newline at end of file
@@ -7,10 +7,16 @@
 
 class CalModel;
 
+// Kind of instance: full instances own a CalModel, baked ones use the pose table of the core
+enum eSkeletalInstance{
+	eSkeletalInstance_Full = 0,
+	eSkeletalInstance_Baked
+};
+
 class cSkeletalMesh : public cMesh{
 public:
 	// Constructor
-	cSkeletalMesh(): cMesh() { }
+	cSkeletalMesh(): cMesh() { mpCal3DModel = NULL; mpCoreModel = NULL; miBakedClip = -1; mfBakedPhase = 0.0f; miState = -1; }
 
 	// Core part of the model
 	friend class cSkeletalCoreModel;
@@ -28,7 +34,21 @@ public:
 	virtual void RenderMesh();
 
 	// Checks if the model is loaded
-	virtual bool IsLoaded() { return (mpCal3DModel != NULL); }
+	virtual bool IsLoaded() { return (mpCal3DModel != NULL || (mpCoreModel != NULL && miBakedClip >= 0)); }
+
+	// Checks if the instance uses the baked poses
+	inline bool IsBaked() const { return (mpCal3DModel == NULL); }
+
+	// Sets the phase (in seconds) of the baked clip, to desync the crowd
+	inline void SetBakedPhase(float lfPhase) { mfBakedPhase = lfPhase; }
+
+	// Moves the instance between the baked poses and a full CalModel, it keeps the cycle
+	// that is playing and its phase (the actions in flight are dropped when it is baked).
+	// False if the cycle has no baked clip, then the instance stays full
+	bool SetBaked(bool lbBaked);
+	// Baked beyond lfBakeDistance, full again under 90% of it so it doesn't switch every
+	// frame at the border
+	void UpdateLod(float lfDistance, float lfBakeDistance);
 	
 	// Render skeleton mesh
 	void RenderSkeleton();
@@ -39,15 +59,47 @@ public:
 	// Stop animation
 	void StopAnim(const std::string & lacAnimName, float lfDelayOut = 0.0f);
 
+	// Same, with the index given by cSkeletalCoreModel::GetAnimationIndex (no string lookups)
+	bool PlayAnim(int liAnim, float lfWeight, float lfDelayIn, float lfDelayOut = 0.0f);
+	void StopAnim(int liAnim, float lfDelayOut = 0.0f);
+
+	// State machine of the core model: starts in the initial state, the events come from
+	// cSkeletalCoreModel::GetEventIndex. Returns false if the model has no state machine
+	bool StartStateMachine(float lfBlendTime = 0.0f);
+	void FireEvent(int liEvent);
+	inline int GetState() const { return miState; }
+	inline cSkeletalCoreModel * GetCoreModel() { return mpCoreModel; }
+
 	// Set shader animation matrix
 	void cSkeletalMesh::PrepareRender(cResourceHandle lMaterial);
 
+	// Skins the current pose in the CPU. The buffers hold 3 floats per vertex of the
+	// core model (GetSkinVertexCount), lafNormals can be NULL
+	void SkinVertices(float * lafPositions, float * lafNormals);
+	unsigned GetSkinVertexCount() const;
+
+	// Compares the CPU skinning against CalPhysique (BenchReport), false without a full instance
+	bool BenchmarkSkinning(unsigned luiIterations);
+
 private:
 
+	// Palette of the current pose (3x4 matrix per bone), returns the bone count
+	unsigned GetBonePalette(float * lafPalette);
+
+	// Baked clip of the heaviest cycle of the mixer, -1 if it has none
+	int GetPlayingBakedClip();
+
 	// Cal3D model
 	CalModel * mpCal3DModel;
 	// And core part
 	cSkeletalCoreModel * mpCoreModel;
+
+	// Baked instances only store the clip and the phase
+	int miBakedClip;
+	float mfBakedPhase;
+
+	// Current state of the state machine (-1 if not used)
+	int miState;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,469 @@
+#include "cSkeletalSkinning.h"
+#include "cSkeletalCoreModel.h"
+#include "../../Utility/ThreadPool.h"
+#include "../../Utility/Benchmark.h"
+#include <xmmintrin.h>
+#include <cmath>
+#include <cassert>
+#include <vector>
+#include <cstring>
+
+// Pointers to the streams of a vertex
+#define SKIN_POSITION(lpVertex) ((const float *)(lpVertex))
+#define SKIN_NORMAL(lpVertex) ((const float *)((lpVertex) + cSkeletalCoreModel::kuiNormalOffset))
+#define SKIN_BONES(lpVertex) ((const float *)((lpVertex) + cSkeletalCoreModel::kuiBoneIxOffset))
+#define SKIN_WEIGHTS(lpVertex) ((lpVertex) + cSkeletalCoreModel::kuiWeightOffset)
+
+void cSkeletalSkinning::SkinRangeScalar( const unsigned char * lpVertices, unsigned luiStride, const sSkinRange &lRange,
+										 const float * lafPalette, float * lafPositions, float * lafNormals ){
+	unsigned luiEnd = lRange.muiFirstVertex + lRange.muiVertexCount;
+	for (unsigned luiVertex = lRange.muiFirstVertex; luiVertex < luiEnd; ++luiVertex){
+		const unsigned char * lpVertex = lpVertices + luiVertex * luiStride;
+		const float * lafPos = SKIN_POSITION(lpVertex);
+		const float * lafNor = SKIN_NORMAL(lpVertex);
+		const float * lafBones = SKIN_BONES(lpVertex);
+		const unsigned char * lacWeights = SKIN_WEIGHTS(lpVertex);
+
+		// Blend the matrices of the influences
+		float lafMatrix[12] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+		for (unsigned luiInfluence = 0; luiInfluence < 4; ++luiInfluence){
+			float lfWeight = lacWeights[luiInfluence] * (1.0f / 255.0f);
+			const float * lafBone = lafPalette + (unsigned)lafBones[luiInfluence] * 12;
+			for (unsigned luiIndex = 0; luiIndex < 12; ++luiIndex){
+				lafMatrix[luiIndex] += lfWeight * lafBone[luiIndex];
+			}
+		}
+
+		float * lafOut = lafPositions + luiVertex * 3;
+		for (unsigned luiRow = 0; luiRow < 3; ++luiRow){
+			const float * lafRow = lafMatrix + luiRow * 4;
+			lafOut[luiRow] = lafRow[0] * lafPos[0] + lafRow[1] * lafPos[1] + lafRow[2] * lafPos[2] + lafRow[3];
+		}
+		if (lafNormals){
+			float * lafOutNormal = lafNormals + luiVertex * 3;
+			for (unsigned luiRow = 0; luiRow < 3; ++luiRow){
+				const float * lafRow = lafMatrix + luiRow * 4;
+				lafOutNormal[luiRow] = lafRow[0] * lafNor[0] + lafRow[1] * lafNor[1] + lafRow[2] * lafNor[2];
+			}
+			float lfLength = sqrtf(lafOutNormal[0] * lafOutNormal[0] + lafOutNormal[1] * lafOutNormal[1] + lafOutNormal[2] * lafOutNormal[2]);
+			if (lfLength > 0.0f){
+				lafOutNormal[0] /= lfLength;
+				lafOutNormal[1] /= lfLength;
+				lafOutNormal[2] /= lfLength;
+			}
+		}
+	}
+}
+
+// Blends the 3 rows of the matrices of the 4 influences of a vertex
+static inline void BlendRows( const unsigned char * lpVertex, const float * lafPalette, __m128 &lRow0, __m128 &lRow1, __m128 &lRow2 ){
+	const float * lafBones = SKIN_BONES(lpVertex);
+	const unsigned char * lacWeights = SKIN_WEIGHTS(lpVertex);
+	lRow0 = _mm_setzero_ps();
+	lRow1 = _mm_setzero_ps();
+	lRow2 = _mm_setzero_ps();
+	for (unsigned luiInfluence = 0; luiInfluence < 4; ++luiInfluence){
+		__m128 lWeight = _mm_set1_ps(lacWeights[luiInfluence] * (1.0f / 255.0f));
+		const float * lafBone = lafPalette + (unsigned)lafBones[luiInfluence] * 12;
+		lRow0 = _mm_add_ps(lRow0, _mm_mul_ps(lWeight, _mm_loadu_ps(lafBone)));
+		lRow1 = _mm_add_ps(lRow1, _mm_mul_ps(lWeight, _mm_loadu_ps(lafBone + 4)));
+		lRow2 = _mm_add_ps(lRow2, _mm_mul_ps(lWeight, _mm_loadu_ps(lafBone + 8)));
+	}
+}
+
+void cSkeletalSkinning::SkinRange( const unsigned char * lpVertices, unsigned luiStride, const sSkinRange &lRange,
+								   const float * lafPalette, float * lafPositions, float * lafNormals ){
+	unsigned luiVertex = lRange.muiFirstVertex;
+	unsigned luiEnd = lRange.muiFirstVertex + lRange.muiVertexCount;
+	const __m128 lOne = _mm_set1_ps(1.0f);
+	const __m128 lEpsilon = _mm_set1_ps(1e-12f);
+
+	// Blocks of 4 vertices
+	for ( ; luiVertex + 4 <= luiEnd; luiVertex += 4){
+		// Blended rows of the 4 vertices, transposed to get one column of the 4 matrices per register
+		__m128 laRow0[4], laRow1[4], laRow2[4];
+		__m128 laPos[4], laNor[4];
+		for (unsigned luiIndex = 0; luiIndex < 4; ++luiIndex){
+			const unsigned char * lpVertex = lpVertices + (luiVertex + luiIndex) * luiStride;
+			BlendRows(lpVertex, lafPalette, laRow0[luiIndex], laRow1[luiIndex], laRow2[luiIndex]);
+			// Position and normal as x, y, z, (w ignored)
+			laPos[luiIndex] = _mm_loadu_ps(SKIN_POSITION(lpVertex));
+			laNor[luiIndex] = _mm_loadu_ps(SKIN_NORMAL(lpVertex));
+		}
+		_MM_TRANSPOSE4_PS(laRow0[0], laRow0[1], laRow0[2], laRow0[3]);
+		_MM_TRANSPOSE4_PS(laRow1[0], laRow1[1], laRow1[2], laRow1[3]);
+		_MM_TRANSPOSE4_PS(laRow2[0], laRow2[1], laRow2[2], laRow2[3]);
+		_MM_TRANSPOSE4_PS(laPos[0], laPos[1], laPos[2], laPos[3]);
+
+		// Positions of the 4 vertices (SoA)
+		__m128 lX = _mm_add_ps(_mm_add_ps(_mm_mul_ps(laRow0[0], laPos[0]), _mm_mul_ps(laRow0[1], laPos[1])), _mm_add_ps(_mm_mul_ps(laRow0[2], laPos[2]), laRow0[3]));
+		__m128 lY = _mm_add_ps(_mm_add_ps(_mm_mul_ps(laRow1[0], laPos[0]), _mm_mul_ps(laRow1[1], laPos[1])), _mm_add_ps(_mm_mul_ps(laRow1[2], laPos[2]), laRow1[3]));
+		__m128 lZ = _mm_add_ps(_mm_add_ps(_mm_mul_ps(laRow2[0], laPos[0]), _mm_mul_ps(laRow2[1], laPos[1])), _mm_add_ps(_mm_mul_ps(laRow2[2], laPos[2]), laRow2[3]));
+
+		float lafOut[3][4];
+		_mm_storeu_ps(lafOut[0], lX);
+		_mm_storeu_ps(lafOut[1], lY);
+		_mm_storeu_ps(lafOut[2], lZ);
+		float * lafDest = lafPositions + luiVertex * 3;
+		for (unsigned luiIndex = 0; luiIndex < 4; ++luiIndex){
+			lafDest[luiIndex * 3] = lafOut[0][luiIndex];
+			lafDest[luiIndex * 3 + 1] = lafOut[1][luiIndex];
+			lafDest[luiIndex * 3 + 2] = lafOut[2][luiIndex];
+		}
+
+		if (lafNormals){
+			_MM_TRANSPOSE4_PS(laNor[0], laNor[1], laNor[2], laNor[3]);
+			__m128 lNX = _mm_add_ps(_mm_add_ps(_mm_mul_ps(laRow0[0], laNor[0]), _mm_mul_ps(laRow0[1], laNor[1])), _mm_mul_ps(laRow0[2], laNor[2]));
+			__m128 lNY = _mm_add_ps(_mm_add_ps(_mm_mul_ps(laRow1[0], laNor[0]), _mm_mul_ps(laRow1[1], laNor[1])), _mm_mul_ps(laRow1[2], laNor[2]));
+			__m128 lNZ = _mm_add_ps(_mm_add_ps(_mm_mul_ps(laRow2[0], laNor[0]), _mm_mul_ps(laRow2[1], laNor[1])), _mm_mul_ps(laRow2[2], laNor[2]));
+
+			// Normalize the 4 normals
+			__m128 lLength = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(lNX, lNX), _mm_mul_ps(lNY, lNY)), _mm_mul_ps(lNZ, lNZ)));
+			__m128 lInvLength = _mm_div_ps(lOne, _mm_max_ps(lLength, lEpsilon));
+			_mm_storeu_ps(lafOut[0], _mm_mul_ps(lNX, lInvLength));
+			_mm_storeu_ps(lafOut[1], _mm_mul_ps(lNY, lInvLength));
+			_mm_storeu_ps(lafOut[2], _mm_mul_ps(lNZ, lInvLength));
+			lafDest = lafNormals + luiVertex * 3;
+			for (unsigned luiIndex = 0; luiIndex < 4; ++luiIndex){
+				lafDest[luiIndex * 3] = lafOut[0][luiIndex];
+				lafDest[luiIndex * 3 + 1] = lafOut[1][luiIndex];
+				lafDest[luiIndex * 3 + 2] = lafOut[2][luiIndex];
+			}
+		}
+	}
+
+	// Remaining vertices
+	if (luiVertex < luiEnd){
+		sSkinRange lTail;
+		lTail.muiFirstVertex = luiVertex;
+		lTail.muiVertexCount = luiEnd - luiVertex;
+		SkinRangeScalar(lpVertices, luiStride, lTail, lafPalette, lafPositions, lafNormals);
+	}
+}
+
+// Data shared by the jobs of SkinRanges
+struct sSkinJob{
+	const unsigned char * mpVertices;
+	unsigned muiStride;
+	const sSkinRange * mpRanges;
+	const float * mpPalette;
+	float * mpPositions;
+	float * mpNormals;
+};
+
+static void SkinRangeJob( unsigned luiIndex, void * lpData ){
+	sSkinJob * lpJob = (sSkinJob *)lpData;
+	cSkeletalSkinning::SkinRange(lpJob->mpVertices, lpJob->muiStride, lpJob->mpRanges[luiIndex], lpJob->mpPalette, lpJob->mpPositions, lpJob->mpNormals);
+}
+
+void cSkeletalSkinning::SkinRanges( const unsigned char * lpVertices, unsigned luiStride, const sSkinRange * laRanges, unsigned luiRangeCount,
+									const float * lafPalette, float * lafPositions, float * lafNormals ){
+	sSkinJob lJob;
+	lJob.mpVertices = lpVertices;
+	lJob.muiStride = luiStride;
+	lJob.mpRanges = laRanges;
+	lJob.mpPalette = lafPalette;
+	lJob.mpPositions = lafPositions;
+	lJob.mpNormals = lafNormals;
+	cThreadPool::Get().ParallelFor(luiRangeCount, SkinRangeJob, &lJob);
+}
+
+
+// Quaternion of the rotation of a matrix, with w >= 0
+static void MatrixToQuaternion( const float * lafMatrix, float * lafQuat ){
+	float m00 = lafMatrix[0], m01 = lafMatrix[1], m02 = lafMatrix[2];
+	float m10 = lafMatrix[4], m11 = lafMatrix[5], m12 = lafMatrix[6];
+	float m20 = lafMatrix[8], m21 = lafMatrix[9], m22 = lafMatrix[10];
+	float lfTrace = m00 + m11 + m22;
+	if (lfTrace > 0.0f){
+		float s = sqrtf(lfTrace + 1.0f) * 2.0f;
+		lafQuat[3] = 0.25f * s;
+		lafQuat[0] = (m21 - m12) / s;
+		lafQuat[1] = (m02 - m20) / s;
+		lafQuat[2] = (m10 - m01) / s;
+	}else if (m00 > m11 && m00 > m22){
+		float s = sqrtf(1.0f + m00 - m11 - m22) * 2.0f;
+		lafQuat[3] = (m21 - m12) / s;
+		lafQuat[0] = 0.25f * s;
+		lafQuat[1] = (m01 + m10) / s;
+		lafQuat[2] = (m02 + m20) / s;
+	}else if (m11 > m22){
+		float s = sqrtf(1.0f + m11 - m00 - m22) * 2.0f;
+		lafQuat[3] = (m02 - m20) / s;
+		lafQuat[0] = (m01 + m10) / s;
+		lafQuat[1] = 0.25f * s;
+		lafQuat[2] = (m12 + m21) / s;
+	}else{
+		float s = sqrtf(1.0f + m22 - m00 - m11) * 2.0f;
+		lafQuat[3] = (m10 - m01) / s;
+		lafQuat[0] = (m02 + m20) / s;
+		lafQuat[1] = (m12 + m21) / s;
+		lafQuat[2] = 0.25f * s;
+	}
+	if (lafQuat[3] < 0.0f){
+		for (unsigned luiIndex = 0; luiIndex < 4; ++luiIndex){
+			lafQuat[luiIndex] = -lafQuat[luiIndex];
+		}
+	}
+}
+
+void cSkeletalSkinning::PaletteToDualQuaternionsScalar( const float * lafPalette, unsigned luiBoneCount, float * lafDualQuats ){
+	for (unsigned luiBone = 0; luiBone < luiBoneCount; ++luiBone){
+		const float * lafMatrix = lafPalette + luiBone * 12;
+		float * q = lafDualQuats + luiBone * 8;
+		float * d = q + 4;
+		MatrixToQuaternion(lafMatrix, q);
+		// Dual part: 0.5 * t * q
+		float tx = lafMatrix[3], ty = lafMatrix[7], tz = lafMatrix[11];
+		d[0] = 0.5f * ( tx * q[3] + ty * q[2] - tz * q[1]);
+		d[1] = 0.5f * (-tx * q[2] + ty * q[3] + tz * q[0]);
+		d[2] = 0.5f * ( tx * q[1] - ty * q[0] + tz * q[3]);
+		d[3] = -0.5f * (tx * q[0] + ty * q[1] + tz * q[2]);
+	}
+}
+
+// Picks lA, lB, lC or lD with the (exclusive) masks
+static inline __m128 Select4( __m128 lMaskA, __m128 lA, __m128 lMaskB, __m128 lB, __m128 lMaskC, __m128 lC, __m128 lMaskD, __m128 lD ){
+	return _mm_or_ps(_mm_or_ps(_mm_and_ps(lMaskA, lA), _mm_and_ps(lMaskB, lB)), _mm_or_ps(_mm_and_ps(lMaskC, lC), _mm_and_ps(lMaskD, lD)));
+}
+
+void cSkeletalSkinning::PaletteToDualQuaternions( const float * lafPalette, unsigned luiBoneCount, float * lafDualQuats ){
+	const __m128 lOne = _mm_set1_ps(1.0f);
+	const __m128 lHalf = _mm_set1_ps(0.5f);
+	const __m128 lZero = _mm_setzero_ps();
+	const __m128 lSignBit = _mm_set1_ps(-0.0f);
+	unsigned luiBone = 0;
+	for ( ; luiBone + 4 <= luiBoneCount; luiBone += 4){
+		// One element of the 4 matrices per register
+		const float * lafMatrix = lafPalette + luiBone * 12;
+		__m128 m00 = _mm_loadu_ps(lafMatrix), m01 = _mm_loadu_ps(lafMatrix + 12), m02 = _mm_loadu_ps(lafMatrix + 24), tx = _mm_loadu_ps(lafMatrix + 36);
+		__m128 m10 = _mm_loadu_ps(lafMatrix + 4), m11 = _mm_loadu_ps(lafMatrix + 16), m12 = _mm_loadu_ps(lafMatrix + 28), ty = _mm_loadu_ps(lafMatrix + 40);
+		__m128 m20 = _mm_loadu_ps(lafMatrix + 8), m21 = _mm_loadu_ps(lafMatrix + 20), m22 = _mm_loadu_ps(lafMatrix + 32), tz = _mm_loadu_ps(lafMatrix + 44);
+		_MM_TRANSPOSE4_PS(m00, m01, m02, tx);
+		_MM_TRANSPOSE4_PS(m10, m11, m12, ty);
+		_MM_TRANSPOSE4_PS(m20, m21, m22, tz);
+
+		// 4 * component^2 of every component, the largest one gives the most stable formula
+		__m128 lW2 = _mm_add_ps(lOne, _mm_add_ps(m00, _mm_add_ps(m11, m22)));
+		__m128 lX2 = _mm_add_ps(lOne, _mm_sub_ps(m00, _mm_add_ps(m11, m22)));
+		__m128 lY2 = _mm_add_ps(lOne, _mm_sub_ps(m11, _mm_add_ps(m00, m22)));
+		__m128 lZ2 = _mm_add_ps(lOne, _mm_sub_ps(m22, _mm_add_ps(m00, m11)));
+		__m128 lMaskW = _mm_cmpge_ps(lW2, _mm_max_ps(lX2, _mm_max_ps(lY2, lZ2)));
+		__m128 lMaskX = _mm_andnot_ps(lMaskW, _mm_cmpge_ps(lX2, _mm_max_ps(lY2, lZ2)));
+		__m128 lMaskY = _mm_andnot_ps(_mm_or_ps(lMaskW, lMaskX), _mm_cmpge_ps(lY2, lZ2));
+		__m128 lMaskZ = _mm_andnot_ps(_mm_or_ps(lMaskW, _mm_or_ps(lMaskX, lMaskY)), _mm_cmpeq_ps(lZero, lZero));
+
+		__m128 lA = _mm_sub_ps(m21, m12), lB = _mm_sub_ps(m02, m20), lC = _mm_sub_ps(m10, m01);
+		__m128 lD = _mm_add_ps(m01, m10), lE = _mm_add_ps(m02, m20), lF = _mm_add_ps(m12, m21);
+		__m128 qw = Select4(lMaskW, lW2, lMaskX, lA, lMaskY, lB, lMaskZ, lC);
+		__m128 qx = Select4(lMaskW, lA, lMaskX, lX2, lMaskY, lD, lMaskZ, lE);
+		__m128 qy = Select4(lMaskW, lB, lMaskX, lD, lMaskY, lY2, lMaskZ, lF);
+		__m128 qz = Select4(lMaskW, lC, lMaskX, lE, lMaskY, lF, lMaskZ, lZ2);
+		__m128 lDen = Select4(lMaskW, lW2, lMaskX, lX2, lMaskY, lY2, lMaskZ, lZ2);
+		__m128 lScale = _mm_div_ps(lHalf, _mm_sqrt_ps(lDen));
+
+		// Keep w >= 0, like the scalar version
+		__m128 lSign = _mm_and_ps(_mm_cmplt_ps(qw, lZero), lSignBit);
+		lScale = _mm_xor_ps(lScale, lSign);
+		qw = _mm_mul_ps(qw, lScale);
+		qx = _mm_mul_ps(qx, lScale);
+		qy = _mm_mul_ps(qy, lScale);
+		qz = _mm_mul_ps(qz, lScale);
+
+		// Dual part: 0.5 * t * q
+		__m128 dx = _mm_mul_ps(lHalf, _mm_sub_ps(_mm_add_ps(_mm_mul_ps(tx, qw), _mm_mul_ps(ty, qz)), _mm_mul_ps(tz, qy)));
+		__m128 dy = _mm_mul_ps(lHalf, _mm_add_ps(_mm_sub_ps(_mm_mul_ps(ty, qw), _mm_mul_ps(tx, qz)), _mm_mul_ps(tz, qx)));
+		__m128 dz = _mm_mul_ps(lHalf, _mm_add_ps(_mm_sub_ps(_mm_mul_ps(tx, qy), _mm_mul_ps(ty, qx)), _mm_mul_ps(tz, qw)));
+		__m128 dw = _mm_sub_ps(lZero, _mm_mul_ps(lHalf, _mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, qx), _mm_mul_ps(ty, qy)), _mm_mul_ps(tz, qz))));
+
+		// Back to one bone per register
+		_MM_TRANSPOSE4_PS(qx, qy, qz, qw);
+		_MM_TRANSPOSE4_PS(dx, dy, dz, dw);
+		float * lafOut = lafDualQuats + luiBone * 8;
+		_mm_storeu_ps(lafOut, qx);
+		_mm_storeu_ps(lafOut + 4, dx);
+		_mm_storeu_ps(lafOut + 8, qy);
+		_mm_storeu_ps(lafOut + 12, dy);
+		_mm_storeu_ps(lafOut + 16, qz);
+		_mm_storeu_ps(lafOut + 20, dz);
+		_mm_storeu_ps(lafOut + 24, qw);
+		_mm_storeu_ps(lafOut + 28, dw);
+	}
+	if (luiBone < luiBoneCount){
+		PaletteToDualQuaternionsScalar(lafPalette + luiBone * 12, luiBoneCount - luiBone, lafDualQuats + luiBone * 8);
+	}
+}
+
+static inline void Cross( const float * lafA, const float * lafB, float * lafOut ){
+	lafOut[0] = lafA[1] * lafB[2] - lafA[2] * lafB[1];
+	lafOut[1] = lafA[2] * lafB[0] - lafA[0] * lafB[2];
+	lafOut[2] = lafA[0] * lafB[1] - lafA[1] * lafB[0];
+}
+
+// Rotates a vector with a unit quaternion: v + 2 * r x (r x v + w * v)
+static inline void RotateVector( const float * q, const float * lafIn, float * lafOut ){
+	float lafTemp[3], lafCross[3];
+	Cross(q, lafIn, lafTemp);
+	lafTemp[0] += q[3] * lafIn[0];
+	lafTemp[1] += q[3] * lafIn[1];
+	lafTemp[2] += q[3] * lafIn[2];
+	Cross(q, lafTemp, lafCross);
+	lafOut[0] = lafIn[0] + 2.0f * lafCross[0];
+	lafOut[1] = lafIn[1] + 2.0f * lafCross[1];
+	lafOut[2] = lafIn[2] + 2.0f * lafCross[2];
+}
+
+void cSkeletalSkinning::SkinRangeDualQuaternion( const unsigned char * lpVertices, unsigned luiStride, const sSkinRange &lRange,
+												 const float * lafDualQuats, float * lafPositions, float * lafNormals ){
+	unsigned luiEnd = lRange.muiFirstVertex + lRange.muiVertexCount;
+	for (unsigned luiVertex = lRange.muiFirstVertex; luiVertex < luiEnd; ++luiVertex){
+		const unsigned char * lpVertex = lpVertices + luiVertex * luiStride;
+		const float * lafBones = SKIN_BONES(lpVertex);
+		const unsigned char * lacWeights = SKIN_WEIGHTS(lpVertex);
+
+		// Blend in the hemisphere of the first influence
+		const float * lafFirst = lafDualQuats + (unsigned)lafBones[0] * 8;
+		float lafBlend[8] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+		for (unsigned luiInfluence = 0; luiInfluence < 4; ++luiInfluence){
+			const float * lafBone = lafDualQuats + (unsigned)lafBones[luiInfluence] * 8;
+			float lfWeight = lacWeights[luiInfluence] * (1.0f / 255.0f);
+			float lfDot = lafFirst[0] * lafBone[0] + lafFirst[1] * lafBone[1] + lafFirst[2] * lafBone[2] + lafFirst[3] * lafBone[3];
+			if (lfDot < 0.0f){
+				lfWeight = -lfWeight;
+			}
+			for (unsigned luiIndex = 0; luiIndex < 8; ++luiIndex){
+				lafBlend[luiIndex] += lfWeight * lafBone[luiIndex];
+			}
+		}
+		float lfLength = sqrtf(lafBlend[0] * lafBlend[0] + lafBlend[1] * lafBlend[1] + lafBlend[2] * lafBlend[2] + lafBlend[3] * lafBlend[3]);
+		if (lfLength > 0.0f){
+			for (unsigned luiIndex = 0; luiIndex < 8; ++luiIndex){
+				lafBlend[luiIndex] /= lfLength;
+			}
+		}
+		const float * r = lafBlend;
+		const float * d = lafBlend + 4;
+
+		// Rotation plus the translation 2 * (w * d - dw * r + r x d)
+		float * lafOut = lafPositions + luiVertex * 3;
+		RotateVector(r, SKIN_POSITION(lpVertex), lafOut);
+		float lafCross[3];
+		Cross(r, d, lafCross);
+		lafOut[0] += 2.0f * (r[3] * d[0] - d[3] * r[0] + lafCross[0]);
+		lafOut[1] += 2.0f * (r[3] * d[1] - d[3] * r[1] + lafCross[1]);
+		lafOut[2] += 2.0f * (r[3] * d[2] - d[3] * r[2] + lafCross[2]);
+		if (lafNormals){
+			RotateVector(r, SKIN_NORMAL(lpVertex), lafNormals + luiVertex * 3);
+		}
+	}
+}
+
+// Small random generator, the test must not change the state of rand()
+static float TestRandom( unsigned &luiSeed ){
+	luiSeed = luiSeed * 1664525u + 1013904223u;
+	return (float)(luiSeed >> 8) / 16777216.0f;
+}
+
+// Largest of lfMaxError and the difference of two results
+static float TestMaxError( float lfMaxError, float lfA, float lfB ){
+	float lfError = fabsf(lfA - lfB);
+	return (lfError > lfMaxError)? lfError : lfMaxError;
+}
+
+// Rigid 3x4 matrix of a rotation of lfAngle around an axis, plus a translation
+static void TestMatrix( const float * lafAxis, float lfAngle, const float * lafTrans, float * lafMatrix ){
+	float lfLength = sqrtf(lafAxis[0] * lafAxis[0] + lafAxis[1] * lafAxis[1] + lafAxis[2] * lafAxis[2]);
+	float x = lafAxis[0] / lfLength, y = lafAxis[1] / lfLength, z = lafAxis[2] / lfLength;
+	float c = cosf(lfAngle), s = sinf(lfAngle), t = 1.0f - c;
+	float lafRotation[12] = { t*x*x + c,   t*x*y - s*z, t*x*z + s*y, lafTrans[0],
+							  t*x*y + s*z, t*y*y + c,   t*y*z - s*x, lafTrans[1],
+							  t*x*z - s*y, t*y*z + s*x, t*z*z + c,   lafTrans[2] };
+	memcpy(lafMatrix, lafRotation, sizeof(lafRotation));
+}
+
+bool cSkeletalSkinning::SelfTest(){
+	const unsigned kuiBones = 11;
+	unsigned luiSeed = 12345u;
+	float lafPalette[kuiBones * 12];
+	float lafDualQuats[kuiBones * 8];
+	float lafDualQuatsScalar[kuiBones * 8];
+
+	// Random rigid transforms, plus the identity and half turns (w = 0)
+	for (unsigned luiBone = 0; luiBone < kuiBones; ++luiBone){
+		float lafAxis[3] = { TestRandom(luiSeed) - 0.5f, TestRandom(luiSeed) - 0.5f, TestRandom(luiSeed) - 0.5f };
+		float lafTrans[3] = { TestRandom(luiSeed) * 10.0f, TestRandom(luiSeed) * 10.0f, TestRandom(luiSeed) * 10.0f };
+		float lfAngle = TestRandom(luiSeed) * 6.2831853f;
+		if (luiBone == 0){
+			lfAngle = 0.0f;
+		}else if (luiBone <= 3){
+			lafAxis[0] = (luiBone == 1)? 1.0f : 0.0f;
+			lafAxis[1] = (luiBone == 2)? 1.0f : 0.0f;
+			lafAxis[2] = (luiBone == 3)? 1.0f : 0.0f;
+			lfAngle = 3.14159265f;
+		}
+		TestMatrix(lafAxis, lfAngle, lafTrans, lafPalette + luiBone * 12);
+	}
+	PaletteToDualQuaternions(lafPalette, kuiBones, lafDualQuats);
+	PaletteToDualQuaternionsScalar(lafPalette, kuiBones, lafDualQuatsScalar);
+
+	// Every bone alone must give the matrix result, with both conversions
+	const unsigned kuiStride = cSkeletalCoreModel::kuiTexCoordOffset;
+	std::vector<unsigned char> lacVertices(kuiBones * kuiStride, 0);
+	for (unsigned luiVertex = 0; luiVertex < kuiBones; ++luiVertex){
+		unsigned char * lpVertex = &lacVertices[luiVertex * kuiStride];
+		float * lafPos = (float *)lpVertex;
+		float * lafNor = (float *)(lpVertex + cSkeletalCoreModel::kuiNormalOffset);
+		float * lafBones = (float *)(lpVertex + cSkeletalCoreModel::kuiBoneIxOffset);
+		for (unsigned luiAxis = 0; luiAxis < 3; ++luiAxis){
+			lafPos[luiAxis] = TestRandom(luiSeed) * 4.0f - 2.0f;
+			lafNor[luiAxis] = (luiAxis == 1)? 1.0f : 0.0f;
+		}
+		lafBones[0] = (float)luiVertex;
+		lpVertex[cSkeletalCoreModel::kuiWeightOffset] = 255;
+	}
+	sSkinRange lRange;
+	lRange.muiFirstVertex = 0;
+	lRange.muiVertexCount = kuiBones;
+	float lafMatrixOut[kuiBones * 3], lafDualOut[kuiBones * 3], lafScalarOut[kuiBones * 3];
+	float lafMatrixNormals[kuiBones * 3], lafDualNormals[kuiBones * 3];
+	SkinRangeScalar(&lacVertices[0], kuiStride, lRange, lafPalette, lafMatrixOut, lafMatrixNormals);
+	SkinRangeDualQuaternion(&lacVertices[0], kuiStride, lRange, lafDualQuats, lafDualOut, lafDualNormals);
+	SkinRangeDualQuaternion(&lacVertices[0], kuiStride, lRange, lafDualQuatsScalar, lafScalarOut, NULL);
+	float lfRigidError = 0.0f;
+	for (unsigned luiIndex = 0; luiIndex < kuiBones * 3; ++luiIndex){
+		lfRigidError = TestMaxError(lfRigidError, lafMatrixOut[luiIndex], lafDualOut[luiIndex]);
+		lfRigidError = TestMaxError(lfRigidError, lafMatrixOut[luiIndex], lafScalarOut[luiIndex]);
+		lfRigidError = TestMaxError(lfRigidError, lafMatrixNormals[luiIndex], lafDualNormals[luiIndex]);
+	}
+
+	// Blends of close transforms must stay close to linear blend skinning
+	float lafAxis[3] = { 0.3f, 1.0f, -0.2f };
+	float lafTrans[3] = { 1.0f, 2.0f, 3.0f };
+	for (unsigned luiBone = 0; luiBone < 4; ++luiBone){
+		TestMatrix(lafAxis, 0.7f + 0.01f * luiBone, lafTrans, lafPalette + luiBone * 12);
+	}
+	PaletteToDualQuaternions(lafPalette, 4, lafDualQuats);
+	for (unsigned luiVertex = 0; luiVertex < kuiBones; ++luiVertex){
+		unsigned char * lpVertex = &lacVertices[luiVertex * kuiStride];
+		float * lafBones = (float *)(lpVertex + cSkeletalCoreModel::kuiBoneIxOffset);
+		unsigned char * lacWeights = lpVertex + cSkeletalCoreModel::kuiWeightOffset;
+		for (unsigned luiInfluence = 0; luiInfluence < 4; ++luiInfluence){
+			lafBones[luiInfluence] = (float)luiInfluence;
+		}
+		lacWeights[0] = 100;
+		lacWeights[1] = 75;
+		lacWeights[2] = 50;
+		lacWeights[3] = 30;
+	}
+	SkinRangeScalar(&lacVertices[0], kuiStride, lRange, lafPalette, lafMatrixOut, NULL);
+	SkinRangeDualQuaternion(&lacVertices[0], kuiStride, lRange, lafDualQuats, lafDualOut, NULL);
+	float lfBlendError = 0.0f;
+	for (unsigned luiIndex = 0; luiIndex < kuiBones * 3; ++luiIndex){
+		lfBlendError = TestMaxError(lfBlendError, lafMatrixOut[luiIndex], lafDualOut[luiIndex]);
+	}
+
+	bool lbPassed = (lfRigidError < 1e-3f) && (lfBlendError < 1e-2f);
+	BenchReport("Dual quaternion skinning: rigid error %g (< 1e-3), blend error %g (< 1e-2)%s",
+				lfRigidError, lfBlendError, lbPassed? "" : ", does not match the matrix path");
+	return lbPassed;
+}
\ No newline at end of file
@@ -0,0 +1,43 @@
+// CPU skinning of the interleaved vertices of a skeletal core model. The SSE kernel
+// transforms 4 vertices at once, reading the packed bone index and weight streams
+
+#ifndef SKELETAL_SKINNING_H
+#define SKELETAL_SKINNING_H
+
+// Range of vertices of a submesh inside the vertex buffer
+struct sSkinRange{
+	unsigned muiFirstVertex;
+	unsigned muiVertexCount;
+};
+
+class cSkeletalSkinning{
+public:
+	// Skins a range of vertices. lafPalette holds a 3x4 matrix per bone (BonesRow layout),
+	// the outputs are 3 floats per vertex indexed from the first vertex of the buffer.
+	// lafNormals can be NULL
+	static void SkinRange( const unsigned char * lpVertices, unsigned luiStride, const sSkinRange &lRange,
+						   const float * lafPalette, float * lafPositions, float * lafNormals );
+
+	// Same result, one vertex at a time (used for the tails and as a reference)
+	static void SkinRangeScalar( const unsigned char * lpVertices, unsigned luiStride, const sSkinRange &lRange,
+								 const float * lafPalette, float * lafPositions, float * lafNormals );
+
+	// Skins all the ranges, spreading them between the threads of the pool
+	static void SkinRanges( const unsigned char * lpVertices, unsigned luiStride, const sSkinRange * laRanges, unsigned luiRangeCount,
+							const float * lafPalette, float * lafPositions, float * lafNormals );
+
+	// Converts rigid 3x4 matrices to dual quaternions, 8 floats per bone: the real part
+	// (x, y, z, w) followed by the dual part. The SSE version converts 4 bones at a time
+	static void PaletteToDualQuaternions( const float * lafPalette, unsigned luiBoneCount, float * lafDualQuats );
+	static void PaletteToDualQuaternionsScalar( const float * lafPalette, unsigned luiBoneCount, float * lafDualQuats );
+
+	// Dual quaternion linear blending of a range of vertices (CPU version of skeletal_dq.fx)
+	static void SkinRangeDualQuaternion( const unsigned char * lpVertices, unsigned luiStride, const sSkinRange &lRange,
+										 const float * lafDualQuats, float * lafPositions, float * lafNormals );
+
+	// Checks the conversion and the blending against the matrix path (BenchReport), false if
+	// they do not match
+	static bool SelfTest();
+};
+
+#endif
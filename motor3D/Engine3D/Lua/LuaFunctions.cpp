@@ -4,6 +4,7 @@
 #include "../Character/CharacterManager.h"
 #include "../Character/Behaviour/BehaviourManager.h"
 #include "../Graphics/GraphicManager.h"
+#include "../Physics/cPhysicsContacts.h"
 
 //Esta funcin ser llamada desde Lua. Se encargar de crear un personaje y asignarle un comportamiento.
 //Adems, inicializar el objetivo de este personaje, establecer su velocidad mxima, velocidad angular.
@@ -130,9 +131,28 @@ int DrawLine( lua_State* lpLuaContext )
 	return 0;
 }
 
+//Ser llamada desde Lua de la siguiente manera:
+//  AddContactListener("NombreFuncion")
+//La funcin de Lua recibir en cada frame una tabla con los eventos de contacto de la fsica.
+int AddContactListener( lua_State* lpLuaContext )
+{
+	//Comprobamos que el contexto de Lua no es NULL
+	assert( lpLuaContext );
+
+	//Comprobamos que recibimos 1 argumento (el nombre de la funcin)
+	assert( lua_gettop( lpLuaContext ) == 1 );
+
+	//Registramos la funcin como oyente de los contactos
+	cPhysicsContacts::Get().AddLuaListener( luaL_checkstring( lpLuaContext, 1 ) );
+
+	//No devolvemos ningn valor
+	return 0;
+}
+
 //Funcin que registrar en Lua las funciones C++
 void RegisterLuaFunctions(){
 	cLuaManager::Get().Register("CreatePatrol", CreatePatrol);
 	cLuaManager::Get().Register("SetPatrolTarget", SetPatrolTarget);
 	cLuaManager::Get().Register("DrawLine", DrawLine);
+	cLuaManager::Get().Register("AddContactListener", AddContactListener);
 }
\ No newline at end of file
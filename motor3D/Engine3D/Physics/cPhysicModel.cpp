@@ -3,11 +3,20 @@
 // Creates a new model using a Box Shape
 void cPhysicModel::InitBox( float lfMass, const cVec3 &lHalfSize ){
 	mfMass = lfMass;
-	mpPhysicShape = cPhysics::Get( ).GetNewBoxShape( lHalfSize );
+	mpPhysicShape = cPhysicsShapes::Get( ).GetBox( lHalfSize );
+	cPhysics::GetDefaultCcd( mpPhysicShape, mCcd );
 }
 
 // Creates a new model using a Sphere Shape
 void cPhysicModel::InitSphere( float lfMass, float lfRadius ){
 	mfMass = lfMass;
-	mpPhysicShape = cPhysics::Get( ).GetNewSphereShape( lfRadius );
+	mpPhysicShape = cPhysicsShapes::Get( ).GetSphere( lfRadius );
+	cPhysics::GetDefaultCcd( mpPhysicShape, mCcd );
+}
+
+void cPhysicModel::Deinit( ){
+	if ( mpPhysicShape ){
+		cPhysicsShapes::Get( ).Release( mpPhysicShape );
+		mpPhysicShape = NULL;
+	}
 }
\ No newline at end of file
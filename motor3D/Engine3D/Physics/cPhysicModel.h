@@ -4,18 +4,27 @@
 #include "..\MathLib\MathLib.h"
 #include "..\Libraries\Bullet\include\btBulletCollisionCommon.h"
 #include "cPhysics.h"
+#include "cPhysicsShapes.h"
 
-// This class links bullet with  the models inside the scene
+// This class links bullet with  the models inside the scene. The models with the same
+// shape share one btCollisionShape (see cPhysicsShapes)
 
 class cPhysicModel{
 public:
+	cPhysicModel( ) { mpPhysicShape = NULL; mfMass = 0.0f; mCcd.mfMotionThreshold = mCcd.mfSweptSphereRadius = 0.0f; }
 	void InitBox( float lfMass, const cVec3 &lHalfSize );
 	void InitSphere( float lfMass, float lfRadius );
+	// Releases the shape, the bodies made with the model keep their own references
+	void Deinit( );
 	btCollisionShape* GetShape( ) { return mpPhysicShape; }
 	float GetMass( ) { return mfMass; }
+	// CCD of the moving bodies of the model, the Init methods take it from the size
+	inline void SetCcd( const sPhysicsCcd& lCcd ) { mCcd = lCcd; }
+	inline const sPhysicsCcd& GetCcd( ) const { return mCcd; }
 private:
 	btCollisionShape *mpPhysicShape;
 	float mfMass;
+	sPhysicsCcd mCcd;
 };
 
 #endif
\ No newline at end of file
@@ -14,20 +14,27 @@ void cPhysicObject::Deinit(){
 // Must update world transform according to Physics
 void cPhysicObject::Update( float lfTimestep ){
 	cObject::Update( lfTimestep );
-	if ( mpPhysicBody && mpPhysicBody->getMotionState( ) ) {
-		// Our position depends on Bullet.
+	// The kinematic bodies are moved by the game, the others by Bullet
+	if ( mpPhysicBody && mpPhysicBody->getMotionState( ) && !mpPhysicBody->isKinematicObject( ) ) {
+		// Our position depends on Bullet, between its last two fixed steps
 		btTransform lTransform;
-		mpPhysicBody->getMotionState()->getWorldTransform(lTransform);
+		cPhysics::Get( ).GetInterpolatedTransform(mpPhysicBody, lTransform);
 		SetWorldMatrix( mScaleMatrix * mDrawOffsetMatrix * cPhysics::Bullet2Local( lTransform ) );
 	}
 }
 
 // Creates a New Physic Body and Link it to the object
-void cPhysicObject::CreatePhysics( cPhysicModel* lpModel ){
+void cPhysicObject::CreatePhysics( cPhysicModel* lpModel, ePhysicsLodClass leLodClass ){
 	mpPhysicBody = cPhysics::Get( ).GetNewBody(lpModel->GetShape( ), lpModel->GetMass( ), mWorldMatrix.GetPosition( ) );
+	if ( lpModel->GetMass( ) == 0.0f ) return;
+	cPhysics::Get( ).SetBodyCcd( mpPhysicBody, lpModel->GetCcd( ) );
+	cPhysicsLod::Get( ).AddBody( mpPhysicBody, leLodClass );
 }
 
 void cPhysicObject::SetKinematic( ){
+	// Moved by the game, out of the lod
+	cPhysicsLod::Get( ).RemoveBody( mpPhysicBody );
+	cPhysics::Get( ).WaitForStep( );
 	mpPhysicBody->setCollisionFlags( mpPhysicBody->getCollisionFlags() | btCollisionObject::CF_KINEMATIC_OBJECT);
 	mpPhysicBody->setActivationState( DISABLE_DEACTIVATION );
 }
@@ -40,18 +47,19 @@ void cPhysicObject::SetPosition( const cVec3 &lPosition, float lYaw ){
 	// Rotation matrix
 	cMatrix lRotationMatrix;
 	lRotationMatrix.LoadRotation(cVec3(0.f, 1.f, 0.f), lYaw);
-	// Change our own Matrix for drawing purposes
-	SetWorldMatrix( lRotationMatrix * lTranslationMatrix );
+	// Change our own Matrix for drawing purposes, scaled and offset like the bodies moved by
+	// Bullet (the kinematic bodies only get this one)
+	SetWorldMatrix( mScaleMatrix * mDrawOffsetMatrix * lRotationMatrix * lTranslationMatrix );
 	// Inform Bullet of the new Position
 	if ( mpPhysicBody && mpPhysicBody->getMotionState( ) ) {
-		mpPhysicBody->getMotionState()->setWorldTransform(cPhysics::Local2Bullet( lRotationMatrix * lTranslationMatrix ));
+		cPhysics::Get( ).SetBodyTransform( mpPhysicBody, cPhysics::Local2Bullet( lRotationMatrix * lTranslationMatrix ) );
 	}
 }
 
 void cPhysicObject::ReloadPhysicPosition(cMatrix &lRotationMatrix, cMatrix &lTranslationMatrix){
 	// Inform Bullet of the new Position
 	if ( mpPhysicBody && mpPhysicBody->getMotionState( ) ) {
-		mpPhysicBody->getMotionState()->setWorldTransform(cPhysics::Local2Bullet( lRotationMatrix * lTranslationMatrix ));
+		cPhysics::Get( ).SetBodyTransform( mpPhysicBody, cPhysics::Local2Bullet( lRotationMatrix * lTranslationMatrix ) );
 	}
 }
 
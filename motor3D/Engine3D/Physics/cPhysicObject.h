@@ -3,6 +3,7 @@
 
 #include "..\Gameplay\Object\Object.h"
 #include "cPhysicModel.h"
+#include "cPhysicsLod.h"
 #include "..\MathLib\MathLib.h"
 
 class cPhysicObject : public cObject{
@@ -10,7 +11,8 @@ public:
 	virtual void Init();
 	virtual void Deinit();
 	virtual void Update( float lfTimestep );
-	void CreatePhysics( cPhysicModel* lpModel );
+	// The moving bodies enter the physics lod with their class
+	void CreatePhysics( cPhysicModel* lpModel, ePhysicsLodClass leLodClass = ePhysicsLodClass_Prop );
 	inline void SetScaleMatrix(const cMatrix& lScale){ mScaleMatrix = lScale; }
 	inline cMatrix GetScaleMatrix( ) { return mScaleMatrix; }
 	inline void SetDrawOffsetMatrix(const cMatrix& lOffset){ mDrawOffsetMatrix = lOffset; }
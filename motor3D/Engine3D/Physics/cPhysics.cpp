@@ -1,5 +1,20 @@
 #include "cPhysics.h"
 #include "cPhysicsDebugDraw.h"
+#include "cPhysicsShapes.h"
+#include "cPhysicsContacts.h"
+#include "..\Utility\ThreadPool.h"
+#include "..\Utility\Benchmark.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "..\Libraries\Bullet\include\BulletCollision\CollisionDispatch\btSimulationIslandManager.h"
+#include "..\Libraries\Bullet\include\BulletCollision\CollisionShapes\btHeightfieldTerrainShape.h"
+#include "..\Libraries\Bullet\include\BulletMultiThreaded\btThreadSupportInterface.h"
+#include "..\Libraries\Bullet\include\BulletMultiThreaded\Win32ThreadSupport.h"
+#include "..\Libraries\Bullet\include\BulletMultiThreaded\SpuGatheringCollisionDispatcher.h"
+#include "..\Libraries\Bullet\include\BulletMultiThreaded\SpuNarrowPhaseCollisionTask\SpuGatheringCollisionTask.h"
+#include "..\Libraries\Bullet\include\BulletMultiThreaded\btParallelConstraintSolver.h"
 
 cVec3 cPhysics::Bullet2Local( const btVector3& lFrom ){
 	return cVec3( lFrom.x(), lFrom.y(), lFrom.z() );
@@ -23,20 +38,192 @@ btTransform cPhysics::Local2Bullet( const cMatrix& lFrom ){
 	return lBtTransform;
 }
 
-void cPhysics::Init( ){
+cPhysics::cPhysics() {
+	memset( &mWorld, 0, sizeof( mWorld ) );
+	GetDefaultConfig( mConfig );
+	mfFixedTimestep = 1.0f / 60.0f;
+	miMaxSubSteps = 5;
+	mfAccumulator = 0.0f;
+	mfAlpha = 0.0f;
+	muiDroppedSteps = 0;
+	miJobSteps = 0;
+	mfJobAlpha = 0.0f;
+	muiReadBuffer = 0;
+	muiQueue = 0;
+	mhThread = NULL;
+	mhStartEvent = NULL;
+	mhDoneEvent = NULL;
+	mdwThreadId = 0;
+	mbQuit = false;
+	mbStepInFlight = false;
+	mpHeightfield = NULL;
+	mbDeterminismCheck = false;
+}
+
+void cPhysics::GetDefaultConfig( sPhysicsConfig& lConfig ){
+	// The workers of the engine pool, the main thread and the physics thread share the cores
+	unsigned luiPoolWorkers;
+	if ( cThreadPool::Get().IsInit() ){
+		luiPoolWorkers = cThreadPool::Get().GetThreadCount() - 1;
+	} else {
+		SYSTEM_INFO lInfo;
+		GetSystemInfo( &lInfo );
+		luiPoolWorkers = ( lInfo.dwNumberOfProcessors > 1 ) ? lInfo.dwNumberOfProcessors - 1 : 0;
+	}
+	lConfig.muiWorkerThreads = ( luiPoolWorkers > 1 ) ? luiPoolWorkers : 1;
+	lConfig.muiSolverIterations = 10;
+	lConfig.mbThreaded = true;
+	lConfig.mbParallelDispatch = false;
+	lConfig.mbParallelSolver = false;
+	lConfig.mbDeterministic = false;
+	lConfig.muiMaxManifolds = 32768;
+	lConfig.meBroadphase = ePhysicsBroadphase_Dbvt;
+	lConfig.mWorldMin = cVec3( -1000.0f, -1000.0f, -1000.0f );
+	lConfig.mWorldMax = cVec3( 1000.0f, 1000.0f, 1000.0f );
+	lConfig.muiMaxProxies = 16383;
+}
+
+btBroadphaseInterface* cPhysics::CreateBroadphase( const sPhysicsConfig& lConfig ){
+	btVector3 lMin = Local2Bullet( lConfig.mWorldMin );
+	btVector3 lMax = Local2Bullet( lConfig.mWorldMax );
+	switch ( lConfig.meBroadphase ){
+		case ePhysicsBroadphase_AxisSweep:
+			// The handles are 16 bits
+			return new btAxisSweep3( lMin, lMax, (unsigned short)btMin( lConfig.muiMaxProxies, 16383u ) );
+		case ePhysicsBroadphase_AxisSweep32:
+			return new bt32BitAxisSweep3( lMin, lMax, lConfig.muiMaxProxies );
+		default:
+			///btDbvtBroadphase is a good general purpose broadphase
+			return new btDbvtBroadphase();
+	}
+}
+
+void cPhysics::CreateWorld( const sPhysicsConfig& lConfig, sPhysicsWorld& lWorld ){
+	assert( lConfig.muiWorkerThreads > 0 );
+	memset( &lWorld, 0, sizeof( lWorld ) );
+	// The workers gather the pairs and batch the islands in the order they finish
+	bool lbParallelDispatch = lConfig.mbParallelDispatch && !lConfig.mbDeterministic;
+	bool lbParallelSolver = lConfig.mbParallelSolver && !lConfig.mbDeterministic;
+
 	///collision configuration contains default setup for memory, collision setup. Advanced users can create their own configuration.
-	mpCollisionConfiguration = new btDefaultCollisionConfiguration();
+	btDefaultCollisionConstructionInfo lInfo;
+	lInfo.m_defaultMaxPersistentManifoldPoolSize = lConfig.muiMaxManifolds;
+	lWorld.mpCollisionConfiguration = new btDefaultCollisionConfiguration( lInfo );
+
+	if ( lbParallelDispatch ){
+		// Narrow phase of the pairs split in tasks, one task in flight per worker
+		lWorld.mpCollisionThreads = new Win32ThreadSupport( Win32ThreadSupport::Win32ThreadConstructionInfo( "collision",
+				processCollisionTask, createCollisionLocalStoreMemory, lConfig.muiWorkerThreads ) );
+		lWorld.mpDispatcher = new SpuGatheringCollisionDispatcher( lWorld.mpCollisionThreads, lConfig.muiWorkerThreads, lWorld.mpCollisionConfiguration );
+	} else {
+		///use the default collision dispatcher.
+		lWorld.mpDispatcher = new btCollisionDispatcher( lWorld.mpCollisionConfiguration );
+	}
+
+	lWorld.mpBroadphase = CreateBroadphase( lConfig );
+
+	if ( lbParallelSolver ){
+		lWorld.mpSolverThreads = new Win32ThreadSupport( Win32ThreadSupport::Win32ThreadConstructionInfo( "solver",
+				SolverThreadFunc, SolverlsMemoryFunc, lConfig.muiWorkerThreads ) );
+		lWorld.mpSolverThreads->startSPU();
+		lWorld.mpSolver = new btParallelConstraintSolver( lWorld.mpSolverThreads );
+		// The solver keeps pointers to the contacts, they can't be moved out of the pool
+		lWorld.mpDispatcher->setDispatcherFlags( btCollisionDispatcher::CD_DISABLE_CONTACTPOOL_DYNAMIC_ALLOCATION );
+	} else {
+		///the default constraint solver.
+		lWorld.mpSolver = new btSequentialImpulseConstraintSolver;
+	}
+
+	lWorld.mpWorld = new btDiscreteDynamicsWorld( lWorld.mpDispatcher, lWorld.mpBroadphase, lWorld.mpSolver, lWorld.mpCollisionConfiguration );
+	lWorld.mpWorld->setGravity( btVector3( 0, -10, 0 ) );
+	lWorld.mpWorld->getSolverInfo().m_numIterations = lConfig.muiSolverIterations;
+	if ( lbParallelSolver ){
+		// The parallel solver splits the islands in batches by itself
+		lWorld.mpWorld->getSimulationIslandManager()->setSplitIslands( false );
+		lWorld.mpWorld->getSolverInfo().m_solverMode = SOLVER_SIMD + SOLVER_USE_WARMSTARTING;
+	}
+}
+
+void cPhysics::DeleteWorld( sPhysicsWorld& lWorld ){
+	if ( !lWorld.mpWorld ) return;
+
+	//remove the rigidbodies from the dynamics world and delete them
+	for ( int liIndex = lWorld.mpWorld->getNumCollisionObjects() - 1; liIndex >= 0; liIndex-- ){
+		btCollisionObject* obj = lWorld.mpWorld->getCollisionObjectArray()[liIndex];
+		btRigidBody* body = btRigidBody::upcast(obj);
+		if (body && body->getMotionState()){
+			delete body->getMotionState();
+		}
+		lWorld.mpWorld->removeCollisionObject( obj );
+		delete obj;
+	}
 
-	///use the default collision dispatcher. For parallel processing you can use a diffent dispatcher (see Extras/BulletMultiThreaded)
-	mpDispatcher = new btCollisionDispatcher(mpCollisionConfiguration);
+	//cleanup in the reverse order of creation/initialization
+	delete lWorld.mpWorld;
+	delete lWorld.mpSolver;
+	delete lWorld.mpSolverThreads;
+	delete lWorld.mpBroadphase;
+	delete lWorld.mpDispatcher;
+	delete lWorld.mpCollisionThreads;
+	delete lWorld.mpCollisionConfiguration;
+	memset( &lWorld, 0, sizeof( lWorld ) );
+}
+
+void cPhysics::SetWorldBounds( const cVec3& lMin, const cVec3& lMax ){
+	mConfig.mWorldMin = lMin;
+	mConfig.mWorldMax = lMax;
+	if ( !mWorld.mpWorld || mConfig.meBroadphase == ePhysicsBroadphase_Dbvt ) return;
+	RebuildBroadphase();
+}
+
+void cPhysics::RebuildBroadphase( ){
+	WaitForStep();
+	btAlignedObjectArray<btCollisionObject*> lapObjects;
+	btAlignedObjectArray<short> laiGroups, laiMasks;
+	for ( unsigned luiSlot = 0; luiSlot < mapSlotBodies.size(); ++luiSlot ){
+		btRigidBody* lpBody = mapSlotBodies[luiSlot];
+		if ( !lpBody || !lpBody->getBroadphaseHandle() ) continue;
+		lapObjects.push_back( lpBody );
+		laiGroups.push_back( lpBody->getBroadphaseHandle()->m_collisionFilterGroup );
+		laiMasks.push_back( lpBody->getBroadphaseHandle()->m_collisionFilterMask );
+	}
+	int liSlotObjects = lapObjects.size();
+	for ( int liIndex = 0; liIndex < liSlotObjects; ++liIndex ){
+		mWorld.mpWorld->removeCollisionObject( lapObjects[liIndex] );
+	}
+	// The objects left in the world are the ones out of the slots
+	btCollisionObjectArray& lObjects = mWorld.mpWorld->getCollisionObjectArray();
+	for ( int liIndex = 0; liIndex < lObjects.size(); ++liIndex ){
+		btBroadphaseProxy* lpProxy = lObjects[liIndex]->getBroadphaseHandle();
+		lapObjects.push_back( lObjects[liIndex] );
+		laiGroups.push_back( lpProxy ? lpProxy->m_collisionFilterGroup : (short)btBroadphaseProxy::DefaultFilter );
+		laiMasks.push_back( lpProxy ? lpProxy->m_collisionFilterMask : (short)btBroadphaseProxy::AllFilter );
+	}
+	for ( int liIndex = lapObjects.size() - 1; liIndex >= liSlotObjects; --liIndex ){
+		mWorld.mpWorld->removeCollisionObject( lapObjects[liIndex] );
+	}
+	btBroadphaseInterface* lpOld = mWorld.mpBroadphase;
+	mWorld.mpBroadphase = CreateBroadphase( mConfig );
+	mWorld.mpWorld->setBroadphase( mWorld.mpBroadphase );
+	delete lpOld;
+	// The ones out of the slots first, then the slots
+	for ( int liStep = 0; liStep < lapObjects.size(); ++liStep ){
+		int liIndex = ( liStep + liSlotObjects ) % lapObjects.size();
+		btRigidBody* lpBody = btRigidBody::upcast( lapObjects[liIndex] );
+		if ( lpBody ) mWorld.mpWorld->addRigidBody( lpBody, laiGroups[liIndex], laiMasks[liIndex] );
+		else mWorld.mpWorld->addCollisionObject( lapObjects[liIndex], laiGroups[liIndex], laiMasks[liIndex] );
+	}
+}
 
-	///btDbvtBroadphase is a good general purpose broadphase. You can also try out btAxis3Sweep.
-	mpOverlappingPairCache = new btDbvtBroadphase();
+void cPhysics::Init( ){
+	sPhysicsConfig lConfig;
+	GetDefaultConfig( lConfig );
+	Init( lConfig );
+}
 
-	///the default constraint solver. For parallel processing you can use a different solver (see Extras/BulletMultiThreaded)
-	mpSolver = new btSequentialImpulseConstraintSolver;
-	mpWorld = new btDiscreteDynamicsWorld(mpDispatcher, mpOverlappingPairCache, mpSolver, mpCollisionConfiguration);
-	mpWorld->setGravity(btVector3(0,-10,0));
+void cPhysics::Init( const sPhysicsConfig& lConfig ){
+	mConfig = lConfig;
+	CreateWorld( mConfig, mWorld );
 
 	///create a few basic rigid bodies
 /*	btCollisionShape* lpGroundShape = new btBoxShape(btVector3(btScalar(10.),btScalar(10.),btScalar(10.)));
@@ -48,68 +235,296 @@ void cPhysics::Init( ){
 	GetNewBody( lpGroundShape, 0.0f, cVec3( 0.0f, 0.0f, 20.0f ));	*/
 
 
-	btCollisionShape* groundShape = new btStaticPlaneShape(btVector3(0,1,0),1);
-	mapCollisionShapes.push_back(groundShape);
+	// The body keeps its own reference to the plane
+	btCollisionShape* groundShape = cPhysicsShapes::Get().GetPlane(cVec3(0,1,0),1);
 	GetNewBody( groundShape, 0.0f, cVec3( 0.0f, -5.0f, 0.0f ));	
+	cPhysicsShapes::Get().Release(groundShape);
 
 	// Draws debug info of bullet
 	cPhysicsDebugDraw::Get( ).setDebugMode( cPhysicsDebugDraw::DBG_DrawWireframe );
-	mpWorld->setDebugDrawer( &cPhysicsDebugDraw::Get( ) );
+	mWorld.mpWorld->setDebugDrawer( &cPhysicsDebugDraw::Get( ) );
+	mWorld.mpWorld->setInternalTickCallback( PreTick, this, true );
+	mWorld.mpWorld->setInternalTickCallback( PostTick, this, false );
+
+	// Physics thread, it sleeps until Update gives it steps
+	if ( mConfig.mbThreaded ){
+		mbQuit = false;
+		mhStartEvent = CreateEvent( NULL, FALSE, FALSE, NULL );
+		mhDoneEvent = CreateEvent( NULL, FALSE, FALSE, NULL );
+		mhThread = CreateThread( NULL, 0, PhysicsMain, this, 0, &mdwThreadId );
+		assert( mhThread );
+	}
 }
 
 void cPhysics::Deinit( ){
-	//cleanup in the reverse order of creation/initialization
-	//remove the rigidbodies from the dynamics world and delete them
-	for ( int liIndex = mpWorld->getNumCollisionObjects() - 1; liIndex >= 0; liIndex-- ){
-		btCollisionObject* obj = mpWorld->getCollisionObjectArray()[liIndex];
-		btRigidBody* body = btRigidBody::upcast(obj);
-		if (body && body->getMotionState()){
-			delete body->getMotionState();
+	// Stop the thread, the world is only ours from here
+	if ( mhThread ){
+		WaitForStep();
+		mbQuit = true;
+		SetEvent( mhStartEvent );
+		WaitForSingleObject( mhThread, INFINITE );
+		CloseHandle( mhThread );
+		CloseHandle( mhStartEvent );
+		CloseHandle( mhDoneEvent );
+		mhThread = mhStartEvent = mhDoneEvent = NULL;
+		mdwThreadId = 0;
+	}
+	maCommands[0].clear();
+	maCommands[1].clear();
+	maSyncCallbacks.clear();
+	maStepCallbacks.clear();
+	maSnapshotCallbacks.clear();
+	mauiStepHashes.clear();
+
+	cPhysicsShapes::Get().Report();
+	ReportPools();
+	//the bodies of the pools leave the world first, their shapes are released after the
+	//world is deleted
+	btAlignedObjectArray<btCollisionShape*> lapShapes;
+	for ( unsigned luiSlot = 0; luiSlot < mapSlotBodies.size(); ++luiSlot ){
+		btRigidBody* lpBody = mapSlotBodies[luiSlot];
+		if ( !lpBody ) continue;
+		lapShapes.push_back( lpBody->getCollisionShape() );
+		mWorld.mpWorld->removeRigidBody( lpBody );
+		mMotionStatePool.Delete( (cPhysicsMotionState*)lpBody->getMotionState() );
+		mBodyPool.Delete( lpBody );
+	}
+	DeleteWorld( mWorld );
+	for ( int liIndex = 0; liIndex < lapShapes.size(); ++liIndex ){
+		cPhysicsShapes::Get().Release( lapShapes[liIndex] );
+	}
+	//the shapes left are reported and deleted
+	cPhysicsShapes::Get().Deinit();
+
+	maBodyStates[0].clear();
+	maBodyStates[1].clear();
+	mapSlotBodies.clear();
+	mauiFreeSlots.clear();
+	mBodyPool.Clear();
+	mMotionStatePool.Clear();
+}
+
+void cPhysics::SetFixedTimestep( float lfHz, int liMaxSubSteps ){
+	assert( lfHz > 0.0f && liMaxSubSteps > 0 );
+	mfFixedTimestep = 1.0f / lfHz;
+	miMaxSubSteps = liMaxSubSteps;
+	mfAccumulator = 0.0f;
+	mfAlpha = 0.0f;
+}
+
+void cPhysics::Update( float lfTimestep ){
+	if ( mhThread ){
+		// The thread had the whole frame to run the steps started in the last one
+		Sync();
+		Kick( lfTimestep );
+	} else {
+		Kick( lfTimestep );
+		Sync();
+	}
+}
+
+void cPhysics::Kick( float lfTimestep ){
+	mfAccumulator += lfTimestep;
+	int liSteps = (int)( mfAccumulator / mfFixedTimestep );
+	mfAccumulator -= liSteps * mfFixedTimestep;
+	// Spiral of death guard: the steps that don't fit are lost, the game slows down instead
+	if ( liSteps > miMaxSubSteps ){
+		muiDroppedSteps += liSteps - miMaxSubSteps;
+		liSteps = miMaxSubSteps;
+	}
+	miJobSteps = liSteps;
+	mfJobAlpha = mfAccumulator / mfFixedTimestep;
+
+	// The game goes on with the other queue
+	muiQueue ^= 1;
+	if ( mhThread ){
+		mbStepInFlight = true;
+		SetEvent( mhStartEvent );
+	} else {
+		RunSteps();
+	}
+}
+
+void cPhysics::Sync( ){
+	WaitForStep();
+	muiReadBuffer ^= 1;
+	mfAlpha = mfJobAlpha;
+	for ( unsigned luiIndex = 0; luiIndex < maSyncCallbacks.size(); ++luiIndex ){
+		maSyncCallbacks[luiIndex].mpCallback( maSyncCallbacks[luiIndex].mpData );
+	}
+}
+
+void cPhysics::WaitForStep( ){
+	if ( mbStepInFlight && GetCurrentThreadId() != mdwThreadId ){
+		WaitForSingleObject( mhDoneEvent, INFINITE );
+		mbStepInFlight = false;
+	}
+}
+
+DWORD WINAPI cPhysics::PhysicsMain( LPVOID lpParam ){
+	cPhysics* lpPhysics = (cPhysics*)lpParam;
+	for ( ;; ){
+		WaitForSingleObject( lpPhysics->mhStartEvent, INFINITE );
+		if ( lpPhysics->mbQuit ) break;
+		lpPhysics->RunSteps();
+		SetEvent( lpPhysics->mhDoneEvent );
+	}
+	return 0;
+}
+
+void cPhysics::RunSteps( ){
+	ApplyCommands( maCommands[muiQueue ^ 1] );
+
+	for ( int liStep = 0; liStep < miJobSteps; ++liStep ){
+		// Every body comes from GetNewBody, so every motion state is a cPhysicsMotionState
+		btCollisionObjectArray& lObjects = mWorld.mpWorld->getCollisionObjectArray();
+		for ( int liIndex = 0; liIndex < lObjects.size(); ++liIndex ){
+			btRigidBody* lpBody = btRigidBody::upcast( lObjects[liIndex] );
+			if ( lpBody && lpBody->getMotionState() && !lpBody->isStaticOrKinematicObject() ){
+				cPhysicsMotionState* lpState = (cPhysicsMotionState*)lpBody->getMotionState();
+				lpState->mPreviousTransform = lpState->m_graphicsWorldTrans;
+			}
+		}
+		// One step of exactly the fixed size, the motion states get its transforms
+		mWorld.mpWorld->stepSimulation( mfFixedTimestep, 1, mfFixedTimestep );
+		if ( mbDeterminismCheck ){
+			WriteSnapshot( macHashBuffer );
+			mauiStepHashes.push_back( HashSnapshot( macHashBuffer ) );
 		}
-		mpWorld->removeCollisionObject( obj );
-		delete obj;
 	}
+	PublishStates();
+}
 
-	//delete collision shapes
-	for ( int liIndex =0; liIndex < mapCollisionShapes.size(); liIndex++){
-		btCollisionShape* shape = mapCollisionShapes[liIndex];
-		mapCollisionShapes[liIndex] = 0;
-		delete shape;
+void cPhysics::ApplyCommands( btAlignedObjectArray<sPhysicsCommand>& laCommands ){
+	for ( int liIndex = 0; liIndex < laCommands.size(); ++liIndex ){
+		sPhysicsCommand& lCommand = laCommands[liIndex];
+		if ( lCommand.meType == ePhysicsCommand_Call ){
+			lCommand.mpFunction( lCommand.mafValues, lCommand.mpData );
+			continue;
+		}
+		// Kinematic bodies are read from their motion state, the others are teleported
+		btRigidBody* lpBody = lCommand.mpBody;
+		if ( !lpBody->isStaticOrKinematicObject() ){
+			lpBody->setWorldTransform( lCommand.mTransform );
+			lpBody->setInterpolationWorldTransform( lCommand.mTransform );
+			lpBody->activate();
+		}
+		cPhysicsMotionState* lpState = (cPhysicsMotionState*)lpBody->getMotionState();
+		lpState->setWorldTransform( lCommand.mTransform );
+		lpState->mPreviousTransform = lpState->m_graphicsWorldTrans;
 	}
+	laCommands.clear();
+}
 
-	//delete dynamics world
-	delete mpWorld;
+void cPhysics::PublishStates( ){
+	btAlignedObjectArray<sPhysicsBodyState>& laStates = maBodyStates[muiReadBuffer ^ 1];
+	for ( unsigned luiSlot = 0; luiSlot < mapSlotBodies.size(); ++luiSlot ){
+		btRigidBody* lpBody = mapSlotBodies[luiSlot];
+		if ( !lpBody ) continue;
+		const cPhysicsMotionState* lpState = (const cPhysicsMotionState*)lpBody->getMotionState();
+		sPhysicsBodyState& lBodyState = laStates[luiSlot];
+		lBodyState.mTransform = lpState->m_graphicsWorldTrans;
+		lBodyState.mPreviousTransform = lpState->mPreviousTransform;
+		lBodyState.mLinearVelocity = lpBody->getLinearVelocity();
+		lBodyState.mAngularVelocity = lpBody->getAngularVelocity();
+	}
+}
 
-	//delete solver
-	delete mpSolver;
+void cPhysics::SetBodyTransform( btRigidBody* lpBody, const btTransform& lTransform ){
+	assert( lpBody && lpBody->getMotionState() );
+	sPhysicsCommand& lCommand = maCommands[muiQueue].expand();
+	lCommand.meType = ePhysicsCommand_SetTransform;
+	lCommand.mpBody = lpBody;
+	lCommand.mTransform = lTransform;
+	lCommand.mpFunction = NULL;
+	lCommand.mpData = NULL;
+}
 
-	//delete broadphase
-	delete mpOverlappingPairCache;
+void cPhysics::QueueCommand( tPhysicsCommand lpCommand, void * lpData, const float * lpafValues, unsigned luiCount ){
+	assert( lpCommand && luiCount <= 4 );
+	sPhysicsCommand& lCommand = maCommands[muiQueue].expand();
+	lCommand.meType = ePhysicsCommand_Call;
+	lCommand.mpBody = NULL;
+	lCommand.mpFunction = lpCommand;
+	lCommand.mpData = lpData;
+	for ( unsigned luiIndex = 0; luiIndex < luiCount; ++luiIndex ){
+		lCommand.mafValues[luiIndex] = lpafValues[luiIndex];
+	}
+}
 
-	//delete dispatcher
-	delete mpDispatcher;
-	delete mpCollisionConfiguration;
+void cPhysics::AddSyncCallback( tPhysicsCallback lpCallback, void * lpData ){
+	sSyncCallback lCallback;
+	lCallback.mpCallback = lpCallback;
+	lCallback.mpData = lpData;
+	maSyncCallbacks.push_back( lCallback );
+}
 
-	//next line is optional: it will be cleared by the destructor when the array goes out of scope
-	mapCollisionShapes.clear();
+void cPhysics::RemoveSyncCallback( tPhysicsCallback lpCallback, void * lpData ){
+	for ( unsigned luiIndex = 0; luiIndex < maSyncCallbacks.size(); ++luiIndex ){
+		if ( maSyncCallbacks[luiIndex].mpCallback == lpCallback && maSyncCallbacks[luiIndex].mpData == lpData ){
+			maSyncCallbacks.erase( maSyncCallbacks.begin() + luiIndex );
+			return;
+		}
+	}
 }
 
-void cPhysics::Update( float lfTimestep ){
-	mpWorld->stepSimulation( lfTimestep );
+void cPhysics::AddStepCallbacks( tPhysicsStepCallback lpPreStep, tPhysicsStepCallback lpPostStep, void * lpData ){
+	WaitForStep();
+	sStepCallbacks lCallbacks;
+	lCallbacks.mpPreStep = lpPreStep;
+	lCallbacks.mpPostStep = lpPostStep;
+	lCallbacks.mpData = lpData;
+	maStepCallbacks.push_back( lCallbacks );
+}
+
+void cPhysics::RemoveStepCallbacks( void * lpData ){
+	WaitForStep();
+	for ( unsigned luiIndex = 0; luiIndex < maStepCallbacks.size(); ++luiIndex ){
+		if ( maStepCallbacks[luiIndex].mpData == lpData ){
+			maStepCallbacks.erase( maStepCallbacks.begin() + luiIndex );
+			return;
+		}
+	}
 }
 
-btCollisionShape* cPhysics::GetNewSphereShape( float lfRadius ){
-	btCollisionShape* lShape = new btSphereShape( lfRadius );
-	mapCollisionShapes.push_back( lShape );
+void cPhysics::PreTick( btDynamicsWorld* lpWorld, btScalar lfStep ){
+	cPhysics* lpPhysics = (cPhysics*)lpWorld->getWorldUserInfo();
+	for ( unsigned luiIndex = 0; luiIndex < lpPhysics->maStepCallbacks.size(); ++luiIndex ){
+		const sStepCallbacks& lCallbacks = lpPhysics->maStepCallbacks[luiIndex];
+		if ( lCallbacks.mpPreStep ) lCallbacks.mpPreStep( lfStep, lCallbacks.mpData );
+	}
+}
 
-	return lShape;
+void cPhysics::PostTick( btDynamicsWorld* lpWorld, btScalar lfStep ){
+	cPhysics* lpPhysics = (cPhysics*)lpWorld->getWorldUserInfo();
+	for ( unsigned luiIndex = 0; luiIndex < lpPhysics->maStepCallbacks.size(); ++luiIndex ){
+		const sStepCallbacks& lCallbacks = lpPhysics->maStepCallbacks[luiIndex];
+		if ( lCallbacks.mpPostStep ) lCallbacks.mpPostStep( lfStep, lCallbacks.mpData );
+	}
 }
 
-btCollisionShape* cPhysics::GetNewBoxShape( const cVec3& lHalfSize ){
-	btCollisionShape* lShape = new btBoxShape( Local2Bullet( lHalfSize ) );
-	mapCollisionShapes.push_back( lShape );
+void cPhysics::GetInterpolatedTransform( const btRigidBody* lpBody, btTransform& lTransform ) const{
+	const sPhysicsBodyState& lState = GetBodyState( lpBody );
+	if ( lpBody->isStaticOrKinematicObject() ){
+		lTransform = lState.mTransform;
+		return;
+	}
+	lTransform.setOrigin( lState.mPreviousTransform.getOrigin().lerp( lState.mTransform.getOrigin(), mfAlpha ) );
+	lTransform.setRotation( lState.mPreviousTransform.getRotation().slerp( lState.mTransform.getRotation(), mfAlpha ) );
+}
+
+const sPhysicsBodyState& cPhysics::GetBodyState( const btRigidBody* lpBody ) const{
+	assert( lpBody && lpBody->getMotionState() );
+	const cPhysicsMotionState* lpState = (const cPhysicsMotionState*)lpBody->getMotionState();
+	assert( lpState->muiSlot < mapSlotBodies.size() && mapSlotBodies[lpState->muiSlot] == lpBody );
+	return maBodyStates[muiReadBuffer][lpState->muiSlot];
+}
 
-	return lShape;
+void cPhysics::ResetInterpolation( btRigidBody* lpBody ){
+	assert( lpBody && lpBody->getMotionState() );
+	cPhysicsMotionState* lpState = (cPhysicsMotionState*)lpBody->getMotionState();
+	lpState->setWorldTransform( lpBody->getWorldTransform() );
+	lpState->mPreviousTransform = lpState->m_graphicsWorldTrans;
 }
 
 btRigidBody* cPhysics::GetNewBody( btCollisionShape* lpShape, float lfMass, const cVec3& lPosition, float lRotation){
@@ -141,14 +556,603 @@ btRigidBody* cPhysics::GetNewBody( btCollisionShape* lpShape, float lfMass, cons
 	//lStartTransform.setOrigin( Local2Bullet( lPosition ) );
 
 	//using motionstate is recommended, it provides interpolation capabilities, and only synchronizes 'active' objects
-	btDefaultMotionState* lpMotionState = new btDefaultMotionState( lStartTransform );
+	cPhysicsMotionState* lpMotionState = new ( mMotionStatePool.Alloc() ) cPhysicsMotionState( lStartTransform );
 	btRigidBody::btRigidBodyConstructionInfo lInfo( lfMass, lpMotionState, lpShape, lLocalInertia);
-	btRigidBody* lpBody = new btRigidBody( lInfo );
-	mpWorld->addRigidBody(lpBody);
+	btRigidBody* lpBody = new ( mBodyPool.Alloc() ) btRigidBody( lInfo );
+	cPhysicsShapes::Get().AddRef( lpShape );
+	WaitForStep();
+	mWorld.mpWorld->addRigidBody(lpBody);
+
+	// Both buffers start with the first transform, it can be read before the first step
+	if ( mauiFreeSlots.empty() ){
+		lpMotionState->muiSlot = mapSlotBodies.size();
+		mapSlotBodies.push_back( lpBody );
+		maBodyStates[0].expand();
+		maBodyStates[1].expand();
+	} else {
+		lpMotionState->muiSlot = mauiFreeSlots.back();
+		mauiFreeSlots.pop_back();
+		mapSlotBodies[lpMotionState->muiSlot] = lpBody;
+	}
+	ResetSlot( lpMotionState->muiSlot, lStartTransform );
 
 	return lpBody;
 }
 
+void cPhysics::ResetSlot( unsigned luiSlot, const btTransform& lTransform ){
+	for ( unsigned luiBuffer = 0; luiBuffer < 2; ++luiBuffer ){
+		sPhysicsBodyState& lState = maBodyStates[luiBuffer][luiSlot];
+		lState.mTransform = lTransform;
+		lState.mPreviousTransform = lTransform;
+		lState.mLinearVelocity.setZero();
+		lState.mAngularVelocity.setZero();
+	}
+}
+
+void cPhysics::DropCommands( btRigidBody* lpBody ){
+	btAlignedObjectArray<sPhysicsCommand>& laCommands = maCommands[muiQueue];
+	int liKept = 0;
+	for ( int liIndex = 0; liIndex < laCommands.size(); ++liIndex ){
+		if ( laCommands[liIndex].mpBody != lpBody ) laCommands[liKept++] = laCommands[liIndex];
+	}
+	laCommands.resize( liKept );
+}
+
+void cPhysics::RemoveBody( btRigidBody* lpBody ){
+	assert( lpBody && lpBody->getMotionState() );
+	WaitForStep();
+	mWorld.mpWorld->removeRigidBody( lpBody );
+
+	// The queued writes and the contact events of the body are dropped
+	DropCommands( lpBody );
+	cPhysicsContacts::Get().ForgetBody( lpBody );
+
+	cPhysicsMotionState* lpState = (cPhysicsMotionState*)lpBody->getMotionState();
+	mapSlotBodies[lpState->muiSlot] = NULL;
+	mauiFreeSlots.push_back( lpState->muiSlot );
+	btCollisionShape* lpShape = lpBody->getCollisionShape();
+	mMotionStatePool.Delete( lpState );
+	mBodyPool.Delete( lpBody );
+	cPhysicsShapes::Get().Release( lpShape );
+}
+
+void cPhysics::ReuseBody( btRigidBody* lpBody, const cMatrix& lTransform ){
+	assert( lpBody && lpBody->getMotionState() );
+	WaitForStep();
+	// Out of the broadphase, its pairs and contacts go with its proxy
+	mWorld.mpWorld->removeRigidBody( lpBody );
+	DropCommands( lpBody );
+
+	btTransform lStartTransform = Local2Bullet( lTransform );
+	lpBody->setWorldTransform( lStartTransform );
+	lpBody->setInterpolationWorldTransform( lStartTransform );
+	lpBody->setLinearVelocity( btVector3( 0, 0, 0 ) );
+	lpBody->setAngularVelocity( btVector3( 0, 0, 0 ) );
+	lpBody->setInterpolationLinearVelocity( btVector3( 0, 0, 0 ) );
+	lpBody->setInterpolationAngularVelocity( btVector3( 0, 0, 0 ) );
+	lpBody->clearForces();
+	if ( lpBody->getActivationState() != DISABLE_DEACTIVATION ) lpBody->forceActivationState( ACTIVE_TAG );
+	lpBody->setDeactivationTime( 0.0f );
+	cPhysicsMotionState* lpState = (cPhysicsMotionState*)lpBody->getMotionState();
+	lpState->setWorldTransform( lStartTransform );
+	lpState->mPreviousTransform = lStartTransform;
+
+	// A new proxy with the box of the new place
+	mWorld.mpWorld->addRigidBody( lpBody );
+	ResetSlot( lpState->muiSlot, lStartTransform );
+}
+
+void cPhysics::GetDefaultCcd( const btCollisionShape* lpShape, sPhysicsCcd& lCcd ){
+	btTransform lIdentity;
+	lIdentity.setIdentity();
+	btVector3 lMin, lMax;
+	lpShape->getAabb( lIdentity, lMin, lMax );
+	btVector3 lHalfSize = ( lMax - lMin ) * 0.5f;
+	// Distance from the origin to the nearest side of the box, planes and terrain have none
+	float lfInside = btMin( -lMin[lMin.maxAxis()], lMax[lMax.minAxis()] );
+	if ( lfInside <= 0.0f || lHalfSize[lHalfSize.maxAxis()] >= BT_LARGE_FLOAT * 0.5f ){
+		lCcd.mfMotionThreshold = 0.0f;
+		lCcd.mfSweptSphereRadius = 0.0f;
+		return;
+	}
+	lCcd.mfMotionThreshold = lHalfSize[lHalfSize.minAxis()];
+	// A bit inside, the sphere doesn't stop the body against what it only touches
+	lCcd.mfSweptSphereRadius = lfInside * 0.8f;
+}
+
+void cPhysics::SetBodyCcd( btRigidBody* lpBody, const sPhysicsCcd& lCcd ){
+	assert( lpBody && lCcd.mfMotionThreshold >= 0.0f && lCcd.mfSweptSphereRadius >= 0.0f );
+	WaitForStep();
+	lpBody->setCcdMotionThreshold( lCcd.mfMotionThreshold );
+	lpBody->setCcdSweptSphereRadius( lCcd.mfSweptSphereRadius );
+}
+
+void cPhysics::ReserveBodies( unsigned luiCount ){
+	mBodyPool.Reserve( luiCount );
+	mMotionStatePool.Reserve( luiCount );
+	mapSlotBodies.reserve( luiCount );
+	mauiFreeSlots.reserve( luiCount );
+	maBodyStates[0].reserve( luiCount );
+	maBodyStates[1].reserve( luiCount );
+}
+
+void cPhysics::GetPoolStats( sPhysicsPoolStats& lBodies, sPhysicsPoolStats& lMotionStates ) const{
+	mBodyPool.GetStats( lBodies );
+	mMotionStatePool.GetStats( lMotionStates );
+}
+
+void cPhysics::ReportPools( ) const{
+	sPhysicsPoolStats lBodies, lMotionStates;
+	GetPoolStats( lBodies, lMotionStates );
+	char lacBuffer[256];
+	sprintf( lacBuffer, "Physics pools: %u bodies (peak %u, capacity %u, %u pages, %u late pages), %u motion states (peak %u)\n",
+			 lBodies.muiUsed, lBodies.muiPeak, lBodies.muiCapacity, lBodies.muiPages, lBodies.muiPageAllocs, lMotionStates.muiUsed, lMotionStates.muiPeak );
+	OutputDebugString( lacBuffer );
+}
+
+// Snapshot layout: header, one record per moving body in the order of the slots, then the
+// bytes of the callbacks in the order they were added
+static const unsigned kuiSnapshotMagic = 0x50534E50;	// PSNP
+static const unsigned kuiSnapshotVersion = 1;
+
+struct sSnapshotHeader{
+	unsigned muiMagic;
+	unsigned muiVersion;
+	unsigned muiSlots;
+	unsigned muiBodies;
+};
+
+struct sSnapshotBody{
+	unsigned muiSlot;
+	float mafBasis[9];
+	float mafOrigin[3];
+	float mafLinearVelocity[3];
+	float mafAngularVelocity[3];
+	int miActivationState;
+	float mfDeactivationTime;
+};
+
+void cPhysics::SnapshotWrite( std::vector<unsigned char>& lacBuffer, const void * lpData, unsigned luiSize ){
+	unsigned luiOffset = lacBuffer.size();
+	lacBuffer.resize( luiOffset + luiSize );
+	memcpy( &lacBuffer[luiOffset], lpData, luiSize );
+}
+
+bool cPhysics::SnapshotRead( const unsigned char*& lpucData, const unsigned char* lpucEnd, void * lpOut, unsigned luiSize ){
+	if ( (unsigned)( lpucEnd - lpucData ) < luiSize ) return false;
+	memcpy( lpOut, lpucData, luiSize );
+	lpucData += luiSize;
+	return true;
+}
+
+unsigned cPhysics::HashSnapshot( const std::vector<unsigned char>& lacBuffer ){
+	// FNV-1a, the bits of the floats go in as they are
+	unsigned luiHash = 2166136261u;
+	for ( unsigned luiIndex = 0; luiIndex < lacBuffer.size(); ++luiIndex ){
+		luiHash = ( luiHash ^ lacBuffer[luiIndex] ) * 16777619u;
+	}
+	return luiHash;
+}
+
+void cPhysics::WriteSnapshot( std::vector<unsigned char>& lacBuffer ) const{
+	// The static bodies never move, they are left out
+	sSnapshotHeader lHeader;
+	lHeader.muiMagic = kuiSnapshotMagic;
+	lHeader.muiVersion = kuiSnapshotVersion;
+	lHeader.muiSlots = mapSlotBodies.size();
+	lHeader.muiBodies = 0;
+	for ( unsigned luiSlot = 0; luiSlot < mapSlotBodies.size(); ++luiSlot ){
+		if ( mapSlotBodies[luiSlot] && !mapSlotBodies[luiSlot]->isStaticObject() ) ++lHeader.muiBodies;
+	}
+	lacBuffer.clear();
+	lacBuffer.reserve( sizeof( lHeader ) + lHeader.muiBodies * sizeof( sSnapshotBody ) );
+	SnapshotWrite( lacBuffer, &lHeader, sizeof( lHeader ) );
+
+	sSnapshotBody lRecord;
+	memset( &lRecord, 0, sizeof( lRecord ) );
+	for ( unsigned luiSlot = 0; luiSlot < mapSlotBodies.size(); ++luiSlot ){
+		const btRigidBody* lpBody = mapSlotBodies[luiSlot];
+		if ( !lpBody || lpBody->isStaticObject() ) continue;
+		const btTransform& lTransform = lpBody->getWorldTransform();
+		lRecord.muiSlot = luiSlot;
+		for ( int liRow = 0; liRow < 3; ++liRow ){
+			for ( int liColumn = 0; liColumn < 3; ++liColumn ){
+				lRecord.mafBasis[liRow * 3 + liColumn] = lTransform.getBasis()[liRow][liColumn];
+			}
+			lRecord.mafOrigin[liRow] = lTransform.getOrigin()[liRow];
+			lRecord.mafLinearVelocity[liRow] = lpBody->getLinearVelocity()[liRow];
+			lRecord.mafAngularVelocity[liRow] = lpBody->getAngularVelocity()[liRow];
+		}
+		lRecord.miActivationState = lpBody->getActivationState();
+		lRecord.mfDeactivationTime = lpBody->getDeactivationTime();
+		SnapshotWrite( lacBuffer, &lRecord, sizeof( lRecord ) );
+	}
+
+	for ( unsigned luiIndex = 0; luiIndex < maSnapshotCallbacks.size(); ++luiIndex ){
+		maSnapshotCallbacks[luiIndex].mpWrite( lacBuffer, maSnapshotCallbacks[luiIndex].mpData );
+	}
+}
+
+void cPhysics::BenchmarkBroadphase( unsigned luiBodies, float lfArea, unsigned luiSteps ){
+	static const char* lacBroadphases[] = { "dbvt", "axis sweep", "axis sweep 32" };
+	static const char* lacDistributions[] = { "uniform", "clusters", "ring track" };
+	static const unsigned kuiClusters = 16;
+	const float lfStep = 1.0f / 60.0f;
+	float lfHalfArea = lfArea * 0.5f;
+
+	btBoxShape lFloorShape( btVector3( lfHalfArea, 1.0f, lfHalfArea ) );
+	btBoxShape lBoxShape( btVector3( 0.5f, 0.5f, 0.5f ) );
+	btVector3 lBoxInertia;
+	lBoxShape.calculateLocalInertia( 1.0f, lBoxInertia );
+
+	cBenchTimer lTimer;
+	for ( unsigned luiDistribution = 0; luiDistribution < 3; ++luiDistribution ){
+		for ( unsigned luiBroadphase = 0; luiBroadphase < ePhysicsBroadphase_Count; ++luiBroadphase ){
+			// Only the broadphase changes, the rest runs in this thread
+			sPhysicsConfig lConfig;
+			GetDefaultConfig( lConfig );
+			lConfig.mbThreaded = false;
+			lConfig.mbParallelDispatch = false;
+			lConfig.mbParallelSolver = false;
+			lConfig.meBroadphase = (ePhysicsBroadphase)luiBroadphase;
+			lConfig.mWorldMin = cVec3( -lfHalfArea, -10.0f, -lfHalfArea );
+			lConfig.mWorldMax = cVec3( lfHalfArea, 100.0f, lfHalfArea );
+			lConfig.muiMaxProxies = luiBodies + 1;
+			if ( lConfig.meBroadphase == ePhysicsBroadphase_AxisSweep && luiBodies + 1 > 16383 ) continue;
+			sPhysicsWorld lWorld;
+			CreateWorld( lConfig, lWorld );
+
+			btTransform lTransform;
+			lTransform.setIdentity();
+			lTransform.setOrigin( btVector3( 0.0f, -1.0f, 0.0f ) );
+			lWorld.mpWorld->addRigidBody( new btRigidBody( 0.0f, new btDefaultMotionState( lTransform ), &lFloorShape ) );
+
+			// The same places for every broadphase
+			srand( 1234 );
+			for ( unsigned luiBody = 0; luiBody < luiBodies; ++luiBody ){
+				float lfX, lfZ;
+				float lfU = rand() / (float)RAND_MAX;
+				float lfV = rand() / (float)RAND_MAX;
+				if ( luiDistribution == 0 ){
+					lfX = ( lfU - 0.5f ) * lfArea * 0.9f;
+					lfZ = ( lfV - 0.5f ) * lfArea * 0.9f;
+				} else if ( luiDistribution == 1 ){
+					// Piles of props, a few metres wide
+					unsigned luiCluster = luiBody % kuiClusters;
+					float lfAngle = luiCluster * SIMD_2_PI / kuiClusters;
+					lfX = cosf( lfAngle ) * lfHalfArea * 0.6f + ( lfU - 0.5f ) * 8.0f;
+					lfZ = sinf( lfAngle ) * lfHalfArea * 0.6f + ( lfV - 0.5f ) * 8.0f;
+				} else {
+					// Along a ring 12 metres wide, like the props beside a track
+					float lfAngle = lfU * SIMD_2_PI;
+					float lfRadius = lfHalfArea * 0.7f + ( lfV - 0.5f ) * 12.0f;
+					lfX = cosf( lfAngle ) * lfRadius;
+					lfZ = sinf( lfAngle ) * lfRadius;
+				}
+				lTransform.setOrigin( btVector3( lfX, 1.0f + ( luiBody % 4 ) * 1.1f, lfZ ) );
+				btRigidBody::btRigidBodyConstructionInfo lInfo( 1.0f, new btDefaultMotionState( lTransform ), &lBoxShape, lBoxInertia );
+				lWorld.mpWorld->addRigidBody( new btRigidBody( lInfo ) );
+			}
+
+			double ldTotal = 0.0, ldWorst = 0.0;
+			double ldPairs = 0.0;
+			for ( unsigned luiStep = 0; luiStep < luiSteps; ++luiStep ){
+				lTimer.Start( );
+				lWorld.mpWorld->stepSimulation( lfStep, 1, lfStep );
+				double ldTime = lTimer.GetMs( );
+				ldTotal += ldTime;
+				if ( ldTime > ldWorst ) ldWorst = ldTime;
+				ldPairs += lWorld.mpBroadphase->getOverlappingPairCache()->getNumOverlappingPairs();
+			}
+
+			BenchReport( "Broadphase benchmark %s, %s, %u bodies: mean step %.2f ms, worst step %.2f ms, %.0f pairs",
+						 lacBroadphases[luiBroadphase], lacDistributions[luiDistribution], luiBodies, ldTotal / luiSteps,
+						 ldWorst, ldPairs / luiSteps );
+			DeleteWorld( lWorld );
+		}
+	}
+}
+
+void cPhysics::SaveSnapshot( std::vector<unsigned char>& lacBuffer ){
+	WaitForStep();
+	WriteSnapshot( lacBuffer );
+}
+
+bool cPhysics::RestoreSnapshot( const std::vector<unsigned char>& lacBuffer ){
+	WaitForStep();
+	if ( lacBuffer.empty() ) return false;
+	const unsigned char* lpucData = &lacBuffer[0];
+	const unsigned char* lpucEnd = lpucData + lacBuffer.size();
+	sSnapshotHeader lHeader;
+	if ( !SnapshotRead( lpucData, lpucEnd, &lHeader, sizeof( lHeader ) ) ||
+		 lHeader.muiMagic != kuiSnapshotMagic || lHeader.muiVersion != kuiSnapshotVersion || lHeader.muiSlots != mapSlotBodies.size() ){
+		OutputDebugString( "Physics snapshot: the buffer doesn't match the world\n" );
+		return false;
+	}
+	// Every record must name a moving body and the extra state must match before anything
+	// is changed
+	const sSnapshotBody* lpRecords = (const sSnapshotBody*)lpucData;
+	if ( (unsigned)( lpucEnd - lpucData ) < lHeader.muiBodies * sizeof( sSnapshotBody ) ) return false;
+	for ( unsigned luiBody = 0; luiBody < lHeader.muiBodies; ++luiBody ){
+		sSnapshotBody lRecord;
+		memcpy( &lRecord, lpRecords + luiBody, sizeof( lRecord ) );
+		if ( lRecord.muiSlot >= mapSlotBodies.size() || !mapSlotBodies[lRecord.muiSlot] || mapSlotBodies[lRecord.muiSlot]->isStaticObject() ){
+			OutputDebugString( "Physics snapshot: the buffer doesn't match the world\n" );
+			return false;
+		}
+	}
+	const unsigned char* lpucExtra = lpucData + lHeader.muiBodies * sizeof( sSnapshotBody );
+	for ( unsigned luiIndex = 0; luiIndex < maSnapshotCallbacks.size(); ++luiIndex ){
+		if ( !maSnapshotCallbacks[luiIndex].mpRead( lpucExtra, lpucEnd, false, maSnapshotCallbacks[luiIndex].mpData ) ){
+			OutputDebugString( "Physics snapshot: the extra state doesn't match\n" );
+			return false;
+		}
+	}
+
+	// The queued writes belong to the state that is left
+	maCommands[muiQueue].clear();
+	for ( unsigned luiBody = 0; luiBody < lHeader.muiBodies; ++luiBody ){
+		sSnapshotBody lRecord;
+		SnapshotRead( lpucData, lpucEnd, &lRecord, sizeof( lRecord ) );
+		btRigidBody* lpBody = mapSlotBodies[lRecord.muiSlot];
+		btTransform lTransform;
+		lTransform.getBasis().setValue( lRecord.mafBasis[0], lRecord.mafBasis[1], lRecord.mafBasis[2],
+										lRecord.mafBasis[3], lRecord.mafBasis[4], lRecord.mafBasis[5],
+										lRecord.mafBasis[6], lRecord.mafBasis[7], lRecord.mafBasis[8] );
+		lTransform.setOrigin( btVector3( lRecord.mafOrigin[0], lRecord.mafOrigin[1], lRecord.mafOrigin[2] ) );
+		btVector3 lLinearVelocity( lRecord.mafLinearVelocity[0], lRecord.mafLinearVelocity[1], lRecord.mafLinearVelocity[2] );
+		btVector3 lAngularVelocity( lRecord.mafAngularVelocity[0], lRecord.mafAngularVelocity[1], lRecord.mafAngularVelocity[2] );
+
+		lpBody->setWorldTransform( lTransform );
+		lpBody->setInterpolationWorldTransform( lTransform );
+		lpBody->setLinearVelocity( lLinearVelocity );
+		lpBody->setAngularVelocity( lAngularVelocity );
+		lpBody->setInterpolationLinearVelocity( lLinearVelocity );
+		lpBody->setInterpolationAngularVelocity( lAngularVelocity );
+		lpBody->clearForces();
+		lpBody->forceActivationState( lRecord.miActivationState );
+		lpBody->setDeactivationTime( lRecord.mfDeactivationTime );
+		cPhysicsMotionState* lpState = (cPhysicsMotionState*)lpBody->getMotionState();
+		lpState->setWorldTransform( lTransform );
+		lpState->mPreviousTransform = lTransform;
+		ResetSlot( lRecord.muiSlot, lTransform );
+	}
+	// The pairs, the contacts and the order of the bodies in the world are those of the new
+	// places, whatever the history of the broadphase. A body frozen by the lod is out of it,
+	// its thaw adds it with the new box
+	RebuildBroadphase();
+	// The random seed of the solver
+	mWorld.mpSolver->reset();
+	mfAccumulator = 0.0f;
+	mfAlpha = 0.0f;
+
+	for ( unsigned luiIndex = 0; luiIndex < maSnapshotCallbacks.size(); ++luiIndex ){
+		bool lbRead = maSnapshotCallbacks[luiIndex].mpRead( lpucData, lpucEnd, true, maSnapshotCallbacks[luiIndex].mpData );
+		assert( lbRead );
+	}
+	return true;
+}
+
+void cPhysics::AddSnapshotCallbacks( tPhysicsSnapshotWrite lpWrite, tPhysicsSnapshotRead lpRead, void * lpData ){
+	assert( lpWrite && lpRead );
+	// The determinism check reads the list in the physics thread
+	WaitForStep();
+	sSnapshotCallbacks lCallbacks;
+	lCallbacks.mpWrite = lpWrite;
+	lCallbacks.mpRead = lpRead;
+	lCallbacks.mpData = lpData;
+	maSnapshotCallbacks.push_back( lCallbacks );
+}
+
+void cPhysics::RemoveSnapshotCallbacks( void * lpData ){
+	WaitForStep();
+	for ( unsigned luiIndex = 0; luiIndex < maSnapshotCallbacks.size(); ++luiIndex ){
+		if ( maSnapshotCallbacks[luiIndex].mpData == lpData ){
+			maSnapshotCallbacks.erase( maSnapshotCallbacks.begin() + luiIndex );
+			return;
+		}
+	}
+}
+
+void cPhysics::SetDeterminismCheck( bool lbEnable ){
+	WaitForStep();
+	if ( lbEnable && !mConfig.mbDeterministic ) OutputDebugString( "Physics determinism check: the world is not deterministic, the hashes can split\n" );
+	mbDeterminismCheck = lbEnable;
+}
+
+const std::vector<unsigned>& cPhysics::GetStepHashes( ){
+	WaitForStep();
+	return mauiStepHashes;
+}
+
+void cPhysics::ClearStepHashes( ){
+	WaitForStep();
+	mauiStepHashes.clear();
+}
+
+bool cPhysics::CheckReplay( unsigned luiSteps ){
+	if ( !mConfig.mbDeterministic ){
+		BenchReport( "Physics replay: the world is not deterministic" );
+		return false;
+	}
+	std::vector<unsigned char> lacStart;
+	SaveSnapshot( lacStart );
+	std::vector<unsigned> lauiRuns[2];
+	for ( unsigned luiRun = 0; luiRun < 2; ++luiRun ){
+		RestoreSnapshot( lacStart );
+		for ( unsigned luiStep = 0; luiStep < luiSteps; ++luiStep ){
+			mWorld.mpWorld->stepSimulation( mfFixedTimestep, 1, mfFixedTimestep );
+			WriteSnapshot( macHashBuffer );
+			lauiRuns[luiRun].push_back( HashSnapshot( macHashBuffer ) );
+		}
+	}
+	RestoreSnapshot( lacStart );
+
+	unsigned luiStep = 0;
+	while ( luiStep < luiSteps && lauiRuns[0][luiStep] == lauiRuns[1][luiStep] ) ++luiStep;
+	if ( luiStep == luiSteps ){
+		BenchReport( "Physics replay: %u steps reproduced, %u bytes per snapshot", luiSteps, (unsigned)lacStart.size() );
+	} else {
+		BenchReport( "Physics replay: the runs split at step %u of %u", luiStep, luiSteps );
+	}
+	return luiStep == luiSteps;
+}
+
 void cPhysics::Render( ){
-	mpWorld->debugDrawWorld();
-}
\ No newline at end of file
+	WaitForStep();
+	// Culled and with the cached wireframes, the static lines are kept between frames
+	cPhysicsDebugDraw::Get( ).DrawWorld( mWorld.mpWorld );
+}
+
+void cPhysics::Benchmark( unsigned luiBodies, unsigned luiSteps ){
+	static const char* lacModes[] = { "sequential", "parallel dispatch", "parallel solver", "parallel dispatch and solver" };
+	static const unsigned kuiPitSide = 16;
+	static const float kfPitch = 1.1f;
+	const float lfStep = 1.0f / 60.0f;
+
+	// Pit with a floor and 4 walls, the bodies fall in layers and pile up
+	float lfHalfPit = kuiPitSide * kfPitch * 0.5f;
+	btBoxShape lFloorShape( btVector3( lfHalfPit + 1.0f, 1.0f, lfHalfPit + 1.0f ) );
+	btBoxShape lWallShape( btVector3( lfHalfPit + 1.0f, 50.0f, 0.5f ) );
+	btBoxShape lBoxShape( btVector3( 0.5f, 0.5f, 0.5f ) );
+	btSphereShape lSphereShape( 0.5f );
+	btVector3 lBoxInertia, lSphereInertia;
+	lBoxShape.calculateLocalInertia( 1.0f, lBoxInertia );
+	lSphereShape.calculateLocalInertia( 1.0f, lSphereInertia );
+
+	cBenchTimer lTimer;
+	for ( unsigned luiMode = 0; luiMode < 4; ++luiMode ){
+		sPhysicsConfig lConfig;
+		GetDefaultConfig( lConfig );
+		lConfig.mbThreaded = false;
+		lConfig.mbParallelDispatch = ( luiMode & 1 ) != 0;
+		lConfig.mbParallelSolver = ( luiMode & 2 ) != 0;
+		sPhysicsWorld lWorld;
+		CreateWorld( lConfig, lWorld );
+
+		btTransform lTransform;
+		lTransform.setIdentity();
+		lTransform.setOrigin( btVector3( 0.0f, -1.0f, 0.0f ) );
+		lWorld.mpWorld->addRigidBody( new btRigidBody( 0.0f, new btDefaultMotionState( lTransform ), &lFloorShape ) );
+		for ( unsigned luiWall = 0; luiWall < 4; ++luiWall ){
+			lTransform.setRotation( btQuaternion( btVector3( 0, 1, 0 ), luiWall * SIMD_HALF_PI ) );
+			lTransform.setOrigin( lTransform.getBasis() * btVector3( 0.0f, 50.0f, lfHalfPit + 0.5f ) );
+			lWorld.mpWorld->addRigidBody( new btRigidBody( 0.0f, new btDefaultMotionState( lTransform ), &lWallShape ) );
+		}
+
+		// Odd layers are shifted half a body, so the pile falls over
+		lTransform.setIdentity();
+		for ( unsigned luiBody = 0; luiBody < luiBodies; ++luiBody ){
+			unsigned luiLayer = luiBody / ( kuiPitSide * kuiPitSide );
+			unsigned luiCell = luiBody % ( kuiPitSide * kuiPitSide );
+			float lfShift = ( luiLayer & 1 ) ? 0.5f : 0.0f;
+			lTransform.setOrigin( btVector3( ( luiCell % kuiPitSide + lfShift ) * kfPitch - lfHalfPit + 0.5f,
+											 1.0f + luiLayer * kfPitch,
+											 ( luiCell / kuiPitSide + lfShift ) * kfPitch - lfHalfPit + 0.5f ) );
+			bool lbBox = ( luiBody & 1 ) == 0;
+			btRigidBody::btRigidBodyConstructionInfo lInfo( 1.0f, new btDefaultMotionState( lTransform ),
+					lbBox ? (btCollisionShape*)&lBoxShape : (btCollisionShape*)&lSphereShape, lbBox ? lBoxInertia : lSphereInertia );
+			lWorld.mpWorld->addRigidBody( new btRigidBody( lInfo ) );
+		}
+
+		double ldTotal = 0.0, ldWorst = 0.0;
+		for ( unsigned luiStep = 0; luiStep < luiSteps; ++luiStep ){
+			lTimer.Start( );
+			lWorld.mpWorld->stepSimulation( lfStep, 1, lfStep );
+			double ldTime = lTimer.GetMs( );
+			ldTotal += ldTime;
+			if ( ldTime > ldWorst ) ldWorst = ldTime;
+		}
+
+		BenchReport( "Physics benchmark %s, %u bodies, %u workers: mean step %.2f ms, worst step %.2f ms, %d manifolds at the end",
+				lacModes[luiMode], luiBodies, ( luiMode == 0 ) ? 0 : lConfig.muiWorkerThreads, ldTotal / luiSteps, ldWorst,
+				lWorld.mpDispatcher->getNumManifolds() );
+		DeleteWorld( lWorld );
+	}
+}
+
+bool cPhysics::TestTunnelling( float lfHz, float lfSpeed, unsigned luiBodies ){
+	static const char* lacCases[] = { "wall", "heightfield" };
+	static const unsigned kuiSamples = 17;
+	const float lfStep = 1.0f / lfHz;
+	// Long enough to cross the scene at the speed of the test
+	unsigned luiSteps = (unsigned)( 40.0f / ( lfSpeed * lfStep ) ) + 10;
+
+	// Wall of 20 cm and a flat heightfield, debris of 10 to 20 cm
+	btBoxShape lWallShape( btVector3( 20.0f, 20.0f, 0.1f ) );
+	float lafHeights[kuiSamples * kuiSamples];
+	memset( lafHeights, 0, sizeof( lafHeights ) );
+	btHeightfieldTerrainShape lTerrainShape( kuiSamples, kuiSamples, lafHeights, 1.0f, -1.0f, 1.0f, 1, PHY_FLOAT, false );
+	lTerrainShape.setLocalScaling( btVector3( 2.5f, 1.0f, 2.5f ) );
+	btSphereShape lSphereShape( 0.1f );
+	btBoxShape lBoxShape( btVector3( 0.1f, 0.1f, 0.1f ) );
+	btVector3 lSphereInertia, lBoxInertia;
+	lSphereShape.calculateLocalInertia( 1.0f, lSphereInertia );
+	lBoxShape.calculateLocalInertia( 1.0f, lBoxInertia );
+	sPhysicsCcd laCcd[2];
+	GetDefaultCcd( &lSphereShape, laCcd[0] );
+	GetDefaultCcd( &lBoxShape, laCcd[1] );
+
+	bool lbPassed = true;
+	for ( unsigned luiCase = 0; luiCase < 2; ++luiCase ){
+		unsigned lauiTunnelled[2];
+		for ( unsigned luiCcd = 0; luiCcd < 2; ++luiCcd ){
+			sPhysicsConfig lConfig;
+			GetDefaultConfig( lConfig );
+			lConfig.mbThreaded = false;
+			sPhysicsWorld lWorld;
+			CreateWorld( lConfig, lWorld );
+
+			btTransform lTransform;
+			lTransform.setIdentity();
+			btRigidBody* lpStatic = new btRigidBody( 0.0f, new btDefaultMotionState( lTransform ),
+					( luiCase == 0 ) ? (btCollisionShape*)&lWallShape : (btCollisionShape*)&lTerrainShape );
+			lWorld.mpWorld->addRigidBody( lpStatic );
+
+			// A grid of bodies 10 m before the obstacle, moving straight at it
+			unsigned luiSide = (unsigned)ceilf( sqrtf( (float)luiBodies ) );
+			for ( unsigned luiBody = 0; luiBody < luiBodies; ++luiBody ){
+				float lfU = ( luiBody % luiSide ) * 1.0f - luiSide * 0.5f;
+				float lfV = ( luiBody / luiSide ) * 1.0f - luiSide * 0.5f;
+				btVector3 lVelocity;
+				if ( luiCase == 0 ){
+					lTransform.setOrigin( btVector3( lfU, lfV + 2.0f, -10.0f ) );
+					lVelocity.setValue( 0.0f, 0.0f, lfSpeed );
+				} else {
+					lTransform.setOrigin( btVector3( lfU, 10.0f, lfV ) );
+					lVelocity.setValue( 0.0f, -lfSpeed, 0.0f );
+				}
+				bool lbBox = ( luiBody & 1 ) != 0;
+				btRigidBody::btRigidBodyConstructionInfo lInfo( 1.0f, new btDefaultMotionState( lTransform ),
+						lbBox ? (btCollisionShape*)&lBoxShape : (btCollisionShape*)&lSphereShape, lbBox ? lBoxInertia : lSphereInertia );
+				btRigidBody* lpBody = new btRigidBody( lInfo );
+				lpBody->setLinearVelocity( lVelocity );
+				lpBody->setActivationState( DISABLE_DEACTIVATION );
+				if ( luiCcd ){
+					lpBody->setCcdMotionThreshold( laCcd[lbBox].mfMotionThreshold );
+					lpBody->setCcdSweptSphereRadius( laCcd[lbBox].mfSweptSphereRadius );
+				}
+				lWorld.mpWorld->addRigidBody( lpBody );
+			}
+
+			for ( unsigned luiStep = 0; luiStep < luiSteps; ++luiStep ){
+				lWorld.mpWorld->stepSimulation( lfStep, 1, lfStep );
+			}
+
+			// Behind the wall or under the ground
+			lauiTunnelled[luiCcd] = 0;
+			for ( int liIndex = 0; liIndex < lWorld.mpWorld->getNumCollisionObjects(); ++liIndex ){
+				btCollisionObject* lpObject = lWorld.mpWorld->getCollisionObjectArray()[liIndex];
+				if ( lpObject == lpStatic ) continue;
+				const btVector3& lPosition = lpObject->getWorldTransform().getOrigin();
+				if ( ( luiCase == 0 ) ? ( lPosition.z() > 0.0f ) : ( lPosition.y() < 0.0f ) ) ++lauiTunnelled[luiCcd];
+			}
+			DeleteWorld( lWorld );
+		}
+
+		BenchReport( "Tunnelling test %s, %u bodies at %.0f m/s, %.0f Hz: %u through without ccd, %u with ccd",
+					 lacCases[luiCase], luiBodies, lfSpeed, lfHz, lauiTunnelled[0], lauiTunnelled[1] );
+		lbPassed = lbPassed && ( lauiTunnelled[1] == 0 );
+	}
+	return lbPassed;
+}
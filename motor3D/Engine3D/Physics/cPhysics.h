@@ -3,23 +3,197 @@
 
 // Class to encapsulate Bullet physics library 
 
+#include <windows.h>
+#include <vector>
 #include "..\Utility\Singleton.h"
 #include "..\MathLib\MathLib.h"
 #include "..\Libraries\Bullet\include\btBulletDynamicsCommon.h"
+#include "cPhysicsPool.h"
+
+class btThreadSupportInterface;
+
+// Motion state of the bodies created by cPhysics. It keeps the transform of the previous
+// fixed step, the render interpolates between it and the current one
+class cPhysicsMotionState : public btDefaultMotionState{
+public:
+	cPhysicsMotionState( const btTransform& lStartTransform ) : btDefaultMotionState( lStartTransform ), mPreviousTransform( lStartTransform ) { muiSlot = 0; }
+	btTransform mPreviousTransform;
+	unsigned muiSlot;		// Place of the body in the published states
+};
+
+// State of a body published by the physics thread after every step
+struct sPhysicsBodyState{
+	btTransform mTransform;
+	btTransform mPreviousTransform;
+	btVector3 mLinearVelocity;
+	btVector3 mAngularVelocity;
+};
+
+enum ePhysicsBroadphase{
+	ePhysicsBroadphase_Dbvt = 0,		// Dynamic AABB trees, no bounds
+	ePhysicsBroadphase_AxisSweep,		// Sweep and prune in the world bounds, up to 16383 proxies
+	ePhysicsBroadphase_AxisSweep32,		// Sweep and prune with 32 bit handles
+	ePhysicsBroadphase_Count
+};
+
+// Continuous collision of a moving body. When it moves more than the threshold in a fixed
+// step, a sphere of the radius is swept from its origin and the body stops at the first hit,
+// so fast and thin bodies don't tunnel. The sphere must be inside the shape
+struct sPhysicsCcd{
+	float mfMotionThreshold;	// 0 disables it
+	float mfSweptSphereRadius;
+};
+
+// How the Bullet world is built. The parallel dispatcher and solver come from
+// BulletMultiThreaded and run on their own pools of Win32 threads, as big as the pool of
+// the engine: they only run one after the other, inside the step
+struct sPhysicsConfig{
+	bool mbThreaded;			// Steps in the physics thread, Update only starts them
+	bool mbParallelDispatch;	// Narrow phase split between the workers
+	bool mbParallelSolver;		// Islands solved by the workers
+	bool mbDeterministic;		// Replays: sequential dispatcher and solver, whatever the flags above say
+	unsigned muiWorkerThreads;	// Workers of the parallel dispatcher and of the parallel solver
+	unsigned muiSolverIterations;
+	unsigned muiMaxManifolds;	// Pool of contact manifolds, the parallel solver can't grow it
+	ePhysicsBroadphase meBroadphase;
+	// Sweep and prune only: the box of the world (the bodies out of it still collide, but
+	// slowly) and the max number of proxies
+	cVec3 mWorldMin;
+	cVec3 mWorldMax;
+	unsigned muiMaxProxies;
+};
+
+// Objects of a Bullet world
+struct sPhysicsWorld{
+	btDefaultCollisionConfiguration* mpCollisionConfiguration;
+	btCollisionDispatcher* mpDispatcher;
+	btBroadphaseInterface* mpBroadphase;
+	btConstraintSolver* mpSolver;
+	btThreadSupportInterface* mpCollisionThreads;
+	btThreadSupportInterface* mpSolverThreads;
+	btDiscreteDynamicsWorld* mpWorld;
+};
+
+// Terrain the scene queries can test directly, without its bullet tiles. It is called from
+// the threads of the pool while the world is idle, it must only read
+class cPhysicsHeightfield{
+public:
+	virtual ~cPhysicsHeightfield( ) { ; }
+	// First crossing of the segment with the surface as a fraction of the segment
+	virtual bool RayCast( const cVec3& lFrom, const cVec3& lTo, float& lfFraction, cVec3& lNormal ) const = 0;
+};
+
+// Extra state of the snapshots (the wheels of the vehicles). Write appends its bytes to the
+// buffer and Read takes them from lpucData, moving it. Read is called twice by a restore:
+// first without lbApply, to check the bytes before anything changes, then with it, and it
+// can't fail there. The determinism check calls Write from the physics thread, it must only
+// read bullet objects
+typedef void (*tPhysicsSnapshotWrite)( std::vector<unsigned char>& lacBuffer, void * lpData );
+typedef bool (*tPhysicsSnapshotRead)( const unsigned char*& lpucData, const unsigned char* lpucEnd, bool lbApply, void * lpData );
+
+// Game code run by the physics thread at the start of the next step
+typedef void (*tPhysicsCommand)( const float * lpafValues, void * lpData );
+// Game code run in the main thread while the world is idle, after every step
+typedef void (*tPhysicsCallback)( void * lpData );
+// Engine code run by the physics thread before and after every fixed step of the world
+typedef void (*tPhysicsStepCallback)( float lfStep, void * lpData );
 
 class cPhysics : public cSingleton<cPhysics>{
 public:
-	cPhysics() { ; }
+	cPhysics();
+	// Threaded stepping with the sequential dispatcher and solver of bullet (10 iterations),
+	// the parallel ones are an option
+	static void GetDefaultConfig( sPhysicsConfig& lConfig );
 	void Init( );
+	void Init( const sPhysicsConfig& lConfig );
+	// Deletes the bodies, then the shapes still registered are reported and deleted
 	void Deinit( );
+	// Collects the results of the steps in flight and starts the fixed steps that fit in
+	// the elapsed time. The rest is kept for the next frame and gives the interpolation
+	// factor of the render transforms. With the thread the results arrive one frame later
 	void Update( float lfTimestep );
-	// Creates basic shapes for collisions test
-	btCollisionShape* GetNewSphereShape( float lfRadius );
-	btCollisionShape* GetNewBoxShape( const cVec3& lHalfSize );
+	// Steps per second and max steps per frame. The steps over the max are dropped, so a
+	// slow frame doesn't make the next one even slower
+	void SetFixedTimestep( float lfHz, int liMaxSubSteps );
+	inline float GetFixedTimestep( ) const { return mfFixedTimestep; }
+	inline float GetInterpolationAlpha( ) const { return mfAlpha; }
+	inline unsigned GetDroppedSteps( ) const { return muiDroppedSteps; }
+	inline const sPhysicsConfig& GetConfig( ) const { return mConfig; }
+	// Bounds of the world (the terrain) for the sweep and prune broadphases. The broadphase
+	// is built again with the bodies in it, the dbvt only keeps them for later
+	void SetWorldBounds( const cVec3& lMin, const cVec3& lMax );
+	// Render transform of a body, between its last two published steps. Static and
+	// kinematic bodies are not interpolated
+	void GetInterpolatedTransform( const btRigidBody* lpBody, btTransform& lTransform ) const;
+	// Last published state of a body (transforms and velocities)
+	const sPhysicsBodyState& GetBodyState( const btRigidBody* lpBody ) const;
+
+	// Game side writes, applied in order at the start of the next step. Main thread only
+	void SetBodyTransform( btRigidBody* lpBody, const btTransform& lTransform );
+	void QueueCommand( tPhysicsCommand lpCommand, void * lpData, const float * lpafValues = NULL, unsigned luiCount = 0 );
+	// Called every frame in the main thread after the results of a step arrive, the world
+	// can be read and changed there without waiting
+	void AddSyncCallback( tPhysicsCallback lpCallback, void * lpData );
+	void RemoveSyncCallback( tPhysicsCallback lpCallback, void * lpData );
+	// Around every fixed step, in the physics thread. Either of them can be NULL
+	void AddStepCallbacks( tPhysicsStepCallback lpPreStep, tPhysicsStepCallback lpPostStep, void * lpData );
+	void RemoveStepCallbacks( void * lpData );
+	// Direct access to the bullet objects from the main thread must wait for the step in
+	// flight. It does nothing in the physics thread
+	void WaitForStep( );
+	// After moving a body by hand (teleports, resets), so it doesn't slide from the old place.
+	// It changes the body, so it is called from a command or after WaitForStep
+	void ResetInterpolation( btRigidBody* lpBody );
+
+	// The shape must come from cPhysicsShapes, the body keeps a reference to it
 	btRigidBody* GetNewBody( btCollisionShape* lpShape, float lfMass, const cVec3& lPosition, float lRotation = 0.0f );
 	btRigidBody* GetNewBody( btCollisionShape* lpShape, float lfMass, const cMatrix& lTranslation );
-	// New for terrain generator
-	btAlignedObjectArray<btCollisionShape*>  getCollisionShapes(){ return mapCollisionShapes; }
+	// Takes the body out of the world and deletes it with its motion state. It releases
+	// the reference of the body to its shape. Their memory goes back to the pools
+	void RemoveBody( btRigidBody* lpBody );
+	// Recycles a live body (debris, projectiles) at a new place, at rest, without any
+	// allocation. It leaves the broadphase and enters it again, so no old pair is kept
+	void ReuseBody( btRigidBody* lpBody, const cMatrix& lTransform );
+	// Pre-warms the pools and the published states for luiCount bodies, at the level load
+	void ReserveBodies( unsigned luiCount );
+	void GetPoolStats( sPhysicsPoolStats& lBodies, sPhysicsPoolStats& lMotionStates ) const;
+	// CCD from the size of a shape: the threshold is half of its thinnest side and the sphere
+	// fits around the origin. Disabled when the origin is out of the shape
+	static void GetDefaultCcd( const btCollisionShape* lpShape, sPhysicsCcd& lCcd );
+	// It waits for the step in flight
+	void SetBodyCcd( btRigidBody* lpBody, const sPhysicsCcd& lCcd );
+
+	// Terrain of the ray queries, NULL to test its bullet tiles like the other objects
+	inline void SetHeightfield( const cPhysicsHeightfield* lpHeightfield ) { mpHeightfield = lpHeightfield; }
+	inline const cPhysicsHeightfield* GetHeightfield( ) const { return mpHeightfield; }
+
+	// Snapshot of the moving bodies of GetNewBody (transforms, velocities and activation) and
+	// of the snapshot callbacks in a compact binary buffer. It waits for the step in flight,
+	// from a sync callback it is free, so it can be taken every frame
+	void SaveSnapshot( std::vector<unsigned char>& lacBuffer );
+	// Puts the world back in the state of the buffer, the bodies must be the same ones. The
+	// whole buffer is checked first, on false the world is left as it was. The
+	// broadphase is built again with the bodies in slot order and the solver is reset, so the
+	// steps after a restore always give the same results in a deterministic world. False if
+	// the buffer doesn't match the world
+	bool RestoreSnapshot( const std::vector<unsigned char>& lacBuffer );
+	void AddSnapshotCallbacks( tPhysicsSnapshotWrite lpWrite, tPhysicsSnapshotRead lpRead, void * lpData );
+	void RemoveSnapshotCallbacks( void * lpData );
+	// Bytes of the snapshots, for the callbacks
+	static void SnapshotWrite( std::vector<unsigned char>& lacBuffer, const void * lpData, unsigned luiSize );
+	static bool SnapshotRead( const unsigned char*& lpucData, const unsigned char* lpucEnd, void * lpOut, unsigned luiSize );
+	static unsigned HashSnapshot( const std::vector<unsigned char>& lacBuffer );
+	// Determinism check: the snapshot is hashed after every fixed step. Two runs from the
+	// same restore with the same inputs must give the same list. It needs a world made with
+	// mbDeterministic, the parallel dispatcher and solver change the order of the contacts
+	void SetDeterminismCheck( bool lbEnable );
+	// It waits for the step in flight
+	const std::vector<unsigned>& GetStepHashes( );
+	void ClearStepHashes( );
+	// Runs luiSteps fixed steps twice from the same snapshot and compares their hashes, the
+	// world is restored at the end. Main thread, for the regression runs of a deterministic
+	// world ("-bench replay")
+	bool CheckReplay( unsigned luiSteps = 120 );
 
 	// Static Methods to translate from and to Bullet Variable Types
 	static cVec3 Bullet2Local( const btVector3& lFrom );
@@ -28,20 +202,128 @@ public:
 	static btTransform Local2Bullet( const cMatrix& lFrom );
 	friend class cSingleton<cPhysics>;
 
-	// Draws debug info
+	// Draws debug info through cPhysicsDebugDraw, it waits for the step in flight
 	void Render( );
 
-	// Devuelve mundo Bullet
-	btDiscreteDynamicsWorld* GetBulletWorld(){ return mpWorld; };
+	// Devuelve mundo Bullet. It waits for the step in flight
+	btDiscreteDynamicsWorld* GetBulletWorld(){ WaitForStep(); return mWorld.mpWorld; };
+
+	// Drops a pile of luiBodies boxes and spheres in a pit and times luiSteps fixed steps
+	// with every configuration of the dispatcher and the solver
+	static void Benchmark( unsigned luiBodies = 4000, unsigned luiSteps = 300 );
+	// Scatters luiBodies boxes over a floor of lfArea x lfArea (uniform, in clusters and
+	// along a ring track) and times luiSteps steps with every broadphase, with the mean
+	// number of overlapping pairs
+	static void BenchmarkBroadphase( unsigned luiBodies = 2000, float lfArea = 400.0f, unsigned luiSteps = 300 );
+	// Tunnelling scene: small debris shot at lfSpeed against a thin wall and dropped on a
+	// heightfield, stepped at lfHz with and without CCD. It counts the bodies that go through
+	// and gives false if any goes through with CCD
+	static bool TestTunnelling( float lfHz = 30.0f, float lfSpeed = 80.0f, unsigned luiBodies = 64 );
 
 private:
+	enum ePhysicsCommandType{
+		ePhysicsCommand_SetTransform = 0,
+		ePhysicsCommand_Call
+	};
+
+	struct sPhysicsCommand{
+		btTransform mTransform;
+		ePhysicsCommandType meType;
+		btRigidBody* mpBody;
+		tPhysicsCommand mpFunction;
+		void * mpData;
+		float mafValues[4];
+	};
+
+	struct sSyncCallback{
+		tPhysicsCallback mpCallback;
+		void * mpData;
+	};
+
+	struct sStepCallbacks{
+		tPhysicsStepCallback mpPreStep;
+		tPhysicsStepCallback mpPostStep;
+		void * mpData;
+	};
+
+	struct sSnapshotCallbacks{
+		tPhysicsSnapshotWrite mpWrite;
+		tPhysicsSnapshotRead mpRead;
+		void * mpData;
+	};
+
+	// Entry point of the physics thread
+	static DWORD WINAPI PhysicsMain( LPVOID lpParam );
+	// Internal tick callbacks of the world, they call the step callbacks
+	static void PreTick( btDynamicsWorld* lpWorld, btScalar lfStep );
+	static void PostTick( btDynamicsWorld* lpWorld, btScalar lfStep );
+	// Commands, fixed steps and publication of the states, in the physics thread or inline
+	void RunSteps( );
+	void ApplyCommands( btAlignedObjectArray<sPhysicsCommand>& laCommands );
+	void PublishStates( );
+	// Both published states of a slot start with this transform and at rest
+	void ResetSlot( unsigned luiSlot, const btTransform& lTransform );
+	// Drops the queued writes to a body
+	void DropCommands( btRigidBody* lpBody );
+	void ReportPools( ) const;
+	// Snapshot without waiting, main thread while idle or physics thread
+	void WriteSnapshot( std::vector<unsigned char>& lacBuffer ) const;
+	// Main thread: results of the last steps and start of the next ones
+	void Sync( );
+	void Kick( float lfTimestep );
+
+	// Builds and deletes the objects of a world. The bodies still in the world are deleted
+	// with their motion states, the shapes belong to their owners
+	static void CreateWorld( const sPhysicsConfig& lConfig, sPhysicsWorld& lWorld );
+	static btBroadphaseInterface* CreateBroadphase( const sPhysicsConfig& lConfig );
+	static void DeleteWorld( sPhysicsWorld& lWorld );
+	// Every object leaves the broadphase, their pairs and contacts go with it, and they enter
+	// a new one with the same filters: first the ones out of the slots in the order of the
+	// world, then the bodies of the slots in slot order. The frozen bodies are left out
+	void RebuildBroadphase( );
+
 	// Bullet world
-	btDiscreteDynamicsWorld* mpWorld;
-	btDefaultCollisionConfiguration* mpCollisionConfiguration;
-	btCollisionDispatcher* mpDispatcher;
-	btBroadphaseInterface* mpOverlappingPairCache;
-	btSequentialImpulseConstraintSolver* mpSolver;
-	btAlignedObjectArray<btCollisionShape*> mapCollisionShapes;
+	sPhysicsConfig mConfig;
+	sPhysicsWorld mWorld;
+	// Fixed timestep
+	float mfFixedTimestep;
+	int miMaxSubSteps;
+	float mfAccumulator;
+	float mfAlpha;
+	unsigned muiDroppedSteps;
+	// Work of the steps in flight
+	int miJobSteps;
+	float mfJobAlpha;
+
+	// Published states, double buffered by slot. The game reads one buffer while the
+	// physics thread writes the other, they are swapped in Sync
+	btAlignedObjectArray<sPhysicsBodyState> maBodyStates[2];
+	unsigned muiReadBuffer;
+	std::vector<btRigidBody*> mapSlotBodies;
+	std::vector<unsigned> mauiFreeSlots;
+	// Memory of the bodies made by GetNewBody
+	cPhysicsPool<btRigidBody> mBodyPool;
+	cPhysicsPool<cPhysicsMotionState> mMotionStatePool;
+
+	// Commands: the game fills one queue while the thread applies the other
+	btAlignedObjectArray<sPhysicsCommand> maCommands[2];
+	unsigned muiQueue;
+	std::vector<sSyncCallback> maSyncCallbacks;
+	std::vector<sStepCallbacks> maStepCallbacks;
+	const cPhysicsHeightfield* mpHeightfield;
+	// Snapshots and determinism check, the hashes are written by the physics thread
+	std::vector<sSnapshotCallbacks> maSnapshotCallbacks;
+	bool mbDeterminismCheck;
+	std::vector<unsigned> mauiStepHashes;
+	std::vector<unsigned char> macHashBuffer;
+
+	// Physics thread
+	HANDLE mhThread;
+	HANDLE mhStartEvent;
+	HANDLE mhDoneEvent;
+	DWORD mdwThreadId;
+	volatile bool mbQuit;
+	bool mbStepInFlight;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,350 @@
+#include "cPhysicsContacts.h"
+#include "cPhysics.h"
+#include "..\LuaManager\cLuaManager.h"
+#include <assert.h>
+#include <string.h>
+
+// Order of the pairs for quickSort
+struct sContactPairLess{
+	template <class T> bool operator()( const T& lA, const T& lB ) const { return lA < lB; }
+};
+
+static const char* kacContactEvents[] = { "begin", "persist", "end" };
+
+static unsigned GetSlot( const btRigidBody* lpBody ){
+	assert( lpBody->getMotionState() );
+	return ((cPhysicsMotionState*)lpBody->getMotionState())->muiSlot;
+}
+
+cPhysicsContacts::cPhysicsContacts( ){
+	GetDefaultConfig( mConfig );
+	memset( &mStats, 0, sizeof( mStats ) );
+	muiHead = 0;
+	muiCount = 0;
+	muiDropped = 0;
+	muiPairs = 0;
+	muiManifolds = 0;
+	mbInit = false;
+}
+
+void cPhysicsContacts::GetDefaultConfig( sPhysicsContactsConfig& lConfig ){
+	lConfig.muiCapacity = 1024;
+	// A crate of some kilos resting on the floor pushes about this much every step
+	lConfig.mfImpulseThreshold = 1.0f;
+	lConfig.mbPersistEvents = false;
+}
+
+void cPhysicsContacts::Init( ){
+	sPhysicsContactsConfig lConfig;
+	GetDefaultConfig( lConfig );
+	Init( lConfig );
+}
+
+void cPhysicsContacts::Init( const sPhysicsContactsConfig& lConfig ){
+	if ( mbInit ) return;
+	assert( lConfig.muiCapacity > 0 );
+	mConfig = lConfig;
+	maEvents.resize( mConfig.muiCapacity );
+	muiHead = 0;
+	muiCount = 0;
+	muiDropped = 0;
+	maPairs[0].resize( 0 );
+	maPairs[1].resize( 0 );
+	muiPairs = 0;
+	memset( &mStats, 0, sizeof( mStats ) );
+	cPhysics::Get().AddStepCallbacks( NULL, PostStep, this );
+	cPhysics::Get().AddSyncCallback( SyncContacts, this );
+	mbInit = true;
+}
+
+void cPhysicsContacts::Deinit( ){
+	if ( !mbInit ) return;
+	cPhysics::Get().RemoveStepCallbacks( this );
+	cPhysics::Get().RemoveSyncCallback( SyncContacts, this );
+	maEvents.clear();
+	maPairs[0].clear();
+	maPairs[1].clear();
+	mausGroup.clear();
+	mausMask.clear();
+	maListeners.clear();
+	macLuaListeners.clear();
+	muiCount = 0;
+	memset( &mStats, 0, sizeof( mStats ) );
+	mbInit = false;
+}
+
+void cPhysicsContacts::SetFilter( const btRigidBody* lpBody, unsigned luiGroup, unsigned luiMask ){
+	assert( lpBody && luiGroup != 0 );
+	cPhysics::Get().WaitForStep();
+	unsigned luiSlot = GetSlot( lpBody );
+	if ( luiSlot >= mausGroup.size() ){
+		mausGroup.resize( luiSlot + 1, 0 );
+		mausMask.resize( luiSlot + 1, 0 );
+	}
+	mausGroup[luiSlot] = (unsigned short)luiGroup;
+	mausMask[luiSlot] = (unsigned short)luiMask;
+}
+
+void cPhysicsContacts::ForgetBody( const btRigidBody* lpBody ){
+	if ( !mbInit ) return;
+	cPhysics::Get().WaitForStep();
+	// Events not given yet, the ring is packed without them
+	unsigned luiCapacity = maEvents.size();
+	unsigned luiKept = 0;
+	for ( unsigned luiEvent = 0; luiEvent < muiCount; ++luiEvent ){
+		const sPhysicsContact& lContact = maEvents[( muiHead + luiEvent ) % luiCapacity];
+		if ( lContact.mpBodyA == lpBody || lContact.mpBodyB == lpBody ) continue;
+		maEvents[( muiHead + luiKept ) % luiCapacity] = lContact;
+		++luiKept;
+	}
+	muiCount = luiKept;
+
+	// Its pairs have no end, the body will not be there to read it
+	btAlignedObjectArray<sContactPair>& laPairs = maPairs[muiPairs];
+	int liKept = 0;
+	for ( int liPair = 0; liPair < laPairs.size(); ++liPair ){
+		if ( laPairs[liPair].mpBodyA == lpBody || laPairs[liPair].mpBodyB == lpBody ) continue;
+		laPairs[liKept++] = laPairs[liPair];
+	}
+	laPairs.resize( liKept );
+
+	// The slot goes to the next body of GetNewBody
+	unsigned luiSlot = GetSlot( lpBody );
+	if ( luiSlot < mausGroup.size() ){
+		mausGroup[luiSlot] = 0;
+		mausMask[luiSlot] = 0;
+	}
+}
+
+void cPhysicsContacts::SetImpulseThreshold( float lfImpulse ){
+	cPhysics::Get().WaitForStep();
+	mConfig.mfImpulseThreshold = lfImpulse;
+}
+
+void cPhysicsContacts::AddListener( tPhysicsContactListener lpListener, void * lpData ){
+	assert( lpListener );
+	sContactListener lListener;
+	lListener.mpListener = lpListener;
+	lListener.mpData = lpData;
+	maListeners.push_back( lListener );
+}
+
+void cPhysicsContacts::RemoveListener( tPhysicsContactListener lpListener, void * lpData ){
+	for ( unsigned luiIndex = 0; luiIndex < maListeners.size(); ++luiIndex ){
+		if ( maListeners[luiIndex].mpListener == lpListener && maListeners[luiIndex].mpData == lpData ){
+			maListeners.erase( maListeners.begin() + luiIndex );
+			return;
+		}
+	}
+}
+
+void cPhysicsContacts::AddLuaListener( const char* lacFunction ){
+	assert( lacFunction );
+	for ( unsigned luiIndex = 0; luiIndex < macLuaListeners.size(); ++luiIndex ){
+		if ( macLuaListeners[luiIndex] == lacFunction ) return;
+	}
+	macLuaListeners.push_back( lacFunction );
+}
+
+void cPhysicsContacts::RemoveLuaListener( const char* lacFunction ){
+	for ( unsigned luiIndex = 0; luiIndex < macLuaListeners.size(); ++luiIndex ){
+		if ( macLuaListeners[luiIndex] == lacFunction ){
+			macLuaListeners.erase( macLuaListeners.begin() + luiIndex );
+			return;
+		}
+	}
+}
+
+unsigned cPhysicsContacts::GetGroup( const btRigidBody* lpBody ) const{
+	unsigned luiSlot = GetSlot( lpBody );
+	if ( luiSlot < mausGroup.size() && mausGroup[luiSlot] ) return mausGroup[luiSlot];
+	return ePhysicsContactGroup_Default;
+}
+
+unsigned cPhysicsContacts::GetMask( const btRigidBody* lpBody ) const{
+	unsigned luiSlot = GetSlot( lpBody );
+	return ( luiSlot < mausMask.size() ) ? mausMask[luiSlot] : 0;
+}
+
+bool cPhysicsContacts::IsListened( const btRigidBody* lpBodyA, const btRigidBody* lpBodyB ) const{
+	return ( GetMask( lpBodyA ) & GetGroup( lpBodyB ) ) || ( GetMask( lpBodyB ) & GetGroup( lpBodyA ) );
+}
+
+void cPhysicsContacts::Push( ePhysicsContactEvent leEvent, btRigidBody* lpBodyA, btRigidBody* lpBodyB, float lfImpulse, const btVector3& lPoint, const btVector3& lNormal ){
+	unsigned luiCapacity = maEvents.size();
+	if ( muiCount == luiCapacity ){
+		++muiDropped;
+		return;
+	}
+	sPhysicsContact& lContact = maEvents[( muiHead + muiCount ) % luiCapacity];
+	lContact.mPoint = lPoint;
+	lContact.mNormal = lNormal;
+	lContact.mpBodyA = lpBodyA;
+	lContact.mpBodyB = lpBodyB;
+	lContact.mfImpulse = lfImpulse;
+	lContact.meEvent = leEvent;
+	++muiCount;
+}
+
+void cPhysicsContacts::PostStep( float lfStep, void * lpData ){
+	((cPhysicsContacts*)lpData)->Collect();
+}
+
+void cPhysicsContacts::Collect( ){
+	btDispatcher* lpDispatcher = cPhysics::Get().GetBulletWorld()->getDispatcher();
+	btAlignedObjectArray<sContactPair>& laLast = maPairs[muiPairs];
+	btAlignedObjectArray<sContactPair>& laPairs = maPairs[muiPairs ^ 1];
+	laPairs.resize( 0 );
+
+	// One pass over the manifolds with points
+	muiManifolds = 0;
+	int liManifolds = lpDispatcher->getNumManifolds();
+	for ( int liManifold = 0; liManifold < liManifolds; ++liManifold ){
+		btPersistentManifold* lpManifold = lpDispatcher->getManifoldByIndexInternal( liManifold );
+		int liPoints = lpManifold->getNumContacts();
+		if ( liPoints == 0 ) continue;
+		++muiManifolds;
+		btRigidBody* lpBody0 = btRigidBody::upcast( (btCollisionObject*)lpManifold->getBody0() );
+		btRigidBody* lpBody1 = btRigidBody::upcast( (btCollisionObject*)lpManifold->getBody1() );
+		if ( !lpBody0 || !lpBody1 || !lpBody0->getMotionState() || !lpBody1->getMotionState() ) continue;
+		if ( !IsListened( lpBody0, lpBody1 ) ) continue;
+
+		// Body A is the lower address, the manifold gives its normal from body 1 to body 0
+		bool lbSwap = lpBody1 < lpBody0;
+		sContactPair lPair;
+		lPair.mpBodyA = lbSwap ? lpBody1 : lpBody0;
+		lPair.mpBodyB = lbSwap ? lpBody0 : lpBody1;
+		lPair.mfImpulse = 0.0f;
+		lPair.mfStrongest = -1.0f;
+		lPair.mbReported = false;
+		for ( int liPoint = 0; liPoint < liPoints; ++liPoint ){
+			const btManifoldPoint& lPoint = lpManifold->getContactPoint( liPoint );
+			float lfImpulse = lPoint.getAppliedImpulse();
+			lPair.mfImpulse += lfImpulse;
+			if ( lfImpulse <= lPair.mfStrongest ) continue;
+			lPair.mfStrongest = lfImpulse;
+			lPair.mPoint = lbSwap ? lPoint.getPositionWorldOnA() : lPoint.getPositionWorldOnB();
+			lPair.mNormal = lbSwap ? -lPoint.m_normalWorldOnB : lPoint.m_normalWorldOnB;
+		}
+		laPairs.push_back( lPair );
+	}
+
+	// The manifolds of the same pair come together, the strongest point is kept
+	laPairs.quickSort( sContactPairLess() );
+	int liMerged = 0;
+	for ( int liPair = 0; liPair < laPairs.size(); ++liPair ){
+		if ( liMerged > 0 && laPairs[liMerged - 1].IsSame( laPairs[liPair] ) ){
+			sContactPair& lMerged = laPairs[liMerged - 1];
+			lMerged.mfImpulse += laPairs[liPair].mfImpulse;
+			if ( laPairs[liPair].mfStrongest > lMerged.mfStrongest ){
+				lMerged.mfStrongest = laPairs[liPair].mfStrongest;
+				lMerged.mPoint = laPairs[liPair].mPoint;
+				lMerged.mNormal = laPairs[liPair].mNormal;
+			}
+			continue;
+		}
+		laPairs[liMerged++] = laPairs[liPair];
+	}
+	laPairs.resize( liMerged );
+
+	// Both lists are sorted, they are walked together
+	int liLast = 0;
+	for ( int liPair = 0; liPair < laPairs.size(); ++liPair ){
+		sContactPair& lPair = laPairs[liPair];
+		for ( ; liLast < laLast.size() && laLast[liLast] < lPair; ++liLast ){
+			const sContactPair& lGone = laLast[liLast];
+			if ( lGone.mbReported ) Push( ePhysicsContact_End, lGone.mpBodyA, lGone.mpBodyB, 0.0f, lGone.mPoint, lGone.mNormal );
+		}
+		bool lbReported = false;
+		if ( liLast < laLast.size() && laLast[liLast].IsSame( lPair ) ){
+			lbReported = laLast[liLast].mbReported;
+			++liLast;
+		}
+		if ( lbReported ){
+			lPair.mbReported = true;
+			if ( mConfig.mbPersistEvents ) Push( ePhysicsContact_Persist, lPair.mpBodyA, lPair.mpBodyB, lPair.mfImpulse, lPair.mPoint, lPair.mNormal );
+		} else if ( lPair.mfStrongest >= mConfig.mfImpulseThreshold ){
+			lPair.mbReported = true;
+			Push( ePhysicsContact_Begin, lPair.mpBodyA, lPair.mpBodyB, lPair.mfImpulse, lPair.mPoint, lPair.mNormal );
+		}
+	}
+	for ( ; liLast < laLast.size(); ++liLast ){
+		const sContactPair& lGone = laLast[liLast];
+		if ( lGone.mbReported ) Push( ePhysicsContact_End, lGone.mpBodyA, lGone.mpBodyB, 0.0f, lGone.mPoint, lGone.mNormal );
+	}
+	muiPairs ^= 1;
+}
+
+void cPhysicsContacts::SyncContacts( void * lpData ){
+	((cPhysicsContacts*)lpData)->Dispatch();
+}
+
+void cPhysicsContacts::Dispatch( ){
+	mStats.muiEvents = muiCount;
+	mStats.muiDropped = muiDropped;
+	mStats.muiPairs = maPairs[muiPairs].size();
+	mStats.muiManifolds = muiManifolds;
+	muiDropped = 0;
+	if ( muiCount == 0 ) return;
+
+	// The events of the ring in at most two spans
+	unsigned luiCapacity = maEvents.size();
+	unsigned luiFirst = btMin( muiCount, luiCapacity - muiHead );
+	const sPhysicsContact* lapSpans[2] = { &maEvents[muiHead], &maEvents[0] };
+	unsigned lauiSpans[2] = { luiFirst, muiCount - luiFirst };
+	for ( unsigned luiSpan = 0; luiSpan < 2; ++luiSpan ){
+		if ( lauiSpans[luiSpan] == 0 ) continue;
+		for ( unsigned luiIndex = 0; luiIndex < maListeners.size(); ++luiIndex ){
+			maListeners[luiIndex].mpListener( lapSpans[luiSpan], lauiSpans[luiSpan], maListeners[luiIndex].mpData );
+		}
+		DispatchLua( lapSpans[luiSpan], lauiSpans[luiSpan] );
+	}
+	muiHead = ( muiHead + muiCount ) % luiCapacity;
+	muiCount = 0;
+}
+
+void cPhysicsContacts::DispatchLua( const sPhysicsContact* lpaContacts, unsigned luiCount ){
+	if ( macLuaListeners.empty() ) return;
+	lua_State* lpContext = cLuaManager::Get().GetContext();
+	assert( lpContext );
+	for ( unsigned luiListener = 0; luiListener < macLuaListeners.size(); ++luiListener ){
+		lua_getglobal( lpContext, macLuaListeners[luiListener].c_str() );
+		// The script may not be loaded yet
+		if ( !lua_isfunction( lpContext, -1 ) ){
+			lua_pop( lpContext, 1 );
+			continue;
+		}
+		lua_createtable( lpContext, luiCount, 0 );
+		for ( unsigned luiIndex = 0; luiIndex < luiCount; ++luiIndex ){
+			const sPhysicsContact& lContact = lpaContacts[luiIndex];
+			lua_createtable( lpContext, 0, 10 );
+			lua_pushstring( lpContext, kacContactEvents[lContact.meEvent] );
+			lua_setfield( lpContext, -2, "event" );
+			lua_pushinteger( lpContext, GetSlot( lContact.mpBodyA ) );
+			lua_setfield( lpContext, -2, "a" );
+			lua_pushinteger( lpContext, GetSlot( lContact.mpBodyB ) );
+			lua_setfield( lpContext, -2, "b" );
+			lua_pushnumber( lpContext, lContact.mfImpulse );
+			lua_setfield( lpContext, -2, "impulse" );
+			lua_pushnumber( lpContext, lContact.mPoint.x() );
+			lua_setfield( lpContext, -2, "x" );
+			lua_pushnumber( lpContext, lContact.mPoint.y() );
+			lua_setfield( lpContext, -2, "y" );
+			lua_pushnumber( lpContext, lContact.mPoint.z() );
+			lua_setfield( lpContext, -2, "z" );
+			lua_pushnumber( lpContext, lContact.mNormal.x() );
+			lua_setfield( lpContext, -2, "nx" );
+			lua_pushnumber( lpContext, lContact.mNormal.y() );
+			lua_setfield( lpContext, -2, "ny" );
+			lua_pushnumber( lpContext, lContact.mNormal.z() );
+			lua_setfield( lpContext, -2, "nz" );
+			lua_rawseti( lpContext, -2, luiIndex + 1 );
+		}
+		if ( lua_pcall( lpContext, 1, 0, 0 ) != 0 ){
+			OutputDebugString( "Physics contacts: " );
+			OutputDebugString( lua_tostring( lpContext, -1 ) );
+			OutputDebugString( "\n" );
+			lua_pop( lpContext, 1 );
+		}
+	}
+}
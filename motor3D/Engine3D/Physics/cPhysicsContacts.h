@@ -0,0 +1,141 @@
+#ifndef cPhysicsContacts_H
+#define cPhysicsContacts_H
+
+// Contact events of the bodies of cPhysics. After every fixed step the physics thread reads
+// the manifolds of the dispatcher once and writes the begin, persist and end events of the
+// touching pairs in a ring buffer allocated at Init. In the sync of the main thread the
+// events of the frame are given to the C++ and Lua listeners in one batch.
+// A pair has events when the mask of one body has the group of the other, and it begins
+// when its strongest contact point reaches the impulse threshold
+
+#include <vector>
+#include <string>
+#include "..\Utility\Singleton.h"
+#include "..\MathLib\MathLib.h"
+#include "..\Libraries\Bullet\include\btBulletDynamicsCommon.h"
+
+enum ePhysicsContactEvent{
+	ePhysicsContact_Begin = 0,
+	ePhysicsContact_Persist,
+	ePhysicsContact_End
+};
+
+// Groups of the bodies, they can be combined
+enum ePhysicsContactGroup{
+	ePhysicsContactGroup_Default = 1,		// Every body without a filter
+	ePhysicsContactGroup_Static = 2,
+	ePhysicsContactGroup_Vehicle = 4,
+	ePhysicsContactGroup_Prop = 8,
+	ePhysicsContactGroup_Debris = 16,
+	ePhysicsContactGroup_All = 0xFFFF
+};
+
+struct sPhysicsContact{
+	btVector3 mPoint;			// Strongest point, on body B
+	btVector3 mNormal;			// From B to A
+	btRigidBody* mpBodyA;
+	btRigidBody* mpBodyB;
+	float mfImpulse;			// Sum of the impulses of the points in the step, 0 at the end
+	ePhysicsContactEvent meEvent;
+};
+
+struct sPhysicsContactsConfig{
+	unsigned muiCapacity;		// Events kept between two syncs, the rest are dropped
+	float mfImpulseThreshold;	// Impulse of the points for a begin
+	bool mbPersistEvents;		// Every step while the pair keeps touching
+};
+
+// Counters of the last sync
+struct sPhysicsContactsStats{
+	unsigned muiEvents;
+	unsigned muiDropped;		// Over the capacity of the ring
+	unsigned muiPairs;			// Pairs touching
+	unsigned muiManifolds;		// Manifolds read in the last step
+};
+
+// Batch of events of a frame. The ring can give them in two parts, every part is a call
+typedef void (*tPhysicsContactListener)( const sPhysicsContact* lpaContacts, unsigned luiCount, void * lpData );
+
+class cPhysicsContacts : public cSingleton<cPhysicsContacts>{
+public:
+	static void GetDefaultConfig( sPhysicsContactsConfig& lConfig );
+	// Hooks the fixed steps and the sync of cPhysics, after its Init
+	void Init( );
+	void Init( const sPhysicsContactsConfig& lConfig );
+	void Deinit( );
+
+	// The bodies without a filter are of the default group and listen to nobody
+	void SetFilter( const btRigidBody* lpBody, unsigned luiGroup, unsigned luiMask );
+	// Events and filter of a body going away, cPhysics::RemoveBody calls it
+	void ForgetBody( const btRigidBody* lpBody );
+	void SetImpulseThreshold( float lfImpulse );
+
+	void AddListener( tPhysicsContactListener lpListener, void * lpData );
+	void RemoveListener( tPhysicsContactListener lpListener, void * lpData );
+	// The Lua function gets a table of events, each one with the fields event ("begin",
+	// "persist" or "end"), a and b (slots of the bodies), impulse, x, y, z, nx, ny and nz
+	void AddLuaListener( const char* lacFunction );
+	void RemoveLuaListener( const char* lacFunction );
+
+	inline const sPhysicsContactsStats& GetStats( ) const { return mStats; }
+
+	friend class cSingleton<cPhysicsContacts>;
+
+private:
+	// Pair touching in a step, the bodies in the order of their addresses. The manifolds of
+	// the same pair (compounds) are merged
+	struct sContactPair{
+		btVector3 mPoint;
+		btVector3 mNormal;
+		btRigidBody* mpBodyA;
+		btRigidBody* mpBodyB;
+		float mfImpulse;
+		float mfStrongest;		// Impulse of the point of the pair
+		bool mbReported;		// Its begin has been sent, its end will be
+		inline bool IsSame( const sContactPair& lOther ) const { return mpBodyA == lOther.mpBodyA && mpBodyB == lOther.mpBodyB; }
+		inline bool operator<( const sContactPair& lOther ) const {
+			return ( mpBodyA != lOther.mpBodyA ) ? ( mpBodyA < lOther.mpBodyA ) : ( mpBodyB < lOther.mpBodyB );
+		}
+	};
+
+	struct sContactListener{
+		tPhysicsContactListener mpListener;
+		void * mpData;
+	};
+
+	cPhysicsContacts( );
+	unsigned GetGroup( const btRigidBody* lpBody ) const;
+	unsigned GetMask( const btRigidBody* lpBody ) const;
+	bool IsListened( const btRigidBody* lpBodyA, const btRigidBody* lpBodyB ) const;
+	void Push( ePhysicsContactEvent leEvent, btRigidBody* lpBodyA, btRigidBody* lpBodyB, float lfImpulse, const btVector3& lPoint, const btVector3& lNormal );
+	// Physics thread, after every fixed step
+	static void PostStep( float lfStep, void * lpData );
+	void Collect( );
+	// Main thread while the world is idle
+	static void SyncContacts( void * lpData );
+	void Dispatch( );
+	void DispatchLua( const sPhysicsContact* lpaContacts, unsigned luiCount );
+
+	sPhysicsContactsConfig mConfig;
+	// Filters by slot of cPhysics
+	std::vector<unsigned short> mausGroup;
+	std::vector<unsigned short> mausMask;
+
+	// Ring of events, written by the physics thread and emptied by the sync
+	btAlignedObjectArray<sPhysicsContact> maEvents;
+	unsigned muiHead;
+	unsigned muiCount;
+	unsigned muiDropped;
+
+	// Pairs of the last step and of this one, swapped every step
+	btAlignedObjectArray<sContactPair> maPairs[2];
+	unsigned muiPairs;
+	unsigned muiManifolds;
+
+	std::vector<sContactListener> maListeners;
+	std::vector<std::string> macLuaListeners;
+	sPhysicsContactsStats mStats;
+	bool mbInit;
+};
+
+#endif
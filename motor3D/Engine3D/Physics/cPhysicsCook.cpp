@@ -0,0 +1,282 @@
+#include "cPhysicsCook.h"
+#include "..\Utility\FileUtils.h"
+#include "..\Libraries\Bullet\include\btBulletCollisionCommon.h"
+#include "..\Libraries\Bullet\include\LinearMath\btConvexHullComputer.h"
+#include <assert.h>
+#include <string.h>
+#include <math.h>
+
+// Cooked file: the header, then for every mesh its number of hulls, the points of every
+// hull and the points themselves
+struct sPhysicsCookHeader{
+	unsigned muiMagic;
+	unsigned muiVersion;
+	unsigned muiSourceHash;
+	unsigned muiMeshCount;
+};
+
+static const unsigned kuiPhysicsCookMagic = 0x4B434850; // "PHCK"
+static const unsigned kuiPhysicsCookVersion = 2;
+
+// Part of a mesh in the decomposition, its triangles and the hull of their vertices
+struct sCookPart{
+	std::vector<unsigned> mauiTriangles;
+	btConvexHullComputer mHull;
+	float mfConcavity;
+};
+
+void cPhysicsCook::GetDefaultConfig( sPhysicsCookConfig& lConfig ){
+	lConfig.muiMaxHulls = 8;
+	lConfig.muiMaxHullVertices = 32;
+	lConfig.mfMaxConcavity = 0.05f;
+}
+
+unsigned cPhysicsCook::HashConfig( const sPhysicsCookConfig& lConfig, unsigned luiSeed ){
+	unsigned luiHash = cFileUtils::Hash( &kuiPhysicsCookVersion, sizeof( kuiPhysicsCookVersion ), luiSeed );
+	luiHash = cFileUtils::Hash( &lConfig.muiMaxHulls, sizeof( lConfig.muiMaxHulls ), luiHash );
+	luiHash = cFileUtils::Hash( &lConfig.muiMaxHullVertices, sizeof( lConfig.muiMaxHullVertices ), luiHash );
+	return cFileUtils::Hash( &lConfig.mfMaxConcavity, sizeof( lConfig.mfMaxConcavity ), luiHash );
+}
+
+// Hull of the vertices of the triangles of a part, and how deep the triangles are inside it
+// over the size of the part. The triangles of a convex part are all on its hull
+static void BuildPart( const float* lpafVertices, const unsigned* lpauiIndices, const btAlignedObjectArray<btVector3>& laCentroids, sCookPart& lPart ){
+	std::vector<float> lafPoints;
+	lafPoints.reserve( lPart.mauiTriangles.size() * 9 );
+	for ( unsigned luiTriangle = 0; luiTriangle < lPart.mauiTriangles.size(); ++luiTriangle ){
+		for ( unsigned luiCorner = 0; luiCorner < 3; ++luiCorner ){
+			const float* lpfVertex = lpafVertices + lpauiIndices[lPart.mauiTriangles[luiTriangle] * 3 + luiCorner] * 3;
+			lafPoints.insert( lafPoints.end(), lpfVertex, lpfVertex + 3 );
+		}
+	}
+	lPart.mHull.compute( &lafPoints[0], sizeof( float ) * 3, lafPoints.size() / 3, 0.0f, 0.0f );
+
+	btVector3 lMin( BT_LARGE_FLOAT, BT_LARGE_FLOAT, BT_LARGE_FLOAT ), lMax = -lMin;
+	for ( int liVertex = 0; liVertex < lPart.mHull.vertices.size(); ++liVertex ){
+		lMin.setMin( lPart.mHull.vertices[liVertex] );
+		lMax.setMax( lPart.mHull.vertices[liVertex] );
+	}
+	float lfSize = ( lMax - lMin ).length();
+	lPart.mfConcavity = 0.0f;
+	if ( lfSize <= SIMD_EPSILON || lPart.mHull.faces.size() < 4 ) return;
+
+	// Planes of the faces, the edges of a face go counter-clockwise seen from outside
+	btAlignedObjectArray<btVector4> laPlanes;
+	for ( int liFace = 0; liFace < lPart.mHull.faces.size(); ++liFace ){
+		const btConvexHullComputer::Edge* lpEdge = &lPart.mHull.edges[lPart.mHull.faces[liFace]];
+		const btVector3& lA = lPart.mHull.vertices[lpEdge->getSourceVertex()];
+		lpEdge = lpEdge->getNextEdgeOfFace();
+		const btVector3& lB = lPart.mHull.vertices[lpEdge->getSourceVertex()];
+		const btVector3& lC = lPart.mHull.vertices[lpEdge->getNextEdgeOfFace()->getSourceVertex()];
+		btVector3 lNormal = ( lB - lA ).cross( lC - lA );
+		if ( lNormal.length2() <= SIMD_EPSILON * SIMD_EPSILON ) continue;
+		lNormal.normalize();
+		laPlanes.push_back( btVector4( lNormal.x(), lNormal.y(), lNormal.z(), -lNormal.dot( lA ) ) );
+	}
+
+	// Depth of a triangle: distance from its centroid to the nearest face of the hull
+	for ( unsigned luiTriangle = 0; luiTriangle < lPart.mauiTriangles.size(); ++luiTriangle ){
+		const btVector3& lCentroid = laCentroids[lPart.mauiTriangles[luiTriangle]];
+		float lfDepth = BT_LARGE_FLOAT;
+		for ( int liPlane = 0; liPlane < laPlanes.size(); ++liPlane ){
+			const btVector4& lPlane = laPlanes[liPlane];
+			lfDepth = btMin( lfDepth, -( lCentroid.dot( lPlane ) + lPlane.w() ) );
+		}
+		lPart.mfConcavity = btMax( lPart.mfConcavity, lfDepth / lfSize );
+	}
+}
+
+// Splits the triangles of a part in two by the mean of their centroids on the longest
+// axis. False when they can't be split (all on one side)
+static bool SplitPart( const sCookPart& lPart, const btAlignedObjectArray<btVector3>& laCentroids, sCookPart& lFront, sCookPart& lBack ){
+	btVector3 lMin( BT_LARGE_FLOAT, BT_LARGE_FLOAT, BT_LARGE_FLOAT ), lMax = -lMin, lMean( 0, 0, 0 );
+	for ( unsigned luiTriangle = 0; luiTriangle < lPart.mauiTriangles.size(); ++luiTriangle ){
+		const btVector3& lCentroid = laCentroids[lPart.mauiTriangles[luiTriangle]];
+		lMin.setMin( lCentroid );
+		lMax.setMax( lCentroid );
+		lMean += lCentroid;
+	}
+	lMean /= (float)lPart.mauiTriangles.size();
+	int liAxis = ( lMax - lMin ).maxAxis();
+	for ( unsigned luiTriangle = 0; luiTriangle < lPart.mauiTriangles.size(); ++luiTriangle ){
+		unsigned luiIndex = lPart.mauiTriangles[luiTriangle];
+		if ( laCentroids[luiIndex][liAxis] < lMean[liAxis] ) lBack.mauiTriangles.push_back( luiIndex );
+		else lFront.mauiTriangles.push_back( luiIndex );
+	}
+	return !lFront.mauiTriangles.empty() && !lBack.mauiTriangles.empty();
+}
+
+// Vertex of the hull farthest along a direction
+static int GetSupportVertex( const btAlignedObjectArray<btVector3>& laVertices, const btVector3& lDirection ){
+	int liBest = 0;
+	float lfBest = laVertices[0].dot( lDirection );
+	for ( int liVertex = 1; liVertex < laVertices.size(); ++liVertex ){
+		float lfDot = laVertices[liVertex].dot( lDirection );
+		if ( lfDot > lfBest ){
+			lfBest = lfDot;
+			liBest = liVertex;
+		}
+	}
+	return liBest;
+}
+
+// Most extreme vertices of a hull, luiMaxVertices at most: the supporting vertices of
+// directions spread evenly over the sphere. The directions are doubled while the cap holds
+static void SelectExtremeVertices( const btAlignedObjectArray<btVector3>& laVertices, unsigned luiMaxVertices, std::vector<int>& laiSelected ){
+	std::vector<char> lacUsed;
+	std::vector<int> laiCandidates;
+	for ( unsigned luiDirections = luiMaxVertices; luiDirections <= luiMaxVertices * 16; luiDirections *= 2 ){
+		lacUsed.assign( laVertices.size(), 0 );
+		laiCandidates.clear();
+		for ( unsigned luiDirection = 0; luiDirection < luiDirections; ++luiDirection ){
+			// Fibonacci sphere, golden angle between the directions
+			float lfY = 1.0f - ( luiDirection + 0.5f ) * 2.0f / luiDirections;
+			float lfRadius = sqrtf( 1.0f - lfY * lfY );
+			float lfAngle = luiDirection * 2.39996323f;
+			int liVertex = GetSupportVertex( laVertices, btVector3( cosf( lfAngle ) * lfRadius, lfY, sinf( lfAngle ) * lfRadius ) );
+			if ( !lacUsed[liVertex] ){
+				lacUsed[liVertex] = 1;
+				laiCandidates.push_back( liVertex );
+			}
+		}
+		if ( laiCandidates.size() > luiMaxVertices ) break;
+		laiSelected.swap( laiCandidates );
+		if ( laiSelected.size() == luiMaxVertices ) break;
+	}
+}
+
+// Adds the hull of a part to the mesh, with its most extreme vertices when it has too many.
+// The points are the ones of the hull, without any margin
+static void AddHull( const sCookPart& lPart, unsigned luiMaxVertices, sPhysicsCookedMesh& lMesh ){
+	const btAlignedObjectArray<btVector3>& laVertices = lPart.mHull.vertices;
+	if ( laVertices.size() == 0 ) return;
+	std::vector<int> laiVertices;
+	if ( (unsigned)laVertices.size() > luiMaxVertices ){
+		SelectExtremeVertices( laVertices, luiMaxVertices, laiVertices );
+	} else {
+		for ( int liVertex = 0; liVertex < laVertices.size(); ++liVertex ) laiVertices.push_back( liVertex );
+	}
+	assert( laiVertices.size() <= luiMaxVertices );
+	lMesh.mauiHullSizes.push_back( laiVertices.size() );
+	for ( unsigned luiVertex = 0; luiVertex < laiVertices.size(); ++luiVertex ){
+		const btVector3& lVertex = laVertices[laiVertices[luiVertex]];
+		lMesh.mafPoints.push_back( lVertex.x() );
+		lMesh.mafPoints.push_back( lVertex.y() );
+		lMesh.mafPoints.push_back( lVertex.z() );
+	}
+}
+
+void cPhysicsCook::CookMesh( const float* lpafVertices, unsigned luiVertexCount, const unsigned* lpauiIndices, unsigned luiIndexCount,
+							 const sPhysicsCookConfig& lConfig, sPhysicsCookedMesh& lMesh ){
+	assert( lConfig.muiMaxHulls > 0 && lConfig.muiMaxHullVertices >= 4 && luiIndexCount % 3 == 0 );
+	lMesh.mauiHullSizes.clear();
+	lMesh.mafPoints.clear();
+	unsigned luiTriangles = luiIndexCount / 3;
+	if ( luiTriangles == 0 ) return;
+
+	btAlignedObjectArray<btVector3> laCentroids;
+	laCentroids.resize( luiTriangles );
+	for ( unsigned luiTriangle = 0; luiTriangle < luiTriangles; ++luiTriangle ){
+		btVector3 lCentroid( 0, 0, 0 );
+		for ( unsigned luiCorner = 0; luiCorner < 3; ++luiCorner ){
+			unsigned luiVertex = lpauiIndices[luiTriangle * 3 + luiCorner];
+			assert( luiVertex < luiVertexCount );
+			const float* lpfVertex = lpafVertices + luiVertex * 3;
+			lCentroid += btVector3( lpfVertex[0], lpfVertex[1], lpfVertex[2] );
+		}
+		laCentroids[luiTriangle] = lCentroid / 3.0f;
+	}
+
+	// The parts are split while some dent is too deep and there is room for more hulls
+	std::vector<sCookPart*> lapParts;
+	lapParts.push_back( new sCookPart );
+	for ( unsigned luiTriangle = 0; luiTriangle < luiTriangles; ++luiTriangle ){
+		lapParts[0]->mauiTriangles.push_back( luiTriangle );
+	}
+	BuildPart( lpafVertices, lpauiIndices, laCentroids, *lapParts[0] );
+	while ( lapParts.size() < lConfig.muiMaxHulls ){
+		unsigned luiWorst = 0;
+		for ( unsigned luiPart = 1; luiPart < lapParts.size(); ++luiPart ){
+			if ( lapParts[luiPart]->mfConcavity > lapParts[luiWorst]->mfConcavity ) luiWorst = luiPart;
+		}
+		if ( lapParts[luiWorst]->mfConcavity <= lConfig.mfMaxConcavity ) break;
+
+		sCookPart* lpFront = new sCookPart;
+		sCookPart* lpBack = new sCookPart;
+		if ( !SplitPart( *lapParts[luiWorst], laCentroids, *lpFront, *lpBack ) ){
+			// It stays as it is, it is not taken again
+			lapParts[luiWorst]->mfConcavity = 0.0f;
+			delete lpFront;
+			delete lpBack;
+			continue;
+		}
+		BuildPart( lpafVertices, lpauiIndices, laCentroids, *lpFront );
+		BuildPart( lpafVertices, lpauiIndices, laCentroids, *lpBack );
+		delete lapParts[luiWorst];
+		lapParts[luiWorst] = lpFront;
+		lapParts.push_back( lpBack );
+	}
+
+	for ( unsigned luiPart = 0; luiPart < lapParts.size(); ++luiPart ){
+		AddHull( *lapParts[luiPart], lConfig.muiMaxHullVertices, lMesh );
+		delete lapParts[luiPart];
+	}
+}
+
+unsigned cPhysicsCook::HashMesh( const sPhysicsCookedMesh& lMesh ){
+	unsigned luiHash = cFileUtils::Hash( lMesh.mauiHullSizes.empty() ? NULL : &lMesh.mauiHullSizes[0], lMesh.mauiHullSizes.size() * sizeof( unsigned ) );
+	return cFileUtils::Hash( lMesh.mafPoints.empty() ? NULL : &lMesh.mafPoints[0], lMesh.mafPoints.size() * sizeof( float ), luiHash );
+}
+
+bool cPhysicsCook::WriteFile( const std::string& lacFile, unsigned luiSourceHash, const std::vector<sPhysicsCookedMesh>& laMeshes ){
+	std::vector<unsigned> lauiData;
+	sPhysicsCookHeader lHeader;
+	lHeader.muiMagic = kuiPhysicsCookMagic;
+	lHeader.muiVersion = kuiPhysicsCookVersion;
+	lHeader.muiSourceHash = luiSourceHash;
+	lHeader.muiMeshCount = laMeshes.size();
+	lauiData.insert( lauiData.end(), (const unsigned*)&lHeader, (const unsigned*)( &lHeader + 1 ) );
+	for ( unsigned luiMesh = 0; luiMesh < laMeshes.size(); ++luiMesh ){
+		const sPhysicsCookedMesh& lMesh = laMeshes[luiMesh];
+		lauiData.push_back( lMesh.mauiHullSizes.size() );
+		lauiData.insert( lauiData.end(), lMesh.mauiHullSizes.begin(), lMesh.mauiHullSizes.end() );
+		// The floats go as they are, the file is only read by this machine
+		for ( unsigned luiFloat = 0; luiFloat < lMesh.mafPoints.size(); ++luiFloat ){
+			unsigned luiBits;
+			memcpy( &luiBits, &lMesh.mafPoints[luiFloat], sizeof( luiBits ) );
+			lauiData.push_back( luiBits );
+		}
+	}
+	return cFileUtils::WriteFile( lacFile, &lauiData[0], lauiData.size() * sizeof( unsigned ) );
+}
+
+bool cPhysicsCook::ReadFile( const std::string& lacFile, unsigned luiSourceHash, std::vector<sPhysicsCookedMesh>& laMeshes ){
+	std::vector<char> lacData;
+	if ( !cFileUtils::ReadFile( lacFile, lacData ) || lacData.size() < sizeof( sPhysicsCookHeader ) || lacData.size() % sizeof( unsigned ) != 0 ){
+		return false;
+	}
+	const sPhysicsCookHeader* lpHeader = (const sPhysicsCookHeader*)&lacData[0];
+	if ( lpHeader->muiMagic != kuiPhysicsCookMagic || lpHeader->muiVersion != kuiPhysicsCookVersion || lpHeader->muiSourceHash != luiSourceHash ){
+		return false;
+	}
+
+	const unsigned* lpuiData = (const unsigned*)( lpHeader + 1 );
+	const unsigned* lpuiEnd = (const unsigned*)( &lacData[0] + lacData.size() );
+	laMeshes.resize( lpHeader->muiMeshCount );
+	for ( unsigned luiMesh = 0; luiMesh < laMeshes.size(); ++luiMesh ){
+		sPhysicsCookedMesh& lMesh = laMeshes[luiMesh];
+		if ( lpuiData >= lpuiEnd || (unsigned)( lpuiEnd - lpuiData ) <= *lpuiData ) return false;
+		unsigned luiHulls = *lpuiData++;
+		lMesh.mauiHullSizes.assign( lpuiData, lpuiData + luiHulls );
+		lpuiData += luiHulls;
+		unsigned luiFloats = 0;
+		for ( unsigned luiHull = 0; luiHull < luiHulls; ++luiHull ){
+			luiFloats += lMesh.mauiHullSizes[luiHull] * 3;
+		}
+		if ( (unsigned)( lpuiEnd - lpuiData ) < luiFloats ) return false;
+		lMesh.mafPoints.resize( luiFloats );
+		if ( luiFloats ) memcpy( &lMesh.mafPoints[0], lpuiData, luiFloats * sizeof( float ) );
+		lpuiData += luiFloats;
+	}
+	return lpuiData == lpuiEnd;
+}
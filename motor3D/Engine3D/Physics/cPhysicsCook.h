@@ -0,0 +1,43 @@
+#ifndef cPhysicsCook_H
+#define cPhysicsCook_H
+
+// Collision of the render meshes, built at load time and kept in a cooked file next to the
+// source. A mesh becomes one convex hull, or a few when it is concave: the triangles are
+// split in two along the longest side of the part with the deepest dent, until every part
+// is almost convex or the max of hulls is reached. The hulls are simplified to a max of
+// vertices. cPhysicsShapes turns a cooked mesh into a shared btConvexHullShape or a
+// btCompoundShape of hulls
+
+#include <string>
+#include <vector>
+
+struct sPhysicsCookConfig{
+	unsigned muiMaxHulls;			// 1 for a single hull
+	unsigned muiMaxHullVertices;	// Hard cap, the most extreme vertices are kept (4 at least)
+	float mfMaxConcavity;			// Deepest dent of a part over the size of the part
+};
+
+// Hulls of a mesh, in the space of the mesh
+struct sPhysicsCookedMesh{
+	std::vector<unsigned> mauiHullSizes;	// Points of every hull
+	std::vector<float> mafPoints;			// x, y, z of the points of all the hulls
+};
+
+class cPhysicsCook{
+public:
+	static void GetDefaultConfig( sPhysicsCookConfig& lConfig );
+	// Hashes the config, so the cooked files follow its changes
+	static unsigned HashConfig( const sPhysicsCookConfig& lConfig, unsigned luiSeed );
+
+	// Triangles given by luiIndexCount indices, 3 floats per vertex
+	static void CookMesh( const float* lpafVertices, unsigned luiVertexCount, const unsigned* lpauiIndices, unsigned luiIndexCount,
+						  const sPhysicsCookConfig& lConfig, sPhysicsCookedMesh& lMesh );
+	static unsigned HashMesh( const sPhysicsCookedMesh& lMesh );
+
+	// Cooked file of the meshes of a source, stamped with the hash of the source. The read
+	// fails when the file is missing, broken or from another source
+	static bool WriteFile( const std::string& lacFile, unsigned luiSourceHash, const std::vector<sPhysicsCookedMesh>& laMeshes );
+	static bool ReadFile( const std::string& lacFile, unsigned luiSourceHash, std::vector<sPhysicsCookedMesh>& laMeshes );
+};
+
+#endif
@@ -1,8 +1,324 @@
 #include "..\Graphics\GraphicManager.h"
+#include "..\Graphics\Frustum.h"
 #include "cPhysicsDebugDraw.h"
 #include "cPhysics.h"
+#include <string.h>
+#include "..\Libraries\Bullet\include\BulletCollision\CollisionShapes\btShapeHull.h"
+
+// Frames a round shape can go without being drawn (culled or far) before its lines are dropped
+static const unsigned kuiShapeEntryFrames = 300;
+
+// FNV-1a, the static objects and their boxes give the key of the static cache
+static unsigned HashBytes( unsigned luiHash, const void * lpData, unsigned luiSize ){
+	const unsigned char* lpucData = (const unsigned char*)lpData;
+	for ( unsigned luiByte = 0; luiByte < luiSize; ++luiByte ){
+		luiHash = ( luiHash ^ lpucData[luiByte] ) * 16777619u;
+	}
+	return luiHash;
+}
+
+cPhysicsDebugDraw::cPhysicsDebugDraw(){
+	miDebugMode = 0;
+	mConfig.mbFrustumCull = true;
+	mConfig.mfMaxDistance = 200.0f;
+	mConfig.mbCacheShapes = true;
+	mConfig.mbCacheStatic = true;
+	memset( &mStats, 0, sizeof( mStats ) );
+	mpTarget = NULL;
+	muiStaticHash = 0;
+	muiFrame = 0;
+	mCamera.setValue( 0.0f, 0.0f, 0.0f );
+}
+
+void cPhysicsDebugDraw::sLineBuffer::Add( const btVector3& lFrom, const btVector3& lTo, const btVector3& lColor ){
+	mafVertices.push_back( lFrom.x() );
+	mafVertices.push_back( lFrom.y() );
+	mafVertices.push_back( lFrom.z() );
+	mafVertices.push_back( lTo.x() );
+	mafVertices.push_back( lTo.y() );
+	mafVertices.push_back( lTo.z() );
+	for ( unsigned luiVertex = 0; luiVertex < 2; ++luiVertex ){
+		mafColors.push_back( lColor.x() );
+		mafColors.push_back( lColor.y() );
+		mafColors.push_back( lColor.z() );
+	}
+}
+
+void cPhysicsDebugDraw::DrawWorld( btDiscreteDynamicsWorld* lpWorld ){
+	unsigned luiStaticRebuilds = mStats.muiStaticRebuilds;
+	memset( &mStats, 0, sizeof( mStats ) );
+	mStats.muiStaticRebuilds = luiStaticRebuilds;
+	++muiFrame;
+
+	// Frustum and position of the active camera, the world matrix is the identity here
+	Frustum lFrustum;
+	lFrustum.calculateFrustum();
+	cCamera* lpCamera = cGraphicManager::Get().GetActiveCamera();
+	if ( lpCamera ) mCamera = cPhysics::Local2Bullet( lpCamera->GetPosition() );
+
+	mFrameLines.Clear();
+	mpTarget = &mFrameLines;
+	if ( mConfig.mbCacheStatic ) UpdateStatic( lpWorld );
+
+	btCollisionObjectArray& lObjects = lpWorld->getCollisionObjectArray();
+	for ( int liIndex = 0; liIndex < lObjects.size(); ++liIndex ){
+		btCollisionObject* lpObject = lObjects[liIndex];
+		// The static ones come from their cache
+		if ( mConfig.mbCacheStatic && lpObject->isStaticObject() ) continue;
+		btVector3 lAabbMin, lAabbMax;
+		lpObject->getCollisionShape()->getAabb( lpObject->getWorldTransform(), lAabbMin, lAabbMax );
+		if ( !IsVisible( lFrustum, lAabbMin, lAabbMax ) ){
+			++mStats.muiCulled;
+			continue;
+		}
+		++mStats.muiObjects;
+		if ( miDebugMode & DBG_DrawWireframe ) DrawShape( lpWorld, lpObject->getWorldTransform(), lpObject->getCollisionShape(), GetColor( lpObject ) );
+		if ( miDebugMode & DBG_DrawAabb ) drawAabb( lAabbMin, lAabbMax, btVector3( 1, 0, 0 ) );
+	}
+
+	if ( miDebugMode & DBG_DrawConstraints ){
+		for ( int liIndex = lpWorld->getNumConstraints() - 1; liIndex >= 0; --liIndex ){
+			lpWorld->debugDrawConstraint( lpWorld->getConstraint( liIndex ) );
+		}
+	}
+	if ( miDebugMode & DBG_DrawContactPoints ){
+		btDispatcher* lpDispatcher = lpWorld->getDispatcher();
+		for ( int liManifold = 0; liManifold < lpDispatcher->getNumManifolds(); ++liManifold ){
+			btPersistentManifold* lpManifold = lpDispatcher->getManifoldByIndexInternal( liManifold );
+			for ( int liPoint = 0; liPoint < lpManifold->getNumContacts(); ++liPoint ){
+				const btManifoldPoint& lPoint = lpManifold->getContactPoint( liPoint );
+				if ( !IsVisible( lFrustum, lPoint.getPositionWorldOnB(), lPoint.getPositionWorldOnB() ) ) continue;
+				drawContactPoint( lPoint.getPositionWorldOnB(), lPoint.m_normalWorldOnB, lPoint.getDistance(), lPoint.getLifeTime(), btVector3( 0, 0, 0 ) );
+			}
+		}
+	}
+	mpTarget = NULL;
+
+	// Every line of the frame at once, then the visible ranges of the static cache
+	mStats.muiLines = mFrameLines.GetCount();
+	Flush( mFrameLines, 0, mFrameLines.GetCount() );
+	if ( mConfig.mbCacheStatic ) DrawStatic( lFrustum );
+
+	DropStaleShapes();
+}
+
+void cPhysicsDebugDraw::ClearCaches( ){
+	mStaticLines.Clear();
+	maStaticEntries.clear();
+	muiStaticHash = 0;
+	mShapeLines.Clear();
+	maShapeEntries.clear();
+}
+
+bool cPhysicsDebugDraw::IsVisible( Frustum& lFrustum, const btVector3& lAabbMin, const btVector3& lAabbMax ) const{
+	if ( mConfig.mfMaxDistance > 0.0f ){
+		// Nearest point of the box to the camera
+		btVector3 lNearest = mCamera;
+		lNearest.setMax( lAabbMin );
+		lNearest.setMin( lAabbMax );
+		if ( ( lNearest - mCamera ).length2() > mConfig.mfMaxDistance * mConfig.mfMaxDistance ) return false;
+	}
+	if ( mConfig.mbFrustumCull ){
+		return lFrustum.boxInFrustum( lAabbMin.x(), lAabbMin.y(), lAabbMin.z(), lAabbMax.x(), lAabbMax.y(), lAabbMax.z() );
+	}
+	return true;
+}
+
+btVector3 cPhysicsDebugDraw::GetColor( const btCollisionObject* lpObject ){
+	// The colours of debugDrawWorld
+	switch ( lpObject->getActivationState() ){
+		case ACTIVE_TAG: return btVector3( 1, 1, 1 );
+		case ISLAND_SLEEPING: return btVector3( 0, 1, 0 );
+		case WANTS_DEACTIVATION: return btVector3( 0, 1, 1 );
+		case DISABLE_SIMULATION: return btVector3( 1, 1, 0 );
+		default: return btVector3( 1, 0, 0 );
+	}
+}
+
+void cPhysicsDebugDraw::UpdateStatic( btDiscreteDynamicsWorld* lpWorld ){
+	// The terrain tiles come and go with the paging, the boxes catch the ones that move
+	btCollisionObjectArray& lObjects = lpWorld->getCollisionObjectArray();
+	unsigned luiHash = 2166136261u;
+	for ( int liIndex = 0; liIndex < lObjects.size(); ++liIndex ){
+		const btCollisionObject* lpObject = lObjects[liIndex];
+		if ( !lpObject->isStaticObject() || !lpObject->getBroadphaseHandle() ) continue;
+		const btBroadphaseProxy* lpProxy = lpObject->getBroadphaseHandle();
+		luiHash = HashBytes( luiHash, &lpObject, sizeof( lpObject ) );
+		luiHash = HashBytes( luiHash, &lpProxy->m_aabbMin, sizeof( float ) * 3 );
+		luiHash = HashBytes( luiHash, &lpProxy->m_aabbMax, sizeof( float ) * 3 );
+	}
+	luiHash ^= miDebugMode;
+	if ( luiHash == muiStaticHash ) return;
+
+	mStaticLines.Clear();
+	maStaticEntries.clear();
+	mpTarget = &mStaticLines;
+	for ( int liIndex = 0; liIndex < lObjects.size(); ++liIndex ){
+		const btCollisionObject* lpObject = lObjects[liIndex];
+		if ( !lpObject->isStaticObject() || !lpObject->getBroadphaseHandle() ) continue;
+		sStaticEntry& lEntry = maStaticEntries.expand();
+		lpObject->getCollisionShape()->getAabb( lpObject->getWorldTransform(), lEntry.mAabbMin, lEntry.mAabbMax );
+		lEntry.muiFirstLine = mStaticLines.GetCount();
+		if ( miDebugMode & DBG_DrawWireframe ) DrawShape( lpWorld, lpObject->getWorldTransform(), lpObject->getCollisionShape(), GetColor( lpObject ) );
+		if ( miDebugMode & DBG_DrawAabb ) drawAabb( lEntry.mAabbMin, lEntry.mAabbMax, btVector3( 1, 0, 0 ) );
+		lEntry.muiLineCount = mStaticLines.GetCount() - lEntry.muiFirstLine;
+	}
+	mpTarget = &mFrameLines;
+	muiStaticHash = luiHash;
+	++mStats.muiStaticRebuilds;
+}
+
+void cPhysicsDebugDraw::DrawStatic( Frustum& lFrustum ){
+	mStats.muiStaticLines = mStaticLines.GetCount();
+	// The neighbour entries are sent together
+	unsigned luiFirst = 0, luiCount = 0;
+	for ( int liEntry = 0; liEntry < maStaticEntries.size(); ++liEntry ){
+		const sStaticEntry& lEntry = maStaticEntries[liEntry];
+		if ( !IsVisible( lFrustum, lEntry.mAabbMin, lEntry.mAabbMax ) ){
+			++mStats.muiCulled;
+			continue;
+		}
+		++mStats.muiObjects;
+		if ( luiFirst + luiCount != lEntry.muiFirstLine ){
+			Flush( mStaticLines, luiFirst, luiCount );
+			mStats.muiLines += luiCount;
+			luiFirst = lEntry.muiFirstLine;
+			luiCount = 0;
+		}
+		luiCount += lEntry.muiLineCount;
+	}
+	Flush( mStaticLines, luiFirst, luiCount );
+	mStats.muiLines += luiCount;
+}
+
+void cPhysicsDebugDraw::DrawShape( btDiscreteDynamicsWorld* lpWorld, const btTransform& lTransform, const btCollisionShape* lpShape, const btVector3& lColor ){
+	if ( lpShape->getShapeType() == COMPOUND_SHAPE_PROXYTYPE ){
+		drawTransform( lTransform, 1 );
+		const btCompoundShape* lpCompound = (const btCompoundShape*)lpShape;
+		for ( int liChild = lpCompound->getNumChildShapes() - 1; liChild >= 0; --liChild ){
+			DrawShape( lpWorld, lTransform * lpCompound->getChildTransform( liChild ), lpCompound->getChildShape( liChild ), lColor );
+		}
+		return;
+	}
+	const sShapeEntry* lpEntry = mConfig.mbCacheShapes ? GetShapeEntry( lpShape ) : NULL;
+	if ( !lpEntry ){
+		// Boxes and hulls are drawn from their edges, the concave ones from their triangles
+		lpWorld->debugDrawObject( lTransform, lpShape, lColor );
+		return;
+	}
+	drawTransform( lTransform, 1 );
+	const float* lpfVertex = &mShapeLines.mafVertices[lpEntry->muiFirstLine * 6];
+	for ( unsigned luiLine = 0; luiLine < lpEntry->muiLineCount; ++luiLine, lpfVertex += 6 ){
+		mpTarget->Add( lTransform( btVector3( lpfVertex[0], lpfVertex[1], lpfVertex[2] ) ), lTransform( btVector3( lpfVertex[3], lpfVertex[4], lpfVertex[5] ) ), lColor );
+	}
+}
+
+const cPhysicsDebugDraw::sShapeEntry* cPhysicsDebugDraw::GetShapeEntry( const btCollisionShape* lpShape ){
+	// The round shapes, bullet builds their lines with sines and cosines every frame
+	switch ( lpShape->getShapeType() ){
+		case SPHERE_SHAPE_PROXYTYPE:
+		case CAPSULE_SHAPE_PROXYTYPE:
+		case CONE_SHAPE_PROXYTYPE:
+		case CYLINDER_SHAPE_PROXYTYPE:
+		case MULTI_SPHERE_SHAPE_PROXYTYPE:
+			break;
+		default:
+			return NULL;
+	}
+	const btConvexInternalShape* lpConvex = (const btConvexInternalShape*)lpShape;
+	for ( int liEntry = 0; liEntry < maShapeEntries.size(); ++liEntry ){
+		sShapeEntry& lEntry = maShapeEntries[liEntry];
+		if ( lEntry.mpShape != lpShape ) continue;
+		if ( lEntry.miType == lpShape->getShapeType() && lEntry.mDimensions == lpConvex->getImplicitShapeDimensions() &&
+			 lEntry.mScaling == lpShape->getLocalScaling() && lEntry.mfMargin == lpShape->getMargin() ){
+			lEntry.muiLastFrame = muiFrame;
+			return &lEntry;
+		}
+		// Another shape in the same place, its lines are dropped with the stale ones
+		lEntry.mpShape = NULL;
+		break;
+	}
+
+	// Edges of the hull of the shape, like the wheels of the vehicles
+	btShapeHull lHull( lpConvex );
+	if ( !lHull.buildHull( lpShape->getMargin() ) ) return NULL;
+	sShapeEntry& lEntry = maShapeEntries.expand();
+	lEntry.mpShape = lpShape;
+	lEntry.miType = lpShape->getShapeType();
+	lEntry.mDimensions = lpConvex->getImplicitShapeDimensions();
+	lEntry.mScaling = lpShape->getLocalScaling();
+	lEntry.mfMargin = lpShape->getMargin();
+	lEntry.muiFirstLine = mShapeLines.GetCount();
+	lEntry.muiLastFrame = muiFrame;
+
+	const int liVertices = lHull.numVertices();
+	const unsigned int* lpuiIndices = lHull.getIndexPointer();
+	const btVector3* lpVertices = lHull.getVertexPointer();
+	btAlignedObjectArray<unsigned char> laucEdges;
+	laucEdges.resize( liVertices * liVertices, 0 );
+	for ( int liIndex = 0; liIndex < lHull.numIndices(); liIndex += 3 ){
+		const unsigned int* lpuiTriangle = lpuiIndices + liIndex;
+		for ( int liFrom = 2, liTo = 0; liTo < 3; liFrom = liTo++ ){
+			unsigned luiA = btMin( lpuiTriangle[liFrom], lpuiTriangle[liTo] );
+			unsigned luiB = btMax( lpuiTriangle[liFrom], lpuiTriangle[liTo] );
+			unsigned char& lucEdge = laucEdges[luiA * liVertices + luiB];
+			if ( lucEdge ) continue;
+			lucEdge = 1;
+			mShapeLines.Add( lpVertices[luiA], lpVertices[luiB], btVector3( 1, 1, 1 ) );
+		}
+	}
+	lEntry.muiLineCount = mShapeLines.GetCount() - lEntry.muiFirstLine;
+	return &lEntry;
+}
+
+void cPhysicsDebugDraw::DropStaleShapes( ){
+	bool lbStale = false;
+	for ( int liEntry = 0; liEntry < maShapeEntries.size() && !lbStale; ++liEntry ){
+		const sShapeEntry& lEntry = maShapeEntries[liEntry];
+		lbStale = !lEntry.mpShape || muiFrame - lEntry.muiLastFrame > kuiShapeEntryFrames;
+	}
+	if ( !lbStale ) return;
+
+	// The entries left keep their order, their lines are moved down
+	sLineBuffer lLines;
+	int liKept = 0;
+	for ( int liEntry = 0; liEntry < maShapeEntries.size(); ++liEntry ){
+		sShapeEntry lEntry = maShapeEntries[liEntry];
+		if ( !lEntry.mpShape || muiFrame - lEntry.muiLastFrame > kuiShapeEntryFrames ) continue;
+		unsigned luiFirst = lLines.GetCount();
+		lLines.mafVertices.insert( lLines.mafVertices.end(), mShapeLines.mafVertices.begin() + lEntry.muiFirstLine * 6,
+								   mShapeLines.mafVertices.begin() + ( lEntry.muiFirstLine + lEntry.muiLineCount ) * 6 );
+		lLines.mafColors.insert( lLines.mafColors.end(), mShapeLines.mafColors.begin() + lEntry.muiFirstLine * 6,
+								 mShapeLines.mafColors.begin() + ( lEntry.muiFirstLine + lEntry.muiLineCount ) * 6 );
+		lEntry.muiFirstLine = luiFirst;
+		maShapeEntries[liKept++] = lEntry;
+	}
+	maShapeEntries.resize( liKept );
+	mShapeLines.mafVertices.swap( lLines.mafVertices );
+	mShapeLines.mafColors.swap( lLines.mafColors );
+}
+
+void cPhysicsDebugDraw::Flush( const sLineBuffer& lBuffer, unsigned luiFirstLine, unsigned luiLineCount ){
+	if ( !luiLineCount ) return;
+	// Like cGraphicManager::DrawLine, without textures
+	glDisable( GL_TEXTURE_2D );
+	glLineWidth( 1 );
+	glEnableClientState( GL_VERTEX_ARRAY );
+	glEnableClientState( GL_COLOR_ARRAY );
+	glVertexPointer( 3, GL_FLOAT, 0, &lBuffer.mafVertices[0] );
+	glColorPointer( 3, GL_FLOAT, 0, &lBuffer.mafColors[0] );
+	glDrawArrays( GL_LINES, luiFirstLine * 2, luiLineCount * 2 );
+	glDisableClientState( GL_COLOR_ARRAY );
+	glDisableClientState( GL_VERTEX_ARRAY );
+	glEnable( GL_TEXTURE_2D );
+}
 
 void cPhysicsDebugDraw::drawLine(const btVector3& lFrom,const btVector3& lTo,const btVector3& lColor ){
+	// In DrawWorld the lines wait for the end of the frame
+	if ( mpTarget ){
+		mpTarget->Add( lFrom, lTo, lColor );
+		return;
+	}
 	cGraphicManager::Get().DrawLine( cPhysics::Bullet2Local( lFrom ), cPhysics::Bullet2Local( lTo ), cPhysics::Bullet2Local( lColor ) );
 }
 
@@ -19,4 +335,4 @@ void cPhysicsDebugDraw::reportErrorWarning(const char* warningString){
 
 void cPhysicsDebugDraw::draw3dText(const btVector3& location,const char* textString){
 // Usar la clase cFont
-}
\ No newline at end of file
+}
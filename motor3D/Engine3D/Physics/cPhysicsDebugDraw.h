@@ -1,16 +1,48 @@
 #ifndef cPhysicsDebugDraw_H
 #define cPhysicsDebugDraw_H
 
-#include "..\Libraries\Bullet\include\btBulletCollisionCommon.h"
+#include <vector>
+#include "..\Utility\Singleton.h"
+#include "..\Libraries\Bullet\include\btBulletDynamicsCommon.h"
+
+class Frustum;
 
 //-----------
 // Custom Debug Drawer for Bullet
 //----------
 
+// What DrawWorld draws and how
+struct sPhysicsDebugDrawConfig{
+	bool mbFrustumCull;			// Only the objects in the frustum of the active camera
+	float mfMaxDistance;		// Only the objects this near to the camera, 0 for all
+	bool mbCacheShapes;			// Wireframes of the round shapes built once and kept
+	bool mbCacheStatic;			// Lines of the static objects kept until they change
+};
+
+// Counters of the last DrawWorld
+struct sPhysicsDebugDrawStats{
+	unsigned muiObjects;		// Drawn
+	unsigned muiCulled;
+	unsigned muiLines;
+	unsigned muiStaticLines;	// In the static cache
+	unsigned muiStaticRebuilds;	// Times the static cache has been built
+};
+
 class cPhysicsDebugDraw: public btIDebugDraw, public cSingleton<cPhysicsDebugDraw> {
 
 public:
-	cPhysicsDebugDraw() { ; }
+	cPhysicsDebugDraw();
+	// Draws the world like debugDrawWorld, culled and with the caches of the config. The
+	// lines are sent together at the end
+	void DrawWorld( btDiscreteDynamicsWorld* lpWorld );
+	inline void SetConfig( const sPhysicsDebugDrawConfig& lConfig ) { mConfig = lConfig; ClearCaches(); }
+	inline const sPhysicsDebugDrawConfig& GetConfig( ) const { return mConfig; }
+	inline const sPhysicsDebugDrawStats& GetStats( ) const { return mStats; }
+	// The static cache follows the static objects added, removed or resized. This is for
+	// a static object changed in place
+	inline void InvalidateStatic( ) { muiStaticHash = 0; }
+	void ClearCaches( );
+
 	// Draw debug simplified shapes
 	void drawLine(const btVector3& from,const btVector3& to,const btVector3& color);
 	// Draw contact point of collisions
@@ -22,7 +54,62 @@ public:
 	friend class cSingleton<cPhysicsDebugDraw>;
 
 private:
+	// Lines with a colour per vertex, ready for the vertex arrays of OpenGL
+	struct sLineBuffer{
+		std::vector<float> mafVertices;
+		std::vector<float> mafColors;
+		inline unsigned GetCount( ) const { return mafVertices.size() / 6; }
+		inline void Clear( ) { mafVertices.clear(); mafColors.clear(); }
+		void Add( const btVector3& lFrom, const btVector3& lTo, const btVector3& lColor );
+	};
+
+	// Static object and its lines in the static cache
+	struct sStaticEntry{
+		btVector3 mAabbMin;
+		btVector3 mAabbMax;
+		unsigned muiFirstLine;
+		unsigned muiLineCount;
+	};
+
+	// Wireframe of a round shape in its own space. The shape is known by its address and
+	// its dimensions, a new shape in the place of a deleted one doesn't take its lines. An
+	// entry not drawn for a while is dropped, its shape can be gone
+	struct sShapeEntry{
+		const btCollisionShape* mpShape;
+		int miType;
+		btVector3 mDimensions;
+		btVector3 mScaling;
+		float mfMargin;
+		unsigned muiFirstLine;
+		unsigned muiLineCount;
+		unsigned muiLastFrame;
+	};
+
+	bool IsVisible( Frustum& lFrustum, const btVector3& lAabbMin, const btVector3& lAabbMax ) const;
+	static btVector3 GetColor( const btCollisionObject* lpObject );
+	void UpdateStatic( btDiscreteDynamicsWorld* lpWorld );
+	void DrawStatic( Frustum& lFrustum );
+	void DrawShape( btDiscreteDynamicsWorld* lpWorld, const btTransform& lTransform, const btCollisionShape* lpShape, const btVector3& lColor );
+	const sShapeEntry* GetShapeEntry( const btCollisionShape* lpShape );
+	void DropStaleShapes( );
+	static void Flush( const sLineBuffer& lBuffer, unsigned luiFirstLine, unsigned luiLineCount );
+
 	int miDebugMode;
+	sPhysicsDebugDrawConfig mConfig;
+	sPhysicsDebugDrawStats mStats;
+	// Lines of the frame, NULL out of DrawWorld (the lines go straight to the graphic manager)
+	sLineBuffer* mpTarget;
+	sLineBuffer mFrameLines;
+	// Static cache
+	sLineBuffer mStaticLines;
+	btAlignedObjectArray<sStaticEntry> maStaticEntries;
+	unsigned muiStaticHash;
+	// Shape cache
+	sLineBuffer mShapeLines;
+	btAlignedObjectArray<sShapeEntry> maShapeEntries;
+	unsigned muiFrame;
+	// Camera of the frame
+	btVector3 mCamera;
 };
 
-#endif
\ No newline at end of file
+#endif
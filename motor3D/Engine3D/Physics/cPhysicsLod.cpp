@@ -0,0 +1,280 @@
+#include "cPhysicsLod.h"
+#include "cPhysics.h"
+#include <assert.h>
+#include <string.h>
+
+// Coming back to a nearer level needs a tenth less distance, a body on a border doesn't
+// change every frame
+static const float kfLodHysteresis = 0.9f;
+
+cPhysicsLod::cPhysicsLod( ){
+	for ( unsigned luiClass = 0; luiClass < ePhysicsLodClass_Count; ++luiClass ){
+		GetDefaultClass( (ePhysicsLodClass)luiClass, maClasses[luiClass] );
+	}
+	memset( &mStats, 0, sizeof( mStats ) );
+	muiTick = 0;
+	muiHeld = 0;
+	mbInit = false;
+}
+
+void cPhysicsLod::GetDefaultClass( ePhysicsLodClass leClass, sPhysicsLodClass& lClass ){
+	// Thresholds of bullet by default
+	lClass.mfLinearSleep = 0.8f;
+	lClass.mfAngularSleep = 1.0f;
+	lClass.mbAwakeNear = false;
+	switch ( leClass ){
+		case ePhysicsLodClass_Debris:
+			lClass.mfReducedRadius = 30.0f;
+			lClass.mfFrozenRadius = 100.0f;
+			lClass.muiReducedRate = 4;
+			lClass.mfLinearSleep = 1.2f;
+			lClass.mfAngularSleep = 1.5f;
+			break;
+		case ePhysicsLodClass_Vehicle:
+			// The action of the vehicles keeps pushing their chassis, they are never frozen
+			lClass.mfReducedRadius = 150.0f;
+			lClass.mfFrozenRadius = BT_LARGE_FLOAT;
+			lClass.muiReducedRate = 2;
+			lClass.mbAwakeNear = true;
+			break;
+		default:
+			lClass.mfReducedRadius = 60.0f;
+			lClass.mfFrozenRadius = 200.0f;
+			lClass.muiReducedRate = 4;
+			break;
+	}
+}
+
+void cPhysicsLod::Init( ){
+	if ( mbInit ) return;
+	cPhysics::Get().AddStepCallbacks( PreStep, PostStep, this );
+	cPhysics::Get().AddSyncCallback( SyncLod, this );
+	mbInit = true;
+}
+
+void cPhysicsLod::Deinit( ){
+	if ( !mbInit ) return;
+	cPhysics::Get().WaitForStep();
+	for ( unsigned luiIndex = 0; luiIndex < mapBodies.size(); ++luiIndex ){
+		Thaw( luiIndex );
+	}
+	cPhysics::Get().RemoveStepCallbacks( this );
+	cPhysics::Get().RemoveSyncCallback( SyncLod, this );
+	mapBodies.clear();
+	maucClass.clear();
+	maucLevel.clear();
+	masGroup.clear();
+	masMask.clear();
+	mafHeldTime.clear();
+	mauiReduced.clear();
+	memset( &mStats, 0, sizeof( mStats ) );
+	mbInit = false;
+}
+
+void cPhysicsLod::AddBody( btRigidBody* lpBody, ePhysicsLodClass leClass ){
+	assert( lpBody && lpBody->getMotionState() && Find( lpBody ) < 0 );
+	if ( lpBody->isStaticOrKinematicObject() ) return;
+	cPhysics::Get().WaitForStep();
+	const sPhysicsLodClass& lClass = maClasses[leClass];
+	lpBody->setSleepingThresholds( lClass.mfLinearSleep, lClass.mfAngularSleep );
+	mapBodies.push_back( lpBody );
+	maucClass.push_back( (unsigned char)leClass );
+	maucLevel.push_back( ePhysicsLodLevel_Full );
+	masGroup.push_back( btBroadphaseProxy::DefaultFilter );
+	masMask.push_back( btBroadphaseProxy::AllFilter );
+	mafHeldTime.push_back( 0.0f );
+	if ( lClass.mbAwakeNear ) lpBody->forceActivationState( DISABLE_DEACTIVATION );
+}
+
+void cPhysicsLod::RemoveBody( btRigidBody* lpBody ){
+	int liIndex = Find( lpBody );
+	if ( liIndex < 0 ) return;
+	cPhysics::Get().WaitForStep();
+	// Back in the world, cPhysics takes it out
+	Thaw( liIndex );
+
+	unsigned luiLast = mapBodies.size() - 1;
+	mapBodies[liIndex] = mapBodies[luiLast];
+	maucClass[liIndex] = maucClass[luiLast];
+	maucLevel[liIndex] = maucLevel[luiLast];
+	masGroup[liIndex] = masGroup[luiLast];
+	masMask[liIndex] = masMask[luiLast];
+	mafHeldTime[liIndex] = mafHeldTime[luiLast];
+	mapBodies.pop_back();
+	maucClass.pop_back();
+	maucLevel.pop_back();
+	masGroup.pop_back();
+	masMask.pop_back();
+	mafHeldTime.pop_back();
+	// The indices have changed, the list is built again in the next sync
+	mauiReduced.clear();
+}
+
+void cPhysicsLod::SetClass( ePhysicsLodClass leClass, const sPhysicsLodClass& lClass ){
+	assert( lClass.muiReducedRate > 0 && lClass.mfReducedRadius <= lClass.mfFrozenRadius );
+	cPhysics::Get().WaitForStep();
+	maClasses[leClass] = lClass;
+	for ( unsigned luiIndex = 0; luiIndex < mapBodies.size(); ++luiIndex ){
+		if ( maucClass[luiIndex] == leClass ) mapBodies[luiIndex]->setSleepingThresholds( lClass.mfLinearSleep, lClass.mfAngularSleep );
+	}
+}
+
+ePhysicsLodLevel cPhysicsLod::GetLevel( const btRigidBody* lpBody ) const{
+	int liIndex = Find( lpBody );
+	return ( liIndex < 0 ) ? ePhysicsLodLevel_Full : (ePhysicsLodLevel)maucLevel[liIndex];
+}
+
+int cPhysicsLod::Find( const btRigidBody* lpBody ) const{
+	for ( unsigned luiIndex = 0; luiIndex < mapBodies.size(); ++luiIndex ){
+		if ( mapBodies[luiIndex] == lpBody ) return (int)luiIndex;
+	}
+	return -1;
+}
+
+void cPhysicsLod::SyncLod( void* lpData ){
+	((cPhysicsLod*)lpData)->Classify();
+}
+
+void cPhysicsLod::Classify( ){
+	memset( &mStats, 0, sizeof( mStats ) );
+	mStats.muiHeld = muiHeld;
+	mStats.muiBodies = mapBodies.size();
+	mauiReduced.clear();
+
+	btVector3 lViewer = cPhysics::Local2Bullet( mViewer );
+	for ( unsigned luiIndex = 0; luiIndex < mapBodies.size(); ++luiIndex ){
+		btRigidBody* lpBody = mapBodies[luiIndex];
+		const sPhysicsLodClass& lClass = maClasses[maucClass[luiIndex]];
+		ePhysicsLodLevel leLevel = (ePhysicsLodLevel)maucLevel[luiIndex];
+		float lfReduced = lClass.mfReducedRadius * ( ( leLevel != ePhysicsLodLevel_Full ) ? kfLodHysteresis : 1.0f );
+		float lfFrozen = lClass.mfFrozenRadius * ( ( leLevel == ePhysicsLodLevel_Frozen ) ? kfLodHysteresis : 1.0f );
+		float lfDistance2 = ( lpBody->getWorldTransform().getOrigin() - lViewer ).length2();
+
+		if ( lfDistance2 < lfReduced * lfReduced ) leLevel = ePhysicsLodLevel_Full;
+		else if ( lfDistance2 < lfFrozen * lfFrozen ) leLevel = ePhysicsLodLevel_Reduced;
+		else leLevel = ePhysicsLodLevel_Frozen;
+		SetLevel( luiIndex, leLevel );
+
+		switch ( leLevel ){
+			case ePhysicsLodLevel_Full: ++mStats.muiFull; break;
+			case ePhysicsLodLevel_Reduced: ++mStats.muiReduced; mauiReduced.push_back( luiIndex ); break;
+			default: ++mStats.muiFrozen; break;
+		}
+		if ( leLevel != ePhysicsLodLevel_Frozen && !lpBody->isActive() ) ++mStats.muiSleeping;
+	}
+}
+
+void cPhysicsLod::SetLevel( unsigned luiIndex, ePhysicsLodLevel leLevel ){
+	// A body leaving the reduced level doesn't wait for its turn
+	if ( maucLevel[luiIndex] == ePhysicsLodLevel_Reduced && leLevel != ePhysicsLodLevel_Reduced ) CatchUp( luiIndex );
+	// The state of the body is checked too, ReuseBody can put a frozen body back in the world
+	if ( leLevel == ePhysicsLodLevel_Frozen ) Freeze( luiIndex );
+	else Thaw( luiIndex );
+	if ( leLevel == maucLevel[luiIndex] ) return;
+	maucLevel[luiIndex] = (unsigned char)leLevel;
+
+	// The vehicles only sleep away from the viewer, their controls wake them
+	btRigidBody* lpBody = mapBodies[luiIndex];
+	if ( !maClasses[maucClass[luiIndex]].mbAwakeNear ) return;
+	if ( leLevel == ePhysicsLodLevel_Full ){
+		lpBody->forceActivationState( DISABLE_DEACTIVATION );
+	} else if ( lpBody->getActivationState() == DISABLE_DEACTIVATION ){
+		lpBody->forceActivationState( ACTIVE_TAG );
+		lpBody->setDeactivationTime( 0.0f );
+	}
+}
+
+void cPhysicsLod::Freeze( unsigned luiIndex ){
+	btRigidBody* lpBody = mapBodies[luiIndex];
+	btBroadphaseProxy* lpProxy = lpBody->getBroadphaseHandle();
+	if ( !lpProxy ) return;
+	masGroup[luiIndex] = lpProxy->m_collisionFilterGroup;
+	masMask[luiIndex] = lpProxy->m_collisionFilterMask;
+	// Its pairs and contacts go with the proxy. The velocities are kept for the thaw
+	cPhysics::Get().GetBulletWorld()->removeRigidBody( lpBody );
+	cPhysics::Get().ResetInterpolation( lpBody );
+	++mStats.muiFreezes;
+}
+
+void cPhysicsLod::Thaw( unsigned luiIndex ){
+	btRigidBody* lpBody = mapBodies[luiIndex];
+	if ( lpBody->getBroadphaseHandle() ) return;
+	cPhysics::Get().GetBulletWorld()->addRigidBody( lpBody, masGroup[luiIndex], masMask[luiIndex] );
+	lpBody->activate();
+	++mStats.muiThaws;
+}
+
+void cPhysicsLod::PreStep( float lfStep, void* lpData ){
+	((cPhysicsLod*)lpData)->HoldReduced();
+}
+
+void cPhysicsLod::PostStep( float lfStep, void* lpData ){
+	((cPhysicsLod*)lpData)->ReleaseHeld( lfStep );
+}
+
+void cPhysicsLod::HoldReduced( ){
+	++muiTick;
+	for ( unsigned luiReduced = 0; luiReduced < mauiReduced.size(); ++luiReduced ){
+		unsigned luiIndex = mauiReduced[luiReduced];
+		unsigned luiRate = maClasses[maucClass[luiIndex]].muiReducedRate;
+		// Every body has its turn, spread by its index
+		if ( luiRate <= 1 || ( muiTick + luiIndex ) % luiRate == 0 ){
+			CatchUp( luiIndex );
+			continue;
+		}
+		btRigidBody* lpBody = mapBodies[luiIndex];
+		int liState = lpBody->getActivationState();
+		if ( liState != ACTIVE_TAG && liState != WANTS_DEACTIVATION ) continue;
+		// A sleeping body is not integrated nor collided with other sleeping ones. Bullet
+		// clears its velocities at the end of the step, they are given back after it
+		mauiHeld.push_back( luiIndex );
+		maHeldLinear.push_back( lpBody->getLinearVelocity() );
+		maHeldAngular.push_back( lpBody->getAngularVelocity() );
+		maiHeldState.push_back( liState );
+		lpBody->forceActivationState( ISLAND_SLEEPING );
+	}
+	muiHeld = mauiHeld.size();
+}
+
+void cPhysicsLod::ReleaseHeld( float lfStep ){
+	for ( unsigned luiHeld = 0; luiHeld < mauiHeld.size(); ++luiHeld ){
+		unsigned luiIndex = mauiHeld[luiHeld];
+		btRigidBody* lpBody = mapBodies[luiIndex];
+		// Woken by the islands when an awake body touched it, it has been stepped
+		if ( lpBody->getActivationState() != ISLAND_SLEEPING ) continue;
+		lpBody->forceActivationState( maiHeldState[luiHeld] );
+		lpBody->setLinearVelocity( maHeldLinear[luiHeld] );
+		lpBody->setAngularVelocity( maHeldAngular[luiHeld] );
+		mafHeldTime[luiIndex] += lfStep;
+	}
+	mauiHeld.clear();
+	maHeldLinear.resize( 0 );
+	maHeldAngular.resize( 0 );
+	maiHeldState.clear();
+}
+
+void cPhysicsLod::CatchUp( unsigned luiIndex ){
+	float lfTime = mafHeldTime[luiIndex];
+	if ( lfTime <= 0.0f ) return;
+	mafHeldTime[luiIndex] = 0.0f;
+	btRigidBody* lpBody = mapBodies[luiIndex];
+	if ( !lpBody->isActive() ) return;
+	// Integrated like an unconstrained step, the next fixed step solves the contacts of the
+	// new place. Without contacts the jump must not go through anything: it is cut to the CCD
+	// motion threshold (half the body without CCD) and the rest of the held time is dropped,
+	// the far body only lags a little
+	btScalar lfMaxMotion = lpBody->getCcdMotionThreshold();
+	if ( lfMaxMotion <= 0.0f ){
+		btVector3 lCenter;
+		lpBody->getCollisionShape()->getBoundingSphere( lCenter, lfMaxMotion );
+		lfMaxMotion *= 0.5f;
+	}
+	// Fastest speed of the jump, the gravity keeps pulling while it was held
+	btScalar lfSpeed = lpBody->getLinearVelocity().length() + lpBody->getGravity().length() * lfTime;
+	if ( lfSpeed * lfTime > lfMaxMotion ) lfTime = lfMaxMotion / lfSpeed;
+	btTransform lTransform;
+	lpBody->applyDamping( lfTime );
+	lpBody->predictIntegratedTransform( lfTime, lTransform );
+	lpBody->setCenterOfMassTransform( lTransform );
+	lpBody->setLinearVelocity( lpBody->getLinearVelocity() + lpBody->getGravity() * lfTime );
+}
@@ -0,0 +1,121 @@
+#ifndef cPhysicsLod_H
+#define cPhysicsLod_H
+
+// Level of detail of the simulation. The bodies added to it are classified every frame by
+// their distance to the viewer (the active camera or the vehicle of the player):
+// - Full: stepped every fixed step
+// - Reduced: stepped one fixed step of every muiReducedRate, they are held asleep in the
+//   others and move the held time on their turn. A held body touched by an awake one is
+//   stepped anyway
+// - Frozen: out of the world and of its broadphase, with their velocities, until the
+//   viewer comes back
+// Every class of object has its own radii and sleep thresholds
+
+#include <vector>
+#include "..\Utility\Singleton.h"
+#include "..\MathLib\MathLib.h"
+#include "..\Libraries\Bullet\include\btBulletDynamicsCommon.h"
+
+enum ePhysicsLodClass{
+	ePhysicsLodClass_Prop = 0,		// Crates, barrels, fences
+	ePhysicsLodClass_Debris,		// Small pieces, they sleep and freeze soon
+	ePhysicsLodClass_Vehicle,		// Chassis of the vehicles, awake near the viewer
+	ePhysicsLodClass_Count
+};
+
+enum ePhysicsLodLevel{
+	ePhysicsLodLevel_Full = 0,
+	ePhysicsLodLevel_Reduced,
+	ePhysicsLodLevel_Frozen
+};
+
+struct sPhysicsLodClass{
+	float mfReducedRadius;		// Beyond it the bodies are stepped at the reduced rate
+	float mfFrozenRadius;		// Beyond it they are frozen
+	unsigned muiReducedRate;	// Fixed steps per simulated step of the reduced bodies
+	float mfLinearSleep;		// Sleep thresholds of bullet
+	float mfAngularSleep;
+	bool mbAwakeNear;			// Never sleeps at full detail (the controls don't wake the vehicles)
+};
+
+// Counters of the last frame
+struct sPhysicsLodStats{
+	unsigned muiBodies;
+	unsigned muiFull;
+	unsigned muiReduced;
+	unsigned muiFrozen;
+	unsigned muiSleeping;		// Asleep by bullet, frozen ones not included
+	unsigned muiHeld;			// Held asleep by the reduced rate in the last fixed step
+	unsigned muiFreezes;		// Bodies frozen and thawed in the last frame
+	unsigned muiThaws;
+};
+
+class cPhysicsLod : public cSingleton<cPhysicsLod>{
+public:
+	static void GetDefaultClass( ePhysicsLodClass leClass, sPhysicsLodClass& lClass );
+	// Hooks the fixed steps of cPhysics, after its Init
+	void Init( );
+	// Thaws every body, before the Deinit of cPhysics
+	void Deinit( );
+
+	// Main thread. Bodies of cPhysics::GetNewBody, static and kinematic ones are not taken.
+	// A body must leave the lod before cPhysics::RemoveBody
+	void AddBody( btRigidBody* lpBody, ePhysicsLodClass leClass );
+	void RemoveBody( btRigidBody* lpBody );
+	// Radii and thresholds of a class, the bodies of the class take the thresholds now
+	void SetClass( ePhysicsLodClass leClass, const sPhysicsLodClass& lClass );
+	inline const sPhysicsLodClass& GetClass( ePhysicsLodClass leClass ) const { return maClasses[leClass]; }
+
+	// Every frame, before cPhysics::Update
+	inline void SetViewer( const cVec3& lPosition ) { mViewer = lPosition; }
+	inline const sPhysicsLodStats& GetStats( ) const { return mStats; }
+	ePhysicsLodLevel GetLevel( const btRigidBody* lpBody ) const;
+
+	friend class cSingleton<cPhysicsLod>;
+
+private:
+	cPhysicsLod( );
+	int Find( const btRigidBody* lpBody ) const;
+	// Main thread while the world is idle: levels, freezes and counters
+	static void SyncLod( void* lpData );
+	void Classify( );
+	void SetLevel( unsigned luiIndex, ePhysicsLodLevel leLevel );
+	void Freeze( unsigned luiIndex );
+	void Thaw( unsigned luiIndex );
+	// Physics thread, around every fixed step
+	static void PreStep( float lfStep, void* lpData );
+	static void PostStep( float lfStep, void* lpData );
+	void HoldReduced( );
+	void ReleaseHeld( float lfStep );
+	// Moves a body the time it was held, free of contacts, no farther than its CCD motion
+	// threshold
+	void CatchUp( unsigned luiIndex );
+
+	sPhysicsLodClass maClasses[ePhysicsLodClass_Count];
+
+	// Bodies, the last one fills the place of a removed one
+	std::vector<btRigidBody*> mapBodies;
+	std::vector<unsigned char> maucClass;
+	std::vector<unsigned char> maucLevel;
+	// Collision filter of the frozen bodies, to enter the broadphase again
+	std::vector<short> masGroup;
+	std::vector<short> masMask;
+	// Time held since the last turn of every body
+	std::vector<float> mafHeldTime;
+
+	// Reduced bodies of the frame, the physics thread holds them by turns
+	std::vector<unsigned> mauiReduced;
+	// Held in the fixed step in flight, by index, with the state to give back
+	std::vector<unsigned> mauiHeld;
+	btAlignedObjectArray<btVector3> maHeldLinear;
+	btAlignedObjectArray<btVector3> maHeldAngular;
+	std::vector<int> maiHeldState;
+	unsigned muiTick;
+	unsigned muiHeld;
+
+	cVec3 mViewer;
+	sPhysicsLodStats mStats;
+	bool mbInit;
+};
+
+#endif
@@ -0,0 +1,102 @@
+#ifndef cPhysicsPool_H
+#define cPhysicsPool_H
+
+// Pool of objects of one type for the physics. The memory comes in pages of luiPageSize
+// objects aligned to 16 bytes (bullet types), the freed objects are kept in a free list and
+// the pages are only given back by Clear, so spawning and removing bodies doesn't reach the
+// allocator once the pool is warm. Main thread only
+
+#include <vector>
+#include <assert.h>
+#include "..\Libraries\Bullet\include\LinearMath\btAlignedAllocator.h"
+
+// Usage counters of a pool
+struct sPhysicsPoolStats{
+	unsigned muiUsed;			// Objects alive
+	unsigned muiCapacity;		// Objects that fit in the pages
+	unsigned muiPeak;			// Max objects alive at once
+	unsigned muiPages;
+	unsigned muiPageAllocs;		// Pages allocated after the last Reserve, the pool was too cold
+};
+
+template<typename T> class cPhysicsPool{
+public:
+	cPhysicsPool( unsigned luiPageSize = 64 ){
+		muiPageSize = luiPageSize;
+		// Every object must keep the free list link and the alignment of the bullet types
+		muiStride = ( ( sizeof( T ) > sizeof( void* ) ? sizeof( T ) : sizeof( void* ) ) + 15 ) & ~15;
+		mpFree = NULL;
+		muiUsed = muiPeak = muiPageAllocs = 0;
+	}
+	~cPhysicsPool( ) { Clear(); }
+
+	// Memory for one object, it is built with placement new
+	void* Alloc( ){
+		if ( !mpFree ){
+			AddPage();
+			++muiPageAllocs;
+		}
+		void* lpObject = mpFree;
+		mpFree = *(void**)mpFree;
+		if ( ++muiUsed > muiPeak ) muiPeak = muiUsed;
+		return lpObject;
+	}
+	void Free( void* lpObject ){
+		assert( lpObject && muiUsed > 0 );
+		*(void**)lpObject = mpFree;
+		mpFree = lpObject;
+		--muiUsed;
+	}
+	// Destroys an object of the pool and keeps its memory
+	void Delete( T* lpObject ){
+		lpObject->~T();
+		Free( lpObject );
+	}
+
+	// Pre-warm: pages for luiCount objects alive at once, for the level load
+	void Reserve( unsigned luiCount ){
+		while ( mapPages.size() * muiPageSize < luiCount ) AddPage();
+		muiPageAllocs = 0;
+	}
+	// Gives the pages back, every object must be freed before
+	void Clear( ){
+		assert( muiUsed == 0 );
+		for ( unsigned luiPage = 0; luiPage < mapPages.size(); ++luiPage ){
+			btAlignedFree( mapPages[luiPage] );
+		}
+		mapPages.clear();
+		mpFree = NULL;
+		muiUsed = muiPeak = muiPageAllocs = 0;
+	}
+
+	void GetStats( sPhysicsPoolStats& lStats ) const{
+		lStats.muiUsed = muiUsed;
+		lStats.muiCapacity = mapPages.size() * muiPageSize;
+		lStats.muiPeak = muiPeak;
+		lStats.muiPages = mapPages.size();
+		lStats.muiPageAllocs = muiPageAllocs;
+	}
+	inline unsigned GetUsed( ) const { return muiUsed; }
+
+private:
+	void AddPage( ){
+		char* lpPage = (char*)btAlignedAlloc( muiStride * muiPageSize, 16 );
+		mapPages.push_back( lpPage );
+		// The objects of the page go to the free list in order
+		for ( unsigned luiIndex = muiPageSize; luiIndex > 0; --luiIndex ){
+			void* lpObject = lpPage + ( luiIndex - 1 ) * muiStride;
+			*(void**)lpObject = mpFree;
+			mpFree = lpObject;
+		}
+	}
+
+	std::vector<void*> mapPages;
+	void* mpFree;
+	unsigned muiPageSize;
+	unsigned muiStride;
+	unsigned muiUsed;
+	unsigned muiPeak;
+	unsigned muiPageAllocs;
+};
+
+#endif
@@ -0,0 +1,335 @@
+#include "cPhysicsQuery.h"
+#include "cPhysics.h"
+#include "..\Utility\ThreadPool.h"
+#include "..\Libraries\Bullet\include\BulletCollision\NarrowPhaseCollision\btGjkPairDetector.h"
+#include "..\Libraries\Bullet\include\BulletCollision\NarrowPhaseCollision\btGjkEpaPenetrationDepthSolver.h"
+#include "..\Libraries\Bullet\include\BulletCollision\NarrowPhaseCollision\btPointCollector.h"
+#include "..\Libraries\Bullet\include\BulletCollision\NarrowPhaseCollision\btVoronoiSimplexSolver.h"
+#include "..\Libraries\Bullet\include\BulletCollision\CollisionShapes\btTriangleShape.h"
+#include <assert.h>
+
+// Queries run by every job of the pool
+static const unsigned kuiQueryChunk = 16;
+
+// The bullet queries used by the workers must not reach BT_PROFILE, the profiler is not
+// thread safe. btCollisionWorld::rayTest doesn't, the sweeps and the compounds are done here
+
+// Closest ray hit that skips one object and, with the terrain fast path, the terrain tiles
+struct sQueryRayCallback : public btCollisionWorld::ClosestRayResultCallback{
+	sQueryRayCallback( const btVector3& lFrom, const btVector3& lTo, const btCollisionObject* lpIgnored, bool lbSkipTerrain, bool lbAnyHit )
+		: btCollisionWorld::ClosestRayResultCallback( lFrom, lTo ), mpIgnored( lpIgnored ), mbSkipTerrain( lbSkipTerrain ), mbAnyHit( lbAnyHit ) { ; }
+
+	virtual bool needsCollision( btBroadphaseProxy* lpProxy ) const{
+		if ( mbAnyHit && hasHit() ) return false;
+		const btCollisionObject* lpObject = (const btCollisionObject*)lpProxy->m_clientObject;
+		if ( lpObject == mpIgnored ) return false;
+		if ( mbSkipTerrain && lpObject->getCollisionShape()->getShapeType() == TERRAIN_SHAPE_PROXYTYPE ) return false;
+		return btCollisionWorld::ClosestRayResultCallback::needsCollision( lpProxy );
+	}
+
+	const btCollisionObject* mpIgnored;
+	bool mbSkipTerrain;
+	bool mbAnyHit;
+};
+
+// Sweep of a convex shape against one shape of an object, the children of the compounds
+// one by one
+static void SweepShape( const btConvexShape* lpCast, const btTransform& lFrom, const btTransform& lTo, btCollisionObject* lpObject,
+						const btCollisionShape* lpShape, const btTransform& lTransform, btCollisionWorld::ConvexResultCallback& lResult ){
+	if ( lpShape->isCompound() ){
+		const btCompoundShape* lpCompound = (const btCompoundShape*)lpShape;
+		for ( int liChild = 0; liChild < lpCompound->getNumChildShapes(); ++liChild ){
+			SweepShape( lpCast, lFrom, lTo, lpObject, lpCompound->getChildShape( liChild ), lTransform * lpCompound->getChildTransform( liChild ), lResult );
+		}
+		return;
+	}
+	btCollisionWorld::objectQuerySingle( lpCast, lFrom, lTo, lpObject, lpShape, lTransform, lResult, 0.0f );
+}
+
+// Objects of the broadphase whose box is crossed by the swept box of the sphere
+struct sQuerySweepCallback : public btBroadphaseRayCallback{
+	sQuerySweepCallback( const btConvexShape* lpCast, const btTransform& lFrom, const btTransform& lTo, const btCollisionObject* lpIgnored,
+						 bool lbAnyHit, btCollisionWorld::ConvexResultCallback& lResult )
+		: mpCast( lpCast ), mFrom( lFrom ), mTo( lTo ), mpIgnored( lpIgnored ), mbAnyHit( lbAnyHit ), mResult( lResult ){
+		// Same setup as btCollisionWorld::convexSweepTest, a sweep without length goes along x
+		btVector3 lDelta = mTo.getOrigin() - mFrom.getOrigin();
+		btVector3 lDirection = ( lDelta.length2() > SIMD_EPSILON ) ? lDelta.normalized() : btVector3( 1, 0, 0 );
+		m_rayDirectionInverse[0] = ( lDirection[0] == btScalar( 0.0 ) ) ? btScalar( BT_LARGE_FLOAT ) : btScalar( 1.0 ) / lDirection[0];
+		m_rayDirectionInverse[1] = ( lDirection[1] == btScalar( 0.0 ) ) ? btScalar( BT_LARGE_FLOAT ) : btScalar( 1.0 ) / lDirection[1];
+		m_rayDirectionInverse[2] = ( lDirection[2] == btScalar( 0.0 ) ) ? btScalar( BT_LARGE_FLOAT ) : btScalar( 1.0 ) / lDirection[2];
+		m_signs[0] = m_rayDirectionInverse[0] < 0.0;
+		m_signs[1] = m_rayDirectionInverse[1] < 0.0;
+		m_signs[2] = m_rayDirectionInverse[2] < 0.0;
+		m_lambda_max = lDirection.dot( lDelta );
+	}
+
+	virtual bool process( const btBroadphaseProxy* lpProxy ){
+		if ( mResult.m_closestHitFraction == btScalar( 0.0f ) || ( mbAnyHit && mResult.hasHit() ) ) return false;
+		btCollisionObject* lpObject = (btCollisionObject*)lpProxy->m_clientObject;
+		if ( lpObject != mpIgnored && mResult.needsCollision( lpObject->getBroadphaseHandle() ) ){
+			SweepShape( mpCast, mFrom, mTo, lpObject, lpObject->getCollisionShape(), lpObject->getWorldTransform(), mResult );
+		}
+		return true;
+	}
+
+	const btConvexShape* mpCast;
+	btTransform mFrom;
+	btTransform mTo;
+	const btCollisionObject* mpIgnored;
+	bool mbAnyHit;
+	btCollisionWorld::ConvexResultCallback& mResult;
+};
+
+// True if two convex shapes touch
+static bool ConvexOverlap( const btConvexShape* lpA, const btTransform& lA, const btConvexShape* lpB, const btTransform& lB ){
+	btVoronoiSimplexSolver lSimplex;
+	btGjkEpaPenetrationDepthSolver lPenetration;
+	btGjkPairDetector lDetector( lpA, lpB, &lSimplex, &lPenetration );
+	btGjkPairDetector::ClosestPointInput lInput;
+	lInput.m_transformA = lA;
+	lInput.m_transformB = lB;
+	btPointCollector lOutput;
+	lDetector.getClosestPoints( lInput, lOutput, NULL );
+	return lOutput.m_hasResult && lOutput.m_distance <= btScalar( 0.0f );
+}
+
+// Triangles of a concave shape near the sphere, until one of them touches it
+struct sQueryTriangleCallback : public btTriangleCallback{
+	sQueryTriangleCallback( const btSphereShape* lpSphere, const btTransform& lSphereTransform )
+		: mpSphere( lpSphere ), mSphereTransform( lSphereTransform ), mbHit( false ) { ; }
+
+	virtual void processTriangle( btVector3* lpTriangle, int liPart, int liIndex ){
+		if ( mbHit ) return;
+		btTriangleShape lTriangle( lpTriangle[0], lpTriangle[1], lpTriangle[2] );
+		mbHit = ConvexOverlap( mpSphere, mSphereTransform, &lTriangle, btTransform::getIdentity() );
+	}
+
+	const btSphereShape* mpSphere;
+	btTransform mSphereTransform;
+	bool mbHit;
+};
+
+// True if the sphere touches a shape of an object
+static bool OverlapShape( const btSphereShape* lpSphere, const btVector3& lCentre, const btCollisionShape* lpShape, const btTransform& lTransform ){
+	if ( lpShape->isCompound() ){
+		const btCompoundShape* lpCompound = (const btCompoundShape*)lpShape;
+		for ( int liChild = 0; liChild < lpCompound->getNumChildShapes(); ++liChild ){
+			if ( OverlapShape( lpSphere, lCentre, lpCompound->getChildShape( liChild ), lTransform * lpCompound->getChildTransform( liChild ) ) ) return true;
+		}
+		return false;
+	}
+	btTransform lSphereTransform;
+	lSphereTransform.setIdentity();
+	lSphereTransform.setOrigin( lCentre );
+	if ( lpShape->isConvex() ){
+		return ConvexOverlap( lpSphere, lSphereTransform, (const btConvexShape*)lpShape, lTransform );
+	}
+	if ( lpShape->isConcave() ){
+		// The triangles come in the space of the shape
+		btTransform lLocalSphere = lTransform.inverse() * lSphereTransform;
+		btVector3 lExtent( lpSphere->getRadius(), lpSphere->getRadius(), lpSphere->getRadius() );
+		sQueryTriangleCallback lCallback( lpSphere, lLocalSphere );
+		( (const btConcaveShape*)lpShape )->processAllTriangles( &lCallback, lLocalSphere.getOrigin() - lExtent, lLocalSphere.getOrigin() + lExtent );
+		return lCallback.mbHit;
+	}
+	return false;
+}
+
+// Objects of the broadphase whose box touches the box of the sphere
+struct sQueryOverlapCallback : public btBroadphaseAabbCallback{
+	sQueryOverlapCallback( const btSphereShape* lpSphere, const btVector3& lCentre, const btCollisionObject* lpIgnored, const btCollisionObject** lapOverlaps, unsigned luiMaxOverlaps )
+		: mpSphere( lpSphere ), mCentre( lCentre ), mpIgnored( lpIgnored ), mapOverlaps( lapOverlaps ), muiMaxOverlaps( luiMaxOverlaps ), muiCount( 0 ) { ; }
+
+	virtual bool process( const btBroadphaseProxy* lpProxy ){
+		const btCollisionObject* lpObject = (const btCollisionObject*)lpProxy->m_clientObject;
+		if ( lpObject == mpIgnored ) return true;
+		if ( OverlapShape( mpSphere, mCentre, lpObject->getCollisionShape(), lpObject->getWorldTransform() ) ){
+			if ( muiCount < muiMaxOverlaps ) mapOverlaps[muiCount] = lpObject;
+			++muiCount;
+		}
+		return true;
+	}
+
+	const btSphereShape* mpSphere;
+	btVector3 mCentre;
+	const btCollisionObject* mpIgnored;
+	const btCollisionObject** mapOverlaps;
+	unsigned muiMaxOverlaps;
+	unsigned muiCount;
+};
+
+cPhysicsQueryBatch::cPhysicsQueryBatch( ){
+	meType = ePhysicsQuery_Ray;
+	muiFlags = ePhysicsQuery_Objects;
+	muiMaxOverlaps = 8;
+	mpWorld = NULL;
+	mpHeightfield = NULL;
+}
+
+void cPhysicsQueryBatch::Init( ePhysicsQueryType leType, unsigned luiFlags, unsigned luiMaxOverlaps ){
+	meType = leType;
+	muiFlags = luiFlags;
+	muiMaxOverlaps = luiMaxOverlaps;
+	Clear();
+}
+
+void cPhysicsQueryBatch::Clear( ){
+	mafFromX.clear();
+	mafFromY.clear();
+	mafFromZ.clear();
+	mafToX.clear();
+	mafToY.clear();
+	mafToZ.clear();
+	mafRadius.clear();
+	mapIgnored.clear();
+}
+
+unsigned cPhysicsQueryBatch::AddRay( const cVec3& lFrom, const cVec3& lTo, const btCollisionObject* lpIgnored ){
+	assert( meType == ePhysicsQuery_Ray );
+	mafFromX.push_back( lFrom.x );
+	mafFromY.push_back( lFrom.y );
+	mafFromZ.push_back( lFrom.z );
+	mafToX.push_back( lTo.x );
+	mafToY.push_back( lTo.y );
+	mafToZ.push_back( lTo.z );
+	mafRadius.push_back( 0.0f );
+	mapIgnored.push_back( lpIgnored );
+	return mafFromX.size() - 1;
+}
+
+unsigned cPhysicsQueryBatch::AddSweep( const cVec3& lFrom, const cVec3& lTo, float lfRadius, const btCollisionObject* lpIgnored ){
+	assert( meType == ePhysicsQuery_Sweep && lfRadius > 0.0f );
+	mafFromX.push_back( lFrom.x );
+	mafFromY.push_back( lFrom.y );
+	mafFromZ.push_back( lFrom.z );
+	mafToX.push_back( lTo.x );
+	mafToY.push_back( lTo.y );
+	mafToZ.push_back( lTo.z );
+	mafRadius.push_back( lfRadius );
+	mapIgnored.push_back( lpIgnored );
+	return mafFromX.size() - 1;
+}
+
+unsigned cPhysicsQueryBatch::AddOverlap( const cVec3& lCentre, float lfRadius, const btCollisionObject* lpIgnored ){
+	assert( meType == ePhysicsQuery_Overlap && lfRadius > 0.0f );
+	mafFromX.push_back( lCentre.x );
+	mafFromY.push_back( lCentre.y );
+	mafFromZ.push_back( lCentre.z );
+	mafToX.push_back( lCentre.x );
+	mafToY.push_back( lCentre.y );
+	mafToZ.push_back( lCentre.z );
+	mafRadius.push_back( lfRadius );
+	mapIgnored.push_back( lpIgnored );
+	return mafFromX.size() - 1;
+}
+
+void cPhysicsQueryBatch::Run( ){
+	unsigned luiCount = GetCount();
+	maucHit.assign( luiCount, ePhysicsHit_None );
+	mafFraction.assign( luiCount, 1.0f );
+	mafPointX.resize( luiCount );
+	mafPointY.resize( luiCount );
+	mafPointZ.resize( luiCount );
+	mafNormalX.resize( luiCount );
+	mafNormalY.resize( luiCount );
+	mafNormalZ.resize( luiCount );
+	mapObjects.assign( luiCount, (const btCollisionObject*)NULL );
+	if ( meType == ePhysicsQuery_Overlap ){
+		mauiOverlapCount.assign( luiCount, 0 );
+		mapOverlaps.assign( luiCount * muiMaxOverlaps, (const btCollisionObject*)NULL );
+	}
+	if ( luiCount == 0 ) return;
+
+	mpWorld = ( muiFlags & ePhysicsQuery_Objects ) ? cPhysics::Get().GetBulletWorld() : NULL;
+	mpHeightfield = ( muiFlags & ePhysicsQuery_Terrain ) ? cPhysics::Get().GetHeightfield() : NULL;
+	cThreadPool::Get().ParallelFor( ( luiCount + kuiQueryChunk - 1 ) / kuiQueryChunk, QueryJob, this );
+	mpWorld = NULL;
+	mpHeightfield = NULL;
+}
+
+void cPhysicsQueryBatch::QueryJob( unsigned luiChunk, void * lpData ){
+	cPhysicsQueryBatch* lpBatch = (cPhysicsQueryBatch*)lpData;
+	unsigned luiEnd = ( luiChunk + 1 ) * kuiQueryChunk;
+	if ( luiEnd > lpBatch->GetCount() ) luiEnd = lpBatch->GetCount();
+	for ( unsigned luiQuery = luiChunk * kuiQueryChunk; luiQuery < luiEnd; ++luiQuery ){
+		switch ( lpBatch->meType ){
+			case ePhysicsQuery_Ray: lpBatch->RunRay( luiQuery ); break;
+			case ePhysicsQuery_Sweep: lpBatch->RunSweep( luiQuery ); break;
+			case ePhysicsQuery_Overlap: lpBatch->RunOverlap( luiQuery ); break;
+		}
+	}
+}
+
+void cPhysicsQueryBatch::SetHit( unsigned luiQuery, ePhysicsHit leHit, float lfFraction, const btVector3& lPoint, const btVector3& lNormal, const btCollisionObject* lpObject ){
+	maucHit[luiQuery] = (unsigned char)leHit;
+	mafFraction[luiQuery] = lfFraction;
+	mafPointX[luiQuery] = lPoint.x();
+	mafPointY[luiQuery] = lPoint.y();
+	mafPointZ[luiQuery] = lPoint.z();
+	mafNormalX[luiQuery] = lNormal.x();
+	mafNormalY[luiQuery] = lNormal.y();
+	mafNormalZ[luiQuery] = lNormal.z();
+	mapObjects[luiQuery] = lpObject;
+}
+
+void cPhysicsQueryBatch::RunRay( unsigned luiQuery ){
+	btVector3 lFrom( mafFromX[luiQuery], mafFromY[luiQuery], mafFromZ[luiQuery] );
+	btVector3 lTo( mafToX[luiQuery], mafToY[luiQuery], mafToZ[luiQuery] );
+	bool lbAnyHit = ( muiFlags & ePhysicsQuery_AnyHit ) != 0;
+
+	// The terrain first, the objects are only looked for in front of it
+	float lfLength = 1.0f;
+	if ( mpHeightfield ){
+		float lfFraction;
+		cVec3 lNormal;
+		if ( mpHeightfield->RayCast( cPhysics::Bullet2Local( lFrom ), cPhysics::Bullet2Local( lTo ), lfFraction, lNormal ) ){
+			SetHit( luiQuery, ePhysicsHit_Terrain, lfFraction, lFrom.lerp( lTo, lfFraction ), cPhysics::Local2Bullet( lNormal ), NULL );
+			if ( lbAnyHit ) return;
+			lfLength = lfFraction;
+		}
+	}
+	if ( !mpWorld || lfLength <= 0.0f ) return;
+
+	btVector3 lEnd = lFrom.lerp( lTo, lfLength );
+	sQueryRayCallback lCallback( lFrom, lEnd, mapIgnored[luiQuery], mpHeightfield != NULL, lbAnyHit );
+	mpWorld->rayTest( lFrom, lEnd, lCallback );
+	if ( lCallback.hasHit() ){
+		SetHit( luiQuery, ePhysicsHit_Object, lCallback.m_closestHitFraction * lfLength, lCallback.m_hitPointWorld,
+				lCallback.m_hitNormalWorld, lCallback.m_collisionObject );
+	}
+}
+
+void cPhysicsQueryBatch::RunSweep( unsigned luiQuery ){
+	if ( !mpWorld ) return;
+	btTransform lFrom, lTo;
+	lFrom.setIdentity();
+	lTo.setIdentity();
+	lFrom.setOrigin( btVector3( mafFromX[luiQuery], mafFromY[luiQuery], mafFromZ[luiQuery] ) );
+	lTo.setOrigin( btVector3( mafToX[luiQuery], mafToY[luiQuery], mafToZ[luiQuery] ) );
+
+	btSphereShape lSphere( mafRadius[luiQuery] );
+	btVector3 lExtent( mafRadius[luiQuery], mafRadius[luiQuery], mafRadius[luiQuery] );
+	btCollisionWorld::ClosestConvexResultCallback lResult( lFrom.getOrigin(), lTo.getOrigin() );
+	sQuerySweepCallback lCallback( &lSphere, lFrom, lTo, mapIgnored[luiQuery], ( muiFlags & ePhysicsQuery_AnyHit ) != 0, lResult );
+	mpWorld->getBroadphase()->rayTest( lFrom.getOrigin(), lTo.getOrigin(), lCallback, -lExtent, lExtent );
+	if ( lResult.hasHit() ){
+		SetHit( luiQuery, ePhysicsHit_Object, lResult.m_closestHitFraction, lResult.m_hitPointWorld,
+				lResult.m_hitNormalWorld, lResult.m_hitCollisionObject );
+	}
+}
+
+void cPhysicsQueryBatch::RunOverlap( unsigned luiQuery ){
+	if ( !mpWorld ) return;
+	btVector3 lCentre( mafFromX[luiQuery], mafFromY[luiQuery], mafFromZ[luiQuery] );
+	btVector3 lExtent( mafRadius[luiQuery], mafRadius[luiQuery], mafRadius[luiQuery] );
+	btSphereShape lSphere( mafRadius[luiQuery] );
+	const btCollisionObject** lapOverlaps = muiMaxOverlaps ? &mapOverlaps[luiQuery * muiMaxOverlaps] : NULL;
+	sQueryOverlapCallback lCallback( &lSphere, lCentre, mapIgnored[luiQuery], lapOverlaps, muiMaxOverlaps );
+	mpWorld->getBroadphase()->aabbTest( lCentre - lExtent, lCentre + lExtent, lCallback );
+	mauiOverlapCount[luiQuery] = lCallback.muiCount;
+	if ( lCallback.muiCount > 0 ){
+		maucHit[luiQuery] = ePhysicsHit_Object;
+		mafFraction[luiQuery] = 0.0f;
+		mapObjects[luiQuery] = lapOverlaps ? lapOverlaps[0] : NULL;
+	}
+}
@@ -0,0 +1,106 @@
+#ifndef cPhysicsQuery_H
+#define cPhysicsQuery_H
+
+// Batched scene queries over the Bullet world: rays, sphere sweeps and sphere overlaps.
+// The queries of a batch are added first and run together, split between the threads of
+// the pool. The inputs and the results are kept in SoA arrays, one entry per query.
+// The rays can test the terrain heightfield directly instead of its bullet tiles
+
+#include <vector>
+#include "..\MathLib\MathLib.h"
+#include "..\Libraries\Bullet\include\btBulletCollisionCommon.h"
+
+class cPhysicsHeightfield;
+
+enum ePhysicsQueryType{
+	ePhysicsQuery_Ray = 0,
+	ePhysicsQuery_Sweep,
+	ePhysicsQuery_Overlap
+};
+
+// Options of a batch, they can be combined
+enum ePhysicsQueryFlags{
+	ePhysicsQuery_Objects = 1,		// Bodies of the world, through the broadphase
+	ePhysicsQuery_Terrain = 2,		// Rays: heightfield of cPhysics, its bullet tiles are skipped
+	ePhysicsQuery_AnyHit = 4		// Rays and sweeps: any hit is enough (visibility), not the closest
+};
+
+enum ePhysicsHit{
+	ePhysicsHit_None = 0,
+	ePhysicsHit_Object,
+	ePhysicsHit_Terrain
+};
+
+class cPhysicsQueryBatch{
+public:
+	cPhysicsQueryBatch();
+
+	// The overlaps keep up to luiMaxOverlaps objects each, the count has all of them
+	void Init( ePhysicsQueryType leType, unsigned luiFlags = ePhysicsQuery_Objects, unsigned luiMaxOverlaps = 8 );
+	// Removes the queries and keeps the memory for the next frame
+	void Clear( );
+
+	// Add a query and return its index. The queries of a batch are of its type
+	unsigned AddRay( const cVec3& lFrom, const cVec3& lTo, const btCollisionObject* lpIgnored = NULL );
+	unsigned AddSweep( const cVec3& lFrom, const cVec3& lTo, float lfRadius, const btCollisionObject* lpIgnored = NULL );
+	unsigned AddOverlap( const cVec3& lCentre, float lfRadius, const btCollisionObject* lpIgnored = NULL );
+
+	// Runs every query. It waits for the step in flight, the world can't change meanwhile
+	void Run( );
+
+	inline unsigned GetCount( ) const { return mafFromX.size(); }
+	// Results of rays and sweeps
+	inline ePhysicsHit GetHit( unsigned luiQuery ) const { return (ePhysicsHit)maucHit[luiQuery]; }
+	inline bool IsHit( unsigned luiQuery ) const { return maucHit[luiQuery] != ePhysicsHit_None; }
+	inline float GetFraction( unsigned luiQuery ) const { return mafFraction[luiQuery]; }
+	inline cVec3 GetPoint( unsigned luiQuery ) const { return cVec3( mafPointX[luiQuery], mafPointY[luiQuery], mafPointZ[luiQuery] ); }
+	inline cVec3 GetNormal( unsigned luiQuery ) const { return cVec3( mafNormalX[luiQuery], mafNormalY[luiQuery], mafNormalZ[luiQuery] ); }
+	// NULL for the terrain
+	inline const btCollisionObject* GetObject( unsigned luiQuery ) const { return mapObjects[luiQuery]; }
+	// Results of overlaps
+	inline unsigned GetOverlapCount( unsigned luiQuery ) const { return mauiOverlapCount[luiQuery]; }
+	inline const btCollisionObject* GetOverlap( unsigned luiQuery, unsigned luiIndex ) const { return mapOverlaps[luiQuery * muiMaxOverlaps + luiIndex]; }
+	// The arrays themselves, for loops over all the results
+	inline const unsigned char* GetHits( ) const { return &maucHit[0]; }
+	inline const float* GetFractions( ) const { return &mafFraction[0]; }
+
+private:
+	static void QueryJob( unsigned luiChunk, void * lpData );
+	void RunRay( unsigned luiQuery );
+	void RunSweep( unsigned luiQuery );
+	void RunOverlap( unsigned luiQuery );
+	void SetHit( unsigned luiQuery, ePhysicsHit leHit, float lfFraction, const btVector3& lPoint, const btVector3& lNormal, const btCollisionObject* lpObject );
+
+	ePhysicsQueryType meType;
+	unsigned muiFlags;
+	unsigned muiMaxOverlaps;
+
+	// Inputs
+	std::vector<float> mafFromX;
+	std::vector<float> mafFromY;
+	std::vector<float> mafFromZ;
+	std::vector<float> mafToX;
+	std::vector<float> mafToY;
+	std::vector<float> mafToZ;
+	std::vector<float> mafRadius;
+	std::vector<const btCollisionObject*> mapIgnored;
+
+	// Results
+	std::vector<unsigned char> maucHit;
+	std::vector<float> mafFraction;
+	std::vector<float> mafPointX;
+	std::vector<float> mafPointY;
+	std::vector<float> mafPointZ;
+	std::vector<float> mafNormalX;
+	std::vector<float> mafNormalY;
+	std::vector<float> mafNormalZ;
+	std::vector<const btCollisionObject*> mapObjects;
+	std::vector<unsigned> mauiOverlapCount;
+	std::vector<const btCollisionObject*> mapOverlaps;
+
+	// While the batch runs
+	btCollisionWorld* mpWorld;
+	const cPhysicsHeightfield* mpHeightfield;
+};
+
+#endif
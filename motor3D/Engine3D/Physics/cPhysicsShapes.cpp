@@ -0,0 +1,254 @@
+#include "cPhysicsShapes.h"
+#include <windows.h>
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include "..\Libraries\Bullet\include\BulletCollision\CollisionShapes\btHeightfieldTerrainShape.h"
+
+btCollisionShape* cPhysicsShapes::GetSphere( float lfRadius ){
+	float lafParams[4] = { lfRadius, 0.0f, 0.0f, 0.0f };
+	return GetShared( ePhysicsShape_Sphere, lafParams );
+}
+
+btCollisionShape* cPhysicsShapes::GetBox( const cVec3& lHalfSize ){
+	float lafParams[4] = { lHalfSize.x, lHalfSize.y, lHalfSize.z, 0.0f };
+	return GetShared( ePhysicsShape_Box, lafParams );
+}
+
+btCollisionShape* cPhysicsShapes::GetCylinderX( const cVec3& lHalfSize ){
+	float lafParams[4] = { lHalfSize.x, lHalfSize.y, lHalfSize.z, 0.0f };
+	return GetShared( ePhysicsShape_CylinderX, lafParams );
+}
+
+btCollisionShape* cPhysicsShapes::GetPlane( const cVec3& lNormal, float lfConstant ){
+	float lafParams[4] = { lNormal.x, lNormal.y, lNormal.z, lfConstant };
+	return GetShared( ePhysicsShape_Plane, lafParams );
+}
+
+btCollisionShape* cPhysicsShapes::GetHulls( const sPhysicsCookedMesh& lMesh ){
+	if ( lMesh.mauiHullSizes.empty() ) return NULL;
+	// Known by the hash of their points and their sizes, two meshes with the same hash are
+	// told apart by their points
+	unsigned lauiKey[4] = { cPhysicsCook::HashMesh( lMesh ), lMesh.mauiHullSizes.size(), lMesh.mafPoints.size(), 0 };
+	float lafParams[4];
+	memcpy( lafParams, lauiKey, sizeof( lafParams ) );
+	for ( unsigned luiIndex = 0; luiIndex < maShapes.size(); ++luiIndex ){
+		sShapeEntry& lEntry = maShapes[luiIndex];
+		if ( lEntry.meType == ePhysicsShape_Hull && memcmp( lEntry.mafParams, lafParams, sizeof( lEntry.mafParams ) ) == 0 &&
+			 HasHulls( lEntry.mpShape, lMesh ) ){
+			++lEntry.muiReferences;
+			return lEntry.mpShape;
+		}
+	}
+
+	sShapeEntry lEntry;
+	lEntry.meType = ePhysicsShape_Hull;
+	memcpy( lEntry.mafParams, lafParams, sizeof( lEntry.mafParams ) );
+	lEntry.muiReferences = 1;
+	lEntry.mpShape = CreateHulls( lMesh );
+	maShapes.push_back( lEntry );
+	return lEntry.mpShape;
+}
+
+btCollisionShape* cPhysicsShapes::CreateHulls( const sPhysicsCookedMesh& lMesh ){
+	btCompoundShape* lpCompound = ( lMesh.mauiHullSizes.size() > 1 ) ? new btCompoundShape() : NULL;
+	btConvexHullShape* lpHull = NULL;
+	unsigned luiFirst = 0;
+	btTransform lIdentity;
+	lIdentity.setIdentity();
+	for ( unsigned luiHull = 0; luiHull < lMesh.mauiHullSizes.size(); ++luiHull ){
+		unsigned luiCount = lMesh.mauiHullSizes[luiHull];
+		lpHull = new btConvexHullShape();
+		for ( unsigned luiPoint = luiFirst; luiPoint < luiFirst + luiCount; ++luiPoint ){
+			const float* lpfPoint = &lMesh.mafPoints[luiPoint * 3];
+			lpHull->addPoint( btVector3( lpfPoint[0], lpfPoint[1], lpfPoint[2] ) );
+		}
+		luiFirst += luiCount;
+		if ( lpCompound ) lpCompound->addChildShape( lIdentity, lpHull );
+	}
+	if ( lpCompound ) return lpCompound;
+	return lpHull;
+}
+
+bool cPhysicsShapes::HasHulls( const btCollisionShape* lpShape, const sPhysicsCookedMesh& lMesh ){
+	const btCompoundShape* lpCompound = lpShape->isCompound() ? (const btCompoundShape*)lpShape : NULL;
+	unsigned luiHulls = lpCompound ? lpCompound->getNumChildShapes() : 1;
+	if ( luiHulls != lMesh.mauiHullSizes.size() ) return false;
+	unsigned luiFirst = 0;
+	for ( unsigned luiHull = 0; luiHull < luiHulls; ++luiHull ){
+		const btConvexHullShape* lpHull = (const btConvexHullShape*)( lpCompound ? lpCompound->getChildShape( luiHull ) : lpShape );
+		unsigned luiCount = lMesh.mauiHullSizes[luiHull];
+		if ( (unsigned)lpHull->getNumPoints() != luiCount ) return false;
+		const btVector3* lpPoints = lpHull->getUnscaledPoints();
+		for ( unsigned luiPoint = 0; luiPoint < luiCount; ++luiPoint ){
+			const float* lpfPoint = &lMesh.mafPoints[( luiFirst + luiPoint ) * 3];
+			if ( lpPoints[luiPoint] != btVector3( lpfPoint[0], lpfPoint[1], lpfPoint[2] ) ) return false;
+		}
+		luiFirst += luiCount;
+	}
+	return true;
+}
+
+btCollisionShape* cPhysicsShapes::GetShared( ePhysicsShapeType leType, const float* lpafParams ){
+	// The parameters are compared bit by bit, the same values always give the same shape
+	for ( unsigned luiIndex = 0; luiIndex < maShapes.size(); ++luiIndex ){
+		sShapeEntry& lEntry = maShapes[luiIndex];
+		if ( lEntry.meType == leType && memcmp( lEntry.mafParams, lpafParams, sizeof( lEntry.mafParams ) ) == 0 ){
+			++lEntry.muiReferences;
+			return lEntry.mpShape;
+		}
+	}
+
+	sShapeEntry lEntry;
+	lEntry.meType = leType;
+	memcpy( lEntry.mafParams, lpafParams, sizeof( lEntry.mafParams ) );
+	lEntry.muiReferences = 1;
+	btVector3 lVector( lpafParams[0], lpafParams[1], lpafParams[2] );
+	switch ( leType ){
+		case ePhysicsShape_Sphere:
+			lEntry.mpShape = new ( mSpheres.Alloc() ) btSphereShape( lpafParams[0] );
+			break;
+		case ePhysicsShape_Box:
+			lEntry.mpShape = new ( mBoxes.Alloc() ) btBoxShape( lVector );
+			break;
+		case ePhysicsShape_CylinderX:
+			lEntry.mpShape = new ( mCylinders.Alloc() ) btCylinderShapeX( lVector );
+			break;
+		case ePhysicsShape_Plane:
+			lEntry.mpShape = new ( mPlanes.Alloc() ) btStaticPlaneShape( lVector, lpafParams[3] );
+			break;
+		default:
+			assert( false );
+			return NULL;
+	}
+	maShapes.push_back( lEntry );
+	return lEntry.mpShape;
+}
+
+void cPhysicsShapes::Register( btCollisionShape* lpShape ){
+	assert( lpShape && Find( lpShape ) < 0 );
+	sShapeEntry lEntry;
+	lEntry.mpShape = lpShape;
+	lEntry.meType = ePhysicsShape_Custom;
+	memset( lEntry.mafParams, 0, sizeof( lEntry.mafParams ) );
+	lEntry.muiReferences = 1;
+	maShapes.push_back( lEntry );
+}
+
+void cPhysicsShapes::AddRef( btCollisionShape* lpShape ){
+	int liIndex = Find( lpShape );
+	assert( liIndex >= 0 );
+	if ( liIndex >= 0 ) ++maShapes[liIndex].muiReferences;
+}
+
+void cPhysicsShapes::Release( btCollisionShape* lpShape ){
+	int liIndex = Find( lpShape );
+	assert( liIndex >= 0 && maShapes[liIndex].muiReferences > 0 );
+	if ( liIndex < 0 ) return;
+	if ( --maShapes[liIndex].muiReferences == 0 ){
+		DeleteShape( maShapes[liIndex] );
+		maShapes[liIndex] = maShapes.back();
+		maShapes.pop_back();
+	}
+}
+
+void cPhysicsShapes::DeleteShape( const sShapeEntry& lEntry ){
+	switch ( lEntry.meType ){
+		case ePhysicsShape_Sphere: mSpheres.Delete( (btSphereShape*)lEntry.mpShape ); break;
+		case ePhysicsShape_Box: mBoxes.Delete( (btBoxShape*)lEntry.mpShape ); break;
+		case ePhysicsShape_CylinderX: mCylinders.Delete( (btCylinderShapeX*)lEntry.mpShape ); break;
+		case ePhysicsShape_Plane: mPlanes.Delete( (btStaticPlaneShape*)lEntry.mpShape ); break;
+		case ePhysicsShape_Hull:
+			// The hulls of a compound are its own
+			if ( lEntry.mpShape->isCompound() ){
+				btCompoundShape* lpCompound = (btCompoundShape*)lEntry.mpShape;
+				for ( int liChild = 0; liChild < lpCompound->getNumChildShapes(); ++liChild ){
+					delete lpCompound->getChildShape( liChild );
+				}
+			}
+			delete lEntry.mpShape;
+			break;
+		default: delete lEntry.mpShape; break;
+	}
+}
+
+bool cPhysicsShapes::IsRegistered( const btCollisionShape* lpShape ) const{
+	return Find( lpShape ) >= 0;
+}
+
+int cPhysicsShapes::Find( const btCollisionShape* lpShape ) const{
+	for ( unsigned luiIndex = 0; luiIndex < maShapes.size(); ++luiIndex ){
+		if ( maShapes[luiIndex].mpShape == lpShape ) return (int)luiIndex;
+	}
+	return -1;
+}
+
+unsigned cPhysicsShapes::GetReferenceCount( ) const{
+	unsigned luiReferences = 0;
+	for ( unsigned luiIndex = 0; luiIndex < maShapes.size(); ++luiIndex ){
+		luiReferences += maShapes[luiIndex].muiReferences;
+	}
+	return luiReferences;
+}
+
+unsigned cPhysicsShapes::GetMemory( ) const{
+	unsigned luiBytes = 0;
+	for ( unsigned luiIndex = 0; luiIndex < maShapes.size(); ++luiIndex ){
+		luiBytes += GetShapeBytes( maShapes[luiIndex].mpShape );
+	}
+	return luiBytes;
+}
+
+unsigned cPhysicsShapes::GetShapeBytes( const btCollisionShape* lpShape ){
+	switch ( lpShape->getShapeType() ){
+		case SPHERE_SHAPE_PROXYTYPE: return sizeof( btSphereShape );
+		case BOX_SHAPE_PROXYTYPE: return sizeof( btBoxShape );
+		case CYLINDER_SHAPE_PROXYTYPE: return sizeof( btCylinderShapeX );
+		case STATIC_PLANE_PROXYTYPE: return sizeof( btStaticPlaneShape );
+		case TERRAIN_SHAPE_PROXYTYPE: return sizeof( btHeightfieldTerrainShape );
+		case CONVEX_HULL_SHAPE_PROXYTYPE:
+			return sizeof( btConvexHullShape ) + ((const btConvexHullShape*)lpShape)->getNumPoints() * sizeof( btVector3 );
+		case COMPOUND_SHAPE_PROXYTYPE:{
+			// The children are other shapes, only the child array counts here
+			const btCompoundShape* lpCompound = (const btCompoundShape*)lpShape;
+			return sizeof( btCompoundShape ) + lpCompound->getNumChildShapes() * sizeof( btCompoundShapeChild );
+		}
+		default: return sizeof( btCollisionShape );
+	}
+}
+
+void cPhysicsShapes::Report( ) const{
+	static const char* lacTypes[] = { "sphere", "box", "cylinder", "plane", "hulls", "custom" };
+	unsigned lauiCount[6] = { 0, 0, 0, 0, 0, 0 };
+	for ( unsigned luiIndex = 0; luiIndex < maShapes.size(); ++luiIndex ){
+		++lauiCount[maShapes[luiIndex].meType];
+	}
+	char lacBuffer[256];
+	sprintf( lacBuffer, "Physics shapes: %u shapes, %u references, %u bytes (", GetShapeCount(), GetReferenceCount(), GetMemory() );
+	OutputDebugString( lacBuffer );
+	for ( unsigned luiType = 0; luiType < 6; ++luiType ){
+		sprintf( lacBuffer, "%s%s %u", ( luiType > 0 ) ? ", " : "", lacTypes[luiType], lauiCount[luiType] );
+		OutputDebugString( lacBuffer );
+	}
+	OutputDebugString( ")\n" );
+}
+
+void cPhysicsShapes::Deinit( ){
+	if ( !maShapes.empty() ){
+		char lacBuffer[128];
+		sprintf( lacBuffer, "Physics shapes: %u shapes still referenced at exit\n", GetShapeCount() );
+		OutputDebugString( lacBuffer );
+	}
+	// The compounds go first, they can reference the other shapes
+	for ( unsigned luiIndex = 0; luiIndex < maShapes.size(); ++luiIndex ){
+		if ( maShapes[luiIndex].mpShape->isCompound() ) DeleteShape( maShapes[luiIndex] );
+	}
+	for ( unsigned luiIndex = 0; luiIndex < maShapes.size(); ++luiIndex ){
+		if ( !maShapes[luiIndex].mpShape->isCompound() ) DeleteShape( maShapes[luiIndex] );
+	}
+	maShapes.clear();
+	mSpheres.Clear();
+	mBoxes.Clear();
+	mCylinders.Clear();
+	mPlanes.Clear();
+}
@@ -0,0 +1,83 @@
+#ifndef cPhysicsShapes_H
+#define cPhysicsShapes_H
+
+// Registry of the collision shapes. The basic shapes are shared: the same type and
+// parameters always give the same btCollisionShape, so a thousand identical crates cost
+// one shape. Every shape has a reference count and it is deleted with its last reference.
+// The bodies made by cPhysics keep a reference to their shape. The shared shapes live in
+// pools, one per type. The cooked hulls of the meshes are shared by their contents
+
+#include <vector>
+#include "..\Utility\Singleton.h"
+#include "..\MathLib\MathLib.h"
+#include "cPhysicsPool.h"
+#include "cPhysicsCook.h"
+#include "..\Libraries\Bullet\include\btBulletCollisionCommon.h"
+
+enum ePhysicsShapeType{
+	ePhysicsShape_Sphere = 0,
+	ePhysicsShape_Box,
+	ePhysicsShape_CylinderX,
+	ePhysicsShape_Plane,
+	ePhysicsShape_Hull,			// Cooked mesh, a convex hull or a compound of hulls
+	ePhysicsShape_Custom		// Built by its owner (compounds, heightfields), never shared
+};
+
+class cPhysicsShapes : public cSingleton<cPhysicsShapes>{
+public:
+	// Shared shapes, every call adds a reference
+	btCollisionShape* GetSphere( float lfRadius );
+	btCollisionShape* GetBox( const cVec3& lHalfSize );
+	btCollisionShape* GetCylinderX( const cVec3& lHalfSize );
+	btCollisionShape* GetPlane( const cVec3& lNormal, float lfConstant );
+	// One hull gives a btConvexHullShape, more a btCompoundShape that owns its hulls. NULL
+	// for a mesh without hulls
+	btCollisionShape* GetHulls( const sPhysicsCookedMesh& lMesh );
+	// Takes a shape built by its owner with one reference, the one of the owner
+	void Register( btCollisionShape* lpShape );
+
+	void AddRef( btCollisionShape* lpShape );
+	// The shape is deleted when its last reference is released
+	void Release( btCollisionShape* lpShape );
+	bool IsRegistered( const btCollisionShape* lpShape ) const;
+
+	// Statistics
+	inline unsigned GetShapeCount( ) const { return maShapes.size(); }
+	unsigned GetReferenceCount( ) const;
+	// Bytes of the shapes themselves (not of the data they read, like the heights)
+	unsigned GetMemory( ) const;
+	// Number of shapes of every type, references and memory, through OutputDebugString
+	void Report( ) const;
+
+	// Deletes the shapes still registered, they are reported as leaks
+	void Deinit( );
+
+	friend class cSingleton<cPhysicsShapes>;
+
+private:
+	struct sShapeEntry{
+		btCollisionShape* mpShape;
+		ePhysicsShapeType meType;
+		float mafParams[4];
+		unsigned muiReferences;
+	};
+
+	cPhysicsShapes( ) : mSpheres( 16 ), mBoxes( 16 ), mCylinders( 16 ), mPlanes( 4 ) { ; }
+	// Shared shape with these parameters, it is created if it doesn't exist
+	btCollisionShape* GetShared( ePhysicsShapeType leType, const float* lpafParams );
+	static btCollisionShape* CreateHulls( const sPhysicsCookedMesh& lMesh );
+	// The hulls of a shape of CreateHulls are those of the mesh, point by point
+	static bool HasHulls( const btCollisionShape* lpShape, const sPhysicsCookedMesh& lMesh );
+	int Find( const btCollisionShape* lpShape ) const;
+	static unsigned GetShapeBytes( const btCollisionShape* lpShape );
+	// Deletes the shape of an entry, the shared ones go back to their pool
+	void DeleteShape( const sShapeEntry& lEntry );
+
+	std::vector<sShapeEntry> maShapes;
+	cPhysicsPool<btSphereShape> mSpheres;
+	cPhysicsPool<btBoxShape> mBoxes;
+	cPhysicsPool<btCylinderShapeX> mCylinders;
+	cPhysicsPool<btStaticPlaneShape> mPlanes;
+};
+
+#endif
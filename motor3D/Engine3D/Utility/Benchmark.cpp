@@ -0,0 +1,58 @@
+#include "Benchmark.h"
+#include <windows.h>
+#include <cstdio>
+#include <cstdarg>
+#include <cstring>
+
+static const char * kacBenchLog = "bench.log";
+
+void cBenchTimer::Start(){
+	LARGE_INTEGER lValue;
+	QueryPerformanceFrequency(&lValue);
+	mlFrequency = lValue.QuadPart;
+	QueryPerformanceCounter(&lValue);
+	mlStart = lValue.QuadPart;
+}
+
+double cBenchTimer::GetMs() const{
+	LARGE_INTEGER lEnd;
+	QueryPerformanceCounter(&lEnd);
+	return (double)(lEnd.QuadPart - mlStart) * 1000.0 / (double)mlFrequency;
+}
+
+void BenchReport( const char * lacFormat, ... ){
+	char lacBuffer[512];
+	va_list lArgs;
+	va_start(lArgs, lacFormat);
+	_vsnprintf(lacBuffer, sizeof(lacBuffer) - 2, lacFormat, lArgs);
+	va_end(lArgs);
+	lacBuffer[sizeof(lacBuffer) - 2] = 0;
+	strcat(lacBuffer, "\n");
+
+	OutputDebugString(lacBuffer);
+	FILE * lpFile = fopen(kacBenchLog, "a");
+	if (lpFile){
+		fputs(lacBuffer, lpFile);
+		fclose(lpFile);
+	}
+}
+
+bool RunBenchTests( const sBenchTest * laTests, unsigned luiCount, const char * lacName ){
+	bool lbAll = (strcmp(lacName, "all") == 0);
+	bool lbFound = false;
+	bool lbPassed = true;
+	for (unsigned luiIndex = 0; luiIndex < luiCount; ++luiIndex){
+		if (!lbAll && strcmp(lacName, laTests[luiIndex].macName) != 0){
+			continue;
+		}
+		lbFound = true;
+		cBenchTimer lTimer;
+		bool lbResult = laTests[luiIndex].mpTest();
+		BenchReport("[%s] %s (%.1f ms)", laTests[luiIndex].macName, lbResult? "ok" : "FAILED", lTimer.GetMs());
+		lbPassed = lbPassed && lbResult;
+	}
+	if (!lbFound){
+		BenchReport("No benchmark or test named %s", lacName);
+	}
+	return lbFound && lbPassed;
+}
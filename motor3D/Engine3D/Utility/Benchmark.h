@@ -0,0 +1,38 @@
+// Timer and report shared by the benchmarks and tests of the engine, and the runner of the
+// tables that list them by name (main.cpp runs them with "-bench <name>" or "-bench all")
+
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+// Wall time with the high resolution counter
+class cBenchTimer{
+public:
+	cBenchTimer() { Start(); }
+
+	void Start();
+
+	// Milliseconds since Start
+	double GetMs() const;
+
+private:
+	long long mlFrequency;
+	long long mlStart;
+};
+
+// Writes a line of the report (printf format, without the end of line) to the output window
+// and to bench.log
+void BenchReport( const char * lacFormat, ... );
+
+// A benchmark or test, returns false when it fails
+typedef bool (*tBenchTest)();
+
+struct sBenchTest{
+	const char * macName;
+	tBenchTest mpTest;
+};
+
+// Runs the entry of the table with that name, or all of them with "all". Returns false if any
+// of them fails or there is no entry with that name
+bool RunBenchTests( const sBenchTest * laTests, unsigned luiCount, const char * lacName );
+
+#endif
@@ -1,4 +1,7 @@
 #include "FileUtils.h"
+#include <cstdio>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 std::string cFileUtils::GetDirectory(const std::string lacFile)
 {
@@ -22,4 +25,57 @@ std::string cFileUtils::GetFilename(const std::string lacFile)
 		}
 	}
 	return lacFile;
+}
+
+bool cFileUtils::ReadFile(const std::string &lacFile, std::vector<char> &lacBuffer)
+{
+	FILE * lpFile = fopen(lacFile.c_str(), "rb");
+	if (!lpFile)
+	{
+		return false;
+	}
+	fseek(lpFile, 0, SEEK_END);
+	long liSize = ftell(lpFile);
+	fseek(lpFile, 0, SEEK_SET);
+	lacBuffer.resize(liSize);
+	bool lbOk = (liSize == 0) || (fread(&lacBuffer[0], 1, liSize, lpFile) == (size_t)liSize);
+	fclose(lpFile);
+	return lbOk;
+}
+
+bool cFileUtils::WriteFile(const std::string &lacFile, const void * lpData, unsigned luiSize)
+{
+	FILE * lpFile = fopen(lacFile.c_str(), "wb");
+	if (!lpFile)
+	{
+		return false;
+	}
+	bool lbOk = (fwrite(lpData, 1, luiSize, lpFile) == luiSize);
+	fclose(lpFile);
+	return lbOk;
+}
+
+unsigned cFileUtils::Hash(const void * lpData, unsigned luiSize, unsigned luiSeed)
+{
+	const unsigned char * lpBytes = (const unsigned char *)lpData;
+	unsigned luiHash = luiSeed;
+	for (unsigned luiIndex = 0; luiIndex < luiSize; ++luiIndex)
+	{
+		luiHash ^= lpBytes[luiIndex];
+		luiHash *= 16777619u;
+	}
+	return luiHash;
+}
+
+unsigned cFileUtils::HashFileStamp(const std::string &lacFile, unsigned luiSeed)
+{
+	unsigned luiHash = Hash(lacFile.c_str(), lacFile.length(), luiSeed);
+	struct stat lStat;
+	if (stat(lacFile.c_str(), &lStat) != 0)
+	{
+		// Missing files still change the hash
+		return Hash(&luiHash, sizeof(luiHash), luiHash);
+	}
+	unsigned lauiStamp[2] = { (unsigned)lStat.st_size, (unsigned)lStat.st_mtime };
+	return Hash(lauiStamp, sizeof(lauiStamp), luiHash);
 }
\ No newline at end of file
@@ -3,12 +3,23 @@
 #ifndef FILE_UTILS_H
 #define FILE_UTILS_H
 #include <string>
+#include <vector>
 
 class cFileUtils
 {
 	public:
 		static std::string GetDirectory(const std::string lacFile);
 		static std::string GetFilename(const std::string lacFile);
+
+		// Reads the whole file in a single read
+		static bool ReadFile(const std::string &lacFile, std::vector<char> &lacBuffer);
+		static bool WriteFile(const std::string &lacFile, const void * lpData, unsigned luiSize);
+
+		// FNV-1a hash, can be chained passing the previous hash as seed
+		static unsigned Hash(const void * lpData, unsigned luiSize, unsigned luiSeed = 2166136261u);
+
+		// Hash of the name, size and modification time of a file (without reading it)
+		static unsigned HashFileStamp(const std::string &lacFile, unsigned luiSeed = 2166136261u);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,111 @@
+#include "ThreadPool.h"
+#include <cassert>
+
+// Parameter of every worker
+struct sWorkerParam{
+	cThreadPool * mpPool;
+	unsigned muiIndex;
+};
+static sWorkerParam gaWorkerParams[64];
+
+void cThreadPool::Init( unsigned luiWorkerCount ){
+	if (mbInit){
+		return;
+	}
+	if (luiWorkerCount == 0){
+		SYSTEM_INFO lInfo;
+		GetSystemInfo(&lInfo);
+		luiWorkerCount = (lInfo.dwNumberOfProcessors > 1)? lInfo.dwNumberOfProcessors - 1 : 0;
+	}
+	if (luiWorkerCount > 64){
+		luiWorkerCount = 64;
+	}
+
+	mbQuit = false;
+	for (unsigned luiIndex = 0; luiIndex < luiWorkerCount; ++luiIndex){
+		maStartEvents.push_back(CreateEvent(NULL, FALSE, FALSE, NULL));
+		maDoneEvents.push_back(CreateEvent(NULL, FALSE, FALSE, NULL));
+	}
+	for (unsigned luiIndex = 0; luiIndex < luiWorkerCount; ++luiIndex){
+		gaWorkerParams[luiIndex].mpPool = this;
+		gaWorkerParams[luiIndex].muiIndex = luiIndex;
+		maThreads.push_back(CreateThread(NULL, 0, WorkerMain, &gaWorkerParams[luiIndex], 0, NULL));
+	}
+	mbInit = true;
+}
+
+void cThreadPool::Deinit(){
+	if (!mbInit){
+		return;
+	}
+	// Wake up the workers to let them quit
+	mbQuit = true;
+	for (unsigned luiIndex = 0; luiIndex < maThreads.size(); ++luiIndex){
+		SetEvent(maStartEvents[luiIndex]);
+	}
+	if (!maThreads.empty()){
+		WaitForMultipleObjects(maThreads.size(), &maThreads[0], TRUE, INFINITE);
+	}
+	for (unsigned luiIndex = 0; luiIndex < maThreads.size(); ++luiIndex){
+		CloseHandle(maThreads[luiIndex]);
+		CloseHandle(maStartEvents[luiIndex]);
+		CloseHandle(maDoneEvents[luiIndex]);
+	}
+	maThreads.clear();
+	maStartEvents.clear();
+	maDoneEvents.clear();
+	mbInit = false;
+}
+
+void cThreadPool::ParallelFor( unsigned luiCount, tParallelJob lpJob, void * lpData ){
+	assert(lpJob && mbInit);
+
+	// Small loops, a pool without workers or a busy pool run in the caller
+	if (luiCount <= 1 || maThreads.empty() || InterlockedCompareExchange(&mlBusy, 1, 0) != 0){
+		for (unsigned luiIndex = 0; luiIndex < luiCount; ++luiIndex){
+			lpJob(luiIndex, lpData);
+		}
+		return;
+	}
+
+	mpJob = lpJob;
+	mpJobData = lpData;
+	muiJobCount = luiCount;
+	mlNextIndex = 0;
+
+	// Only wake up the workers that can get a job
+	unsigned luiWorkers = (luiCount - 1 < maThreads.size())? luiCount - 1 : maThreads.size();
+	for (unsigned luiIndex = 0; luiIndex < luiWorkers; ++luiIndex){
+		SetEvent(maStartEvents[luiIndex]);
+	}
+	RunJobs();
+	WaitForMultipleObjects(luiWorkers, &maDoneEvents[0], TRUE, INFINITE);
+
+	mpJob = NULL;
+	mpJobData = NULL;
+	InterlockedExchange(&mlBusy, 0);
+}
+
+void cThreadPool::RunJobs(){
+	for (;;){
+		unsigned luiIndex = (unsigned)(InterlockedIncrement(&mlNextIndex) - 1);
+		if (luiIndex >= muiJobCount){
+			break;
+		}
+		mpJob(luiIndex, mpJobData);
+	}
+}
+
+DWORD WINAPI cThreadPool::WorkerMain( LPVOID lpParam ){
+	sWorkerParam * lpWorker = (sWorkerParam *)lpParam;
+	cThreadPool * lpPool = lpWorker->mpPool;
+	for (;;){
+		WaitForSingleObject(lpPool->maStartEvents[lpWorker->muiIndex], INFINITE);
+		if (lpPool->mbQuit){
+			break;
+		}
+		lpPool->RunJobs();
+		SetEvent(lpPool->maDoneEvents[lpWorker->muiIndex]);
+	}
+	return 0;
+}
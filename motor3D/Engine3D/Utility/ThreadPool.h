@@ -0,0 +1,59 @@
+// Small pool of worker threads used to split loops between the cores (parallel for).
+// The calling thread also works, so a pool of N workers runs N+1 jobs at once
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <windows.h>
+#include <vector>
+#include "Singleton.h"
+
+// Job called for every index of the loop
+typedef void (*tParallelJob)( unsigned luiIndex, void * lpData );
+
+class cThreadPool : public cSingleton<cThreadPool>{
+public:
+	// Starts the workers (0 = one per core, minus the calling thread). Main thread, at startup,
+	// before any loop
+	void Init( unsigned luiWorkerCount = 0 );
+
+	// Stops and releases the workers
+	void Deinit();
+
+	// Runs lpJob for every index in [0, luiCount) and returns when all of them are done.
+	// If the pool is already busy (nested or concurrent calls) the loop runs in the caller
+	void ParallelFor( unsigned luiCount, tParallelJob lpJob, void * lpData );
+
+	// Number of threads that run the jobs (workers and caller)
+	inline unsigned GetThreadCount() const { return maThreads.size() + 1; }
+	inline bool IsInit() const { return mbInit; }
+
+	// This class follows the singleton pattern
+	friend class cSingleton<cThreadPool>;
+
+protected:
+	cThreadPool() { mbInit = false; mbQuit = false; mlBusy = 0; mlNextIndex = 0; muiJobCount = 0; mpJob = NULL; mpJobData = NULL; }
+
+private:
+	// Entry point of the workers
+	static DWORD WINAPI WorkerMain( LPVOID lpParam );
+
+	// Takes indexes until the loop is finished
+	void RunJobs();
+
+	std::vector<HANDLE> maThreads;
+	std::vector<HANDLE> maStartEvents;
+	std::vector<HANDLE> maDoneEvents;
+
+	// Current loop
+	volatile LONG mlBusy;
+	volatile LONG mlNextIndex;
+	unsigned muiJobCount;
+	tParallelJob mpJob;
+	void * mpJobData;
+
+	bool mbInit;
+	volatile bool mbQuit;
+};
+
+#endif
@@ -10,7 +10,9 @@
 #include <stdio.h>
 #include <Windows.h>
 #include <stdlib.h>
+#include <string.h>
 #include "Game\Game.h"
+#include "Game\GameBench.h"
 
 //Al tratarse de un proyecto win 32 el protipo de la funcin main es especfico.
 //La funcin "WinMain" es el mtodo de entrada de un programa Windows, en lugar de la conocida "main", 
@@ -26,21 +28,39 @@ int WINAPI WinMain(
 	LPSTR     lpCmdLine,      // Command Line Parameters
 	int       nCmdShow)// Window Show State
 {
+   //Con "-bench <nombre>" (o "-bench all") se ejecutan los benchmarks y tests al cargar el juego
+   // y se sale, devolviendo 1 si alguno falla
+   char lacBench[64] = "";
+   const char * lacSwitch = strstr( lpCmdLine, "-bench" );
+   if ( lacSwitch && sscanf( lacSwitch + 6, "%63s", lacBench ) != 1 )
+      strcpy( lacBench, "all" );
+   //Los tests repiten pasos de la fisica desde un snapshot
+   cGame::Get().SetDeterministicPhysics( lacBench[0] != 0 );
+
    //Inicializamos el juego
    if ( cGame::Get().Init() )
    {
-	   //Se obtiene el tiempo en milisegundos desde que arranc el Sistema (Windows)
-	   unsigned long luiLastTime = timeGetTime();
+	   if ( lacBench[0] )
+	   {
+		  bool lbPassed = RunGameBench( lacBench );
+		  cGame::Get().Deinit();
+		  return lbPassed ? 0 : 1;
+	   }
+	   //Se obtiene el tiempo con el contador de alta resolucin: timeGetTime solo da
+	   //milisegundos y a ms de 1000 fps daba pasos de 0
+	   LARGE_INTEGER lFrequency, lLastTime, lActualTime;
+	   QueryPerformanceFrequency(&lFrequency);
+	   QueryPerformanceCounter(&lLastTime);
 	   //Mientras no se finalice, se actualiza y renderiza
 	   while (!cGame::Get().HasFinished())
 	   {
-		  //Se calcula el tiempo transcurrido (pasndolo a segundos) desde la iteracin anterior
-		  unsigned long luiActualTime = timeGetTime();
+		  //Se calcula el tiempo transcurrido (pasndolo a segundos) desde la iteracin anterior.
+		  //La fsica avanza en pasos fijos, as que un paso pequeo o de 0 no cambia la simulacin
+		  QueryPerformanceCounter(&lActualTime);
 			
-		  float lfTimestep = ((float)(luiActualTime - luiLastTime) 
-							 / 1000.0f);
-		  luiLastTime = luiActualTime;
-		  if (lfTimestep == 0.0f){ lfTimestep = 1.0f;  }
+		  float lfTimestep = (float)((double)(lActualTime.QuadPart - lLastTime.QuadPart) 
+							 / (double)lFrequency.QuadPart);
+		  lLastTime = lActualTime;
 
 		  //Se llama a la funcin Update pasndole el tiempo transcurrido, para que acte igual en mquinas rpidas como lentas, 
 		  // ya la mquina rpida ejecutar ms iteraciones pero el tiempo ser 
@@ -57,4 +77,5 @@ int WINAPI WinMain(
 	   sprintf(buff, "Existen leaks de memoria? %d\n", exist_leaks);
 	   OutputDebugStr(buff);
    }
+   return 0;
 }
\ No newline at end of file